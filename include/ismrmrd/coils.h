@@ -0,0 +1,168 @@
+/* ISMRMRD Coil Processing */
+
+/**
+ * @file coils.h
+ * @defgroup coils Coil Processing API
+ * @{
+ */
+
+#pragma once
+#ifndef ISMRMRD_COILS_H
+#define ISMRMRD_COILS_H
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/xml.h"
+#include <vector>
+
+namespace ISMRMRD {
+
+/**
+ *   Channel selection and coil compression
+ *
+ *   The compressor maps the data of the channels of an array to fewer
+ *   virtual channels, the principal components of the calibration data: the
+ *   eigenvectors of the channel covariance of all samples of the calibration
+ *   readouts with the largest eigenvalues. Compressing an acquisition
+ *   multiplies its data, channels by samples, with the virtual channels by
+ *   channels matrix. Afterwards the acquisition holds virtual channels 0 to
+ *   virtual channels - 1, in active_channels and the channel mask.
+ *
+ *   The input channels are the active channels of the first calibration
+ *   readout, or of those the ones also in the selection. Later acquisitions
+ *   must have all of them active; other active channels are ignored.
+ *
+ *   The eigenvectors are computed by Householder reduction to a tridiagonal
+ *   matrix and the QL method, O(channels^3), which takes milliseconds for
+ *   arrays up to a few hundred channels.
+ */
+class EXPORTISMRMRD CoilCompressor {
+public:
+    CoilCompressor();
+
+    /// Only the channels in selection are calibrated and compressed
+    void selectChannels(const ChannelMask &selection);
+
+    /**
+     * Adds the samples of acq to the calibration if it is flagged
+     * ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION or ..._AND_IMAGING, returns
+     * whether it was used.
+     */
+    bool addCalibration(const Acquisition &acq);
+    /// Adds the samples of acq to the calibration, whatever its flags
+    void addCalibrationData(const Acquisition &acq);
+    /// Discards the calibration and the matrix, not the selection
+    void reset();
+
+    /// The input channels, empty before the first calibration readout
+    const ChannelMask &getChannels() const;
+    size_t getNumberOfCalibrationSamples() const;
+
+    /// Eigenvalues of the calibration covariance, largest first
+    const std::vector<double> &getEigenvalues();
+    /// The fewest virtual channels that keep fraction of the calibration energy
+    uint16_t channelsForEnergy(double fraction);
+
+    /// Computes the matrix compressing to virtual_channels channels
+    void computeMatrix(uint16_t virtual_channels);
+    /// Virtual channels by input channels, row major
+    const std::vector<complex_float_t> &getMatrix() const;
+    uint16_t getNumberOfVirtualChannels() const;
+
+    /// Compresses the data of acq in place
+    void compress(Acquisition &acq);
+    /// Compresses count acquisitions, one matrix product per acquisition
+    void compress(Acquisition *acqs, size_t count);
+    void compress(std::vector<Acquisition> &acqs);
+
+private:
+    void decompose();
+
+    ChannelMask selection_;
+    bool selected_;
+    ChannelMask channels_;
+    uint16_t num_channels_;
+    size_t num_samples_;
+    std::vector<complex_double_t> covariance_;    // upper triangle, row major
+    bool decomposed_;
+    std::vector<double> eigenvalues_;
+    std::vector<complex_double_t> eigenvectors_;  // columns, largest eigenvalue first
+    uint16_t virtual_channels_;
+    std::vector<complex_float_t> matrix_;
+    std::vector<float> coefficients_;  // the matrix split and in blocks of virtual channels
+    std::vector<size_t> rows_;
+    std::vector<float> work_;
+};
+
+/**
+ *   Noise prewhitening
+ *
+ *   The prewhitener estimates the noise covariance of the channels, per
+ *   sample, from the noise measurement readouts, factors it as L L^H and
+ *   multiplies the data of later acquisitions with the whitening matrix
+ *   L^-1, which makes the noise of the channels uncorrelated. It is scaled by
+ *
+ *     sqrt(2 * sample_time_us / noise sample_time_us * relativeReceiverNoiseBandwidth)
+ *
+ *   for the bandwidth of the data relative to that of the noise readouts,
+ *   so the real and imaginary parts of the whitened noise each have about
+ *   unit variance.
+ *
+ *   The channels are the active channels of the first noise readout. Later
+ *   acquisitions must have all of them active; their other channels are
+ *   left as they are.
+ */
+class EXPORTISMRMRD NoisePrewhitener {
+public:
+    NoisePrewhitener();
+    /// Takes relativeReceiverNoiseBandwidth from the acquisition system information, if set
+    explicit NoisePrewhitener(const IsmrmrdHeader &header);
+
+    /// The receiver noise bandwidth relative to the sampling bandwidth, 1 by default
+    void setRelativeReceiverNoiseBandwidth(float bandwidth);
+    float getRelativeReceiverNoiseBandwidth() const;
+
+    /**
+     * Adds the samples of acq to the noise covariance if it is flagged
+     * ISMRMRD_ACQ_IS_NOISE_MEASUREMENT, returns whether it was used.
+     */
+    bool addNoise(const Acquisition &acq);
+    /// Adds the samples of acq to the noise covariance, whatever its flags
+    void addNoiseData(const Acquisition &acq);
+    /// Discards the noise covariance and the whitening matrix
+    void reset();
+
+    /// The channels, empty before the first noise readout
+    const ChannelMask &getChannels() const;
+    size_t getNumberOfNoiseSamples() const;
+    /// The noise covariance per sample, channels by channels, row major
+    std::vector<complex_float_t> getNoiseCovariance() const;
+
+    /// Computes the whitening matrix, throws if the covariance is not positive definite
+    void computeWhitening();
+    /// The unscaled whitening matrix L^-1, lower triangular, channels by channels, row major
+    const std::vector<complex_float_t> &getWhiteningMatrix() const;
+
+    /// Whitens the data of acq in place, computing the whitening matrix first if needed
+    void whiten(Acquisition &acq);
+    /// Whitens count acquisitions, one triangular matrix product per acquisition
+    void whiten(Acquisition *acqs, size_t count);
+    void whiten(std::vector<Acquisition> &acqs);
+
+private:
+    float bandwidth_;
+    ChannelMask channels_;
+    uint16_t num_channels_;
+    size_t num_samples_;
+    float noise_dwell_time_us_;
+    std::vector<complex_double_t> covariance_;  // upper triangle, row major
+    std::vector<complex_float_t> whitening_;
+    std::vector<float> coefficients_;
+    std::vector<size_t> rows_;
+    std::vector<float> work_;
+};
+
+} // namespace ISMRMRD
+
+/** @} */
+
+#endif /* ISMRMRD_COILS_H */
@@ -0,0 +1,109 @@
+/* ISMRMRD Acquisition Compression */
+
+/**
+ * @file compression.h
+ * @defgroup compression Acquisition Compression API
+ * @{
+ */
+
+#pragma once
+#ifndef ISMRMRD_COMPRESSION_H
+#define ISMRMRD_COMPRESSION_H
+
+#include "ismrmrd/ismrmrd.h"
+
+#ifdef __cplusplus
+namespace ISMRMRD {
+extern "C" {
+#endif
+
+/**
+ *   Compression of acquisition data
+ *
+ *   The data of an acquisition, 2 * number_of_samples * active_channels 32 bit
+ *   words, is byte shuffled into four planes (the first byte of every word,
+ *   then the second, ...), and each plane is entropy coded with an order-0
+ *   rANS coder, or stored as is when that does not pay off. The exponent and
+ *   sign bytes of k-space data are highly redundant; the low mantissa bytes
+ *   mostly are not, which is what near-lossless mode is for: it first
+ *   quantizes every channel with a step of tolerance times its noise standard
+ *   deviation, so the error is at most half the step, and codes the integers.
+ *
+ *   A compressed block is self-describing:
+ *
+ *     uint16_t version, uint16_t mode, uint32_t number of words,
+ *     uint16_t channels, uint16_t reserved, float tolerance
+ *     float quantization step of each channel (near-lossless only)
+ *     4 times: uint32_t length, then length bytes of plane coding
+ *
+ *   The trajectory and the header are not compressed. Where acquisitions
+ *   are stored or sent compressed (Dataset, StreamWriter) the data holds the
+ *   block and the header is flagged ISMRMRD_ACQ_COMPRESSION1 for lossless,
+ *   ISMRMRD_ACQ_COMPRESSION2 for near-lossless blocks; readers decompress
+ *   and clear the flag.
+ */
+enum ISMRMRD_CompressionModes {
+    ISMRMRD_COMPRESSION_NONE = 0,
+    ISMRMRD_COMPRESSION_LOSSLESS = 1,      /**< byte shuffle and entropy coding */
+    ISMRMRD_COMPRESSION_NEAR_LOSSLESS = 2  /**< noise-scaled quantization, then as lossless */
+};
+
+typedef struct ISMRMRD_CompressionParameters {
+    uint16_t mode;                /**< ISMRMRD_CompressionModes */
+    uint16_t threads;             /**< threads for batches of acquisitions, 0 for one per CPU */
+    float tolerance;              /**< near-lossless: quantization step in noise standard deviations */
+    uint16_t num_noise_channels;  /**< entries in noise_stddev */
+    const float *noise_stddev;    /**< near-lossless: noise standard deviation of the real (and imaginary)
+                                       part of each channel; channels without one are estimated from the
+                                       outer eighths of each readout */
+} ISMRMRD_CompressionParameters;
+
+/** Initializes the parameters to lossless compression */
+EXPORTISMRMRD int ismrmrd_init_compression_parameters(ISMRMRD_CompressionParameters *params);
+
+/** The acquisition flag marking data compressed in mode, 0 for ISMRMRD_COMPRESSION_NONE */
+EXPORTISMRMRD uint64_t ismrmrd_compression_flag(uint16_t mode);
+
+/** Whether the data of an acquisition with this header holds a compressed block */
+EXPORTISMRMRD bool ismrmrd_is_compressed(const ISMRMRD_AcquisitionHeader *head);
+
+/** Largest compressed size of the data of acq */
+EXPORTISMRMRD size_t ismrmrd_size_of_compressed_data_bound(const ISMRMRD_Acquisition *acq);
+
+/**
+ * Compresses the data of acq into out, which holds *size bytes on entry, at
+ * least ismrmrd_size_of_compressed_data_bound. On return *size is the size of
+ * the block.
+ */
+EXPORTISMRMRD int ismrmrd_compress_acquisition_data(const ISMRMRD_Acquisition *acq,
+        const ISMRMRD_CompressionParameters *params, void *out, size_t *size);
+
+/**
+ * Decompresses a block of size bytes into the data of acq, which must already
+ * have the number of samples and channels the block was made from.
+ */
+EXPORTISMRMRD int ismrmrd_decompress_acquisition_data(const void *in, size_t size, ISMRMRD_Acquisition *acq);
+
+/**
+ * Compresses the data of count acquisitions on params->threads threads.
+ * out[n] holds sizes[n] bytes on entry and the block of acqs[n] on return.
+ */
+EXPORTISMRMRD int ismrmrd_compress_acquisitions(const ISMRMRD_Acquisition *acqs, uint32_t count,
+        const ISMRMRD_CompressionParameters *params, void *const *out, size_t *sizes);
+
+/** Decompresses count blocks into acqs, already sized, on threads threads (0 for one per CPU) */
+EXPORTISMRMRD int ismrmrd_decompress_acquisitions(const void *const *in, const size_t *sizes, uint32_t count,
+        ISMRMRD_Acquisition *acqs, uint16_t threads);
+
+#ifdef __cplusplus
+} // extern "C"
+
+/// Compression parameters, see ISMRMRD_CompressionParameters
+typedef ISMRMRD_CompressionParameters CompressionParameters;
+
+} // namespace ISMRMRD
+#endif
+
+/** @} */
+
+#endif /* ISMRMRD_COMPRESSION_H */
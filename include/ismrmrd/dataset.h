@@ -9,10 +9,16 @@
 #define ISMRMRD_DATASET_H
 
 #include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/compression.h"
 #include <hdf5.h>
 
 #ifdef __cplusplus
 #include <string>
+#include "ismrmrd/xml.h"
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <memory>
+#define ISMRMRD_HEADER_CACHE
+#endif
 namespace ISMRMRD {
 extern "C" {
 #endif
@@ -25,11 +31,70 @@ extern "C" {
  *   XML configuration is stored in the variable groupname/xml and the
  *   Acquisitions are stored in the variable groupname/data.
  *
+ *   Concurrency:
+ *
+ *   Different datasets, i.e. different ISMRMRD_Dataset structs or Dataset
+ *   objects, can be used from different threads at the same time, whether they
+ *   refer to different files or are opened read only on the same file. A single
+ *   dataset must not be used from two threads at once, including its statistics
+ *   counters, unless the caller serializes the calls.
+ *
+ *   HDF5 itself is only safe to call from several threads when it was built
+ *   thread-safe, and even then it serializes every call and shares the objects
+ *   of a file opened more than once, so one handle closing the file can pull
+ *   them from under another. The library therefore holds one process-wide lock
+ *   for the HDF5 calls of each operation, from opening an HDF5 dataset to
+ *   closing it. Allocating acquisitions, images and arrays and copying the data
+ *   out of the buffers HDF5 returns is done outside the lock, but the reads and
+ *   writes of a process happen one at a time. With a thread-safe HDF5, and no
+ *   file opened by more than one dataset at a time, the lock can be turned off
+ *   by setting the environment variable ISMRMRD_HDF5_LOCK to 0 before the first
+ *   dataset is initialized. Code that calls HDF5 directly, next to this
+ *   library, has to make its own arrangements.
+ */
+/**
+ *   Number of calls to an HDF5 operation and the total time spent in them.
+ */
+typedef struct ISMRMRD_DatasetCounter {
+    uint64_t count;
+    uint64_t ns;
+} ISMRMRD_DatasetCounter;
+
+/**
+ *   Instrumentation counters of a dataset.
+ *
+ *   Collection is off by default and costs a single branch per HDF5 call.
+ *   It is turned on with ismrmrd_dataset_enable_stats or by setting the
+ *   environment variable ISMRMRD_DATASET_STATS (to anything but 0) before the
+ *   dataset is initialized, in which case the statistics are also printed to
+ *   stderr when the dataset is closed.
+ */
+typedef struct ISMRMRD_DatasetStats {
+    ISMRMRD_DatasetCounter file_opens;          /**< H5Fopen/H5Fcreate */
+    ISMRMRD_DatasetCounter dataset_opens;       /**< H5Dopen */
+    ISMRMRD_DatasetCounter link_lookups;        /**< H5Lexists */
+    ISMRMRD_DatasetCounter extent_changes;      /**< H5Dset_extent */
+    ISMRMRD_DatasetCounter type_constructions;  /**< building (or matching) HDF5 datatypes */
+    ISMRMRD_DatasetCounter writes;              /**< H5Dwrite */
+    ISMRMRD_DatasetCounter reads;               /**< H5Dread */
+    uint64_t bytes_written;                     /**< headers, attributes and data written */
+    uint64_t bytes_read;                        /**< headers, attributes and data read */
+    uint64_t vlen_allocations;                  /**< variable length buffers allocated by HDF5 on read */
+    uint64_t header_cache_hits;                 /**< Dataset::readParsedHeader calls answered by the header cache */
+    uint64_t header_cache_misses;               /**< Dataset::readParsedHeader calls that decoded the header */
+} ISMRMRD_DatasetStats;
+
+/**
+ *   An HDF5 file and group. The stats and compression members were added in
+ *   1.3.4; code allocating this struct has to be built against these headers,
+ *   which the library's SOVERSION (1.3.1) enforces for shared linking.
  */
 typedef struct ISMRMRD_Dataset {
     char *filename;
     char *groupname;
     hid_t fileid;
+    ISMRMRD_DatasetStats *stats;  /**< NULL unless statistics are enabled */
+    ISMRMRD_CompressionParameters *compression;  /**< NULL unless acquisitions are written compressed */
 } ISMRMRD_Dataset;
 
 /**
@@ -50,9 +115,51 @@ EXPORTISMRMRD int ismrmrd_open_dataset(ISMRMRD_Dataset *dset, const bool create_
  */
 EXPORTISMRMRD int ismrmrd_close_dataset(ISMRMRD_Dataset *dset);
 
+/**
+ *  Turns collection of instrumentation counters on or off.
+ *  Turning it off discards the counters collected so far.
+ */
+EXPORTISMRMRD int ismrmrd_dataset_enable_stats(ISMRMRD_Dataset *dset, const bool enable);
+
+/**
+ *  Copies the instrumentation counters, all zero if collection is off.
+ */
+EXPORTISMRMRD int ismrmrd_dataset_get_stats(const ISMRMRD_Dataset *dset, ISMRMRD_DatasetStats *stats);
+
+/**
+ *  Resets the instrumentation counters to zero.
+ */
+EXPORTISMRMRD int ismrmrd_dataset_reset_stats(ISMRMRD_Dataset *dset);
+
+/**
+ *  Compresses the data of the acquisitions appended from now on, see
+ *  compression.h; NULL or ISMRMRD_COMPRESSION_NONE appends them as they are.
+ *  The parameters, including the noise levels, are copied. Compressed
+ *  acquisitions are decompressed on read whatever the setting.
+ *
+ *  The acquisitions of a group with compression on are stored in
+ *  groupname/data_compressed instead of groupname/data. Readers that do not
+ *  know about compression find no acquisitions, rather than copying
+ *  uncompressed sizes out of compressed records. Compression has to be set
+ *  before the first acquisition of the group is appended; later appends,
+ *  compressed or not, go to the same variable. Only records of
+ *  groupname/data_compressed are decompressed: files written before
+ *  compression may set the ISMRMRD_ACQ_COMPRESSION flags on plain data,
+ *  which is read as it is, flags included.
+ */
+EXPORTISMRMRD int ismrmrd_dataset_set_compression(ISMRMRD_Dataset *dset, const ISMRMRD_CompressionParameters *params);
+
+/**
+ *  Returns true if the library serializes its HDF5 calls, see Concurrency above.
+ */
+EXPORTISMRMRD bool ismrmrd_dataset_serializes_hdf5(void);
+
 /**
  *  Writes the XML header string to the dataset.
  *
+ *  The header is tagged with a hash of the string, in the xml_hash attribute,
+ *  which the binary copy of the header is checked against.
+ *
  *  @warning There is no check of whether the string is a valid XML document at this point.
  *
  */
@@ -66,6 +173,40 @@ EXPORTISMRMRD int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *
  */
 EXPORTISMRMRD char * ismrmrd_read_header(const ISMRMRD_Dataset *dset);
 
+/**
+ *  The hash ismrmrd_write_header tags the XML header with.
+ */
+EXPORTISMRMRD uint64_t ismrmrd_hash_header(const char *xmlstring);
+
+/**
+ *  Reads the hash the XML header is tagged with, without reading the header.
+ *
+ *  Returns false, with no error, if there is no header or it was written
+ *  without the tag, by an older version of the library or another writer.
+ */
+EXPORTISMRMRD bool ismrmrd_read_header_hash(const ISMRMRD_Dataset *dset, uint64_t *hash);
+
+/**
+ *  Stores an encoded copy of the header, in groupname/xml_bin, next to the XML.
+ *
+ *  The XML remains the reference. It has to be written first: the copy is
+ *  tagged with the hash of the XML, and ismrmrd_write_header removes a copy
+ *  written earlier. An XML header written without the hash is hashed and
+ *  tagged here.
+ */
+EXPORTISMRMRD int ismrmrd_write_binary_header(const ISMRMRD_Dataset *dset, const void *data, const size_t length);
+
+/**
+ *  Reads the binary copy of the header into a buffer allocated with malloc.
+ *
+ *  Returns NULL with length set to 0, and no error, if the dataset has none
+ *  or if its hash is not the one the XML is tagged with: other writers may
+ *  have replaced the XML without removing the copy. Only the tags are
+ *  compared, the XML is not read. A writer that overwrites the XML in place
+ *  and keeps the tag is not noticed.
+ */
+EXPORTISMRMRD void * ismrmrd_read_binary_header(const ISMRMRD_Dataset *dset, size_t *length);
+
 /**
  *  Appends and NMR/MRI acquisition to the dataset.
  *
@@ -73,11 +214,22 @@ EXPORTISMRMRD char * ismrmrd_read_header(const ISMRMRD_Dataset *dset);
  */
 EXPORTISMRMRD int ismrmrd_append_acquisition(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acq);
 
+/**
+ *  Appends count acquisitions stored in an array with a single HDF5 write.
+ */
+EXPORTISMRMRD int ismrmrd_append_acquisitions(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acqs, uint32_t count);
+
 /**
  *  Reads the acquisition with the specified index from the dataset.
  */
 EXPORTISMRMRD int ismrmrd_read_acquisition(const ISMRMRD_Dataset *dset, uint32_t index, ISMRMRD_Acquisition *acq);
 
+/**
+ *  Reads count consecutive acquisitions, starting at index, with a single HDF5
+ *  read into an array of initialized acquisitions.
+ */
+EXPORTISMRMRD int ismrmrd_read_acquisitions(const ISMRMRD_Dataset *dset, uint32_t index, uint32_t count, ISMRMRD_Acquisition *acqs);
+
 /**
  *  Return the number of acquisitions in the dataset.
  */
@@ -151,10 +303,23 @@ public:
     // XML Header
     void writeHeader(const std::string &xmlstring);
     void readHeader(std::string& xmlstring);
+    // Writes h as XML and, if binary is set, also in binary form for fast reading
+    void writeHeader(const IsmrmrdHeader& h, bool binary = true);
+    // Decodes the binary copy of the header if there is a usable one, the XML otherwise
+    void readHeader(IsmrmrdHeader& h);
+#ifdef ISMRMRD_HEADER_CACHE
+    // Like readHeader, but datasets with identical XML share one decoded
+    // header through the process-wide header cache
+    std::shared_ptr<const IsmrmrdHeader> readParsedHeader();
+#endif
     // Acquisitions
     void appendAcquisition(const Acquisition &acq);
+    void appendAcquisitions(const Acquisition *acqs, size_t count);
     void readAcquisition(uint32_t index, Acquisition &acq);
+    void readAcquisitions(uint32_t index, size_t count, Acquisition *acqs);
     uint32_t getNumberOfAcquisitions();
+    // Compresses the acquisitions appended from now on, see ismrmrd_dataset_set_compression
+    void setCompression(const CompressionParameters &params);
     // Images
     template <typename T> void appendImage(const std::string &var, const Image<T> &im);
     void appendImage(const std::string &var, const ISMRMRD_Image *im);
@@ -165,11 +330,54 @@ public:
     void appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr);
     template <typename T> void readNDArray(const std::string &var, uint32_t index, NDArray<T> &arr);
     uint32_t getNumberOfNDArrays(const std::string &var);
+    // Instrumentation
+    void enableStats(bool enable = true);
+    ISMRMRD_DatasetStats getStats() const;
+    void resetStats();
 
 protected:
     ISMRMRD_Dataset dset_;
 };
 
+#ifdef ISMRMRD_HEADER_CACHE
+/**
+ *  Counters of the process-wide header cache used by Dataset::readParsedHeader.
+ *
+ *  Headers written by ismrmrd_write_header are keyed by the hash they are
+ *  tagged with, so a hit reads neither the XML nor the binary copy; the tag
+ *  is checked against the XML before a header is cached under it. Untagged
+ *  headers are keyed by the XML, compared in full on a hit. Each entry is
+ *  charged the size of its key plus the memory of the decoded header, its
+ *  strings and vectors included, and the least recently used entries are
+ *  evicted to stay within the capacity.
+ */
+struct HeaderCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;      /**< charged to the current entries */
+    size_t capacity;   /**< bytes, 0 when caching is off */
+};
+
+/**
+ *  Bounds the memory of the header cache, evicting entries as needed.
+ *  A capacity of 0 turns caching off. The default is 16 MiB.
+ */
+EXPORTISMRMRD void setHeaderCacheCapacity(size_t bytes);
+
+/**
+ *  Returns the process-wide counters of the header cache.
+ */
+EXPORTISMRMRD HeaderCacheStats getHeaderCacheStats();
+
+/**
+ *  Drops all entries and resets the counters. Headers already returned
+ *  remain valid.
+ */
+EXPORTISMRMRD void clearHeaderCache();
+#endif
+
 } /* ISMRMRD namespace */
 #endif
 
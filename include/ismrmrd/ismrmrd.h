@@ -70,6 +70,7 @@ typedef int bool;
 
 /* Vectors */
 #ifdef __cplusplus
+#include <iterator>
 #include <vector>
 #endif /* __cplusplus */
 
@@ -388,6 +389,38 @@ EXPORTISMRMRD bool ismrmrd_is_channel_on(const uint64_t channel_mask[ISMRMRD_CHA
 EXPORTISMRMRD int ismrmrd_set_channel_on(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t chan);
 EXPORTISMRMRD int ismrmrd_set_channel_off(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t chan);
 EXPORTISMRMRD int ismrmrd_set_all_channels_off(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS]);
+
+/** Turns on the count channels from first on, a word at a time */
+EXPORTISMRMRD int ismrmrd_set_channels_on(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t first, const uint16_t count);
+/** Turns off the count channels from first on, a word at a time */
+EXPORTISMRMRD int ismrmrd_set_channels_off(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t first, const uint16_t count);
+/** Turns on exactly the count channels listed */
+EXPORTISMRMRD int ismrmrd_set_channel_list(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t *channels, const uint16_t count);
+/** Number of channels on */
+EXPORTISMRMRD uint16_t ismrmrd_count_channels_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS]);
+/** The first channel on from chan up, -1 if there is none */
+EXPORTISMRMRD int ismrmrd_next_channel_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t chan);
+/**
+ * Writes the channels on, in increasing order, to channels, which has room
+ * for ismrmrd_count_channels_on of them, and returns their number.
+ */
+EXPORTISMRMRD uint16_t ismrmrd_get_channels_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], uint16_t *channels);
+
+/**
+ * The data of an acquisition holds its active_channels channels in the
+ * order of their numbers in channel_mask, or, if the mask is empty, channels
+ * 0 to active_channels - 1.
+ *
+ * Compacting keeps the channels that are also on in keep, moving their data
+ * down in place, and updates active_channels and channel_mask to match.
+ */
+EXPORTISMRMRD int ismrmrd_compact_acquisition_channels(ISMRMRD_Acquisition *acq, const uint64_t keep[ISMRMRD_CHANNEL_MASKS]);
+/**
+ * Expanding makes the data hold channels 0 to channels - 1, each at the index
+ * of its number, with zeros for the channels that were not active, and turns
+ * all of them on. It undoes a compaction to a subset of those channels.
+ */
+EXPORTISMRMRD int ismrmrd_expand_acquisition_channels(ISMRMRD_Acquisition *acq, const uint16_t channels);
 /** @} */
 
 /******************/
@@ -409,10 +442,19 @@ EXPORTISMRMRD char *ismrmrd_strerror(int code);
 /** @} */
 
 /** Populates parameters (if non-NULL) with error information
+ *
+ * Errors are kept per thread, this pops the most recent error pushed by the
+ * calling thread. Each thread keeps its last 64 errors, older ones are dropped.
  * @returns true if there was error information to return, false otherwise */
 bool ismrmrd_pop_error(char **file, int *line, char **func,
         int *code, char **msg);
 
+/** Number of errors dropped from the calling thread's full error stack since it was last cleared */
+EXPORTISMRMRD unsigned long ismrmrd_error_stack_overflow(void);
+
+/** Discards the calling thread's errors and resets its overflow count */
+EXPORTISMRMRD void ismrmrd_clear_error_stack(void);
+
 /*****************************/
 /* Rotations and Quaternions */
 /*****************************/
@@ -427,6 +469,44 @@ EXPORTISMRMRD void ismrmrd_directions_to_quaternion(float read_dir[3], float pha
 
 /** Converts a quaternion of the form | a b c d | to a 3x3 rotation matrix */
 EXPORTISMRMRD void ismrmrd_quaternion_to_directions(float quat[4], float read_dir[3], float phase_dir[3], float slice_dir[3]);
+
+/**
+ * Direction vectors of n orientations in structure of arrays layout,
+ * read_dir[k][i] is component k of the read direction of orientation i.
+ */
+typedef struct ISMRMRD_Directions {
+    float *read_dir[3];
+    float *phase_dir[3];
+    float *slice_dir[3];
+} ISMRMRD_Directions;
+
+/**
+ * The batch versions below give the same results as the functions above,
+ * applied to each orientation in turn. Their loops are written so that the
+ * compiler can vectorize them.
+ */
+
+/** Signs of the determinants of n orientations */
+EXPORTISMRMRD int ismrmrd_sign_of_directions_n(const ISMRMRD_Directions *dirs, size_t n, int *sign);
+
+/** Quaternions of n orientations, quat[k][i] is component k of quaternion i */
+EXPORTISMRMRD int ismrmrd_directions_to_quaternion_n(const ISMRMRD_Directions *dirs, size_t n, float *quat[4]);
+
+/** Direction vectors of n quaternions */
+EXPORTISMRMRD int ismrmrd_quaternion_to_directions_n(float *quat[4], size_t n, const ISMRMRD_Directions *dirs);
+
+/**
+ * Orientations of an array of n acquisition headers. Each output may be NULL:
+ * quat receives 4 floats per header, sign one int and rot a row major 3x3
+ * matrix with the read, phase and slice directions as its columns, which
+ * rotates logical coordinates into the patient coordinate system.
+ */
+EXPORTISMRMRD int ismrmrd_acquisition_orientations(const ISMRMRD_AcquisitionHeader *head, size_t n,
+                                                   float *quat, int *sign, float *rot);
+
+/** Orientations of an array of n image headers, see ismrmrd_acquisition_orientations */
+EXPORTISMRMRD int ismrmrd_image_orientations(const ISMRMRD_ImageHeader *head, size_t n,
+                                             float *quat, int *sign, float *rot);
 /** @} */
 
 #pragma pack(pop) /* Restore old alignment */
@@ -436,7 +516,7 @@ EXPORTISMRMRD void ismrmrd_quaternion_to_directions(float quat[4], float read_di
 
 ///  ISMRMRD C++ Interface
 
-/// Construct exception message from ISMRMRD error stack
+/// Construct exception message from the calling thread's ISMRMRD error stack, emptying it
 std::string build_exception_string(void);
 
 /// Some typedefs to beautify the namespace
@@ -470,6 +550,73 @@ public:
 
 };
 
+/// Set of channels, a value copy of an acquisition channel mask
+class EXPORTISMRMRD ChannelMask {
+public:
+    /// Visits the active channels in increasing order, a word scan per step
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef uint16_t value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const uint16_t *pointer;
+        typedef uint16_t reference;
+
+        const_iterator() : bits_(NULL), chan_(-1) { }
+        uint16_t operator*() const { return static_cast<uint16_t>(chan_); }
+        const_iterator &operator++() {
+            chan_ = chan_ + 1 < 64 * ISMRMRD_CHANNEL_MASKS ? ismrmrd_next_channel_on(bits_, static_cast<uint16_t>(chan_ + 1)) : -1;
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator old(*this); ++*this; return old; }
+        bool operator==(const const_iterator &other) const { return chan_ == other.chan_; }
+        bool operator!=(const const_iterator &other) const { return chan_ != other.chan_; }
+
+    private:
+        friend class ChannelMask;
+        const_iterator(const uint64_t *bits, int chan) : bits_(bits), chan_(chan) { }
+        const uint64_t *bits_;
+        int chan_;
+    };
+
+    /// No channel active
+    ChannelMask();
+    explicit ChannelMask(const uint64_t (&bits)[ISMRMRD_CHANNEL_MASKS]);
+    /// Exactly the count channels listed
+    ChannelMask(const uint16_t *channels, uint16_t count);
+    explicit ChannelMask(const std::vector<uint16_t> &channels);
+    /// The count channels from first on
+    static ChannelMask range(uint16_t first, uint16_t count);
+
+    bool isActive(uint16_t channel_id) const;
+    ChannelMask &setActive(uint16_t channel_id);
+    ChannelMask &setNotActive(uint16_t channel_id);
+    ChannelMask &setRangeActive(uint16_t first, uint16_t count);
+    ChannelMask &setRangeNotActive(uint16_t first, uint16_t count);
+    ChannelMask &setAllNotActive();
+
+    /// Number of active channels
+    uint16_t count() const;
+    bool empty() const;
+    /// The active channels in increasing order
+    std::vector<uint16_t> channels() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    ChannelMask &operator&=(const ChannelMask &other);
+    ChannelMask &operator|=(const ChannelMask &other);
+    ChannelMask operator&(const ChannelMask &other) const;
+    ChannelMask operator|(const ChannelMask &other) const;
+    bool operator==(const ChannelMask &other) const;
+    bool operator!=(const ChannelMask &other) const;
+
+    const uint64_t (&bits() const)[ISMRMRD_CHANNEL_MASKS];
+    void copyTo(uint64_t (&bits)[ISMRMRD_CHANNEL_MASKS]) const;
+
+private:
+    uint64_t bits_[ISMRMRD_CHANNEL_MASKS];
+};
+
 /// Header for MR Acquisition type
 class EXPORTISMRMRD AcquisitionHeader: public ISMRMRD_AcquisitionHeader {
 public:
@@ -493,6 +640,10 @@ public:
 /// MR Acquisition type
 class EXPORTISMRMRD Acquisition {
     friend class Dataset;
+    friend class StreamWriter;
+    friend class StreamReader;
+    friend class SharedRing;
+    friend class AcquisitionView;
 public:
     // Constructors, assignment, destructor
     Acquisition();
@@ -606,6 +757,15 @@ public:
     void setChannelNotActive(uint16_t channel_id);
     void setAllChannelsNotActive();
 
+    /// The channels the data holds, 0 to active_channels - 1 if the mask is empty
+    ChannelMask getActiveChannels() const;
+    /// Replaces the channel mask, the data and active_channels are left as they are
+    void setChannelMask(const ChannelMask &mask);
+    /// Keeps the data of the active channels also in keep, see ismrmrd_compact_acquisition_channels
+    void compactChannels(const ChannelMask &keep);
+    /// Spreads the data out to channels 0 to channels - 1, see ismrmrd_expand_acquisition_channels
+    void expandChannels(uint16_t channels);
+
 protected:
     ISMRMRD_Acquisition acq;
 };
@@ -627,6 +787,10 @@ public:
 /// MR Image type
 template <typename T> class EXPORTISMRMRD Image {
     friend class Dataset;
+    friend class StreamWriter;
+    friend class StreamReader;
+    friend class SharedRing;
+    friend class ImageView;
 public:
     // Constructors
     Image(uint16_t matrix_size_x = 0, uint16_t matrix_size_y = 1,
@@ -789,6 +953,8 @@ protected:
 /// N-Dimensional array type
 template <typename T> class EXPORTISMRMRD NDArray {
     friend class Dataset;
+    friend class StreamWriter;
+    friend class StreamReader;
 public:
     // Constructors, destructor and copy
     NDArray();
@@ -15,6 +15,8 @@
 #include <map>
 #include <stdexcept>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 namespace ISMRMRD
 {
@@ -51,6 +53,12 @@ namespace ISMRMRD
      type and it guarantees that any value will have a
      representation as any type.
 
+     The value is stored in the type it was set with, the other
+     representations are converted on first use and cached, so a
+     value that is only ever read as a string is never parsed.
+     Because of that cache, reading the same MetaValue from several
+     threads at once needs external locking.
+
      The class uses std::string internally to store the 
      string representation of the value but this std::string
      is never exposed on the class interface and so it should not 
@@ -109,64 +117,190 @@ namespace ISMRMRD
     ///Get the ingeter representation of the value
     long as_long() const
     {
+      if (!(valid_ & LONG_VALID)) {
+        l_ = type_ == DOUBLE_VALID ? static_cast<long>(d_) : strtol(s_.c_str(), 0, 10);
+        valid_ |= LONG_VALID;
+      }
       return l_;
     }
 
     ///Get the floating point representation of the value
     double as_double() const
     {
+      if (!(valid_ & DOUBLE_VALID)) {
+        d_ = type_ == LONG_VALID ? static_cast<double>(l_) : strtod(s_.c_str(), 0);
+        valid_ |= DOUBLE_VALID;
+      }
       return d_;
     }
     
     ///get the C string representation of the value
     const char* as_str() const
     {
+      if (!(valid_ & STRING_VALID)) {
+        // Formatted as a std::stringstream would
+        char buffer[32];
+        if (type_ == LONG_VALID) {
+          snprintf(buffer, sizeof(buffer), "%ld", l_);
+        } else {
+          snprintf(buffer, sizeof(buffer), "%g", d_);
+        }
+        s_ = buffer;
+        valid_ |= STRING_VALID;
+      }
       return s_.c_str();
     }
 
 
   protected:
-    long l_;
-    double d_;
-    std::string s_;
+    /// The representation the value was set with is its type
+    enum
+    {
+      LONG_VALID = 1,
+      DOUBLE_VALID = 2,
+      STRING_VALID = 4
+    };
+
+    mutable long l_;
+    mutable double d_;
+    mutable std::string s_;
+    int type_;
+    mutable int valid_;
 
     void set(const char* s)
     {
-      s_ = std::string(s);
-      sscanf(s_.c_str(),"%ld",&l_);
-      sscanf(s_.c_str(),"%lf",&d_);      
+      l_ = 0;
+      d_ = 0;
+      s_ = s;
+      type_ = valid_ = STRING_VALID;
     }
 
     void set(long l)
     {
       l_ = l;
-      d_ = static_cast<double>(l_);
-      std::stringstream strstream;
-      strstream << l_;
-      strstream >> s_;
+      d_ = 0;
+      type_ = valid_ = LONG_VALID;
     }
 
     void set(double d)
     {
+      l_ = 0;
       d_ = d;
-      l_ = static_cast<long>(d_);
-      std::stringstream strstream;
-      strstream << d_;
-      strstream >> s_;
+      type_ = valid_ = DOUBLE_VALID;
     }
   };
 
   class MetaContainer;
 
+  /**
+     Deserialize meta attributes from either encoding. Strings that start
+     with the binary magic are decoded with the binary reader, anything else
+     is parsed as ismrmrdMeta XML.
+   */
   EXPORTISMRMRD void deserialize(const char* xml, MetaContainer& h);
   EXPORTISMRMRD void serialize(MetaContainer& h, std::ostream& o);
 
-  /// Meta Container
+  /**
+     Compact binary encoding of the meta attributes
+
+     Names and string values are stored once in a string table, integers and
+     floating point values that survive the round trip unchanged are stored
+     as typed varints. The encoding never contains a NUL byte, so it can be
+     stored as an image attribute string like the XML. Readers that predate
+     the binary encoding only understand the XML, use serialize() for files
+     that need to be read by them.
+   */
+  EXPORTISMRMRD void serialize_binary(MetaContainer& h, std::string& o);
+
+  /// True if the null terminated string s holds binary encoded meta attributes
+  EXPORTISMRMRD bool is_binary_meta(const char* s);
+
+  /**
+     Interned copy of a parameter name
+
+     Returns the same pointer for equal names, the copy lives until the
+     process exits. MetaContainer stores its parameter names this way, so
+     containers share the handful of names an image pipeline uses instead
+     of copying them for every image.
+
+     The pool holds at most ISMRMRD_META_NAME_POOL_BYTES characters, names
+     read from arbitrary files cannot grow it without bound. Once it is full
+     a name that is not in it yet gives NULL, and the container keeps its
+     own copy of the name.
+   */
+  EXPORTISMRMRD const char* intern_meta_name(const char* name);
+
+  /**
+     The values of one parameter. The first value is stored inline, only
+     arrays allocate.
+   */
+  class MetaValueArray
+  {
+  public:
+    MetaValueArray()
+      : size_(0)
+    {
+    }
+
+    size_t size() const
+    {
+      return size_;
+    }
+
+    const MetaValue& operator[](size_t index) const
+    {
+      return index == 0 ? first_ : rest_[index - 1];
+    }
+
+    void assign(const MetaValue& v)
+    {
+      first_ = v;
+      rest_.clear();
+      size_ = 1;
+    }
+
+    void push_back(const MetaValue& v)
+    {
+      if (size_ == 0) {
+        first_ = v;
+      } else {
+        rest_.push_back(v);
+      }
+      size_++;
+    }
+
+  protected:
+    MetaValue first_;
+    std::vector<MetaValue> rest_;
+    size_t size_;
+  };
+
+  /**
+     Meta Container
+
+     The parameters are kept in a vector sorted by name, the order in which
+     they are serialized. Lookups compare the name with strcmp and never
+     allocate, inserting a new parameter interns its name.
+   */
   class MetaContainer
   {
-    typedef std::map< std::string, std::vector<MetaValue> > map_t;
+    struct Entry
+    {
+      // Interned name, NULL when the pool is full and owned holds the name
+      const char* interned;
+      std::string owned;
+      MetaValueArray values;
+
+      const char* name() const
+      {
+        return interned ? interned : owned.c_str();
+      }
+    };
+
+    typedef std::vector<Entry> entries_t;
 
     friend void serialize(MetaContainer& h, std::ostream& o);
+    friend void serialize_binary(MetaContainer& h, std::string& o);
 
   public:
     MetaContainer()
@@ -184,27 +318,22 @@ namespace ISMRMRD
     template <class T> void set(const char* name, T value)
     {
       MetaValue v(value);
-      map_[std::string(name)] = std::vector<MetaValue>(1,value);
+      insert(name).values.assign(v);
     }
 
    
     template <class T> void append(const char* name, T value)
     {
-      map_t::iterator it = map_.find(std::string(name));      
-      if (it == map_.end()) {
-	set(name, value);
-      } else {
-	MetaValue v(value);
-	it->second.push_back(v);
-      }
+      MetaValue v(value);
+      insert(name).values.push_back(v);
     }
 
     /// Return number of values of a particular parameter
     size_t length(const char* name) const
     {
-      map_t::const_iterator it = map_.find(std::string(name));
-      if (it != map_.end()) {
-	return it->second.size();
+      const Entry* e = find(name);
+      if (e) {
+	return e->values.size();
       }
       return 0;
     }
@@ -229,23 +358,73 @@ namespace ISMRMRD
 
     const MetaValue& value(const char* name, size_t index = 0) const
     {
-      map_t::const_iterator it = map_.find(std::string(name));
-      if (it == map_.end()) {
+      const Entry* e = find(name);
+      if (!e) {
 	throw std::runtime_error("Attempting to access unknown parameter");
       }
-      if (index >= it->second.size()) {
+      if (index >= e->values.size()) {
 	throw std::runtime_error("Attempting to access indexed value out of bounds");
       }
-      return it->second[index];
+      return e->values[index];
     }
 
     bool empty()
     {
-        return map_.empty();
+        return entries_.empty();
     }
 
   protected:
-    map_t map_; 
+    // First entry whose name is not less than name
+    size_t lower_bound(const char* name) const
+    {
+      size_t first = 0;
+      size_t count = entries_.size();
+      while (count > 0) {
+        size_t half = count / 2;
+        if (strcmp(entries_[first + half].name(), name) < 0) {
+          first += half + 1;
+          count -= half + 1;
+        } else {
+          count = half;
+        }
+      }
+      return first;
+    }
+
+    const Entry* find(const char* name) const
+    {
+      size_t i = lower_bound(name);
+      if (i < entries_.size() && strcmp(entries_[i].name(), name) == 0) {
+        return &entries_[i];
+      }
+      return 0;
+    }
+
+    Entry& insert(const char* name)
+    {
+      // Deserialization inserts the names in order, check the end first
+      size_t i = entries_.size();
+      if (i > 0) {
+        int c = strcmp(entries_[i - 1].name(), name);
+        if (c == 0) {
+          return entries_[i - 1];
+        }
+        if (c > 0) {
+          i = lower_bound(name);
+          if (strcmp(entries_[i].name(), name) == 0) {
+            return entries_[i];
+          }
+        }
+      }
+      Entry e;
+      e.interned = intern_meta_name(name);
+      if (!e.interned) {
+        e.owned = name;
+      }
+      return *entries_.insert(entries_.begin() + i, e);
+    }
+
+    entries_t entries_;
   };
 
   //Template function instantiations
@@ -0,0 +1,166 @@
+/* ISMRMRD Shared Memory Ring */
+
+/**
+ * @file ring.h
+ * @defgroup ring Shared Memory Ring API
+ * @{
+ */
+
+#pragma once
+#ifndef ISMRMRD_RING_H
+#define ISMRMRD_RING_H
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/stream.h"
+#include <string>
+
+namespace ISMRMRD {
+
+/**
+ *   An acquisition stored in place in a SharedRing: the header, then the
+ *   trajectory and the data. The sizes are fixed when the space is reserved,
+ *   so number_of_samples, active_channels and trajectory_dimensions must not
+ *   be changed through head().
+ */
+class EXPORTISMRMRD AcquisitionView {
+public:
+    AcquisitionView();
+
+    ISMRMRD_AcquisitionHeader &head();
+    const ISMRMRD_AcquisitionHeader &head() const;
+    float *getTrajPtr();
+    const float *getTrajPtr() const;
+    complex_float_t *getDataPtr();
+    const complex_float_t *getDataPtr() const;
+    size_t getTrajSize() const;
+    size_t getDataSize() const;
+    size_t getNumberOfDataElements() const;
+
+    /// Copies the acquisition out of the ring
+    void copyTo(Acquisition &acq) const;
+
+private:
+    friend class SharedRing;
+    AcquisitionView(char *base);
+    char *base_;
+};
+
+/**
+ *   An image stored in place in a SharedRing: the header, then the attribute
+ *   string (attribute_string_len bytes, not null terminated) and the data.
+ *   The data follows the 198 byte header and the attribute string directly, so
+ *   it is only 2 byte aligned; read it with memcpy or copyTo.
+ */
+class EXPORTISMRMRD ImageView {
+public:
+    ImageView();
+
+    const ISMRMRD_ImageHeader &head() const;
+    const char *getAttributeString() const;
+    size_t getAttributeStringLength() const;
+    const void *getDataPtr() const;
+    size_t getDataSize() const;
+
+    /// Copies the image out of the ring, throws if the data types differ
+    template <typename T> void copyTo(Image<T> &im) const;
+
+private:
+    friend class SharedRing;
+    ImageView(const char *base);
+    const char *base_;
+};
+
+/**
+ *   Single producer, single consumer ring of messages in POSIX shared memory
+ *
+ *   The ring carries the messages of the stream format (stream.h) between two
+ *   processes, or threads, on the same host without going through the kernel
+ *   for the data. One side creates the ring under a shared memory name, the
+ *   other opens it by that name; either one can be the producer.
+ *
+ *   The producer reserves space for an acquisition with beginAcquisition,
+ *   builds it in place through the returned view and publishes it with
+ *   commit. The consumer gets the id of the next message from nextMessage,
+ *   reads the acquisition or image in place and hands the space back with
+ *   release (or the next call to nextMessage). writeAcquisition, writeImage,
+ *   readAcquisition and readImage are the copying shortcuts.
+ *
+ *   Messages are stored contiguously, 64 byte aligned, as a StreamFrame
+ *   followed by the payload; a message that does not fit before the end of
+ *   the ring starts over at the beginning. A side that has to wait spins
+ *   briefly and then sleeps on a futex in the ring (polls on systems without
+ *   futexes), so an idle ring costs no CPU.
+ *
+ *   Only one thread may produce and one thread consume. Errors, including a
+ *   message larger than the ring, throw std::runtime_error.
+ */
+class EXPORTISMRMRD SharedRing {
+public:
+    /// Default capacity of a created ring
+    static const size_t DEFAULT_CAPACITY = 64 << 20;
+
+    /**
+     * Creates the ring name (e.g. "/ismrmrd_ring"), replacing an old one, or
+     * opens an existing ring. A created ring is unlinked by the destructor.
+     */
+    SharedRing(const std::string &name, bool create, size_t capacity = DEFAULT_CAPACITY);
+    ~SharedRing();
+
+    /// Usable bytes in the ring
+    size_t capacity() const;
+
+    // Producer
+    AcquisitionView beginAcquisition(uint16_t num_samples, uint16_t active_channels = 1,
+                                     uint16_t trajectory_dimensions = 0);
+    void commit();
+    void writeHeader(const std::string &xml);
+    void writeAcquisition(const Acquisition &acq);
+    template <typename T> void writeImage(const Image<T> &im);
+    /// Sends STREAM_CLOSE
+    void close();
+
+    // Consumer
+    /**
+     * Waits for the next message and returns its id, releasing the current
+     * one. STREAM_CLOSE is a message like any other: after it the call
+     * blocks until the producer sends more.
+     */
+    uint16_t nextMessage();
+    AcquisitionView acquisition();
+    ImageView image();
+    void readHeader(std::string &xml);
+    void readAcquisition(Acquisition &acq);
+    template <typename T> void readImage(Image<T> &im);
+    void release();
+
+private:
+    SharedRing(const SharedRing &);
+    SharedRing &operator=(const SharedRing &);
+
+    char *reserve(uint16_t id, size_t length);
+    void expect(uint16_t id) const;
+
+    std::string name_;
+    bool owner_;
+    char *map_;
+    size_t map_size_;
+    char *data_;
+    size_t capacity_;
+
+    // Producer state: the reserved message, not yet published
+    uint64_t head_;
+    char *reserved_;
+    size_t reserved_length_;
+
+    // Consumer state: the message being read
+    uint64_t tail_;
+    char *current_;
+    uint16_t current_id_;
+    uint64_t current_length_;
+};
+
+/** @} */
+
+} // namespace ISMRMRD
+
+#endif // ISMRMRD_RING_H
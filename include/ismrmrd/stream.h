@@ -0,0 +1,161 @@
+/* ISMRMRD Stream */
+
+/**
+ * @file stream.h
+ * @defgroup stream Stream API
+ * @{
+ */
+
+#pragma once
+#ifndef ISMRMRD_STREAM_H
+#define ISMRMRD_STREAM_H
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/compression.h"
+#include <string>
+#include <vector>
+
+namespace ISMRMRD {
+
+/**
+ *   Framed binary stream of ISMRMRD objects over a file descriptor
+ *
+ *   A stream is a sequence of messages. Every message starts with a 16 byte
+ *   frame followed by the payload:
+ *
+ *     uint16_t id           one of StreamMessageId
+ *     uint16_t reserved[3]  written as zero
+ *     uint64_t length       payload size in bytes
+ *
+ *   The payload of each message id is
+ *
+ *     STREAM_HEADER       the XML header text, without a terminating null
+ *     STREAM_ACQUISITION  ISMRMRD_AcquisitionHeader, trajectory, data
+ *     STREAM_IMAGE        ISMRMRD_ImageHeader, attribute string
+ *                         (attribute_string_len bytes, no null), data
+ *     STREAM_NDARRAY      StreamNDArrayHeader, data
+ *     STREAM_CLOSE        empty, the writer has finished
+ *
+ *   Headers are sent with the packed in-memory layout of ismrmrd.h and all
+ *   numbers in host byte order, so both ends must share the byte order, which
+ *   is little endian on every platform ISMRMRD is built for. The sizes of the
+ *   trajectory and data follow from the fixed header and the reader rejects
+ *   a message whose length does not match.
+ *
+ *   A writer set to compress sends the data of each acquisition as a block of
+ *   compression.h, with the header flagged accordingly; the message is then
+ *   the header, the trajectory and the block. Readers recognize the flag and
+ *   decompress, whatever their own setting.
+ *
+ *   StreamWriter hands the fixed header and the caller's trajectory and data
+ *   buffers to writev, or sendmsg on sockets, as separate iovecs, so the
+ *   samples are never copied into an intermediate buffer; writeAcquisitions
+ *   sends a whole batch with as few system calls as IOV_MAX allows. StreamReader buffers the small
+ *   parts of the stream and reads large payloads straight into the object. It
+ *   may read ahead of the current message, so once a reader is attached the
+ *   descriptor should not be read by anything else.
+ *
+ *   The descriptor can be a socket, a pipe or a file and stays owned by the
+ *   caller. Errors, including a stream that ends inside a message, throw
+ *   std::runtime_error. A writer and a reader must each be used by one
+ *   thread at a time.
+ */
+enum StreamMessageId {
+    STREAM_HEADER = 3,
+    STREAM_CLOSE = 4,
+    STREAM_ACQUISITION = 1008,
+    STREAM_IMAGE = 1022,
+    STREAM_NDARRAY = 1030
+};
+
+/// Frame in front of every message
+struct StreamFrame {
+    uint16_t id;
+    uint16_t reserved[3];
+    uint64_t length;
+};
+
+/// Fixed header of an NDArray message
+struct StreamNDArrayHeader {
+    uint16_t version;
+    uint16_t data_type;
+    uint16_t ndim;
+    uint16_t reserved;
+    uint64_t dims[ISMRMRD_NDARRAY_MAXDIM];
+};
+
+class EXPORTISMRMRD StreamWriter {
+public:
+    /// Writes to fd, which must stay open for the lifetime of the writer
+    StreamWriter(int fd);
+
+    void writeHeader(const std::string &xml);
+    void writeAcquisition(const Acquisition &acq);
+    /// Sends n acquisitions, batching their frames into few system calls
+    void writeAcquisitions(const Acquisition *acqs, size_t n);
+    template <typename T> void writeImage(const Image<T> &im);
+    template <typename T> void writeNDArray(const NDArray<T> &arr);
+    /// Sends STREAM_CLOSE, the descriptor itself is left open
+    void close();
+
+    /// Compresses the acquisitions written from now on, ISMRMRD_COMPRESSION_NONE turns it off
+    void setCompression(const CompressionParameters &params);
+
+    /// Size of the messages written so far, frames included
+    uint64_t bytesWritten() const;
+
+private:
+    void writeCompressedAcquisitions(const Acquisition *acqs, size_t n);
+
+    int fd_;
+    bool socket_;
+    uint64_t bytes_;
+    CompressionParameters compression_;
+    std::vector<float> noise_stddev_;
+    std::vector<char> blocks_;
+};
+
+class EXPORTISMRMRD StreamReader {
+public:
+    /// Reads from fd, which must stay open for the lifetime of the reader
+    StreamReader(int fd);
+
+    /**
+     * Moves to the next message and returns its id. The unread rest of the
+     * current message is skipped. A stream that ends between two messages
+     * reads as STREAM_CLOSE.
+     */
+    uint16_t nextMessage();
+    /// Payload length of the current message
+    uint64_t messageLength() const;
+
+    /// The read functions throw unless the current message has the right id
+    void readHeader(std::string &xml);
+    void readAcquisition(Acquisition &acq);
+    template <typename T> void readImage(Image<T> &im);
+    template <typename T> void readNDArray(NDArray<T> &arr);
+
+    /// Size of the messages started so far, frames included
+    uint64_t bytesRead() const;
+
+private:
+    void expect(uint16_t id);
+    void take(void *dst, size_t n);
+    bool fill(size_t n);
+    void finish();
+
+    int fd_;
+    std::vector<char> buf_;
+    std::vector<char> block_;
+    size_t pos_;
+    size_t end_;
+    uint16_t id_;
+    uint64_t remaining_;
+    uint64_t bytes_;
+};
+
+/** @} */
+
+} // namespace ISMRMRD
+
+#endif // ISMRMRD_STREAM_H
@@ -325,8 +325,85 @@ namespace ISMRMRD
 
 
 
+  /// Top level sections of the header, combined into masks for selective decoding
+  enum HeaderSection
+  {
+    HEADER_SUBJECT_INFORMATION            = 1 << 0,
+    HEADER_STUDY_INFORMATION              = 1 << 1,
+    HEADER_MEASUREMENT_INFORMATION        = 1 << 2,
+    HEADER_ACQUISITION_SYSTEM_INFORMATION = 1 << 3,
+    HEADER_EXPERIMENTAL_CONDITIONS        = 1 << 4,
+    HEADER_ENCODING                       = 1 << 5,
+    HEADER_SEQUENCE_PARAMETERS            = 1 << 6,
+    HEADER_USER_PARAMETERS                = 1 << 7,
+    HEADER_ALL_SECTIONS                   = (1 << 8) - 1
+  };
+
   EXPORTISMRMRD void deserialize(const char* xml, IsmrmrdHeader& h);
+  /**
+   * Deserializes len bytes of XML, which need not be null terminated.
+   *
+   * Only the sections in the mask are decoded, the others are left as they
+   * are in h and are not checked for presence. The version is always decoded.
+   */
+  EXPORTISMRMRD void deserialize(const char* xml, size_t len, IsmrmrdHeader& h,
+                                 unsigned int sections = HEADER_ALL_SECTIONS);
+
+  /// User parameter as text in the document retained by a LazyHeader
+  struct UserParameterView
+  {
+    const char* type;   ///< "Long", "Double", "String" or "Base64"
+    const char* name;
+    const char* value;
+  };
+
+  /**
+   * Header that keeps the parsed document so user parameters, which can run
+   * to megabytes, are only decoded when asked for.
+   *
+   * header() holds the sections selected at construction, except the user
+   * parameters, which are decoded by the first call to userParameters() unless
+   * HEADER_USER_PARAMETERS was selected. The views and the strings returned by
+   * findUserParameter point into the retained document and are valid for the
+   * lifetime of the LazyHeader. Not safe for concurrent use.
+   */
+  class EXPORTISMRMRD LazyHeader
+  {
+  public:
+    LazyHeader(const char* xml, size_t len,
+               unsigned int sections = HEADER_ALL_SECTIONS & ~HEADER_USER_PARAMETERS);
+    ~LazyHeader();
+
+    const IsmrmrdHeader& header() const;
+    const Optional<UserParameters>& userParameters();
+    /// All user parameters in document order, without decoding them
+    void userParameterViews(std::vector<UserParameterView>& views) const;
+    /// Text value of the first user parameter with this name, NULL if there is none
+    const char* findUserParameter(const char* name) const;
+
+  private:
+    LazyHeader(const LazyHeader&);
+    LazyHeader& operator=(const LazyHeader&);
+
+    struct Impl;
+    Impl* impl_;
+    IsmrmrdHeader header_;
+  };
   EXPORTISMRMRD void serialize(const IsmrmrdHeader& h, std::ostream& o);
+  /// Serializes into o, replacing its contents
+  EXPORTISMRMRD void serialize(const IsmrmrdHeader& h, std::string& o);
+
+  /**
+   * Compact, versioned binary encoding of the header for exchange between
+   * processes built against the same schema. The XML stays the canonical
+   * interchange format; the binary form only saves parsing it again.
+   */
+  EXPORTISMRMRD void serialize_binary(const IsmrmrdHeader& h, std::string& o);
+  /// Throws std::runtime_error if the data is not a binary header of this format version,
+  /// ISMRMRD_XMLHDR_VERSION and set of header fields
+  EXPORTISMRMRD void deserialize_binary(const char* data, size_t len, IsmrmrdHeader& h);
+  /// True if data starts like the output of serialize_binary
+  EXPORTISMRMRD bool is_binary_header(const char* data, size_t len);
 }
 
 /** @} */
@@ -0,0 +1,685 @@
+#include "ismrmrd/coils.h"
+
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace ISMRMRD {
+
+// Samples per tile of the compression product, so a tile of all input
+// channels stays in the L2 cache, and output channels per pass over a tile
+static const size_t TILE_SAMPLES = 64;
+static const size_t TILE_CHANNELS = 4;
+
+// Adds x conj(y) over n samples to sum. The real part is the plain dot
+// product of the interleaved floats, the imaginary one pairs each float
+// with its neighbor; eight lanes of each let both vectorize.
+static void add_dot_conj(const float *x, const float *y, size_t n, complex_double_t &sum)
+{
+    float re[8] = { 0 }, im[8] = { 0 };
+    size_t f = 0;
+    for (; f + 8 <= 2 * n; f += 8) {
+        for (size_t l = 0; l < 8; l++) {
+            re[l] += x[f + l] * y[f + l];
+            im[l] += x[f + l] * y[f + (l ^ 1)];
+        }
+    }
+    double r = 0, i = 0;
+    for (size_t l = 0; l < 8; l++) {
+        r += re[l];
+        i += (l & 1) ? im[l] : -im[l];
+    }
+    for (; f < 2 * n; f += 2) {
+        r += x[f] * y[f] + x[f + 1] * y[f + 1];
+        i += x[f + 1] * y[f] - x[f] * y[f + 1];
+    }
+    sum += complex_double_t(r, i);
+}
+
+// Adds the covariance of the channels in rows of acq, x_i conj(x_j) summed
+// over the samples, to the upper triangle of covariance
+static void add_covariance(const Acquisition &acq, const std::vector<size_t> &rows,
+                           std::vector<complex_double_t> &covariance)
+{
+    size_t channels = rows.size(), n = acq.getHead().number_of_samples;
+    const float *data = reinterpret_cast<const float *>(acq.getDataPtr());
+    for (size_t i = 0; i < channels; i++) {
+        const float *x = data + 2 * rows[i] * n;
+        for (size_t j = i; j < channels; j++) {
+            add_dot_conj(x, data + 2 * rows[j] * n, n, covariance[i * channels + j]);
+        }
+    }
+}
+
+// The rows of the data of acq holding channels, which must all be active
+static void channel_rows(const Acquisition &acq, const ChannelMask &channels, std::vector<size_t> &rows)
+{
+    ChannelMask active = acq.getActiveChannels();
+    if ((active & channels) != channels) {
+        throw std::runtime_error("Acquisition does not have all calibrated channels active");
+    }
+    rows.clear();
+    size_t row = 0;
+    for (ChannelMask::const_iterator it = active.begin(); it != active.end(); ++it, ++row) {
+        if (channels.isActive(*it)) {
+            rows.push_back(row);
+        }
+    }
+}
+
+// Lays the outputs by inputs matrix out for multiply_channels: per block of
+// TILE_CHANNELS outputs, per input, the real parts of the block, then the
+// imaginary ones; the last block is padded with zeros
+static void split_coefficients(const std::vector<complex_float_t> &matrix, size_t outputs, size_t inputs,
+                               std::vector<float> &coefficients)
+{
+    size_t blocks = (outputs + TILE_CHANNELS - 1) / TILE_CHANNELS;
+    coefficients.assign(blocks * inputs * 2 * TILE_CHANNELS, 0.0f);
+    for (size_t k = 0; k < outputs; k++) {
+        for (size_t c = 0; c < inputs; c++) {
+            float *block = &coefficients[((k / TILE_CHANNELS) * inputs + c) * 2 * TILE_CHANNELS];
+            block[k % TILE_CHANNELS] = matrix[k * inputs + c].real();
+            block[TILE_CHANNELS + k % TILE_CHANNELS] = matrix[k * inputs + c].imag();
+        }
+    }
+}
+
+// Multiplies the channels in rows of acq by the matrix of coefficients and
+// scale, in place: output k goes to row k, or rows[k] if in_rows is set.
+// Per tile of samples the inputs are copied into split real and imaginary
+// rows first, so the outputs can overwrite the data, then each block of
+// outputs accumulates over them with plain multiply-adds. For a lower
+// triangular matrix the inputs after the block are skipped.
+static void multiply_channels(const std::vector<float> &coefficients, size_t outputs, bool lower,
+                              Acquisition &acq, const std::vector<size_t> &rows, bool in_rows, float scale,
+                              std::vector<float> &work)
+{
+    size_t n = acq.getHead().number_of_samples, inputs = rows.size();
+    size_t blocks = (outputs + TILE_CHANNELS - 1) / TILE_CHANNELS;
+    work.resize(2 * inputs * TILE_SAMPLES + 2 * TILE_CHANNELS * TILE_SAMPLES);
+    float *split = &work[0];
+    float *acc = split + 2 * inputs * TILE_SAMPLES;
+    float *data = reinterpret_cast<float *>(acq.getDataPtr());
+
+    for (size_t s0 = 0; s0 < n; s0 += TILE_SAMPLES) {
+        size_t len = std::min(TILE_SAMPLES, n - s0);
+        for (size_t c = 0; c < inputs; c++) {
+            const float *x = data + 2 * (rows[c] * n + s0);
+            float *xr = split + 2 * c * TILE_SAMPLES, *xi = xr + TILE_SAMPLES;
+            for (size_t s = 0; s < len; s++) {
+                xr[s] = x[2 * s];
+                xi[s] = x[2 * s + 1];
+            }
+        }
+
+        for (size_t b = 0; b < blocks; b++) {
+            memset(acc, 0, 2 * TILE_CHANNELS * TILE_SAMPLES * sizeof(float));
+            const float *m = &coefficients[b * inputs * 2 * TILE_CHANNELS];
+            size_t end = lower ? std::min(inputs, (b + 1) * TILE_CHANNELS) : inputs;
+            for (size_t c = 0; c < end; c++, m += 2 * TILE_CHANNELS) {
+                const float *xr = split + 2 * c * TILE_SAMPLES, *xi = xr + TILE_SAMPLES;
+                for (size_t j = 0; j < TILE_CHANNELS; j++) {
+                    float mr = m[j], mi = m[TILE_CHANNELS + j];
+                    float *yr = acc + 2 * j * TILE_SAMPLES, *yi = yr + TILE_SAMPLES;
+                    for (size_t s = 0; s < TILE_SAMPLES; s++) {
+                        yr[s] += mr * xr[s] - mi * xi[s];
+                        yi[s] += mr * xi[s] + mi * xr[s];
+                    }
+                }
+            }
+
+            for (size_t j = 0; j < TILE_CHANNELS && b * TILE_CHANNELS + j < outputs; j++) {
+                size_t k = b * TILE_CHANNELS + j;
+                const float *yr = acc + 2 * j * TILE_SAMPLES, *yi = yr + TILE_SAMPLES;
+                float *y = data + 2 * ((in_rows ? rows[k] : k) * n + s0);
+                for (size_t s = 0; s < len; s++) {
+                    y[2 * s] = scale * yr[s];
+                    y[2 * s + 1] = scale * yi[s];
+                }
+            }
+        }
+    }
+}
+
+//
+// CoilCompressor class implementation
+//
+CoilCompressor::CoilCompressor()
+    : selected_(false)
+    , num_channels_(0)
+    , num_samples_(0)
+    , decomposed_(false)
+    , virtual_channels_(0)
+{
+}
+
+void CoilCompressor::selectChannels(const ChannelMask &selection)
+{
+    if (num_samples_ > 0) {
+        throw std::runtime_error("Channels must be selected before the calibration");
+    }
+    selection_ = selection;
+    selected_ = true;
+}
+
+bool CoilCompressor::addCalibration(const Acquisition &acq)
+{
+    uint64_t flags = acq.getHead().flags;
+    if (!ismrmrd_is_flag_set(flags, ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION) &&
+        !ismrmrd_is_flag_set(flags, ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION_AND_IMAGING)) {
+        return false;
+    }
+    addCalibrationData(acq);
+    return true;
+}
+
+void CoilCompressor::addCalibrationData(const Acquisition &acq)
+{
+    if (num_samples_ == 0 && num_channels_ == 0) {
+        channels_ = acq.getActiveChannels();
+        if (selected_) {
+            channels_ &= selection_;
+        }
+        num_channels_ = channels_.count();
+        if (num_channels_ == 0) {
+            throw std::runtime_error("No channels to calibrate");
+        }
+        covariance_.assign(static_cast<size_t>(num_channels_) * num_channels_, complex_double_t(0));
+    }
+
+    channel_rows(acq, channels_, rows_);
+    add_covariance(acq, rows_, covariance_);
+    num_samples_ += acq.getHead().number_of_samples;
+    decomposed_ = false;
+}
+
+void CoilCompressor::reset()
+{
+    channels_.setAllNotActive();
+    num_channels_ = 0;
+    num_samples_ = 0;
+    covariance_.clear();
+    decomposed_ = false;
+    eigenvalues_.clear();
+    eigenvectors_.clear();
+    virtual_channels_ = 0;
+    matrix_.clear();
+    coefficients_.clear();
+}
+
+const ChannelMask &CoilCompressor::getChannels() const
+{
+    return channels_;
+}
+
+size_t CoilCompressor::getNumberOfCalibrationSamples() const
+{
+    return num_samples_;
+}
+
+const std::vector<double> &CoilCompressor::getEigenvalues()
+{
+    decompose();
+    return eigenvalues_;
+}
+
+uint16_t CoilCompressor::channelsForEnergy(double fraction)
+{
+    decompose();
+    double total = 0;
+    for (size_t k = 0; k < eigenvalues_.size(); k++) {
+        total += std::max(eigenvalues_[k], 0.0);
+    }
+    double kept = 0;
+    uint16_t k = 0;
+    while (k < num_channels_ && (k == 0 || kept < fraction * total)) {
+        kept += std::max(eigenvalues_[k++], 0.0);
+    }
+    return k;
+}
+
+// Reduces the Hermitian n by n matrix a to tridiagonal form Q^H a Q by
+// Householder reflections H_k = I - tau_k v_k v_k^H, with v_k in row k of
+// house from column k + 1 on. d is the diagonal, e[k] the element below d[k].
+static void tridiagonalize(std::vector<complex_double_t> &a, size_t n, std::vector<complex_double_t> &house,
+                           std::vector<double> &tau, std::vector<double> &d, std::vector<complex_double_t> &e)
+{
+    std::vector<complex_double_t> p(n);
+    house.assign(n * n, complex_double_t(0));
+    tau.assign(n, 0.0);
+    for (size_t k = 0; k + 2 < n; k++) {
+        complex_double_t *v = &house[k * n];
+        double norm = 0;
+        for (size_t i = k + 1; i < n; i++) {
+            v[i] = a[i * n + k];
+            norm += std::norm(v[i]);
+        }
+        norm = std::sqrt(norm);
+        if (norm == 0) {
+            continue;
+        }
+        // H x = alpha e_1, alpha of the opposite phase of x_1 so v does not cancel
+        double x1 = std::abs(v[k + 1]);
+        complex_double_t phase = x1 > 0 ? v[k + 1] / x1 : complex_double_t(1);
+        complex_double_t alpha = -phase * norm;
+        v[k + 1] -= alpha;
+        tau[k] = 1 / (norm * (norm + x1));
+
+        // a = H a H = a - v w^H - w v^H, w = p - (tau v^H p / 2) v, p = tau a v
+        complex_double_t vp = 0;
+        for (size_t i = k + 1; i < n; i++) {
+            complex_double_t sum = 0;
+            for (size_t j = k + 1; j < n; j++) {
+                sum += a[i * n + j] * v[j];
+            }
+            p[i] = tau[k] * sum;
+            vp += std::conj(v[i]) * p[i];
+        }
+        double half = 0.5 * tau[k] * vp.real();
+        for (size_t i = k + 1; i < n; i++) {
+            p[i] -= half * v[i];
+        }
+        for (size_t i = k + 1; i < n; i++) {
+            for (size_t j = k + 1; j < n; j++) {
+                a[i * n + j] -= v[i] * std::conj(p[j]) + p[i] * std::conj(v[j]);
+            }
+        }
+        a[(k + 1) * n + k] = alpha;
+        for (size_t i = k + 2; i < n; i++) {
+            a[i * n + k] = 0;
+        }
+    }
+
+    d.resize(n);
+    e.assign(n, complex_double_t(0));
+    for (size_t i = 0; i < n; i++) {
+        d[i] = a[i * n + i].real();
+        if (i + 1 < n) {
+            e[i] = a[(i + 1) * n + i];
+        }
+    }
+}
+
+// Eigenvalues of the real symmetric tridiagonal matrix with diagonal d and
+// subdiagonal e by the implicit QL method, on return in d; row i of z, n by
+// n and the identity on entry, is the eigenvector of d[i].
+static void tridiagonal_ql(std::vector<double> &d, std::vector<double> &e, std::vector<double> &z, size_t n)
+{
+    e[n - 1] = 0;
+    for (size_t l = 0; l < n; l++) {
+        for (int iter = 0; iter < 60; iter++) {
+            size_t m = l;
+            for (; m + 1 < n; m++) {
+                double dd = std::fabs(d[m]) + std::fabs(d[m + 1]);
+                if (std::fabs(e[m]) <= 1e-15 * dd) {
+                    break;
+                }
+            }
+            if (m == l) {
+                break;
+            }
+
+            double g = (d[l + 1] - d[l]) / (2 * e[l]);
+            double r = std::sqrt(g * g + 1);
+            g = d[m] - d[l] + e[l] / (g + (g >= 0 ? r : -r));
+            double s = 1, c = 1, p = 0;
+            ptrdiff_t i = static_cast<ptrdiff_t>(m) - 1;
+            for (; i >= static_cast<ptrdiff_t>(l); i--) {
+                double f = s * e[i], b = c * e[i];
+                e[i + 1] = r = std::sqrt(f * f + g * g);
+                if (r == 0) {
+                    d[i + 1] -= p;
+                    e[m] = 0;
+                    break;
+                }
+                s = f / r;
+                c = g / r;
+                g = d[i + 1] - p;
+                r = (d[i] - g) * s + 2 * c * b;
+                p = s * r;
+                d[i + 1] = g + p;
+                g = c * r - b;
+
+                double *zi = &z[i * n], *zj = zi + n;
+                for (size_t k = 0; k < n; k++) {
+                    double f2 = zj[k];
+                    zj[k] = s * zi[k] + c * f2;
+                    zi[k] = c * zi[k] - s * f2;
+                }
+            }
+            if (r == 0 && i >= static_cast<ptrdiff_t>(l)) {
+                continue;
+            }
+            d[l] -= p;
+            e[l] = g;
+            e[m] = 0;
+        }
+    }
+}
+
+// Eigenvalues and eigenvectors of the Hermitian covariance: Householder
+// reduction to a tridiagonal matrix, whose off-diagonal elements a diagonal
+// unitary D turns real, and the QL method on that. The eigenvectors of the
+// covariance are Q D Z for those Z of the real matrix.
+void CoilCompressor::decompose()
+{
+    if (decomposed_) {
+        return;
+    }
+    if (num_samples_ == 0) {
+        throw std::runtime_error("No calibration data");
+    }
+
+    size_t n = num_channels_;
+    std::vector<complex_double_t> a(n * n);
+    for (size_t i = 0; i < n; i++) {
+        a[i * n + i] = complex_double_t(covariance_[i * n + i].real(), 0);
+        for (size_t j = i + 1; j < n; j++) {
+            a[i * n + j] = covariance_[i * n + j];
+            a[j * n + i] = std::conj(covariance_[i * n + j]);
+        }
+    }
+
+    std::vector<complex_double_t> house, e;
+    std::vector<double> tau, d;
+    tridiagonalize(a, n, house, tau, d, e);
+
+    std::vector<complex_double_t> phase(n);
+    std::vector<double> off(n);
+    phase[0] = 1;
+    for (size_t i = 0; i + 1 < n; i++) {
+        off[i] = std::abs(e[i]);
+        phase[i + 1] = off[i] > 0 ? phase[i] * e[i] / off[i] : phase[i];
+    }
+
+    std::vector<double> z(n * n, 0.0);
+    for (size_t i = 0; i < n; i++) {
+        z[i * n + i] = 1;
+    }
+    tridiagonal_ql(d, off, z, n);
+
+    // v = D Z, then the reflections from the last one back
+    std::vector<complex_double_t> v(n * n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            v[i * n + j] = phase[i] * z[j * n + i];
+        }
+    }
+    std::vector<complex_double_t> vh(n);
+    for (size_t k = n >= 2 ? n - 2 : 0; k-- > 0;) {
+        if (tau[k] == 0) {
+            continue;
+        }
+        const complex_double_t *h = &house[k * n];
+        std::fill(vh.begin(), vh.end(), complex_double_t(0));
+        for (size_t i = k + 1; i < n; i++) {
+            complex_double_t hi = std::conj(h[i]);
+            for (size_t j = 0; j < n; j++) {
+                vh[j] += hi * v[i * n + j];
+            }
+        }
+        for (size_t i = k + 1; i < n; i++) {
+            complex_double_t hi = tau[k] * h[i];
+            for (size_t j = 0; j < n; j++) {
+                v[i * n + j] -= hi * vh[j];
+            }
+        }
+    }
+
+    std::vector<std::pair<double, size_t> > order(n);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = std::make_pair(-d[i], i);
+    }
+    std::sort(order.begin(), order.end());
+
+    eigenvalues_.resize(n);
+    eigenvectors_.resize(n * n);
+    for (size_t k = 0; k < n; k++) {
+        eigenvalues_[k] = -order[k].first;
+        for (size_t i = 0; i < n; i++) {
+            eigenvectors_[i * n + k] = v[i * n + order[k].second];
+        }
+    }
+    decomposed_ = true;
+}
+
+void CoilCompressor::computeMatrix(uint16_t virtual_channels)
+{
+    decompose();
+    if (virtual_channels == 0 || virtual_channels > num_channels_) {
+        throw std::runtime_error("Number of virtual channels must be between 1 and the number of channels");
+    }
+
+    // Virtual channel k is the projection onto eigenvector k
+    size_t n = num_channels_;
+    virtual_channels_ = virtual_channels;
+    matrix_.resize(virtual_channels_ * n);
+    for (size_t k = 0; k < virtual_channels_; k++) {
+        for (size_t c = 0; c < n; c++) {
+            complex_double_t m = std::conj(eigenvectors_[c * n + k]);
+            matrix_[k * n + c] = complex_float_t(static_cast<float>(m.real()), static_cast<float>(m.imag()));
+        }
+    }
+
+    split_coefficients(matrix_, virtual_channels_, n, coefficients_);
+}
+
+const std::vector<complex_float_t> &CoilCompressor::getMatrix() const
+{
+    return matrix_;
+}
+
+uint16_t CoilCompressor::getNumberOfVirtualChannels() const
+{
+    return virtual_channels_;
+}
+
+void CoilCompressor::compress(Acquisition &acq)
+{
+    if (virtual_channels_ == 0) {
+        throw std::runtime_error("No coil compression matrix computed");
+    }
+    channel_rows(acq, channels_, rows_);
+    multiply_channels(coefficients_, virtual_channels_, false, acq, rows_, false, 1.0f, work_);
+
+    // The virtual channels are the first rows, the resize keeps them and the trajectory
+    acq.resize(acq.getHead().number_of_samples, virtual_channels_, acq.getHead().trajectory_dimensions);
+    acq.setChannelMask(ChannelMask::range(0, virtual_channels_));
+}
+
+void CoilCompressor::compress(Acquisition *acqs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        compress(acqs[i]);
+    }
+}
+
+void CoilCompressor::compress(std::vector<Acquisition> &acqs)
+{
+    if (!acqs.empty()) {
+        compress(&acqs[0], acqs.size());
+    }
+}
+
+//
+// NoisePrewhitener class implementation
+//
+NoisePrewhitener::NoisePrewhitener()
+    : bandwidth_(1.0f)
+    , num_channels_(0)
+    , num_samples_(0)
+    , noise_dwell_time_us_(0)
+{
+}
+
+NoisePrewhitener::NoisePrewhitener(const IsmrmrdHeader &header)
+    : bandwidth_(1.0f)
+    , num_channels_(0)
+    , num_samples_(0)
+    , noise_dwell_time_us_(0)
+{
+    if (header.acquisitionSystemInformation.is_present() &&
+        header.acquisitionSystemInformation->relativeReceiverNoiseBandwidth.is_present()) {
+        setRelativeReceiverNoiseBandwidth(*header.acquisitionSystemInformation->relativeReceiverNoiseBandwidth);
+    }
+}
+
+void NoisePrewhitener::setRelativeReceiverNoiseBandwidth(float bandwidth)
+{
+    if (!(bandwidth > 0)) {
+        throw std::runtime_error("Relative receiver noise bandwidth must be positive");
+    }
+    bandwidth_ = bandwidth;
+}
+
+float NoisePrewhitener::getRelativeReceiverNoiseBandwidth() const
+{
+    return bandwidth_;
+}
+
+bool NoisePrewhitener::addNoise(const Acquisition &acq)
+{
+    if (!ismrmrd_is_flag_set(acq.getHead().flags, ISMRMRD_ACQ_IS_NOISE_MEASUREMENT)) {
+        return false;
+    }
+    addNoiseData(acq);
+    return true;
+}
+
+void NoisePrewhitener::addNoiseData(const Acquisition &acq)
+{
+    if (num_channels_ == 0) {
+        channels_ = acq.getActiveChannels();
+        num_channels_ = channels_.count();
+        if (num_channels_ == 0) {
+            throw std::runtime_error("No channels in the noise readout");
+        }
+        covariance_.assign(static_cast<size_t>(num_channels_) * num_channels_, complex_double_t(0));
+        noise_dwell_time_us_ = acq.getHead().sample_time_us;
+    }
+
+    channel_rows(acq, channels_, rows_);
+    add_covariance(acq, rows_, covariance_);
+    num_samples_ += acq.getHead().number_of_samples;
+    whitening_.clear();
+}
+
+void NoisePrewhitener::reset()
+{
+    channels_.setAllNotActive();
+    num_channels_ = 0;
+    num_samples_ = 0;
+    noise_dwell_time_us_ = 0;
+    covariance_.clear();
+    whitening_.clear();
+    coefficients_.clear();
+}
+
+const ChannelMask &NoisePrewhitener::getChannels() const
+{
+    return channels_;
+}
+
+size_t NoisePrewhitener::getNumberOfNoiseSamples() const
+{
+    return num_samples_;
+}
+
+std::vector<complex_float_t> NoisePrewhitener::getNoiseCovariance() const
+{
+    size_t n = num_channels_;
+    std::vector<complex_float_t> covariance(n * n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            complex_double_t c = covariance_[i * n + j] / static_cast<double>(num_samples_);
+            covariance[i * n + j] = complex_float_t(static_cast<float>(c.real()), static_cast<float>(c.imag()));
+            covariance[j * n + i] = std::conj(covariance[i * n + j]);
+        }
+    }
+    return covariance;
+}
+
+// The Cholesky factor L of the covariance, then its inverse by forward
+// substitution, both lower triangular
+void NoisePrewhitener::computeWhitening()
+{
+    if (num_samples_ == 0) {
+        throw std::runtime_error("No noise data");
+    }
+
+    size_t n = num_channels_;
+    std::vector<complex_double_t> l(n * n, complex_double_t(0));
+    for (size_t j = 0; j < n; j++) {
+        double d = covariance_[j * n + j].real();
+        for (size_t k = 0; k < j; k++) {
+            d -= std::norm(l[j * n + k]);
+        }
+        if (!(d > 0)) {
+            throw std::runtime_error("Noise covariance is not positive definite");
+        }
+        double ljj = std::sqrt(d);
+        l[j * n + j] = ljj;
+        for (size_t i = j + 1; i < n; i++) {
+            complex_double_t sum = std::conj(covariance_[j * n + i]);
+            for (size_t k = 0; k < j; k++) {
+                sum -= l[i * n + k] * std::conj(l[j * n + k]);
+            }
+            l[i * n + j] = sum / ljj;
+        }
+    }
+
+    // Per sample, so the whitening does not depend on how much noise was measured
+    double norm = std::sqrt(static_cast<double>(num_samples_));
+    whitening_.assign(n * n, complex_float_t(0));
+    std::vector<complex_double_t> w(n);
+    for (size_t j = 0; j < n; j++) {
+        for (size_t i = j; i < n; i++) {
+            complex_double_t sum = (i == j) ? 1.0 : 0.0;
+            for (size_t k = j; k < i; k++) {
+                sum -= l[i * n + k] * w[k];
+            }
+            w[i] = sum / l[i * n + i].real();
+            complex_double_t x = w[i] * norm;
+            whitening_[i * n + j] = complex_float_t(static_cast<float>(x.real()), static_cast<float>(x.imag()));
+        }
+    }
+    split_coefficients(whitening_, n, n, coefficients_);
+}
+
+const std::vector<complex_float_t> &NoisePrewhitener::getWhiteningMatrix() const
+{
+    return whitening_;
+}
+
+void NoisePrewhitener::whiten(Acquisition &acq)
+{
+    if (whitening_.empty()) {
+        computeWhitening();
+    }
+    channel_rows(acq, channels_, rows_);
+
+    double ratio = 1;
+    float dwell = acq.getHead().sample_time_us;
+    if (dwell > 0 && noise_dwell_time_us_ > 0) {
+        ratio = dwell / noise_dwell_time_us_;
+    }
+    float scale = static_cast<float>(std::sqrt(2 * ratio * bandwidth_));
+    multiply_channels(coefficients_, num_channels_, true, acq, rows_, true, scale, work_);
+}
+
+void NoisePrewhitener::whiten(Acquisition *acqs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        whiten(acqs[i]);
+    }
+}
+
+void NoisePrewhitener::whiten(std::vector<Acquisition> &acqs)
+{
+    if (!acqs.empty()) {
+        whiten(&acqs[0], acqs.size());
+    }
+}
+
+} // namespace ISMRMRD
@@ -0,0 +1,741 @@
+/* sysconf is POSIX, not C99 */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+/* Language and Cross platform section for defining types */
+#ifdef __cplusplus
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#else
+/* C99 compiler */
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#endif /* __cplusplus */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "ismrmrd/compression.h"
+
+#ifdef __cplusplus
+namespace ISMRMRD {
+extern "C" {
+#endif
+
+#define COMPRESSION_VERSION 1
+#define COMPRESSED_HEADER_SIZE 16
+
+/* How a byte plane is coded, the first byte of its coding */
+#define PLANE_RAW 0
+#define PLANE_CONSTANT 1
+#define PLANE_RANS 2
+
+/* Symbol bitmap and up to two bytes of frequency per symbol */
+#define PLANE_TABLE_SIZE (1 + 32 + 2 * 256)
+
+/* rANS with 12 bit probabilities and two 32 bit states, for the even and the
+ * odd symbols, renormalized a byte at a time. The interleaved states keep two
+ * dependency chains in flight, and the division of the encoder is done as a
+ * multiplication by the reciprocal. */
+#define RANS_SCALE_BITS 12
+#define RANS_TOTAL (1u << RANS_SCALE_BITS)
+#define RANS_L (1u << 23)
+
+/* Quantized values beyond this do not fit 32 bit words once zigzagged */
+#define MAX_QUANTIZED 1.0e9f
+
+#define MAX_THREADS 64
+
+typedef struct rans_symbol {
+    uint32_t x_max;
+    uint32_t rcp_freq;
+    uint32_t bias;
+    uint32_t cmpl_freq;
+    uint32_t rcp_shift;
+} rans_symbol;
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void rans_symbol_init(rans_symbol *s, uint32_t start, uint32_t freq)
+{
+    s->x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * freq;
+    s->cmpl_freq = RANS_TOTAL - freq;
+    if (freq < 2) {
+        s->rcp_freq = ~0u;
+        s->rcp_shift = 0;
+        s->bias = start + RANS_TOTAL - 1;
+    } else {
+        uint32_t shift = 0;
+        while (freq > (1u << shift)) {
+            shift++;
+        }
+        s->rcp_freq = (uint32_t)((((uint64_t)1 << (shift + 31)) + freq - 1) / freq);
+        s->rcp_shift = shift - 1;
+        s->bias = start;
+    }
+}
+
+/* Scales the counts of n symbols to frequencies summing to RANS_TOTAL, every
+ * symbol that occurs keeps at least 1 */
+static void normalize_frequencies(const uint32_t count[256], size_t n, uint32_t freq[256])
+{
+    uint32_t sum = 0;
+    int s, largest = 0;
+
+    for (s = 0; s < 256; s++) {
+        freq[s] = 0;
+        if (count[s] > 0) {
+            freq[s] = (uint32_t)(((uint64_t)count[s] * RANS_TOTAL) / n);
+            if (freq[s] == 0) {
+                freq[s] = 1;
+            }
+            sum += freq[s];
+            if (count[s] > count[largest]) {
+                largest = s;
+            }
+        }
+    }
+
+    /* The rounding error goes to the most frequent symbol if it can take it */
+    if (sum <= RANS_TOTAL) {
+        freq[largest] += RANS_TOTAL - sum;
+    } else if (freq[largest] > sum - RANS_TOTAL) {
+        freq[largest] -= sum - RANS_TOTAL;
+    } else {
+        while (sum > RANS_TOTAL) {
+            for (s = 0; s < 256 && sum > RANS_TOTAL; s++) {
+                if (freq[s] > 1) {
+                    freq[s]--;
+                    sum--;
+                }
+            }
+        }
+    }
+}
+
+/* Size, in bytes, of an ideal order-0 coding of n symbols with these counts */
+static double entropy_bytes(const uint32_t count[256], size_t n)
+{
+    double bits = 0;
+    int s;
+    for (s = 0; s < 256; s++) {
+        if (count[s] > 0) {
+            bits -= count[s] * log2((double)count[s] / n);
+        }
+    }
+    return bits / 8;
+}
+
+/* Codes the n bytes of a plane into out, which has room for 1 + n bytes,
+ * and returns the size of the coding. scratch holds 2 * n + 16 bytes. */
+static size_t encode_plane(const uint8_t *in, size_t n, uint8_t *out, uint8_t *scratch)
+{
+    uint32_t count[256], freq[256], start = 0;
+    rans_symbol syms[256];
+    uint8_t table[PLANE_TABLE_SIZE];
+    size_t i, table_size, stream_size;
+    uint8_t *end, *ptr;
+    uint32_t x0, x1;
+    int s, used = 0;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+        count[in[i]]++;
+    }
+    for (s = 0; s < 256; s++) {
+        used += count[s] > 0;
+    }
+    if (used == 1) {
+        out[0] = PLANE_CONSTANT;
+        out[1] = in[0];
+        return 2;
+    }
+    /* Noise bytes are not worth coding, nor the table */
+    if (used == 0 || entropy_bytes(count, n) + 33 + used >= (double)n) {
+        out[0] = PLANE_RAW;
+        memcpy(out + 1, in, n);
+        return 1 + n;
+    }
+
+    normalize_frequencies(count, n, freq);
+    table[0] = PLANE_RANS;
+    memset(table + 1, 0, 32);
+    table_size = 33;
+    for (s = 0; s < 256; s++) {
+        if (freq[s] == 0) {
+            continue;
+        }
+        table[1 + s / 8] |= (uint8_t)(1 << (s % 8));
+        if (freq[s] < 128) {
+            table[table_size++] = (uint8_t)freq[s];
+        } else {
+            table[table_size++] = (uint8_t)(0x80 | (freq[s] >> 8));
+            table[table_size++] = (uint8_t)(freq[s] & 0xff);
+        }
+        rans_symbol_init(&syms[s], start, freq[s]);
+        start += freq[s];
+    }
+
+#define RANS_ENCODE(x, symbol) do { \
+        const rans_symbol *sym = &syms[symbol]; \
+        uint32_t q; \
+        while (x >= sym->x_max) { \
+            *--ptr = (uint8_t)(x & 0xff); \
+            x >>= 8; \
+        } \
+        q = (uint32_t)(((uint64_t)x * sym->rcp_freq) >> 32) >> sym->rcp_shift; \
+        x += sym->bias + q * sym->cmpl_freq; \
+    } while (0)
+
+    /* Coded backwards, so that the decoder reads forwards */
+    end = scratch + 2 * n + 16;
+    ptr = end;
+    x0 = x1 = RANS_L;
+    i = n;
+    if (i & 1) {
+        i--;
+        RANS_ENCODE(x0, in[i]);
+    }
+    while (i > 0) {
+        i -= 2;
+        RANS_ENCODE(x1, in[i + 1]);
+        RANS_ENCODE(x0, in[i]);
+    }
+#undef RANS_ENCODE
+    ptr -= 4;
+    put_u32(ptr, x1);
+    ptr -= 4;
+    put_u32(ptr, x0);
+    stream_size = (size_t)(end - ptr);
+
+    if (table_size + stream_size >= 1 + n) {
+        out[0] = PLANE_RAW;
+        memcpy(out + 1, in, n);
+        return 1 + n;
+    }
+    memcpy(out, table, table_size);
+    memcpy(out + table_size, ptr, stream_size);
+    return table_size + stream_size;
+}
+
+/* Decodes a plane of n bytes from the len bytes of its coding */
+static int decode_plane(const uint8_t *in, size_t len, size_t n, uint8_t *out)
+{
+    uint32_t freq[256], start[256], total = 0, x0, x1;
+    uint8_t slot_symbol[RANS_TOTAL];
+    const uint8_t *ptr, *end = in + len;
+    size_t i, pos;
+    int s;
+
+    if (len == 0) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is empty");
+    }
+    if (in[0] == PLANE_RAW) {
+        if (len != 1 + n) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane has the wrong size");
+        }
+        memcpy(out, in + 1, n);
+        return ISMRMRD_NOERROR;
+    }
+    if (in[0] == PLANE_CONSTANT) {
+        if (len != 2) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane has the wrong size");
+        }
+        memset(out, in[1], n);
+        return ISMRMRD_NOERROR;
+    }
+    if (in[0] != PLANE_RANS || len < 33) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is corrupt");
+    }
+
+    pos = 33;
+    for (s = 0; s < 256; s++) {
+        freq[s] = 0;
+        start[s] = total;
+        if ((in[1 + s / 8] & (1 << (s % 8))) == 0) {
+            continue;
+        }
+        if (pos >= len) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is corrupt");
+        }
+        freq[s] = in[pos++];
+        if (freq[s] & 0x80) {
+            if (pos >= len) {
+                return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is corrupt");
+            }
+            freq[s] = ((freq[s] & 0x7f) << 8) | in[pos++];
+        }
+        if (freq[s] == 0 || total + freq[s] > RANS_TOTAL) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is corrupt");
+        }
+        memset(slot_symbol + total, s, freq[s]);
+        total += freq[s];
+    }
+    if (total != RANS_TOTAL || pos + 8 > len) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is corrupt");
+    }
+
+#define RANS_DECODE(x, i) do { \
+        uint32_t slot = x & (RANS_TOTAL - 1); \
+        uint8_t sym = slot_symbol[slot]; \
+        out[i] = sym; \
+        x = freq[sym] * (x >> RANS_SCALE_BITS) + slot - start[sym]; \
+        while (x < RANS_L) { \
+            if (ptr == end) { \
+                return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is truncated"); \
+            } \
+            x = (x << 8) | *ptr++; \
+        } \
+    } while (0)
+
+    x0 = get_u32(in + pos);
+    x1 = get_u32(in + pos + 4);
+    ptr = in + pos + 8;
+    for (i = 0; i + 1 < n; i += 2) {
+        RANS_DECODE(x0, i);
+        RANS_DECODE(x1, i + 1);
+    }
+    if (i < n) {
+        RANS_DECODE(x0, i);
+    }
+#undef RANS_DECODE
+    /* The coder ends where the encoder started */
+    if (x0 != RANS_L || x1 != RANS_L || ptr != end) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed plane is corrupt");
+    }
+    return ISMRMRD_NOERROR;
+}
+
+/* Noise standard deviation of the real and imaginary parts of a readout of
+ * n samples, from its outer eighths */
+static float edge_stddev(const float *x, size_t n)
+{
+    size_t edge = n / 8, i;
+    double sum = 0;
+
+    if (edge == 0) {
+        edge = (n + 1) / 2;
+    }
+    for (i = 0; i < 2 * edge; i++) {
+        sum += (double)x[i] * x[i] + (double)x[2 * n - 1 - i] * x[2 * n - 1 - i];
+    }
+    return edge > 0 ? (float)sqrt(sum / (4.0 * edge)) : 0.0f;
+}
+
+/* Rounds x / step to zigzagged integers, false if one does not fit */
+static bool quantize(const float *x, size_t n, float step, uint32_t *q)
+{
+    float inv = 1.0f / step;
+    int bad = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        float v = x[i] * inv;
+        int32_t k = (int32_t)lrintf(v);
+        bad |= !(fabsf(v) <= MAX_QUANTIZED);
+        q[i] = ((uint32_t)k << 1) ^ (uint32_t)(k >> 31);
+    }
+    return bad == 0;
+}
+
+static void dequantize(const uint32_t *q, size_t n, float step, float *x)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        int32_t k = (int32_t)(q[i] >> 1) ^ -(int32_t)(q[i] & 1);
+        x[i] = (float)k * step;
+    }
+}
+
+/* Quantization step of a channel: tolerance noise standard deviations, or,
+ * in noise free data, the float resolution of its largest value */
+static float channel_step(const ISMRMRD_CompressionParameters *params, uint16_t channel, const float *x, size_t samples)
+{
+    float sigma, step, peak = 0;
+    size_t i;
+
+    if (params->noise_stddev != NULL && channel < params->num_noise_channels) {
+        sigma = params->noise_stddev[channel];
+    } else {
+        sigma = edge_stddev(x, samples);
+    }
+    step = params->tolerance * sigma;
+    if (step > 0 && step <= FLT_MAX) {
+        return step;
+    }
+    for (i = 0; i < 2 * samples; i++) {
+        peak = fabsf(x[i]) > peak ? fabsf(x[i]) : peak;
+    }
+    step = peak * FLT_EPSILON;
+    return step > 0 && step <= FLT_MAX ? step : 1.0f;
+}
+
+int ismrmrd_init_compression_parameters(ISMRMRD_CompressionParameters *params)
+{
+    if (params == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    params->mode = ISMRMRD_COMPRESSION_LOSSLESS;
+    params->threads = 0;
+    params->tolerance = 0.5f;
+    params->num_noise_channels = 0;
+    params->noise_stddev = NULL;
+    return ISMRMRD_NOERROR;
+}
+
+uint64_t ismrmrd_compression_flag(uint16_t mode)
+{
+    if (mode == ISMRMRD_COMPRESSION_LOSSLESS) {
+        return (uint64_t)1 << (ISMRMRD_ACQ_COMPRESSION1 - 1);
+    }
+    if (mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS) {
+        return (uint64_t)1 << (ISMRMRD_ACQ_COMPRESSION2 - 1);
+    }
+    return 0;
+}
+
+bool ismrmrd_is_compressed(const ISMRMRD_AcquisitionHeader *head)
+{
+    return head != NULL && (head->flags & (ismrmrd_compression_flag(ISMRMRD_COMPRESSION_LOSSLESS)
+                                           | ismrmrd_compression_flag(ISMRMRD_COMPRESSION_NEAR_LOSSLESS))) != 0;
+}
+
+size_t ismrmrd_size_of_compressed_data_bound(const ISMRMRD_Acquisition *acq)
+{
+    size_t words;
+    if (acq == NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+        return 0;
+    }
+    words = 2 * (size_t)acq->head.number_of_samples * acq->head.active_channels;
+    return COMPRESSED_HEADER_SIZE + sizeof(float) * acq->head.active_channels + 4 * (sizeof(uint32_t) + 1 + words);
+}
+
+int ismrmrd_compress_acquisition_data(const ISMRMRD_Acquisition *acq,
+        const ISMRMRD_CompressionParameters *params, void *out, size_t *size)
+{
+    size_t samples, words, pos, i;
+    uint16_t channels, c;
+    uint16_t version = COMPRESSION_VERSION, mode, reserved = 0;
+    float tolerance;
+    uint32_t num_words;
+    uint8_t *block = (uint8_t *)out, *scratch, *planes;
+    const uint32_t *values;
+    uint32_t *quantized = NULL;
+    int b;
+
+    if (acq == NULL || params == NULL || out == NULL || size == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    mode = params->mode;
+    if (mode != ISMRMRD_COMPRESSION_LOSSLESS && mode != ISMRMRD_COMPRESSION_NEAR_LOSSLESS) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Unknown compression mode");
+    }
+    if (mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS && !(params->tolerance > 0)) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Near-lossless compression needs a positive tolerance");
+    }
+    tolerance = mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS ? params->tolerance : 0.0f;
+    if (*size < ismrmrd_size_of_compressed_data_bound(acq)) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compression buffer is too small");
+    }
+
+    samples = acq->head.number_of_samples;
+    channels = acq->head.active_channels;
+    words = 2 * samples * channels;
+    num_words = (uint32_t)words;
+
+    /* Four planes, the rANS output and the quantized words */
+    scratch = (uint8_t *)malloc(6 * words + 16 + (mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS ? 4 * words : 0));
+    if (scratch == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression buffer");
+    }
+    planes = scratch + 2 * words + 16;
+
+    memcpy(block, &version, 2);
+    memcpy(block + 2, &mode, 2);
+    memcpy(block + 4, &num_words, 4);
+    memcpy(block + 8, &channels, 2);
+    memcpy(block + 10, &reserved, 2);
+    memcpy(block + 12, &tolerance, 4);
+    pos = COMPRESSED_HEADER_SIZE;
+
+    values = (const uint32_t *)acq->data;
+    if (mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS) {
+        quantized = (uint32_t *)(planes + 4 * words);
+        for (c = 0; c < channels; c++) {
+            const float *x = (const float *)acq->data + 2 * samples * c;
+            float step = channel_step(params, c, x, samples);
+            if (!quantize(x, 2 * samples, step, quantized + 2 * samples * c)) {
+                free(scratch);
+                return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compression tolerance is too small for the data");
+            }
+            memcpy(block + pos, &step, sizeof(step));
+            pos += sizeof(step);
+        }
+        values = quantized;
+    }
+
+    /* Byte shuffle, the bits 8b to 8b + 7 of every word go to plane b */
+    for (i = 0; i < words; i++) {
+        uint32_t v = values[i];
+        planes[i] = (uint8_t)v;
+        planes[words + i] = (uint8_t)(v >> 8);
+        planes[2 * words + i] = (uint8_t)(v >> 16);
+        planes[3 * words + i] = (uint8_t)(v >> 24);
+    }
+    for (b = 0; b < 4; b++) {
+        size_t len = encode_plane(planes + b * words, words, block + pos + 4, scratch);
+        put_u32(block + pos, (uint32_t)len);
+        pos += 4 + len;
+    }
+
+    free(scratch);
+    *size = pos;
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_decompress_acquisition_data(const void *in, size_t size, ISMRMRD_Acquisition *acq)
+{
+    const uint8_t *block = (const uint8_t *)in;
+    uint16_t version, mode, channels, c;
+    uint32_t num_words, *values;
+    size_t samples, words, pos, i;
+    uint8_t *planes;
+    int b, status = ISMRMRD_NOERROR;
+
+    if (in == NULL || acq == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    if (size < COMPRESSED_HEADER_SIZE) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed data is truncated");
+    }
+    memcpy(&version, block, 2);
+    memcpy(&mode, block + 2, 2);
+    memcpy(&num_words, block + 4, 4);
+    memcpy(&channels, block + 8, 2);
+    if (version != COMPRESSION_VERSION
+        || (mode != ISMRMRD_COMPRESSION_LOSSLESS && mode != ISMRMRD_COMPRESSION_NEAR_LOSSLESS)) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Unknown compressed data format");
+    }
+    samples = acq->head.number_of_samples;
+    words = 2 * samples * acq->head.active_channels;
+    if (num_words != words || channels != acq->head.active_channels) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed data does not match the acquisition");
+    }
+    pos = COMPRESSED_HEADER_SIZE;
+    if (mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS) {
+        pos += sizeof(float) * channels;
+    }
+
+    planes = (uint8_t *)malloc(4 * words + 1);
+    if (planes == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression buffer");
+    }
+    for (b = 0; b < 4 && status == ISMRMRD_NOERROR; b++) {
+        uint32_t len;
+        if (pos + 4 > size || (len = get_u32(block + pos)) > size - pos - 4) {
+            status = ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compressed data is truncated");
+            break;
+        }
+        status = decode_plane(block + pos + 4, len, words, planes + b * words);
+        pos += 4 + len;
+    }
+    if (status != ISMRMRD_NOERROR) {
+        free(planes);
+        return status;
+    }
+
+    values = (uint32_t *)acq->data;
+    for (i = 0; i < words; i++) {
+        values[i] = (uint32_t)planes[i] | (uint32_t)planes[words + i] << 8
+                    | (uint32_t)planes[2 * words + i] << 16 | (uint32_t)planes[3 * words + i] << 24;
+    }
+    free(planes);
+
+    if (mode == ISMRMRD_COMPRESSION_NEAR_LOSSLESS) {
+        for (c = 0; c < channels; c++) {
+            float step;
+            memcpy(&step, block + COMPRESSED_HEADER_SIZE + sizeof(float) * c, sizeof(step));
+            dequantize(values + 2 * samples * c, 2 * samples, step, (float *)acq->data + 2 * samples * c);
+        }
+    }
+    return ISMRMRD_NOERROR;
+}
+
+/* A share of a batch, run on its own thread */
+typedef struct compression_job {
+    const ISMRMRD_CompressionParameters *params;
+    const ISMRMRD_Acquisition *acqs;
+    void *const *out;
+    size_t *sizes;
+    const void *const *in;
+    const size_t *in_sizes;
+    ISMRMRD_Acquisition *dest;
+    uint32_t first;
+    uint32_t count;
+    int status;
+} compression_job;
+
+static void run_job(compression_job *job)
+{
+    uint32_t n;
+    for (n = job->first; n < job->first + job->count && job->status == ISMRMRD_NOERROR; n++) {
+        if (job->acqs != NULL) {
+            job->status = ismrmrd_compress_acquisition_data(&job->acqs[n], job->params, job->out[n], &job->sizes[n]);
+        } else {
+            job->status = ismrmrd_decompress_acquisition_data(job->in[n], job->in_sizes[n], &job->dest[n]);
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI job_thread(LPVOID arg)
+{
+    run_job((compression_job *)arg);
+    return 0;
+}
+#else
+static void *job_thread(void *arg)
+{
+    run_job((compression_job *)arg);
+    return NULL;
+}
+#endif
+
+static unsigned cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+#endif
+}
+
+/* Splits the count acquisitions of job over threads threads (0 for one per
+ * CPU), the first share runs on the calling thread */
+static int run_batch(const compression_job *job, uint16_t threads)
+{
+    compression_job jobs[MAX_THREADS];
+#ifdef _WIN32
+    HANDLE handles[MAX_THREADS];
+#else
+    pthread_t handles[MAX_THREADS];
+#endif
+    bool started[MAX_THREADS];
+    unsigned t, num_threads = threads > 0 ? threads : cpu_count();
+    uint32_t first = 0;
+    int status = ISMRMRD_NOERROR;
+
+    if (num_threads > MAX_THREADS) {
+        num_threads = MAX_THREADS;
+    }
+    if (num_threads > job->count) {
+        num_threads = job->count;
+    }
+    for (t = 0; t < num_threads; t++) {
+        jobs[t] = *job;
+        jobs[t].first = first;
+        jobs[t].count = job->count / num_threads + (t < job->count % num_threads ? 1 : 0);
+        jobs[t].status = ISMRMRD_NOERROR;
+        first += jobs[t].count;
+    }
+
+    for (t = 1; t < num_threads; t++) {
+#ifdef _WIN32
+        handles[t] = CreateThread(NULL, 0, job_thread, &jobs[t], 0, NULL);
+        started[t] = handles[t] != NULL;
+#else
+        started[t] = pthread_create(&handles[t], NULL, job_thread, &jobs[t]) == 0;
+#endif
+    }
+    if (num_threads > 0) {
+        run_job(&jobs[0]);
+    }
+    for (t = 1; t < num_threads; t++) {
+        /* A share without a thread runs here */
+        if (!started[t]) {
+            run_job(&jobs[t]);
+            continue;
+        }
+#ifdef _WIN32
+        WaitForSingleObject(handles[t], INFINITE);
+        CloseHandle(handles[t]);
+#else
+        pthread_join(handles[t], NULL);
+#endif
+    }
+
+    /* Errors of the other threads went to their own error stacks */
+    for (t = 0; t < num_threads; t++) {
+        if (jobs[t].status != ISMRMRD_NOERROR) {
+            status = jobs[t].status;
+        }
+    }
+    return status;
+}
+
+int ismrmrd_compress_acquisitions(const ISMRMRD_Acquisition *acqs, uint32_t count,
+        const ISMRMRD_CompressionParameters *params, void *const *out, size_t *sizes)
+{
+    compression_job job;
+
+    if (acqs == NULL || params == NULL || out == NULL || sizes == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    memset(&job, 0, sizeof(job));
+    job.params = params;
+    job.acqs = acqs;
+    job.out = out;
+    job.sizes = sizes;
+    job.count = count;
+    if (run_batch(&job, params->threads) != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Failed to compress acquisitions");
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_decompress_acquisitions(const void *const *in, const size_t *sizes, uint32_t count,
+        ISMRMRD_Acquisition *acqs, uint16_t threads)
+{
+    compression_job job;
+
+    if (in == NULL || sizes == NULL || acqs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    memset(&job, 0, sizeof(job));
+    job.in = in;
+    job.in_sizes = sizes;
+    job.dest = acqs;
+    job.count = count;
+    if (run_batch(&job, threads) != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Failed to decompress acquisitions");
+    }
+    return ISMRMRD_NOERROR;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+} // namespace ISMRMRD
+#endif
@@ -1,3 +1,8 @@
+/* clock_gettime is POSIX, not C99 */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 /* Language and Cross platform section for defining types */
 #ifdef __cplusplus
 #include <cstring>
@@ -10,6 +15,13 @@
 #include <stdio.h>
 #endif /* __cplusplus */
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <pthread.h>
+#endif
+
 #include <hdf5.h>
 #include "ismrmrd/dataset.h"
 
@@ -22,6 +34,63 @@ extern "C" {
 /* Private (Static) Functions */
 /******************************/
 
+/* Instrumentation, see ISMRMRD_DatasetStats.
+ * With statistics off each probe is a single test of dset->stats. */
+static uint64_t stats_clock_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * (1.0e9 / (double)frequency.QuadPart));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#define STATS_START(dset) ((dset)->stats ? stats_clock_ns() : 0)
+#define STATS_STOP(dset, counter, t0) do { \
+        if ((dset)->stats) { \
+            (dset)->stats->counter.count++; \
+            (dset)->stats->counter.ns += stats_clock_ns() - (t0); \
+        } } while (0)
+#define STATS_ADD(dset, field, n) do { \
+        if ((dset)->stats) { \
+            (dset)->stats->field += (n); \
+        } } while (0)
+
+static void print_stats_counter(FILE *f, const char *name, const ISMRMRD_DatasetCounter *c)
+{
+    fprintf(f, "  %-20s %12llu calls %12.3f ms\n", name, (unsigned long long)c->count, c->ns * 1.0e-6);
+}
+
+static void print_stats(const ISMRMRD_Dataset *dset, FILE *f)
+{
+    const ISMRMRD_DatasetStats *st = dset->stats;
+    fprintf(f, "ISMRMRD dataset statistics for %s:/%s\n",
+            dset->filename ? dset->filename : "", dset->groupname ? dset->groupname : "");
+    print_stats_counter(f, "file_opens", &st->file_opens);
+    print_stats_counter(f, "dataset_opens", &st->dataset_opens);
+    print_stats_counter(f, "link_lookups", &st->link_lookups);
+    print_stats_counter(f, "extent_changes", &st->extent_changes);
+    print_stats_counter(f, "type_constructions", &st->type_constructions);
+    print_stats_counter(f, "writes", &st->writes);
+    print_stats_counter(f, "reads", &st->reads);
+    fprintf(f, "  %-20s %12llu\n", "bytes_written", (unsigned long long)st->bytes_written);
+    fprintf(f, "  %-20s %12llu\n", "bytes_read", (unsigned long long)st->bytes_read);
+    fprintf(f, "  %-20s %12llu\n", "vlen_allocations", (unsigned long long)st->vlen_allocations);
+    fprintf(f, "  %-20s %12llu\n", "header_cache_hits", (unsigned long long)st->header_cache_hits);
+    fprintf(f, "  %-20s %12llu\n", "header_cache_misses", (unsigned long long)st->header_cache_misses);
+}
+
+static bool stats_requested_by_environment(void)
+{
+    const char *env = getenv("ISMRMRD_DATASET_STATS");
+    return env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
 static herr_t walk_hdf5_errors(unsigned int n, const H5E_error2_t *desc, void *client_data)
 {
     (void)n;
@@ -30,14 +99,89 @@ static herr_t walk_hdf5_errors(unsigned int n, const H5E_error2_t *desc, void *c
     return 0;
 }
 
+/* Serialization of HDF5 calls, see "Concurrency" in dataset.h.
+ * The public functions take the lock around the HDF5 calls they make, helpers
+ * below never take it and must be called with it held. It is a plain mutex,
+ * so a function holding it must not call another public function. */
+#ifdef _WIN32
+static SRWLOCK hdf5_mutex = SRWLOCK_INIT;
+static INIT_ONCE hdf5_lock_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_mutex_t hdf5_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t hdf5_lock_once = PTHREAD_ONCE_INIT;
+#endif
+static bool hdf5_serialized = true;
+
+static void init_hdf5_lock(void)
+{
+    const char *env = getenv("ISMRMRD_HDF5_LOCK");
+    hbool_t threadsafe = 0;
+
+#if H5_VERS_MAJOR > 1 || (H5_VERS_MAJOR == 1 && (H5_VERS_MINOR > 8 || H5_VERS_RELEASE >= 16))
+    if (H5is_library_threadsafe(&threadsafe) < 0) {
+        threadsafe = 0;
+    }
+#endif
+    /* Opting out is only possible with a thread-safe HDF5 */
+    hdf5_serialized = !(threadsafe && env != NULL && strcmp(env, "0") == 0);
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK init_hdf5_lock_once(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    init_hdf5_lock();
+    return TRUE;
+}
+#endif
+
+static bool hdf5_needs_lock(void)
+{
+#ifdef _WIN32
+    InitOnceExecuteOnce(&hdf5_lock_once, init_hdf5_lock_once, NULL, NULL);
+#else
+    pthread_once(&hdf5_lock_once, init_hdf5_lock);
+#endif
+    return hdf5_serialized;
+}
+
+static void hdf5_lock(void)
+{
+    if (hdf5_needs_lock()) {
+#ifdef _WIN32
+        AcquireSRWLockExclusive(&hdf5_mutex);
+#else
+        pthread_mutex_lock(&hdf5_mutex);
+#endif
+    }
+}
+
+static void hdf5_unlock(void)
+{
+    if (hdf5_serialized) {
+#ifdef _WIN32
+        ReleaseSRWLockExclusive(&hdf5_mutex);
+#else
+        pthread_mutex_unlock(&hdf5_mutex);
+#endif
+    }
+}
+
 static bool link_exists(const ISMRMRD_Dataset *dset, const char *link_path) {
-    htri_t val = H5Lexists(dset->fileid, link_path, H5P_DEFAULT);
+    htri_t val;
+    uint64_t t0;
 
     if (NULL == dset) {
         ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
         return false;
     }
 
+    t0 = STATS_START(dset);
+    val = H5Lexists(dset->fileid, link_path, H5P_DEFAULT);
+    STATS_STOP(dset, link_lookups, t0);
+
     if (val < 0 ) {
         return false;
     }
@@ -519,10 +663,25 @@ static uint16_t get_ndarray_data_type(hid_t hdf5type) {
     return dtype;
 }
 
+/* Transfer properties of the element reads and writes.
+ * With the defaults HDF5 allocates and clears a 1 MiB conversion buffer for
+ * every call that converts variable length data, which costs more than the
+ * I/O of an acquisition and, being above the malloc mmap threshold, faults in
+ * fresh pages each time. Conversions larger than this buffer take several passes. */
+#define TRANSFER_BUFFER_SIZE 65536
+
+static hid_t create_transfer_properties(void)
+{
+    hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_buffer(dxpl, TRANSFER_BUFFER_SIZE, NULL, NULL);
+    return dxpl;
+}
+
 static uint32_t get_number_of_elements(const ISMRMRD_Dataset *dset, const char * path)
 {
     herr_t h5status;
     uint32_t num;
+    uint64_t t0;
 
     if (NULL == dset) {
         ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
@@ -532,7 +691,9 @@ static uint32_t get_number_of_elements(const ISMRMRD_Dataset *dset, const char *
     if (link_exists(dset, path)) {
         hid_t dataset, dataspace;
         hsize_t rank, *dims, *maxdims;
+        t0 = STATS_START(dset);
         dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+        STATS_STOP(dset, dataset_opens, t0);
         dataspace = H5Dget_space(dataset);
         rank = H5Sget_simple_extent_ndims(dataspace);
         dims = (hsize_t *) malloc(rank*sizeof(hsize_t));
@@ -557,14 +718,16 @@ static uint32_t get_number_of_elements(const ISMRMRD_Dataset *dset, const char *
     return num;
 }
 
-static int append_element(const ISMRMRD_Dataset * dset, const char * path,
+/* Appends num elements stored contiguously at elem with a single write */
+static int append_elements(const ISMRMRD_Dataset * dset, const char * path,
         void * elem, const hid_t datatype,
-        const uint16_t ndim, const size_t *dims)
+        const uint16_t ndim, const size_t *dims, const uint32_t num)
 {
-    hid_t dataset, dataspace, props, filespace, memspace;
+    hid_t dataset, dataspace, props, filespace, memspace, dxpl;
     herr_t h5status = 0;
     hsize_t *hdfdims = NULL, *ext_dims = NULL, *offset = NULL, *maxdims = NULL, *chunk_dims = NULL;
     int n = 0, rank = 0;
+    uint64_t t0;
     
     if (NULL == dset) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
@@ -573,7 +736,9 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     /* Check the path and find rank */
     if (link_exists(dset, path)) {
         /* open dataset */
+        t0 = STATS_START(dset);
         dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+        STATS_STOP(dset, dataset_opens, t0);
         /* TODO check that the header dataset's datatype is correct */
         dataspace = H5Dget_space(dataset);
         rank = H5Sget_simple_extent_ndims(dataspace);
@@ -605,19 +770,21 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
                 return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Dimensions are incorrect.");
             }
         }
-        /* extend it by one */
-        hdfdims[0] += 1;
+        /* extend it by num */
+        hdfdims[0] += num;
+        t0 = STATS_START(dset);
         h5status = H5Dset_extent(dataset, hdfdims);
+        STATS_STOP(dset, extent_changes, t0);
         /* Select the last block */
-        ext_dims[0] = 1;
+        ext_dims[0] = num;
         for (n = 0; n < ndim; n++) {
             offset[n + 1] = 0;
             ext_dims[n + 1] = dims[n];
         }
     } else {
-        hdfdims[0] = 1;
+        hdfdims[0] = num;
         maxdims[0] = H5S_UNLIMITED;
-        ext_dims[0] = 1;
+        ext_dims[0] = num;
         chunk_dims[0] = 1;
         for (n = 0; n < ndim; n++) {
             hdfdims[n + 1] = dims[n];
@@ -654,7 +821,7 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     }
 
     /* Select the last block */
-    offset[0] = hdfdims[0]-1;
+    offset[0] = hdfdims[0]-num;
     filespace = H5Dget_space(dataset);
     h5status  = H5Sselect_hyperslab (filespace, H5S_SELECT_SET, offset, NULL, ext_dims, NULL);
     memspace = H5Screate_simple(rank, ext_dims, NULL);
@@ -666,8 +833,12 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     free(chunk_dims);
 
     /* Write it */
-    /* since this is a 1 element array we can just pass the pointer to the header */
-    h5status = H5Dwrite(dataset, datatype, memspace, filespace, H5P_DEFAULT, elem);
+    /* the elements are contiguous in memory, so elem is the whole block */
+    t0 = STATS_START(dset);
+    dxpl = create_transfer_properties();
+    h5status = H5Dwrite(dataset, datatype, memspace, filespace, dxpl, elem);
+    H5Pclose(dxpl);
+    STATS_STOP(dset, writes, t0);
     if (h5status < 0) {
         H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
         return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write dataset");
@@ -698,6 +869,13 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     return ISMRMRD_NOERROR;
 }
 
+static int append_element(const ISMRMRD_Dataset * dset, const char * path,
+        void * elem, const hid_t datatype,
+        const uint16_t ndim, const size_t *dims)
+{
+    return append_elements(dset, path, elem, datatype, ndim, dims, 1);
+}
+
 static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
         uint16_t *ndim, size_t dims[ISMRMRD_NDARRAY_MAXDIM],
         uint16_t *data_type)
@@ -706,6 +884,7 @@ static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
     hsize_t *hdfdims = NULL;
     herr_t h5status = 0;
     int rank, n;
+    uint64_t t0;
 
     if (NULL == dset) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
@@ -717,7 +896,9 @@ static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
     }
 
     /* open dataset */
+    t0 = STATS_START(dset);
     dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+    STATS_STOP(dset, dataset_opens, t0);
 
     /* get the data type */
     hdf5type = H5Dget_type(dataset);
@@ -733,7 +914,9 @@ static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
     h5status = H5Sget_simple_extent_dims(filespace, hdfdims, NULL);
 
     /* set the return values - permute dimensions */
+    t0 = STATS_START(dset);
     *data_type = get_ndarray_data_type(hdf5type);
+    STATS_STOP(dset, type_constructions, t0);
     *ndim = rank;
     for (n=0; n<rank; n++) {
         dims[n] = hdfdims[rank-n-1];
@@ -762,15 +945,17 @@ static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
 
 }
 
-int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
-        const hid_t datatype, const uint32_t index)
+/* Reads the num elements starting at index into elem with a single read */
+static int read_elements(const ISMRMRD_Dataset *dset, const char *path, void *elem,
+        const hid_t datatype, const uint32_t index, const uint32_t num)
 {
-    hid_t dataset, filespace, memspace;
+    hid_t dataset, filespace, memspace, dxpl;
     hsize_t *hdfdims = NULL, *offset = NULL, *count = NULL;
     herr_t h5status = 0;
     int rank = 0;
     int n;
     int ret_code = ISMRMRD_NOERROR;
+    uint64_t t0;
 
 
     if (NULL == dset) {
@@ -783,7 +968,9 @@ int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
     }
 
     /* open dataset */
+    t0 = STATS_START(dset);
     dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+    STATS_STOP(dset, dataset_opens, t0);
 
     /* TODO check that the dataset's datatype is correct */
     filespace = H5Dget_space(dataset);
@@ -796,13 +983,13 @@ int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
 
     h5status = H5Sget_simple_extent_dims(filespace, hdfdims, NULL);
 
-    if (index >= hdfdims[0]) {
+    if (index >= hdfdims[0] || num > hdfdims[0] - index) {
         ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Index out of range.");
         goto cleanup;
     }
 
     offset[0] = index;
-    count[0] = 1;
+    count[0] = num;
     for (n=1; n< rank; n++) {
         offset[n] = 0;
         count[n] = hdfdims[n];
@@ -810,10 +997,14 @@ int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
 
     h5status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
 
-    /* create space for one */
+    /* create space for num */
     memspace = H5Screate_simple(rank, count, NULL);
 
-    h5status = H5Dread(dataset, datatype, memspace, filespace, H5P_DEFAULT, elem);
+    t0 = STATS_START(dset);
+    dxpl = create_transfer_properties();
+    h5status = H5Dread(dataset, datatype, memspace, filespace, dxpl, elem);
+    H5Pclose(dxpl);
+    STATS_STOP(dset, reads, t0);
     if (h5status < 0) {
         H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
         ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to read from dataset.");
@@ -846,6 +1037,12 @@ cleanup:
     return ret_code;
 }
 
+int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
+        const hid_t datatype, const uint32_t index)
+{
+    return read_elements(dset, path, elem, datatype, index, 1);
+}
+
 /********************/
 /* Public functions */
 /********************/
@@ -857,7 +1054,9 @@ int ismrmrd_init_dataset(ISMRMRD_Dataset *dset, const char *filename,
     }
 
     /* Disable HDF5 automatic error printing */
+    hdf5_lock();
     H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+    hdf5_unlock();
 
     dset->filename = (char *) malloc(strlen(filename) + 1);
     if (dset->filename == NULL) {
@@ -872,53 +1071,150 @@ int ismrmrd_init_dataset(ISMRMRD_Dataset *dset, const char *filename,
     strcpy(dset->groupname, groupname);
 
     dset->fileid = 0;
+    dset->stats = NULL;
+    dset->compression = NULL;
+    if (stats_requested_by_environment()) {
+        return ismrmrd_dataset_enable_stats(dset, true);
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_dataset_set_compression(ISMRMRD_Dataset *dset, const ISMRMRD_CompressionParameters *params)
+{
+    ISMRMRD_CompressionParameters *copy;
+    float *noise_stddev = NULL;
+
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
+    }
+    if (params != NULL && params->mode != ISMRMRD_COMPRESSION_NONE
+        && ismrmrd_compression_flag(params->mode) == 0) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Unknown compression mode");
+    }
+
+    if (dset->compression != NULL) {
+        free((void *)dset->compression->noise_stddev);
+        free(dset->compression);
+        dset->compression = NULL;
+    }
+    if (params == NULL || params->mode == ISMRMRD_COMPRESSION_NONE) {
+        return ISMRMRD_NOERROR;
+    }
+
+    copy = (ISMRMRD_CompressionParameters *) malloc(sizeof(*copy));
+    if (copy == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression parameters");
+    }
+    *copy = *params;
+    if (params->noise_stddev != NULL && params->num_noise_channels > 0) {
+        noise_stddev = (float *) malloc(params->num_noise_channels * sizeof(float));
+        if (noise_stddev == NULL) {
+            free(copy);
+            return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression parameters");
+        }
+        memcpy(noise_stddev, params->noise_stddev, params->num_noise_channels * sizeof(float));
+    } else {
+        copy->num_noise_channels = 0;
+    }
+    copy->noise_stddev = noise_stddev;
+    dset->compression = copy;
+    return ISMRMRD_NOERROR;
+}
+
+bool ismrmrd_dataset_serializes_hdf5(void)
+{
+    return hdf5_needs_lock();
+}
+
+int ismrmrd_dataset_enable_stats(ISMRMRD_Dataset *dset, const bool enable)
+{
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
+    }
+
+    if (enable && dset->stats == NULL) {
+        dset->stats = (ISMRMRD_DatasetStats *) calloc(1, sizeof(ISMRMRD_DatasetStats));
+        if (dset->stats == NULL) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc dataset statistics");
+        }
+    }
+    else if (!enable) {
+        free(dset->stats);
+        dset->stats = NULL;
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_dataset_get_stats(const ISMRMRD_Dataset *dset, ISMRMRD_DatasetStats *stats)
+{
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
+    }
+    if (NULL == stats) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL stats parameter");
+    }
+
+    if (dset->stats) {
+        *stats = *dset->stats;
+    }
+    else {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_dataset_reset_stats(ISMRMRD_Dataset *dset)
+{
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
+    }
+
+    if (dset->stats) {
+        memset(dset->stats, 0, sizeof(*dset->stats));
+    }
     return ISMRMRD_NOERROR;
 }
 
 int ismrmrd_open_dataset(ISMRMRD_Dataset *dset, const bool create_if_needed) {
     /* TODO add a mode for clobbering the dataset if it exists. */
     hid_t fileid;
+    uint64_t t0;
 
     if (NULL == dset) {
         ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
         return false;
     }
 
+    hdf5_lock();
+    t0 = STATS_START(dset);
+
     /* Try opening the file */
     /* Note the is_hdf5 function doesn't work well when trying to open multiple files */
     fileid = H5Fopen(dset->filename, H5F_ACC_RDWR, H5P_DEFAULT);
 
-    if (fileid > 0) {
-        dset->fileid = fileid;
-    }
-    else if (create_if_needed == false) {
+    if (fileid <= 0 && create_if_needed == false) {
         /*Try opening the file as read-only*/
         fileid = H5Fopen(dset->filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-        if (fileid > 0) {
-            dset->fileid = fileid;
-        }
-        else{
-            H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
-            /* Some sort of error opening the file - Maybe it doesn't exist? */
-            return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to open file.");
-        }
     }
-    else {
+    else if (fileid <= 0) {
         /* Try creating a new file using the default properties. */
         /* this will be readwrite */
         fileid = H5Fcreate(dset->filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-        if (fileid > 0) {
-            dset->fileid = fileid;
-        }
-        else {
-            /* Error opening the file */
-            H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
-            return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to open file.");
-        }
     }
+
+    if (fileid <= 0) {
+        /* Some sort of error opening the file - Maybe it doesn't exist? */
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        hdf5_unlock();
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to open file.");
+    }
+    dset->fileid = fileid;
+    STATS_STOP(dset, file_opens, t0);
+
     /* Open the existing dataset */
     /* ensure that /groupname exists */
     create_link(dset, dset->groupname);
+    hdf5_unlock();
 
     return ISMRMRD_NOERROR;
 }
@@ -931,6 +1227,16 @@ int ismrmrd_close_dataset(ISMRMRD_Dataset *dset) {
         return false;
     }
 
+    if (dset->stats != NULL) {
+        if (stats_requested_by_environment()) {
+            print_stats(dset, stderr);
+        }
+        free(dset->stats);
+        dset->stats = NULL;
+    }
+
+    ismrmrd_dataset_set_compression(dset, NULL);
+
     if (dset->filename != NULL) {
         free(dset->filename);
         dset->filename = NULL;
@@ -943,10 +1249,14 @@ int ismrmrd_close_dataset(ISMRMRD_Dataset *dset) {
 
     /* Check for a valid fileid before trying to close the file */
     if (dset->fileid > 0) {
+        hdf5_lock();
         h5status = H5Fclose (dset->fileid);
         dset->fileid = 0;
         if (h5status < 0) {
             H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        }
+        hdf5_unlock();
+        if (h5status < 0) {
             return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to close dataset.");
         }
     }
@@ -954,12 +1264,82 @@ int ismrmrd_close_dataset(ISMRMRD_Dataset *dset) {
     return ISMRMRD_NOERROR;
 }
 
-int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
-    hid_t dataset, dataspace, datatype, props;
+/* FNV-1a hash of the XML header. ismrmrd_write_header tags the xml dataset
+ * with it and the binary copy carries the hash of the XML it was made from,
+ * so the two are compared without reading the XML. */
+static uint64_t hash_xml_header(const char *xmlstring) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *xmlstring; xmlstring++) {
+        h = (h ^ (unsigned char)*xmlstring) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Stores hash in the xml_hash attribute of an open dataset */
+static herr_t write_hash_attribute(hid_t dataset, uint64_t hash) {
+    hid_t dataspace, attribute;
+    herr_t h5status;
+
+    if (H5Aexists(dataset, "xml_hash") > 0) {
+        H5Adelete(dataset, "xml_hash");
+    }
+    dataspace = H5Screate(H5S_SCALAR);
+    attribute = H5Acreate2(dataset, "xml_hash", H5T_STD_U64LE, dataspace, H5P_DEFAULT, H5P_DEFAULT);
+    h5status = attribute < 0 ? -1 : H5Awrite(attribute, H5T_NATIVE_UINT64, &hash);
+    if (attribute >= 0) {
+        H5Aclose(attribute);
+    }
+    H5Sclose(dataspace);
+    return h5status;
+}
+
+/* Reads the xml_hash attribute of an open dataset, false if it has none */
+static bool read_hash_attribute(hid_t dataset, uint64_t *hash) {
+    hid_t attribute;
+    herr_t h5status;
+
+    if (H5Aexists(dataset, "xml_hash") <= 0) {
+        return false;
+    }
+    attribute = H5Aopen(dataset, "xml_hash", H5P_DEFAULT);
+    if (attribute < 0) {
+        return false;
+    }
+    h5status = H5Aread(attribute, H5T_NATIVE_UINT64, hash);
+    H5Aclose(attribute);
+    return h5status >= 0;
+}
+
+/* The xml_hash attribute of the XML header, false if there is no header or
+ * it was written without one. Called with the lock held. */
+static bool read_xml_hash(const ISMRMRD_Dataset *dset, uint64_t *hash) {
+    hid_t dataset;
+    char *path;
+    bool found = false;
+    uint64_t t0;
+
+    path = make_path(dset, "xml");
+    if (link_exists(dset, path)) {
+        t0 = STATS_START(dset);
+        dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+        STATS_STOP(dset, dataset_opens, t0);
+        if (dataset >= 0) {
+            found = read_hash_attribute(dataset, hash);
+            H5Dclose(dataset);
+        }
+    }
+    free(path);
+    return found;
+}
+
+/* ismrmrd_write_header, called with the lock held */
+static int write_xml_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
+    hid_t dataset, dataspace, datatype, props, dxpl;
     hsize_t dims[] = {1};
     herr_t h5status;
     void *buff[1];
     char * path;
+    uint64_t t0;
 
     if (dset==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
@@ -974,11 +1354,15 @@ int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
 
     /* Delete the old header if it exists */
     h5status = delete_var(dset, "xml");
+    /* and the binary copy of it, which would no longer match */
+    h5status = delete_var(dset, "xml_bin");
 
     /* Create a new dataset for the xmlstring */
     /* i.e. create the memory type, data space, and data set */
     dataspace = H5Screate_simple(1, dims, NULL);
+    t0 = STATS_START(dset);
     datatype = get_hdf5type_xmlheader();
+    STATS_STOP(dset, type_constructions, t0);
     props = H5Pcreate (H5P_DATASET_CREATE);
     dataset = H5Dcreate2(dset->fileid, path, datatype, dataspace, H5P_DEFAULT, props,  H5P_DEFAULT);
     free(path);
@@ -986,11 +1370,20 @@ int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
     /* Write it out */
     /* We have to wrap the xmlstring in an array */
     buff[0] = (void *) xmlstring;  /* safe to get rid of const the type */
-    h5status = H5Dwrite(dataset, datatype, H5S_ALL, H5S_ALL, H5P_DEFAULT, buff);
+    t0 = STATS_START(dset);
+    dxpl = create_transfer_properties();
+    h5status = H5Dwrite(dataset, datatype, H5S_ALL, H5S_ALL, dxpl, buff);
+    H5Pclose(dxpl);
+    STATS_STOP(dset, writes, t0);
+    STATS_ADD(dset, bytes_written, strlen(xmlstring));
     if (h5status < 0) {
         H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
         return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write xml string to dataset");
     }
+    if (write_hash_attribute(dataset, hash_xml_header(xmlstring)) < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write xml header hash");
+    }
 
     /* Clean up */
     h5status = H5Pclose(props);
@@ -1017,11 +1410,22 @@ int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
     return ISMRMRD_NOERROR;
 }
 
-char * ismrmrd_read_header(const ISMRMRD_Dataset *dset) {
-    hid_t dataset, datatype;
+int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
+    int status;
+
+    hdf5_lock();
+    status = write_xml_header(dset, xmlstring);
+    hdf5_unlock();
+    return status;
+}
+
+/* ismrmrd_read_header, called with the lock held */
+static char * read_xml_header(const ISMRMRD_Dataset *dset) {
+    hid_t dataset, datatype, dxpl;
     herr_t h5status;
     char* xmlstring = NULL;
     char* path = NULL;
+    uint64_t t0;
 
     if (dset==NULL) {
         ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
@@ -1037,10 +1441,22 @@ char * ismrmrd_read_header(const ISMRMRD_Dataset *dset) {
         goto cleanup_path;
     }
 
+    t0 = STATS_START(dset);
     dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+    STATS_STOP(dset, dataset_opens, t0);
+    t0 = STATS_START(dset);
     datatype = get_hdf5type_xmlheader();
+    STATS_STOP(dset, type_constructions, t0);
     /* Read it into a 1D buffer*/
-    h5status = H5Dread(dataset, datatype, H5S_ALL, H5S_ALL, H5P_DEFAULT, &xmlstring);
+    t0 = STATS_START(dset);
+    dxpl = create_transfer_properties();
+    h5status = H5Dread(dataset, datatype, H5S_ALL, H5S_ALL, dxpl, &xmlstring);
+    H5Pclose(dxpl);
+    STATS_STOP(dset, reads, t0);
+    if (xmlstring != NULL) {
+        STATS_ADD(dset, vlen_allocations, 1);
+        STATS_ADD(dset, bytes_read, strlen(xmlstring));
+    }
     if (h5status < 0 || xmlstring == NULL) {
         H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
         ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read header.");
@@ -1071,6 +1487,271 @@ cleanup_path:
     return xmlstring;
 }
 
+char * ismrmrd_read_header(const ISMRMRD_Dataset *dset) {
+    char *xmlstring;
+
+    hdf5_lock();
+    xmlstring = read_xml_header(dset);
+    hdf5_unlock();
+    return xmlstring;
+}
+
+uint64_t ismrmrd_hash_header(const char *xmlstring) {
+    return hash_xml_header(xmlstring);
+}
+
+bool ismrmrd_read_header_hash(const ISMRMRD_Dataset *dset, uint64_t *hash) {
+    bool found;
+
+    if (dset == NULL || hash == NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+        return false;
+    }
+    hdf5_lock();
+    found = read_xml_hash(dset, hash);
+    hdf5_unlock();
+    return found;
+}
+
+/* ismrmrd_write_binary_header, called with the lock held */
+static int write_bin_header(const ISMRMRD_Dataset *dset, const void *data, const size_t length) {
+    hid_t dataset, dataspace, xml_dataset;
+    hsize_t dims[1];
+    herr_t h5status;
+    char * path;
+    char * xmlstring;
+    uint64_t xml_hash;
+    uint64_t t0;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+
+    if (data==NULL && length > 0) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "data should not be NULL.");
+    }
+
+    /* The binary copy is only valid for the XML it was made from. An XML
+     * header written before it was tagged is hashed and tagged now. */
+    if (!read_xml_hash(dset, &xml_hash)) {
+        xmlstring = read_xml_header(dset);
+        if (xmlstring == NULL) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "The XML header has to be written before the binary copy.");
+        }
+        xml_hash = hash_xml_header(xmlstring);
+        free(xmlstring);
+        path = make_path(dset, "xml");
+        xml_dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+        free(path);
+        h5status = xml_dataset < 0 ? -1 : write_hash_attribute(xml_dataset, xml_hash);
+        if (xml_dataset >= 0) {
+            H5Dclose(xml_dataset);
+        }
+        if (h5status < 0) {
+            H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+            return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write xml header hash");
+        }
+    }
+
+    /* The path to the binary header */
+    path = make_path(dset, "xml_bin");
+
+    /* Delete the old one if it exists */
+    h5status = delete_var(dset, "xml_bin");
+
+    /* A plain array of bytes */
+    dims[0] = length;
+    dataspace = H5Screate_simple(1, dims, NULL);
+    dataset = H5Dcreate2(dset->fileid, path, H5T_NATIVE_UINT8, dataspace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    free(path);
+    if (dataset < 0) {
+        H5Sclose(dataspace);
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to create binary header dataset");
+    }
+
+    if (length > 0) {
+        t0 = STATS_START(dset);
+        h5status = H5Dwrite(dataset, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+        STATS_STOP(dset, writes, t0);
+        STATS_ADD(dset, bytes_written, length);
+        if (h5status < 0) {
+            H5Dclose(dataset);
+            H5Sclose(dataspace);
+            H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+            return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write binary header to dataset");
+        }
+    }
+
+    /* Tag it with the hash of the XML */
+    if (write_hash_attribute(dataset, xml_hash) < 0) {
+        H5Dclose(dataset);
+        H5Sclose(dataspace);
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write binary header XML hash");
+    }
+
+    /* Clean up */
+    h5status = H5Sclose(dataspace);
+    if (h5status < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to close dataspace.");
+    }
+    h5status = H5Dclose(dataset);
+    if (h5status < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to close dataset.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_write_binary_header(const ISMRMRD_Dataset *dset, const void *data, const size_t length) {
+    int status;
+
+    hdf5_lock();
+    status = write_bin_header(dset, data, length);
+    hdf5_unlock();
+    return status;
+}
+
+/* Whether the binary header dataset was written for the XML header in the
+ * file now: both carry the same hash. Called with the lock held. */
+static bool binary_header_matches_xml(const ISMRMRD_Dataset *dset, hid_t dataset) {
+    uint64_t stored, xml_hash;
+
+    return read_hash_attribute(dataset, &stored) && read_xml_hash(dset, &xml_hash) && stored == xml_hash;
+}
+
+/* ismrmrd_read_binary_header, called with the lock held */
+static void * read_bin_header(const ISMRMRD_Dataset *dset, size_t *length) {
+    hid_t dataset, dataspace;
+    hssize_t npoints;
+    herr_t h5status;
+    char *path = NULL;
+    void *data = NULL;
+    uint64_t t0;
+
+    if (dset==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+        return NULL;
+    }
+    if (length==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "length should not be NULL.");
+        return NULL;
+    }
+    *length = 0;
+
+    /* The path to the binary header */
+    path = make_path(dset, "xml_bin");
+
+    if (!link_exists(dset, path)) {
+        /* Not an error, the binary header is optional */
+        free(path);
+        return NULL;
+    }
+
+    t0 = STATS_START(dset);
+    dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+    STATS_STOP(dset, dataset_opens, t0);
+    free(path);
+    if (dataset < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to open binary header.");
+        return NULL;
+    }
+
+    /* Other writers may have replaced the XML and left the binary copy */
+    if (!binary_header_matches_xml(dset, dataset)) {
+        H5Dclose(dataset);
+        return NULL;
+    }
+
+    dataspace = H5Dget_space(dataset);
+    npoints = H5Sget_simple_extent_npoints(dataspace);
+    H5Sclose(dataspace);
+
+    /* one extra byte so an empty header still returns a valid pointer */
+    data = malloc(npoints > 0 ? (size_t)npoints : 1);
+    if (data == NULL) {
+        H5Dclose(dataset);
+        ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc binary header.");
+        return NULL;
+    }
+
+    if (npoints > 0) {
+        t0 = STATS_START(dset);
+        h5status = H5Dread(dataset, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+        STATS_STOP(dset, reads, t0);
+        if (h5status < 0) {
+            free(data);
+            H5Dclose(dataset);
+            H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+            ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read binary header.");
+            return NULL;
+        }
+        STATS_ADD(dset, bytes_read, (uint64_t)npoints);
+    }
+
+    h5status = H5Dclose(dataset);
+    if (h5status < 0) {
+        free(data);
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to close binary header HDF5 dataset.");
+        return NULL;
+    }
+
+    *length = (size_t)npoints;
+    return data;
+}
+
+void * ismrmrd_read_binary_header(const ISMRMRD_Dataset *dset, size_t *length) {
+    void *data;
+
+    hdf5_lock();
+    data = read_bin_header(dset, length);
+    hdf5_unlock();
+    return data;
+}
+
+/* The variable holding the acquisitions of the group, allocated with malloc.
+ * Compressed data goes to data_compressed rather than data: readers that
+ * predate compression copy number_of_samples * active_channels samples out
+ * of every record of data. A group holds one or the other, so once
+ * compression is on all acquisitions go to data_compressed, and it cannot be
+ * turned on for a group that already has data. compressed, if not NULL, is
+ * set when the path is data_compressed: only records read from there are
+ * decompressed, older files may set the compression flags on plain data.
+ * Called with the lock held. */
+static char * acquisition_path(const ISMRMRD_Dataset *dset, bool append, bool *compressed) {
+    char *path, *plain;
+    bool plain_exists;
+
+    if (compressed != NULL) {
+        *compressed = true;
+    }
+    path = make_path(dset, "data_compressed");
+    if (link_exists(dset, path)) {
+        return path;
+    }
+    if (append && dset->compression != NULL) {
+        plain = make_path(dset, "data");
+        plain_exists = link_exists(dset, plain);
+        free(plain);
+        if (!plain_exists) {
+            return path;
+        }
+        free(path);
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Compression has to be set before the first acquisition of the group is appended.");
+        return NULL;
+    }
+    free(path);
+    if (compressed != NULL) {
+        *compressed = false;
+    }
+    return make_path(dset, "data");
+}
+
 uint32_t ismrmrd_get_number_of_acquisitions(const ISMRMRD_Dataset *dset) {
     char *path;
     uint32_t numacq;
@@ -1079,100 +1760,345 @@ uint32_t ismrmrd_get_number_of_acquisitions(const ISMRMRD_Dataset *dset) {
         ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
         return 0;
     }
+    hdf5_lock();
     /* The path to the acqusition data */    
-    path = make_path(dset, "data");
+    path = acquisition_path(dset, false, NULL);
     numacq = get_number_of_elements(dset, path);
+    hdf5_unlock();
     free(path);
     return numacq;
 }
 
+/* Points the data of hdf5acqs at compressed copies of the data of acqs, all
+ * in one buffer returned in blocks, and flags their headers */
+static int compress_acquisitions(const ISMRMRD_CompressionParameters *params, const ISMRMRD_Acquisition *acqs,
+        uint32_t count, HDF5_Acquisition *hdf5acqs, uint8_t **blocks)
+{
+    size_t *sizes, total = 0;
+    void **out;
+    uint8_t *buffer;
+    uint32_t n;
+    int status;
+
+    sizes = (size_t *) malloc(count * (sizeof(size_t) + sizeof(void *)));
+    if (sizes == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression buffers.");
+    }
+    out = (void **) (sizes + count);
+    for (n = 0; n < count; n++) {
+        /* Every block starts at a float */
+        sizes[n] = (ismrmrd_size_of_compressed_data_bound(&acqs[n]) + 3) & ~(size_t)3;
+        total += sizes[n];
+    }
+    buffer = (uint8_t *) malloc(total);
+    if (buffer == NULL) {
+        free(sizes);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression buffers.");
+    }
+    for (n = 0, total = 0; n < count; n++) {
+        out[n] = buffer + total;
+        total += sizes[n];
+    }
+
+    status = ismrmrd_compress_acquisitions(acqs, count, params, out, sizes);
+    if (status == ISMRMRD_NOERROR) {
+        for (n = 0; n < count; n++) {
+            /* The data is stored as floats, the block is padded with zeros */
+            memset((uint8_t *) out[n] + sizes[n], 0, (4 - sizes[n] % 4) % 4);
+            hdf5acqs[n].head.flags |= ismrmrd_compression_flag(params->mode);
+            hdf5acqs[n].data.len = (sizes[n] + 3) / 4;
+            hdf5acqs[n].data.p = out[n];
+        }
+        *blocks = buffer;
+    } else {
+        free(buffer);
+    }
+    free(sizes);
+    return status;
+}
+
+/* Decompresses the count data blocks of hdf5acqs into acqs, which have the
+ * sizes of their headers */
+static int decompress_acquisitions(const ISMRMRD_Dataset *dset, const HDF5_Acquisition *hdf5acqs,
+        uint32_t count, ISMRMRD_Acquisition *acqs)
+{
+    const void **in;
+    size_t *sizes;
+    uint32_t n;
+    int status;
+
+    sizes = (size_t *) malloc(count * (sizeof(size_t) + sizeof(void *)));
+    if (sizes == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc compression buffers.");
+    }
+    in = (const void **) (sizes + count);
+    for (n = 0; n < count; n++) {
+        in[n] = hdf5acqs[n].data.p;
+        sizes[n] = hdf5acqs[n].data.p != NULL ? 4 * hdf5acqs[n].data.len : 0;
+    }
+    status = ismrmrd_decompress_acquisitions(in, sizes, count, acqs,
+                                             dset->compression != NULL ? dset->compression->threads : 0);
+    free(sizes);
+    return status;
+}
+
 int ismrmrd_append_acquisition(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acq) {
+    return ismrmrd_append_acquisitions(dset, acq, 1);
+}
+
+int ismrmrd_append_acquisitions(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acqs, uint32_t count) {
     int status;
+    herr_t h5status;
     char *path;
     hid_t datatype;
-    HDF5_Acquisition hdf5acq[1];
+    HDF5_Acquisition one[1], *hdf5acqs;
+    uint8_t *blocks = NULL;
+    uint32_t n;
+    size_t bytes = 0;
+    uint64_t t0;
 
     if (dset==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
     }
-    if (acq==NULL) {
+    if (acqs==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Acquisition pointer should not be NULL.");
     }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+
+    /* Create the HDF5 version of the acquisitions, pointing at their buffers */
+    hdf5acqs = count == 1 ? one : (HDF5_Acquisition *)malloc(count * sizeof(*hdf5acqs));
+    if (hdf5acqs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc acquisitions.");
+    }
+    for (n = 0; n < count; n++) {
+        const ISMRMRD_Acquisition *acq = &acqs[n];
+        hdf5acqs[n].head = acq->head;
+        hdf5acqs[n].traj.len = acq->head.number_of_samples * acq->head.trajectory_dimensions;
+        hdf5acqs[n].traj.p = acq->traj;
+        hdf5acqs[n].data.len = 2 * acq->head.number_of_samples * acq->head.active_channels;
+        hdf5acqs[n].data.p = acq->data;
+    }
+
+    /* Compressed, outside the lock */
+    if (dset->compression != NULL) {
+        status = compress_acquisitions(dset->compression, acqs, count, hdf5acqs, &blocks);
+        if (status != ISMRMRD_NOERROR) {
+            if (hdf5acqs != one) {
+                free(hdf5acqs);
+            }
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Failed to compress acquisitions.");
+        }
+    }
+    for (n = 0; n < count; n++) {
+        bytes += sizeof(hdf5acqs[n].head) + ismrmrd_size_of_acquisition_traj(&acqs[n])
+                 + hdf5acqs[n].data.len * sizeof(float);
+    }
+
+    hdf5_lock();
 
     /* The path to the acqusition data */    
-    path = make_path(dset, "data");
+    path = acquisition_path(dset, true, NULL);
+    if (path == NULL) {
+        hdf5_unlock();
+        free(blocks);
+        if (hdf5acqs != one) {
+            free(hdf5acqs);
+        }
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Failed to append acquisition.");
+    }
 
     /* The acquisition datatype */
+    t0 = STATS_START(dset);
     datatype = get_hdf5type_acquisition();
+    STATS_STOP(dset, type_constructions, t0);
 
-    /* Create the HDF5 version of the acquisition */
-    hdf5acq[0].head = acq->head;
-    hdf5acq[0].traj.len = acq->head.number_of_samples * acq->head.trajectory_dimensions;
-    hdf5acq[0].traj.p = acq->traj;
-    hdf5acq[0].data.len = 2 * acq->head.number_of_samples * acq->head.active_channels;
-    hdf5acq[0].data.p = acq->data;
+    /* Write them */
+    status = append_elements(dset, path, hdf5acqs, datatype, 0, NULL, count);
 
-    /* Write it */
-    status = append_element(dset, path, hdf5acq, datatype, 0, NULL);
-    if (status != ISMRMRD_NOERROR) {
-        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append acquisition.");
+    /* Clean up */
+    h5status = H5Tclose(datatype);
+    if (h5status < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
     }
-
+    hdf5_unlock();
     free(path);
+    free(blocks);
+    if (hdf5acqs != one) {
+        free(hdf5acqs);
+    }
 
-    /* Clean up */
-    status = H5Tclose(datatype);
-    if (status < 0) {
-        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append acquisition.");
+    }
+    if (h5status < 0) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
     }
+    STATS_ADD(dset, bytes_written, bytes);
 
     return ISMRMRD_NOERROR;
 }
 
 int ismrmrd_read_acquisition(const ISMRMRD_Dataset *dset, uint32_t index, ISMRMRD_Acquisition *acq)
 {
+    return ismrmrd_read_acquisitions(dset, index, 1, acq);
+}
+
+int ismrmrd_read_acquisitions(const ISMRMRD_Dataset *dset, uint32_t index, uint32_t count, ISMRMRD_Acquisition *acqs)
+{
+    int status;
     hid_t datatype;
-    herr_t status;
-    HDF5_Acquisition hdf5acq;
+    herr_t h5status;
+    HDF5_Acquisition one[1], *hdf5acqs;
     char *path;
+    bool from_compressed;
+    uint32_t n, compressed;
+    uint64_t t0;
 
     if (dset==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
     }
-    if (acq==NULL) {
+    if (acqs==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Acquisition pointer should not be NULL.");
     }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+
+    hdf5acqs = count == 1 ? one : (HDF5_Acquisition *)malloc(count * sizeof(*hdf5acqs));
+    if (hdf5acqs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc acquisitions.");
+    }
+
+    hdf5_lock();
 
     /* The path to the acquisition data */
-    path = make_path(dset, "data");
+    path = acquisition_path(dset, false, &from_compressed);
 
     /* The acquisition datatype */
+    t0 = STATS_START(dset);
     datatype = get_hdf5type_acquisition();
+    STATS_STOP(dset, type_constructions, t0);
 
-    status = read_element(dset, path, &hdf5acq, datatype, index);
-    memcpy(&acq->head, &hdf5acq.head, sizeof(ISMRMRD_AcquisitionHeader));
-    ismrmrd_make_consistent_acquisition(acq);
-    memcpy(acq->traj, hdf5acq.traj.p, ismrmrd_size_of_acquisition_traj(acq));
-    memcpy(acq->data, hdf5acq.data.p, ismrmrd_size_of_acquisition_data(acq));
+    status = read_elements(dset, path, hdf5acqs, datatype, index, count);
 
-    /* clean up */
+    h5status = H5Tclose(datatype);
+    if (h5status < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+    }
+    hdf5_unlock();
     free(path);
-    free(hdf5acq.traj.p);
-    free(hdf5acq.data.p);
 
-    status = H5Tclose(datatype);
-    if (status < 0) {
-        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+    if (status != ISMRMRD_NOERROR) {
+        if (hdf5acqs != one) {
+            free(hdf5acqs);
+        }
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read acquisition.");
+    }
+
+    /* The variable length buffers are plain malloc'ed memory, unpack them
+     * without holding the lock */
+    compressed = 0;
+    for (n = 0; n < count; n++) {
+        ISMRMRD_Acquisition *acq = &acqs[n];
+        memcpy(&acq->head, &hdf5acqs[n].head, sizeof(ISMRMRD_AcquisitionHeader));
+        if (from_compressed && ismrmrd_is_compressed(&acq->head)) {
+            acq->head.flags &= ~(ismrmrd_compression_flag(ISMRMRD_COMPRESSION_LOSSLESS)
+                                 | ismrmrd_compression_flag(ISMRMRD_COMPRESSION_NEAR_LOSSLESS));
+            compressed++;
+        }
+        if (ismrmrd_make_consistent_acquisition(acq) == ISMRMRD_NOERROR) {
+            memcpy(acq->traj, hdf5acqs[n].traj.p, ismrmrd_size_of_acquisition_traj(acq));
+            if (!from_compressed || !ismrmrd_is_compressed(&hdf5acqs[n].head)) {
+                memcpy(acq->data, hdf5acqs[n].data.p, ismrmrd_size_of_acquisition_data(acq));
+            }
+        } else {
+            status = ISMRMRD_MEMORYERROR;
+        }
+        STATS_ADD(dset, vlen_allocations, (hdf5acqs[n].traj.p != NULL) + (hdf5acqs[n].data.p != NULL));
+        STATS_ADD(dset, bytes_read, sizeof(acq->head) + ismrmrd_size_of_acquisition_traj(acq)
+                  + hdf5acqs[n].data.len * sizeof(float));
+    }
+
+    /* A batch of compressed acquisitions is decompressed in parallel */
+    if (status == ISMRMRD_NOERROR && compressed == count) {
+        status = decompress_acquisitions(dset, hdf5acqs, count, acqs);
+    } else if (status == ISMRMRD_NOERROR && compressed > 0) {
+        for (n = 0; n < count && status == ISMRMRD_NOERROR; n++) {
+            if (ismrmrd_is_compressed(&hdf5acqs[n].head)) {
+                status = decompress_acquisitions(dset, &hdf5acqs[n], 1, &acqs[n]);
+            }
+        }
+    }
+
+    /* clean up */
+    for (n = 0; n < count; n++) {
+        free(hdf5acqs[n].traj.p);
+        free(hdf5acqs[n].data.p);
+    }
+    if (hdf5acqs != one) {
+        free(hdf5acqs);
+    }
+
+    if (status == ISMRMRD_MEMORYERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate acquisition.");
+    }
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Failed to decompress acquisition.");
+    }
+    if (h5status < 0) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
     }
 
     return ISMRMRD_NOERROR;
 }
 
-int ismrmrd_append_image(const ISMRMRD_Dataset *dset, const char *varname, const ISMRMRD_Image *im) {
+/* Appends one element to the variable at path, under the lock */
+static int append_locked(const ISMRMRD_Dataset *dset, const char *path, void *elem,
+        hid_t (*make_type)(void), const uint16_t data_type,
+        const uint16_t ndim, const size_t *dims)
+{
+    int status;
+    hid_t datatype;
+    uint64_t t0;
+
+    hdf5_lock();
+    t0 = STATS_START(dset);
+    datatype = make_type ? make_type() : get_hdf5type_ndarray(data_type);
+    STATS_STOP(dset, type_constructions, t0);
+    status = append_element(dset, path, elem, datatype, ndim, dims);
+    if (H5Tclose(datatype) < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        status = ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
+    }
+    hdf5_unlock();
+    return status;
+}
+
+/* Reads one element of the variable at path, under the lock */
+static int read_locked(const ISMRMRD_Dataset *dset, const char *path, void *elem,
+        hid_t (*make_type)(void), const uint16_t data_type, const uint32_t index)
+{
     int status;
     hid_t datatype;
+    uint64_t t0;
+
+    hdf5_lock();
+    t0 = STATS_START(dset);
+    datatype = make_type ? make_type() : get_hdf5type_ndarray(data_type);
+    STATS_STOP(dset, type_constructions, t0);
+    status = read_element(dset, path, elem, datatype, index);
+    if (H5Tclose(datatype) < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        status = ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
+    }
+    hdf5_unlock();
+    return status;
+}
+
+int ismrmrd_append_image(const ISMRMRD_Dataset *dset, const char *varname, const ISMRMRD_Image *im) {
+    int status;
     char *path, *headerpath, *attrpath, *datapath;
     size_t dims[4];
 
@@ -1190,49 +2116,44 @@ int ismrmrd_append_image(const ISMRMRD_Dataset *dset, const char *varname, const
     /* /groupname/varname */
     path = make_path(dset, varname);
     /* Make sure the path exists */
+    hdf5_lock();
     create_link(dset, path);        
+    hdf5_unlock();
 
     /* Handle the header */
     headerpath = append_to_path(dset, path, "header");
-    datatype = get_hdf5type_imageheader();
-    status = append_element(dset, headerpath, (void *) &im->head, datatype, 0, NULL);
+    status = append_locked(dset, headerpath, (void *) &im->head, get_hdf5type_imageheader, 0, 0, NULL);
+    free(headerpath);
     if (status != ISMRMRD_NOERROR) {
+        free(path);
         return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append image header.");
     }
-    status = H5Tclose(datatype);
-    free(headerpath);
 
     /* Handle the attribute string */
     attrpath = append_to_path(dset, path, "attributes");
-    datatype = get_hdf5type_image_attribute_string();
-    status = append_element(dset, attrpath, (void *) &im->attribute_string, datatype, 0, NULL);
+    status = append_locked(dset, attrpath, (void *) &im->attribute_string,
+            get_hdf5type_image_attribute_string, 0, 0, NULL);
+    free(attrpath);
     if (status != ISMRMRD_NOERROR) {
+        free(path);
         return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append image attribute string.");
     }
-    status = H5Tclose(datatype);
-    free(attrpath);
 
     /* Handle the data */
     datapath = append_to_path(dset, path, "data");
-    datatype = get_hdf5type_ndarray(im->head.data_type);
     /* permute the dimensions in the hdf5 file */
     dims[3] = im->head.matrix_size[0];
     dims[2] = im->head.matrix_size[1];
     dims[1] = im->head.matrix_size[2];
     dims[0] = im->head.channels;
-    status = append_element(dset, datapath, im->data, datatype, 4, dims);
+    status = append_locked(dset, datapath, im->data, NULL, im->head.data_type, 4, dims);
+    free(datapath);
+    free(path);
     if (status != ISMRMRD_NOERROR) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append image data.");
     }
-    status = H5Tclose(datatype);
-    free(datapath);
-
-    /* Final cleanup */
-    if (status < 0) {
-        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
-        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
-    }
-    free(path);
+    STATS_ADD(dset, bytes_written, sizeof(im->head) + ismrmrd_size_of_image_attribute_string(im)
+              + ismrmrd_size_of_image_data(im));
 
     return ISMRMRD_NOERROR;
 }
@@ -1255,7 +2176,9 @@ uint32_t ismrmrd_get_number_of_images(const ISMRMRD_Dataset *dset, const char *v
     path = make_path(dset, varname);
     /* The path to the acqusition image headers */
     headerpath = append_to_path(dset, path, "header");
+    hdf5_lock();
     numimages = get_number_of_elements(dset, headerpath);
+    hdf5_unlock();
     free(headerpath);
     free(path);
     return numimages;
@@ -1266,7 +2189,6 @@ int ismrmrd_read_image(const ISMRMRD_Dataset *dset, const char *varname,
         const uint32_t index, ISMRMRD_Image *im) {
 
     int status;
-    hid_t datatype;
     char *path, *headerpath, *attrpath, *datapath, *attr_string;
     uint32_t numims;
 
@@ -1292,54 +2214,46 @@ int ismrmrd_read_image(const ISMRMRD_Dataset *dset, const char *varname,
 
     /* Handle the header */
     headerpath = append_to_path(dset, path, "header");
-    datatype = get_hdf5type_imageheader();
-    status = read_element(dset, headerpath, (void *) &im->head, datatype, index);
+    status = read_locked(dset, headerpath, (void *) &im->head, get_hdf5type_imageheader, 0, index);
+    free(headerpath);
     if (status != ISMRMRD_NOERROR) {
+        free(path);
         return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image header.");
     }
-    free(headerpath);
-    H5Tclose(datatype);
 
     /* Allocate the memory for the attribute string and the data */
     ismrmrd_make_consistent_image(im);
 
     /* Handle the attribute string */
     attrpath = append_to_path(dset, path, "attributes");
-    datatype = get_hdf5type_image_attribute_string();
-    status = read_element(dset, attrpath, (void *) &attr_string, datatype, index);
+    status = read_locked(dset, attrpath, (void *) &attr_string, get_hdf5type_image_attribute_string, 0, index);
+    free(attrpath);
     if (status != ISMRMRD_NOERROR) {
+        free(path);
         return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image attribute string.");
     }
-    free(attrpath);
-    H5Tclose(datatype);
 
     /* copy the attribute string read from the file into the Image */
     memcpy(im->attribute_string, attr_string, ismrmrd_size_of_image_attribute_string(im));
     free(attr_string);
+    STATS_ADD(dset, vlen_allocations, 1);
 
     /* Handle the data */
     datapath = append_to_path(dset, path, "data");
-    datatype = get_hdf5type_ndarray(im->head.data_type);
-    status = read_element(dset, datapath, im->data, datatype, index);
+    status = read_locked(dset, datapath, im->data, NULL, im->head.data_type, index);
+    free(datapath);
+    free(path);
     if (status != ISMRMRD_NOERROR) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image data.");
     }
-    free(datapath);
-
-    /* Final cleanup */
-    status = H5Tclose(datatype);
-    if (status < 0) {
-        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
-        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
-    }
-    free(path);
+    STATS_ADD(dset, bytes_read, sizeof(im->head) + ismrmrd_size_of_image_attribute_string(im)
+              + ismrmrd_size_of_image_data(im));
 
     return ISMRMRD_NOERROR;
 }
 
 int ismrmrd_append_array(const ISMRMRD_Dataset *dset, const char *varname, const ISMRMRD_NDArray *arr) {
     int status;
-    hid_t datatype;
     uint16_t ndim;
     size_t *dims;
     int n;
@@ -1360,27 +2274,21 @@ int ismrmrd_append_array(const ISMRMRD_Dataset *dset, const char *varname, const
     path = make_path(dset, varname);
 
     /* Handle the data */
-    datatype = get_hdf5type_ndarray(arr->data_type);
     ndim = arr->ndim;
     dims = (size_t *) malloc(ndim*sizeof(size_t));
     /* permute the dimensions in the hdf5 file */
     for (n=0; n<ndim; n++) {
         dims[ndim-n-1] = arr->dims[n];
     }
-    status = append_element(dset, path, arr->data, datatype, ndim, dims);
-    if (status != ISMRMRD_NOERROR) {
-        free(dims);
-        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append array.");
-    }
+    status = append_locked(dset, path, arr->data, NULL, arr->data_type, ndim, dims);
 
     /* Final cleanup */
     free(dims);
-    status = H5Tclose(datatype);
-    if (status < 0) {
-        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
-        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
-    }
     free(path);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append array.");
+    }
+    STATS_ADD(dset, bytes_written, ismrmrd_size_of_ndarray_data(arr));
 
     return ISMRMRD_NOERROR;
 }
@@ -1401,7 +2309,9 @@ uint32_t ismrmrd_get_number_of_arrays(const ISMRMRD_Dataset *dset, const char *v
     /* The group for this set */
     /* /groupname/varname */
     path = make_path(dset, varname);
+    hdf5_lock();
     numarrays = get_number_of_elements(dset, path);
+    hdf5_unlock();
     free(path);
     return numarrays;
 }
@@ -1409,7 +2319,6 @@ uint32_t ismrmrd_get_number_of_arrays(const ISMRMRD_Dataset *dset, const char *v
 int ismrmrd_read_array(const ISMRMRD_Dataset *dset, const char *varname,
         const uint32_t index, ISMRMRD_NDArray *arr) {    
     int status;
-    hid_t datatype;
     char *path;
 
     if (dset==NULL) {
@@ -1427,25 +2336,24 @@ int ismrmrd_read_array(const ISMRMRD_Dataset *dset, const char *varname,
     path = make_path(dset, varname);
 
     /* get the array properties */
-    get_array_properties(dset, path, &arr->ndim, arr->dims, &arr->data_type);
-    datatype = get_hdf5type_ndarray(arr->data_type);
+    hdf5_lock();
+    status = get_array_properties(dset, path, &arr->ndim, arr->dims, &arr->data_type);
+    hdf5_unlock();
+    if (status != ISMRMRD_NOERROR) {
+        free(path);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read array properties.");
+    }
 
     /* allocate the memory */
     ismrmrd_make_consistent_ndarray(arr);
 
     /* read the data */
-    status = read_element(dset, path, arr->data, datatype, index);
+    status = read_locked(dset, path, arr->data, NULL, arr->data_type, index);
+    free(path);
     if (status != ISMRMRD_NOERROR) {
-        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append array.");
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read array.");
     }
-
-    /* Final cleanup */
-    status = H5Tclose(datatype);
-    if (status < 0) {
-        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
-        return ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close datatype.");
-    }
-    free(path);
+    STATS_ADD(dset, bytes_read, ismrmrd_size_of_ndarray_data(arr));
 
     return ISMRMRD_NOERROR;
 }
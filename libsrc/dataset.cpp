@@ -4,6 +4,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdexcept>
+#ifdef ISMRMRD_HEADER_CACHE
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "xml_fields.h"
+#endif
 
 namespace ISMRMRD {
 //
@@ -54,6 +60,340 @@ void Dataset::readHeader(std::string& xmlstring){
     }
 }
 
+void Dataset::writeHeader(const IsmrmrdHeader& h, bool binary)
+{
+    std::string s;
+    serialize(h, s);
+    writeHeader(s);
+    if (binary) {
+        serialize_binary(h, s);
+        int status = ismrmrd_write_binary_header(&dset_, s.data(), s.size());
+        if (status != ISMRMRD_NOERROR) {
+            throw std::runtime_error(build_exception_string());
+        }
+    }
+}
+
+// Decodes the binary copy of the header into h, false if there is no usable one
+static bool read_binary_header(ISMRMRD_Dataset& dset, IsmrmrdHeader& h)
+{
+    size_t length;
+    char * temp = static_cast<char*>(ismrmrd_read_binary_header(&dset, &length));
+    if (NULL == temp) {
+        return false;
+    }
+    try {
+        deserialize_binary(temp, length, h);
+        free(temp);
+        return true;
+    } catch (std::runtime_error&) {
+        // Written for another version of the header fields; fall back to the XML
+        free(temp);
+        return false;
+    }
+}
+
+void Dataset::readHeader(IsmrmrdHeader& h)
+{
+    if (read_binary_header(dset_, h)) {
+        return;
+    }
+
+    std::string xml;
+    readHeader(xml);
+    deserialize(xml.data(), xml.size(), h);
+}
+
+#ifdef ISMRMRD_HEADER_CACHE
+namespace {
+
+// Hash of an encoded header, eight bytes at a time
+uint64_t hash_header(const std::string& xml)
+{
+    const char* p = xml.data();
+    size_t n = xml.size();
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, p, n);
+    h = (h ^ w) * 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 29);
+}
+
+// Heap memory of a decoded header, a visitor over the field tables; the
+// members stored inline are in sizeof(IsmrmrdHeader)
+class HeaderFootprint {
+public:
+    HeaderFootprint() : bytes(sizeof(IsmrmrdHeader)) { }
+
+    void begin() { }
+    void end() { }
+
+    void operator()(const char*, unsigned short&) { }
+    void operator()(const char*, long&) { }
+    void operator()(const char*, float&) { }
+    void operator()(const char*, double&) { }
+
+    void operator()(const char*, std::string& v)
+    {
+        bytes += v.capacity();
+    }
+
+    template <class T> void operator()(const char* name, std::vector<T>& v)
+    {
+        bytes += v.capacity() * sizeof(T);
+        for (size_t i = 0; i < v.size(); i++) {
+            (*this)(name, v[i]);
+        }
+    }
+
+    template <class T> void operator()(const char* name, Optional<T>& v)
+    {
+        if (v) {
+            (*this)(name, v.get());
+        }
+    }
+
+    template <class T> void operator()(const char*, T& v)
+    {
+        fields(*this, v);
+    }
+
+    template <class T> void section(unsigned int, const char* name, T& v)
+    {
+        (*this)(name, v);
+    }
+
+    template <class T> void wrapped(const char*, const char* inner, std::vector<T>& v)
+    {
+        (*this)(inner, v);
+    }
+
+    size_t bytes;
+};
+
+size_t header_footprint(const IsmrmrdHeader& h)
+{
+    HeaderFootprint f;
+    // Only reads through the non-const field lists
+    fields(f, const_cast<IsmrmrdHeader&>(h));
+    return f.bytes;
+}
+
+// LRU cache of decoded headers, most recently used first
+class HeaderCache {
+public:
+    HeaderCache() : capacity_(16 << 20), bytes_(0), hits_(0), misses_(0), evictions_(0) { }
+
+    std::shared_ptr<const IsmrmrdHeader> find(uint64_t hash, const std::string& xml)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unordered_map<uint64_t, Entries::iterator>::iterator it = index_.find(hash);
+        if (it != index_.end() && it->second->xml == xml) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            hits_++;
+            return it->second->header;
+        }
+        misses_++;
+        return std::shared_ptr<const IsmrmrdHeader>();
+    }
+
+    // cost is the memory of the decoded header, the key is charged on top
+    void insert(uint64_t hash, const std::string& xml, const std::shared_ptr<const IsmrmrdHeader>& header, size_t cost)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cost += xml.size();
+        if (cost > capacity_) {
+            return;
+        }
+        // A concurrent miss on the same header, or a hash collision: newest wins
+        std::unordered_map<uint64_t, Entries::iterator>::iterator it = index_.find(hash);
+        if (it != index_.end()) {
+            erase(it->second);
+        }
+        Entry e = { hash, xml, header, cost };
+        entries_.push_front(e);
+        index_[hash] = entries_.begin();
+        bytes_ += cost;
+        evict();
+    }
+
+    void set_capacity(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = bytes;
+        evict();
+    }
+
+    HeaderCacheStats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HeaderCacheStats s = { hits_, misses_, evictions_, entries_.size(), bytes_, capacity_ };
+        return s;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        index_.clear();
+        bytes_ = 0;
+        hits_ = misses_ = evictions_ = 0;
+    }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string xml;
+        std::shared_ptr<const IsmrmrdHeader> header;
+        size_t cost;
+    };
+    typedef std::list<Entry> Entries;
+
+    void erase(Entries::iterator e)
+    {
+        bytes_ -= e->cost;
+        index_.erase(e->hash);
+        entries_.erase(e);
+    }
+
+    void evict()
+    {
+        while (bytes_ > capacity_) {
+            erase(--entries_.end());
+            evictions_++;
+        }
+    }
+
+    std::mutex mutex_;
+    Entries entries_;
+    std::unordered_map<uint64_t, Entries::iterator> index_;
+    size_t capacity_;
+    size_t bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+};
+
+HeaderCache& header_cache()
+{
+    static HeaderCache cache;
+    return cache;
+}
+
+}
+
+std::shared_ptr<const IsmrmrdHeader> Dataset::readParsedHeader()
+{
+    // A tagged XML header is keyed on its tag, a hit reads neither the XML
+    // nor the binary copy. Untagged headers have no valid binary copy either
+    // and are keyed on the XML.
+    std::string key;
+    std::string xml;
+    uint64_t tag;
+    bool tagged = ismrmrd_read_header_hash(&dset_, &tag);
+    if (tagged) {
+        key.assign("xml_hash");
+        key.append(reinterpret_cast<const char*>(&tag), sizeof(tag));
+    } else {
+        readHeader(xml);
+        key = xml;
+    }
+    uint64_t hash = hash_header(key);
+
+    std::shared_ptr<const IsmrmrdHeader> cached = header_cache().find(hash, key);
+    if (dset_.stats) {
+        if (cached) {
+            dset_.stats->header_cache_hits++;
+        } else {
+            dset_.stats->header_cache_misses++;
+        }
+    }
+    if (cached) {
+        return cached;
+    }
+
+    // Decoded outside the cache lock
+    std::shared_ptr<IsmrmrdHeader> h = std::make_shared<IsmrmrdHeader>();
+    if (tagged) {
+        // Other files may share the tag, so it is checked against the XML
+        // before the header is cached under it: a writer may have replaced
+        // the XML in place and kept the tag
+        readHeader(xml);
+        if (ismrmrd_hash_header(xml.c_str()) != tag) {
+            key = xml;
+            hash = hash_header(key);
+        } else {
+            size_t length;
+            char * temp = static_cast<char*>(ismrmrd_read_binary_header(&dset_, &length));
+            if (NULL != temp) {
+                std::string encoded(temp, length);
+                free(temp);
+                try {
+                    deserialize_binary(encoded.data(), encoded.size(), *h);
+                    header_cache().insert(hash, key, h, header_footprint(*h));
+                    return h;
+                } catch (std::runtime_error&) {
+                    // Written for another version of the header fields, the
+                    // XML is cached under the tag instead
+                    *h = IsmrmrdHeader();
+                }
+            }
+        }
+    }
+    deserialize(xml.data(), xml.size(), *h);
+    header_cache().insert(hash, key, h, header_footprint(*h));
+    return h;
+}
+
+void setHeaderCacheCapacity(size_t bytes)
+{
+    header_cache().set_capacity(bytes);
+}
+
+HeaderCacheStats getHeaderCacheStats()
+{
+    return header_cache().stats();
+}
+
+void clearHeaderCache()
+{
+    header_cache().clear();
+}
+#endif
+
+// Instrumentation
+void Dataset::enableStats(bool enable)
+{
+    int status = ismrmrd_dataset_enable_stats(&dset_, enable);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+ISMRMRD_DatasetStats Dataset::getStats() const
+{
+    ISMRMRD_DatasetStats stats;
+    int status = ismrmrd_dataset_get_stats(&dset_, &stats);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return stats;
+}
+
+void Dataset::resetStats()
+{
+    int status = ismrmrd_dataset_reset_stats(&dset_);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
 // Acquisitions
 void Dataset::appendAcquisition(const Acquisition &acq)
 {
@@ -63,6 +403,22 @@ void Dataset::appendAcquisition(const Acquisition &acq)
     }
 }
 
+void Dataset::appendAcquisitions(const Acquisition *acqs, size_t count)
+{
+    int status = ismrmrd_append_acquisitions(&dset_, reinterpret_cast<const ISMRMRD_Acquisition*>(acqs), static_cast<uint32_t>(count));
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+void Dataset::setCompression(const CompressionParameters &params)
+{
+    int status = ismrmrd_dataset_set_compression(&dset_, &params);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
 void Dataset::readAcquisition(uint32_t index, Acquisition & acq) {
     int status = ismrmrd_read_acquisition(&dset_, index, reinterpret_cast<ISMRMRD_Acquisition*>(&acq));
     if (status != ISMRMRD_NOERROR) {
@@ -70,6 +426,13 @@ void Dataset::readAcquisition(uint32_t index, Acquisition & acq) {
     }
 }
 
+void Dataset::readAcquisitions(uint32_t index, size_t count, Acquisition *acqs) {
+    int status = ismrmrd_read_acquisitions(&dset_, index, static_cast<uint32_t>(count), reinterpret_cast<ISMRMRD_Acquisition*>(acqs));
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
 
 uint32_t Dataset::getNumberOfAcquisitions()
 {
@@ -23,7 +23,6 @@ extern "C" {
 
 /* Error handling prototypes */
 typedef struct ISMRMRD_error_node {
-    struct ISMRMRD_error_node *next;
     char *file;
     char *func;
     char *msg;
@@ -31,9 +30,33 @@ typedef struct ISMRMRD_error_node {
     int code;
 } ISMRMRD_error_node_t;
 
+/* Every thread has its own error stack, a ring of preallocated nodes. When it
+ * is full the oldest error is dropped and counted. */
+#define ISMRMRD_ERROR_STACK_SIZE 64
+
+typedef struct ISMRMRD_error_stack {
+    ISMRMRD_error_node_t nodes[ISMRMRD_ERROR_STACK_SIZE];
+    unsigned int bottom;
+    unsigned int count;
+    unsigned long overflow;
+} ISMRMRD_error_stack_t;
+
+#if defined(__cplusplus) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900))
+#define ISMRMRD_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define ISMRMRD_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define ISMRMRD_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define ISMRMRD_THREAD_LOCAL _Thread_local
+#else
+/* Without thread local storage the error stack is shared by all threads */
+#define ISMRMRD_THREAD_LOCAL
+#endif
+
 static void ismrmrd_error_default(const char *file, int line,
         const char *func, int code, const char *msg);
-static ISMRMRD_error_node_t *error_stack_head = NULL;
+static ISMRMRD_THREAD_LOCAL ISMRMRD_error_stack_t error_stack;
 static ismrmrd_error_handler_t ismrmrd_error_handler = ismrmrd_error_default;
 
 
@@ -525,6 +548,9 @@ bool ismrmrd_is_channel_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], c
     if (channel_mask==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to channel_mask should not be NULL.");
     }
+    if (chan >= 64 * ISMRMRD_CHANNEL_MASKS) {
+        return false;
+    }
     bitmask = (uint64_t)(1) << (chan % 64);
     offset = chan / 64;
     return (channel_mask[offset] & bitmask) > 0;
@@ -536,6 +562,9 @@ int ismrmrd_set_channel_on(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const u
     if (channel_mask==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to channel_mask should not be NULL.");
     }
+    if (chan >= 64 * ISMRMRD_CHANNEL_MASKS) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Channel is outside of the channel mask.");
+    }
     bitmask = (uint64_t)(1) << (chan % 64);
     offset = chan / 64;
     channel_mask[offset] |= bitmask;
@@ -548,7 +577,10 @@ int ismrmrd_set_channel_off(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const
     if (channel_mask==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to channel_mask should not be NULL.");
     }
-    bitmask = 1 << (chan % 64);
+    if (chan >= 64 * ISMRMRD_CHANNEL_MASKS) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Channel is outside of the channel mask.");
+    }
+    bitmask = (uint64_t)(1) << (chan % 64);
     offset = chan / 64;
     channel_mask[offset] &= ~bitmask;
     return ISMRMRD_NOERROR;
@@ -565,6 +597,235 @@ int ismrmrd_set_all_channels_off(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS]) {
     return ISMRMRD_NOERROR;
 }
     
+#define ISMRMRD_MAX_CHANNELS (64 * ISMRMRD_CHANNEL_MASKS)
+
+static int popcount64(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* Index of the lowest bit set of a nonzero word */
+static int ctz64(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    return popcount64((w & (~w + 1)) - 1);
+#endif
+}
+
+/* Bits first to first + count - 1 of word, which holds channels 64 * word on */
+static uint64_t range_bits(size_t word, uint32_t first, uint32_t end) {
+    uint32_t lo = (uint32_t)(64 * word), hi = lo + 64;
+    uint64_t bits = ~(uint64_t)0;
+    if (first > lo) {
+        bits &= ~(uint64_t)0 << (first - lo);
+    }
+    if (end < hi) {
+        bits &= ~(uint64_t)0 >> (hi - end);
+    }
+    return bits;
+}
+
+static int set_channel_range(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t first,
+        const uint16_t count, const bool on) {
+    uint32_t end = (uint32_t)first + count;
+    size_t word;
+    if (channel_mask==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to channel_mask should not be NULL.");
+    }
+    if (end > ISMRMRD_MAX_CHANNELS) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Channel range is outside of the channel mask.");
+    }
+    for (word = first / 64; count > 0 && word <= (end - 1) / 64; word++) {
+        if (on) {
+            channel_mask[word] |= range_bits(word, first, end);
+        } else {
+            channel_mask[word] &= ~range_bits(word, first, end);
+        }
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_set_channels_on(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t first, const uint16_t count) {
+    return set_channel_range(channel_mask, first, count, true);
+}
+
+int ismrmrd_set_channels_off(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t first, const uint16_t count) {
+    return set_channel_range(channel_mask, first, count, false);
+}
+
+int ismrmrd_set_channel_list(uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t *channels, const uint16_t count) {
+    uint64_t mask[ISMRMRD_CHANNEL_MASKS] = {0};
+    uint16_t n;
+    if (channel_mask==NULL || (channels==NULL && count > 0)) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    for (n = 0; n < count; n++) {
+        if (channels[n] >= ISMRMRD_MAX_CHANNELS) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Channel is outside of the channel mask.");
+        }
+        mask[channels[n] / 64] |= (uint64_t)(1) << (channels[n] % 64);
+    }
+    memcpy(channel_mask, mask, sizeof(mask));
+    return ISMRMRD_NOERROR;
+}
+
+uint16_t ismrmrd_count_channels_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS]) {
+    int count = 0;
+    size_t word;
+    if (channel_mask==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to channel_mask should not be NULL.");
+        return 0;
+    }
+    for (word = 0; word < ISMRMRD_CHANNEL_MASKS; word++) {
+        count += popcount64(channel_mask[word]);
+    }
+    return (uint16_t)count;
+}
+
+int ismrmrd_next_channel_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], const uint16_t chan) {
+    size_t word = chan / 64;
+    uint64_t bits;
+    if (channel_mask==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to channel_mask should not be NULL.");
+        return -1;
+    }
+    if (chan >= ISMRMRD_MAX_CHANNELS) {
+        return -1;
+    }
+    bits = channel_mask[word] & (~(uint64_t)0 << (chan % 64));
+    while (bits == 0) {
+        if (++word == ISMRMRD_CHANNEL_MASKS) {
+            return -1;
+        }
+        bits = channel_mask[word];
+    }
+    return (int)(64 * word) + ctz64(bits);
+}
+
+uint16_t ismrmrd_get_channels_on(const uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS], uint16_t *channels) {
+    uint16_t count = 0;
+    size_t word;
+    if (channel_mask==NULL || channels==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+        return 0;
+    }
+    for (word = 0; word < ISMRMRD_CHANNEL_MASKS; word++) {
+        uint64_t bits = channel_mask[word];
+        while (bits != 0) {
+            channels[count++] = (uint16_t)(64 * word + ctz64(bits));
+            bits &= bits - 1;
+        }
+    }
+    return count;
+}
+
+/* The channels whose data an acquisition holds, see ismrmrd_compact_acquisition_channels */
+static int acquisition_channels(const ISMRMRD_Acquisition *acq, uint64_t mask[ISMRMRD_CHANNEL_MASKS]) {
+    uint16_t count = ismrmrd_count_channels_on(acq->head.channel_mask);
+    if (count == 0) {
+        memset(mask, 0, ISMRMRD_CHANNEL_MASKS * sizeof(uint64_t));
+        return ismrmrd_set_channels_on(mask, 0, acq->head.active_channels);
+    }
+    if (count != acq->head.active_channels) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Channel mask does not match the number of active channels.");
+    }
+    memcpy(mask, acq->head.channel_mask, ISMRMRD_CHANNEL_MASKS * sizeof(uint64_t));
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_compact_acquisition_channels(ISMRMRD_Acquisition *acq, const uint64_t keep[ISMRMRD_CHANNEL_MASKS]) {
+    uint64_t mask[ISMRMRD_CHANNEL_MASKS];
+    size_t samples, word;
+    uint16_t index = 0, kept = 0;
+    int status;
+
+    if (acq==NULL || keep==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    status = acquisition_channels(acq, mask);
+    if (status != ISMRMRD_NOERROR) {
+        return status;
+    }
+
+    /* Each channel is a contiguous block of samples, the kept ones slide down */
+    samples = acq->head.number_of_samples;
+    for (word = 0; word < ISMRMRD_CHANNEL_MASKS; word++) {
+        uint64_t bits = mask[word];
+        while (bits != 0) {
+            uint64_t bit = bits & (~bits + 1);
+            if (keep[word] & bit) {
+                if (kept != index) {
+                    memmove(acq->data + kept * samples, acq->data + index * samples, samples * sizeof(*acq->data));
+                }
+                kept++;
+            }
+            index++;
+            bits &= bits - 1;
+        }
+        mask[word] &= keep[word];
+    }
+
+    memcpy(acq->head.channel_mask, mask, sizeof(mask));
+    acq->head.active_channels = kept;
+    return ismrmrd_make_consistent_acquisition(acq);
+}
+
+int ismrmrd_expand_acquisition_channels(ISMRMRD_Acquisition *acq, const uint16_t channels) {
+    uint64_t mask[ISMRMRD_CHANNEL_MASKS];
+    uint16_t list[ISMRMRD_MAX_CHANNELS];
+    uint16_t count, chan, n;
+    size_t samples;
+    int status;
+
+    if (acq==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer should not be NULL.");
+    }
+    if (channels > ISMRMRD_MAX_CHANNELS) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Channel count is outside of the channel mask.");
+    }
+    status = acquisition_channels(acq, mask);
+    if (status != ISMRMRD_NOERROR) {
+        return status;
+    }
+    count = ismrmrd_get_channels_on(mask, list);
+    if (count > 0 && list[count - 1] >= channels) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Active channel is outside of the expanded channels.");
+    }
+
+    acq->head.active_channels = channels;
+    status = ismrmrd_make_consistent_acquisition(acq);
+    if (status != ISMRMRD_NOERROR) {
+        acq->head.active_channels = count;
+        return status;
+    }
+
+    /* From the last channel down each block moves up to its number, then
+     * the gaps are cleared */
+    samples = acq->head.number_of_samples;
+    for (n = count; n-- > 0;) {
+        if (list[n] != n) {
+            memmove(acq->data + list[n] * samples, acq->data + n * samples, samples * sizeof(*acq->data));
+        }
+    }
+    for (chan = 0, n = 0; chan < channels; chan++) {
+        if (n < count && list[n] == chan) {
+            n++;
+        } else {
+            memset(acq->data + chan * samples, 0, samples * sizeof(*acq->data));
+        }
+    }
+
+    ismrmrd_set_all_channels_off(acq->head.channel_mask);
+    return ismrmrd_set_channels_on(acq->head.channel_mask, 0, channels);
+}
+
 int ismrmrd_sign_of_directions(float read_dir[3], float phase_dir[3], float slice_dir[3]) {
     float r11 = read_dir[0], r12 = phase_dir[0], r13 = slice_dir[0];
     float r21 = read_dir[1], r22 = phase_dir[1], r23 = slice_dir[1];
@@ -672,13 +933,230 @@ void ismrmrd_quaternion_to_directions(float quat[4], float read_dir[3],
     slice_dir[2] = 1.0f - 2.0f * (a * a + b * b);
 }
 
+/* Orientations are converted in blocks, small enough for the stack */
+#define ISMRMRD_ORIENTATION_BLOCK 64
+
+/* The kernels below take every array as a restrict pointer, that is what
+ * lets the compiler vectorize them without runtime alias checks */
+#ifdef __cplusplus
+#define ISMRMRD_RESTRICT __restrict
+#else
+#define ISMRMRD_RESTRICT restrict
+#endif
+
+static void sign_of_directions_kernel(size_t n,
+        const float *ISMRMRD_RESTRICT r11p, const float *ISMRMRD_RESTRICT r12p, const float *ISMRMRD_RESTRICT r13p,
+        const float *ISMRMRD_RESTRICT r21p, const float *ISMRMRD_RESTRICT r22p, const float *ISMRMRD_RESTRICT r23p,
+        const float *ISMRMRD_RESTRICT r31p, const float *ISMRMRD_RESTRICT r32p, const float *ISMRMRD_RESTRICT r33p,
+        int *ISMRMRD_RESTRICT sign) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float r11 = r11p[i], r12 = r12p[i], r13 = r13p[i];
+        float r21 = r21p[i], r22 = r22p[i], r23 = r23p[i];
+        float r31 = r31p[i], r32 = r32p[i], r33 = r33p[i];
+        float deti = (r11 * r22 * r33) + (r12 * r23 * r31) + (r21 * r32 * r13) -
+                     (r13 * r22 * r31) - (r12 * r21 * r33) - (r11 * r23 * r32);
+        sign[i] = deti < 0 ? -1 : 1;
+    }
+}
+
+/* The common case of ismrmrd_directions_to_quaternion without branches, with
+ * the same operations in the same order so that the results are identical.
+ * trace receives the value that decides whether that case applies. */
+static void directions_to_quaternion_kernel(size_t n,
+        const float *ISMRMRD_RESTRICT r11p, const float *ISMRMRD_RESTRICT r12p, const float *ISMRMRD_RESTRICT r13p,
+        const float *ISMRMRD_RESTRICT r21p, const float *ISMRMRD_RESTRICT r22p, const float *ISMRMRD_RESTRICT r23p,
+        const float *ISMRMRD_RESTRICT r31p, const float *ISMRMRD_RESTRICT r32p, const float *ISMRMRD_RESTRICT r33p,
+        float *ISMRMRD_RESTRICT qa, float *ISMRMRD_RESTRICT qb, float *ISMRMRD_RESTRICT qc, float *ISMRMRD_RESTRICT qd,
+        double *ISMRMRD_RESTRICT trace) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float r11 = r11p[i], r12 = r12p[i], r13 = r13p[i];
+        float r21 = r21p[i], r22 = r22p[i], r23 = r23p[i];
+        float r31 = r31p[i], r32 = r32p[i], r33 = r33p[i];
+        float deti = (r11 * r22 * r33) + (r12 * r23 * r31) + (r21 * r32 * r13) -
+                     (r13 * r22 * r31) - (r12 * r21 * r33) - (r11 * r23 * r32);
+        float flip = deti < 0 ? -1.0f : 1.0f;
+        double t, s;
+        r13 *= flip;
+        r23 *= flip;
+        r33 *= flip;
+        t = 1.0 + r11 + r22 + r33;
+        s = sqrt(t) * 2;
+        qa[i] = (float)((r32 - r23) / s);
+        qb[i] = (float)((r13 - r31) / s);
+        qc[i] = (float)((r21 - r12) / s);
+        qd[i] = (float)(0.25 * s);
+        trace[i] = t;
+    }
+}
+
+static void quaternion_to_directions_kernel(size_t n,
+        const float *ISMRMRD_RESTRICT qa, const float *ISMRMRD_RESTRICT qb,
+        const float *ISMRMRD_RESTRICT qc, const float *ISMRMRD_RESTRICT qd,
+        float *ISMRMRD_RESTRICT r11p, float *ISMRMRD_RESTRICT r12p, float *ISMRMRD_RESTRICT r13p,
+        float *ISMRMRD_RESTRICT r21p, float *ISMRMRD_RESTRICT r22p, float *ISMRMRD_RESTRICT r23p,
+        float *ISMRMRD_RESTRICT r31p, float *ISMRMRD_RESTRICT r32p, float *ISMRMRD_RESTRICT r33p) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float a = qa[i], b = qb[i], c = qc[i], d = qd[i];
+
+        r11p[i] = 1.0f - 2.0f * (b * b + c * c);
+        r12p[i] = 2.0f * (a * b - c * d);
+        r13p[i] = 2.0f * (a * c + b * d);
+
+        r21p[i] = 2.0f * (a * b + c * d);
+        r22p[i] = 1.0f - 2.0f * (a * a + c * c);
+        r23p[i] = 2.0f * (b * c - a * d);
+
+        r31p[i] = 2.0f * (a * c - b * d);
+        r32p[i] = 2.0f * (b * c + a * d);
+        r33p[i] = 1.0f - 2.0f * (a * a + b * b);
+    }
+}
+
+int ismrmrd_sign_of_directions_n(const ISMRMRD_Directions *dirs, size_t n, int *sign) {
+    if (dirs == NULL || sign == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointers to directions and signs should not be NULL.");
+    }
+    sign_of_directions_kernel(n,
+            dirs->read_dir[0], dirs->phase_dir[0], dirs->slice_dir[0],
+            dirs->read_dir[1], dirs->phase_dir[1], dirs->slice_dir[1],
+            dirs->read_dir[2], dirs->phase_dir[2], dirs->slice_dir[2], sign);
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_directions_to_quaternion_n(const ISMRMRD_Directions *dirs, size_t n, float *quat[4]) {
+    double trace[ISMRMRD_ORIENTATION_BLOCK];
+    size_t start, i;
+    if (dirs == NULL || quat == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointers to directions and quaternions should not be NULL.");
+    }
+    for (start = 0; start < n; start += ISMRMRD_ORIENTATION_BLOCK) {
+        size_t count = n - start < ISMRMRD_ORIENTATION_BLOCK ? n - start : ISMRMRD_ORIENTATION_BLOCK;
+        directions_to_quaternion_kernel(count,
+                dirs->read_dir[0] + start, dirs->phase_dir[0] + start, dirs->slice_dir[0] + start,
+                dirs->read_dir[1] + start, dirs->phase_dir[1] + start, dirs->slice_dir[1] + start,
+                dirs->read_dir[2] + start, dirs->phase_dir[2] + start, dirs->slice_dir[2] + start,
+                quat[0] + start, quat[1] + start, quat[2] + start, quat[3] + start, trace);
+
+        /* Rotations close to a half turn take the scalar path */
+        for (i = 0; i < count; i++) {
+            if (!(trace[i] > 0.00001)) {
+                float read_dir[3], phase_dir[3], slice_dir[3], q[4];
+                int k;
+                for (k = 0; k < 3; k++) {
+                    read_dir[k] = dirs->read_dir[k][start + i];
+                    phase_dir[k] = dirs->phase_dir[k][start + i];
+                    slice_dir[k] = dirs->slice_dir[k][start + i];
+                }
+                ismrmrd_directions_to_quaternion(read_dir, phase_dir, slice_dir, q);
+                for (k = 0; k < 4; k++) {
+                    quat[k][start + i] = q[k];
+                }
+            }
+        }
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_quaternion_to_directions_n(float *quat[4], size_t n, const ISMRMRD_Directions *dirs) {
+    if (dirs == NULL || quat == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointers to quaternions and directions should not be NULL.");
+    }
+    quaternion_to_directions_kernel(n, quat[0], quat[1], quat[2], quat[3],
+            dirs->read_dir[0], dirs->phase_dir[0], dirs->slice_dir[0],
+            dirs->read_dir[1], dirs->phase_dir[1], dirs->slice_dir[1],
+            dirs->read_dir[2], dirs->phase_dir[2], dirs->slice_dir[2]);
+    return ISMRMRD_NOERROR;
+}
+
+/* Converts the direction vectors of n headers, stride bytes apart, see
+ * ismrmrd_acquisition_orientations */
+static int header_orientations(const char *read_dir, const char *phase_dir, const char *slice_dir,
+                               size_t stride, size_t n, float *quat, int *sign, float *rot) {
+    float buffer[13][ISMRMRD_ORIENTATION_BLOCK];
+    int signs[ISMRMRD_ORIENTATION_BLOCK];
+    ISMRMRD_Directions dirs;
+    float *q[4];
+    size_t start, i;
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        dirs.read_dir[k] = buffer[k];
+        dirs.phase_dir[k] = buffer[3 + k];
+        dirs.slice_dir[k] = buffer[6 + k];
+    }
+    for (k = 0; k < 4; k++) {
+        q[k] = buffer[9 + k];
+    }
+
+    for (start = 0; start < n; start += ISMRMRD_ORIENTATION_BLOCK) {
+        size_t count = n - start < ISMRMRD_ORIENTATION_BLOCK ? n - start : ISMRMRD_ORIENTATION_BLOCK;
+        for (i = 0; i < count; i++) {
+            size_t offset = (start + i) * stride;
+            const float *r = (const float *)(read_dir + offset);
+            const float *p = (const float *)(phase_dir + offset);
+            const float *s = (const float *)(slice_dir + offset);
+            for (k = 0; k < 3; k++) {
+                dirs.read_dir[k][i] = r[k];
+                dirs.phase_dir[k][i] = p[k];
+                dirs.slice_dir[k][i] = s[k];
+                if (rot != NULL) {
+                    rot[9 * (start + i) + 3 * k + 0] = r[k];
+                    rot[9 * (start + i) + 3 * k + 1] = p[k];
+                    rot[9 * (start + i) + 3 * k + 2] = s[k];
+                }
+            }
+        }
+        if (sign != NULL) {
+            ismrmrd_sign_of_directions_n(&dirs, count, signs);
+            memcpy(sign + start, signs, count * sizeof(*sign));
+        }
+        if (quat != NULL) {
+            ismrmrd_directions_to_quaternion_n(&dirs, count, q);
+            for (i = 0; i < count; i++) {
+                for (k = 0; k < 4; k++) {
+                    quat[4 * (start + i) + k] = q[k][i];
+                }
+            }
+        }
+    }
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_acquisition_orientations(const ISMRMRD_AcquisitionHeader *head, size_t n,
+                                     float *quat, int *sign, float *rot) {
+    if (head == NULL && n > 0) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to acquisition headers should not be NULL.");
+    }
+    if (n == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    return header_orientations((const char *)head->read_dir, (const char *)head->phase_dir,
+                               (const char *)head->slice_dir, sizeof(*head), n, quat, sign, rot);
+}
+
+int ismrmrd_image_orientations(const ISMRMRD_ImageHeader *head, size_t n,
+                               float *quat, int *sign, float *rot) {
+    if (head == NULL && n > 0) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Pointer to image headers should not be NULL.");
+    }
+    if (n == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    return header_orientations((const char *)head->read_dir, (const char *)head->phase_dir,
+                               (const char *)head->slice_dir, sizeof(*head), n, quat, sign, rot);
+}
+
 /**
- * Saves error information on the error stack
+ * Saves error information on the calling thread's error stack
  * @returns error code
  */
 int ismrmrd_push_error(const char *file, const int line, const char *func,
         const int code, const char *msg)
 {
+    ISMRMRD_error_stack_t *stack = &error_stack;
     ISMRMRD_error_node_t *node = NULL;
 
     /* Call user-defined error handler if it exists */
@@ -686,15 +1164,14 @@ int ismrmrd_push_error(const char *file, const int line, const char *func,
         ismrmrd_error_handler(file, line, func, code, msg);
     }
 
-    /* Save error information on error stack */
-    node = (ISMRMRD_error_node_t*)calloc(1, sizeof(*node));
-    if (node == NULL) {
-        /* TODO: how to handle this? */
-        return ISMRMRD_MEMORYERROR;
+    /* Save error information on error stack, dropping the oldest if full */
+    if (stack->count == ISMRMRD_ERROR_STACK_SIZE) {
+        stack->bottom = (stack->bottom + 1) % ISMRMRD_ERROR_STACK_SIZE;
+        stack->count--;
+        stack->overflow++;
     }
-
-    node->next = error_stack_head;
-    error_stack_head = node;
+    node = &stack->nodes[(stack->bottom + stack->count) % ISMRMRD_ERROR_STACK_SIZE];
+    stack->count++;
 
     node->file = (char*)file;
     node->line = line;
@@ -708,14 +1185,16 @@ int ismrmrd_push_error(const char *file, const int line, const char *func,
 bool ismrmrd_pop_error(char **file, int *line, char **func,
         int *code, char **msg)
 {
-    ISMRMRD_error_node_t *node = error_stack_head;
-    if (node == NULL) {
+    ISMRMRD_error_stack_t *stack = &error_stack;
+    ISMRMRD_error_node_t *node = NULL;
+    if (stack->count == 0) {
         /* nothing to pop */
         return false;
     }
 
     /* pop head off stack */
-    error_stack_head = node->next;
+    stack->count--;
+    node = &stack->nodes[(stack->bottom + stack->count) % ISMRMRD_ERROR_STACK_SIZE];
 
     if (file != NULL) {
         *file = node->file;
@@ -733,10 +1212,19 @@ bool ismrmrd_pop_error(char **file, int *line, char **func,
         *msg = node->msg;
     }
 
-    free(node);
     return true;
 }
 
+unsigned long ismrmrd_error_stack_overflow(void) {
+    return error_stack.overflow;
+}
+
+void ismrmrd_clear_error_stack(void) {
+    error_stack.bottom = 0;
+    error_stack.count = 0;
+    error_stack.overflow = 0;
+}
+
 void ismrmrd_set_error_handler(ismrmrd_error_handler_t handler) {
     ismrmrd_error_handler = handler;
 }
@@ -8,6 +8,141 @@
 
 namespace ISMRMRD {
 
+//
+// ChannelMask class implementation
+//
+ChannelMask::ChannelMask() {
+    memset(bits_, 0, sizeof(bits_));
+}
+
+ChannelMask::ChannelMask(const uint64_t (&bits)[ISMRMRD_CHANNEL_MASKS]) {
+    memcpy(bits_, bits, sizeof(bits_));
+}
+
+ChannelMask::ChannelMask(const uint16_t *channels, uint16_t count) {
+    if (ismrmrd_set_channel_list(bits_, channels, count) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+ChannelMask::ChannelMask(const std::vector<uint16_t> &channels) {
+    if (ismrmrd_set_channel_list(bits_, channels.empty() ? NULL : &channels[0],
+                                 static_cast<uint16_t>(channels.size())) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+ChannelMask ChannelMask::range(uint16_t first, uint16_t count) {
+    ChannelMask mask;
+    return mask.setRangeActive(first, count);
+}
+
+bool ChannelMask::isActive(uint16_t channel_id) const {
+    return ismrmrd_is_channel_on(bits_, channel_id);
+}
+
+ChannelMask &ChannelMask::setActive(uint16_t channel_id) {
+    if (ismrmrd_set_channel_on(bits_, channel_id) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return *this;
+}
+
+ChannelMask &ChannelMask::setNotActive(uint16_t channel_id) {
+    if (ismrmrd_set_channel_off(bits_, channel_id) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return *this;
+}
+
+ChannelMask &ChannelMask::setRangeActive(uint16_t first, uint16_t count) {
+    if (ismrmrd_set_channels_on(bits_, first, count) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return *this;
+}
+
+ChannelMask &ChannelMask::setRangeNotActive(uint16_t first, uint16_t count) {
+    if (ismrmrd_set_channels_off(bits_, first, count) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return *this;
+}
+
+ChannelMask &ChannelMask::setAllNotActive() {
+    memset(bits_, 0, sizeof(bits_));
+    return *this;
+}
+
+uint16_t ChannelMask::count() const {
+    return ismrmrd_count_channels_on(bits_);
+}
+
+bool ChannelMask::empty() const {
+    for (int i = 0; i < ISMRMRD_CHANNEL_MASKS; i++) {
+        if (bits_[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<uint16_t> ChannelMask::channels() const {
+    std::vector<uint16_t> list(count());
+    if (!list.empty()) {
+        ismrmrd_get_channels_on(bits_, &list[0]);
+    }
+    return list;
+}
+
+ChannelMask::const_iterator ChannelMask::begin() const {
+    return const_iterator(bits_, ismrmrd_next_channel_on(bits_, 0));
+}
+
+ChannelMask::const_iterator ChannelMask::end() const {
+    return const_iterator(bits_, -1);
+}
+
+ChannelMask &ChannelMask::operator&=(const ChannelMask &other) {
+    for (int i = 0; i < ISMRMRD_CHANNEL_MASKS; i++) {
+        bits_[i] &= other.bits_[i];
+    }
+    return *this;
+}
+
+ChannelMask &ChannelMask::operator|=(const ChannelMask &other) {
+    for (int i = 0; i < ISMRMRD_CHANNEL_MASKS; i++) {
+        bits_[i] |= other.bits_[i];
+    }
+    return *this;
+}
+
+ChannelMask ChannelMask::operator&(const ChannelMask &other) const {
+    ChannelMask mask(*this);
+    return mask &= other;
+}
+
+ChannelMask ChannelMask::operator|(const ChannelMask &other) const {
+    ChannelMask mask(*this);
+    return mask |= other;
+}
+
+bool ChannelMask::operator==(const ChannelMask &other) const {
+    return memcmp(bits_, other.bits_, sizeof(bits_)) == 0;
+}
+
+bool ChannelMask::operator!=(const ChannelMask &other) const {
+    return !(*this == other);
+}
+
+const uint64_t (&ChannelMask::bits() const)[ISMRMRD_CHANNEL_MASKS] {
+    return bits_;
+}
+
+void ChannelMask::copyTo(uint64_t (&bits)[ISMRMRD_CHANNEL_MASKS]) const {
+    memcpy(bits, bits_, sizeof(bits_));
+}
+
 //
 // AcquisitionHeader class implementation
 //
@@ -322,6 +457,29 @@ void Acquisition::setAllChannelsNotActive() {
     ismrmrd_set_all_channels_off(acq.head.channel_mask);
 }
 
+ChannelMask Acquisition::getActiveChannels() const {
+    if (ismrmrd_count_channels_on(acq.head.channel_mask) == 0) {
+        return ChannelMask::range(0, acq.head.active_channels);
+    }
+    return ChannelMask(acq.head.channel_mask);
+}
+
+void Acquisition::setChannelMask(const ChannelMask &mask) {
+    mask.copyTo(acq.head.channel_mask);
+}
+
+void Acquisition::compactChannels(const ChannelMask &keep) {
+    if (ismrmrd_compact_acquisition_channels(&acq, keep.bits()) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+void Acquisition::expandChannels(uint16_t channels) {
+    if (ismrmrd_expand_acquisition_channels(&acq, channels) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
 
 //
 // ImageHeader class Implementation
@@ -1198,19 +1356,28 @@ template EXPORTISMRMRD class NDArray<complex_float_t>;
 template EXPORTISMRMRD class NDArray<complex_double_t>;
 
 
-// Helper function for generating exception message from ISMRMRD error stack
+// Helper function for generating exception message from the calling thread's ISMRMRD error stack
 std::string build_exception_string(void)
 {
     char *file = NULL, *func = NULL, *msg = NULL;
     int line = 0, code = 0;
     std::stringstream stream;
-    for (int i = 0; ismrmrd_pop_error(&file, &line, &func, &code, &msg); ++i) {
+    int i = 0;
+    for (; ismrmrd_pop_error(&file, &line, &func, &code, &msg); ++i) {
         if (i > 0) {
             stream << std::endl;
         }
         stream << "ISMRMRD " << ismrmrd_strerror(code) << " in " << func <<
                 " (" << file << ":" << line << ": " << msg;
     }
+    unsigned long dropped = ismrmrd_error_stack_overflow();
+    if (dropped > 0) {
+        if (i > 0) {
+            stream << std::endl;
+        }
+        stream << "ISMRMRD " << dropped << " earlier errors dropped";
+        ismrmrd_clear_error_stack();
+    }
     return stream.str();
 }
 
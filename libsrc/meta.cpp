@@ -1,11 +1,485 @@
 #include "ismrmrd/meta.h"
 #include "pugixml.hpp"
+#include <stdint.h>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <set>
 
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <mutex>
+#define ISMRMRD_META_INTERN_LOCK
+#endif
+
+// Characters the parameter name pool may hold, names past it are not interned
+#ifndef ISMRMRD_META_NAME_POOL_BYTES
+#define ISMRMRD_META_NAME_POOL_BYTES (64 * 1024)
+#endif
+
+/* Binary encoding of the meta attributes
+ *
+ * The encoding starts with the magic bytes "ISMM" and a format version byte,
+ * followed by
+ *
+ *   string count, the strings as length and bytes
+ *   parameter count, per parameter its name index, value count and values
+ *
+ * Every value is a type byte and its payload: a string table index, a zigzag
+ * encoded integer, or a decimal number as zigzag encoded significand and
+ * exponent. All counts and payloads are written as LEB128 varints of the
+ * number plus one, which never contain a zero byte, so the whole encoding is
+ * a valid C string.
+ *
+ * A value is only typed when the decoded string is exactly the original one,
+ * anything else goes through the string table. Decoding a typed value then
+ * gives the same long and double the XML would, without scanning a string.
+ */
 
 namespace ISMRMRD
 {
+  struct NameLess
+  {
+    bool operator()(const char* a, const char* b) const
+    {
+      return strcmp(a, b) < 0;
+    }
+  };
+
+  // Parameter names interned for the lifetime of the process
+  struct NamePool
+  {
+    NamePool() : bytes(0) {}
+
+    std::set<const char*, NameLess> index;
+    std::deque<std::string> names;
+    size_t bytes;
+#ifdef ISMRMRD_META_INTERN_LOCK
+    std::mutex mutex;
+#endif
+  };
+
+  const char* intern_meta_name(const char* name)
+  {
+    static NamePool pool;
+#ifdef ISMRMRD_META_INTERN_LOCK
+    std::lock_guard<std::mutex> lock(pool.mutex);
+#endif
+    std::set<const char*, NameLess>::iterator it = pool.index.find(name);
+    if (it != pool.index.end()) {
+      return *it;
+    }
+    size_t length = strlen(name) + 1;
+    if (length > ISMRMRD_META_NAME_POOL_BYTES - pool.bytes) {
+      return 0;
+    }
+    pool.bytes += length;
+    pool.names.push_back(name);
+    const char* interned = pool.names.back().c_str();
+    pool.index.insert(interned);
+    return interned;
+  }
+
+  static const char meta_magic[4] = {'I', 'S', 'M', 'M'};
+  static const char meta_format_version = 1;
+
+  enum MetaValueType
+  {
+    META_STRING = 1,
+    META_LONG = 2,
+    META_DECIMAL = 3
+  };
+
+  // Powers of ten that are exact doubles
+  static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  // Significands up to 15 digits are exact doubles as well
+  static const int64_t max_significand = 999999999999999LL;
+
+  static void put_varint(std::string& o, uint64_t v)
+  {
+    v++;
+    while (v >= 0x80) {
+      o += static_cast<char>((v & 0x7F) | 0x80);
+      v >>= 7;
+    }
+    o += static_cast<char>(v);
+  }
+
+  static uint64_t zigzag(int64_t v)
+  {
+    return (static_cast<uint64_t>(v) << 1) ^ (v < 0 ? ~static_cast<uint64_t>(0) : 0);
+  }
+
+  static int64_t unzigzag(uint64_t u)
+  {
+    return static_cast<int64_t>((u >> 1) ^ (~(u & 1) + 1));
+  }
+
+  // Writes the digits of v backwards from end, returns the first character
+  static char* format_digits(uint64_t v, char* end)
+  {
+    do {
+      *--end = static_cast<char>('0' + v % 10);
+      v /= 10;
+    } while (v);
+    return end;
+  }
+
+  // m * 10^e the way printf("%g") prints it, with at least six significant digits
+  static void format_decimal(int64_t m, int e, char* buffer)
+  {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* d = format_digits(m < 0 ? 0 - static_cast<uint64_t>(m) : static_cast<uint64_t>(m), end);
+    int n = static_cast<int>(end - d);
+    int exponent = n - 1 + e;
+    char* p = buffer;
+    if (m < 0) {
+      *p++ = '-';
+    }
+    if (exponent < -4 || exponent >= (n > 6 ? n : 6)) {
+      *p++ = d[0];
+      if (n > 1) {
+        *p++ = '.';
+        memcpy(p, d + 1, n - 1);
+        p += n - 1;
+      }
+      *p++ = 'e';
+      *p++ = exponent < 0 ? '-' : '+';
+      int a = exponent < 0 ? -exponent : exponent;
+      if (a < 10) {
+        *p++ = '0';
+      }
+      char exp_digits[8];
+      char* x = format_digits(a, exp_digits + sizeof(exp_digits));
+      memcpy(p, x, exp_digits + sizeof(exp_digits) - x);
+      p += exp_digits + sizeof(exp_digits) - x;
+    } else if (e >= 0) {
+      memcpy(p, d, n);
+      p += n;
+      memset(p, '0', e);
+      p += e;
+    } else if (n + e > 0) {
+      memcpy(p, d, n + e);
+      p += n + e;
+      *p++ = '.';
+      memcpy(p, d + n + e, -e);
+      p += -e;
+    } else {
+      *p++ = '0';
+      *p++ = '.';
+      memset(p, '0', -e - n);
+      p += -e - n;
+      memcpy(p, d, n);
+      p += n;
+    }
+    *p = '\0';
+  }
+
+  // Canonical decimal integers other than LONG_MIN, which is all MetaValue(long) prints
+  static bool typed_long(const char* s, long& l)
+  {
+    const char* p = s;
+    if (*p == '-') {
+      p++;
+    }
+    if (*p < '0' || *p > '9' || (*p == '0' && (p[1] != '\0' || p != s))) {
+      return false;
+    }
+    for (const char* q = p; *q; q++) {
+      if (*q < '0' || *q > '9') {
+        return false;
+      }
+    }
+    errno = 0;
+    char* end;
+    l = strtol(s, &end, 10);
+    return errno == 0 && *end == '\0' && l != LONG_MIN;
+  }
+
+  // Non-zero decimal numbers that format_decimal prints back unchanged and
+  // that convert to double exactly through exact_powers_of_ten
+  static bool typed_decimal(const char* s, int64_t& m, int& e)
+  {
+    const char* p = s;
+    bool negative = *p == '-';
+    if (negative) {
+      p++;
+    }
+    m = 0;
+    e = 0;
+    int digits = 0;
+    bool point = false;
+    for (; (*p >= '0' && *p <= '9') || (*p == '.' && !point); p++) {
+      if (*p == '.') {
+        point = true;
+        continue;
+      }
+      if (m > 0 || *p != '0') {
+        if (++digits > 15) {
+          return false;
+        }
+      }
+      m = 10 * m + (*p - '0');
+      e -= point ? 1 : 0;
+    }
+    if (*p == 'e') {
+      p++;
+      bool negative_exponent = *p == '-';
+      if (*p == '-' || *p == '+') {
+        p++;
+      }
+      int x = 0;
+      for (; *p >= '0' && *p <= '9' && x < 1000; p++) {
+        x = 10 * x + (*p - '0');
+      }
+      e += negative_exponent ? -x : x;
+    }
+    if (*p != '\0' || m == 0) {
+      return false;
+    }
+    while (m % 10 == 0) {
+      m /= 10;
+      e++;
+    }
+    if (e > 22 || e < -22) {
+      return false;
+    }
+    if (negative) {
+      m = -m;
+    }
+    char buffer[64];
+    format_decimal(m, e, buffer);
+    return strcmp(buffer, s) == 0;
+  }
+
+  static double decimal_value(int64_t m, int e)
+  {
+    double d = static_cast<double>(m < 0 ? -m : m);
+    d = e < 0 ? d / exact_powers_of_ten[-e] : d * exact_powers_of_ten[e];
+    return m < 0 ? -d : d;
+  }
+
+  // What sscanf("%ld") reads from the start of a decimal number
+  static long leading_long(const char* s)
+  {
+    bool negative = *s == '-';
+    if (negative) {
+      s++;
+    }
+    long l = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+      l = 10 * l + (*s - '0');
+    }
+    return negative ? -l : l;
+  }
+
+  // A decimal number of the binary encoding, a string whose long and
+  // double conversions are known up front
+  class DecodedValue : public MetaValue
+  {
+  public:
+    DecodedValue(long l, double d, const char* s)
+      : MetaValue(s)
+    {
+      l_ = l;
+      d_ = d;
+      valid_ = LONG_VALID | DOUBLE_VALID | STRING_VALID;
+    }
+  };
+
+  class MetaReader
+  {
+  public:
+    MetaReader(const char* data, size_t len)
+      : p_(reinterpret_cast<const unsigned char*>(data))
+      , end_(reinterpret_cast<const unsigned char*>(data) + len)
+    {
+    }
+
+    unsigned char byte()
+    {
+      need(1);
+      return *p_++;
+    }
+
+    uint64_t varint()
+    {
+      uint64_t v = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char b = byte();
+        v |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+          if (v == 0) {
+            break;
+          }
+          return v - 1;
+        }
+      }
+      throw std::runtime_error("Malformed varint in binary ISMRMRD Meta attributes");
+    }
+
+    // A count of items that take at least one byte each
+    size_t count()
+    {
+      uint64_t n = varint();
+      if (n > static_cast<uint64_t>(end_ - p_)) {
+        throw std::runtime_error("Truncated binary ISMRMRD Meta attributes");
+      }
+      return static_cast<size_t>(n);
+    }
+
+    std::string string()
+    {
+      size_t n = count();
+      std::string s(reinterpret_cast<const char*>(p_), n);
+      p_ += n;
+      return s;
+    }
+
+    bool at_end() const
+    {
+      return p_ == end_;
+    }
+
+  private:
+    void need(size_t n)
+    {
+      if (static_cast<size_t>(end_ - p_) < n) {
+        throw std::runtime_error("Truncated binary ISMRMRD Meta attributes");
+      }
+    }
+
+    const unsigned char* p_;
+    const unsigned char* end_;
+  };
+
+  bool is_binary_meta(const char* s)
+  {
+    return strncmp(s, meta_magic, sizeof(meta_magic)) == 0;
+  }
+
+  class StringTable
+  {
+  public:
+    uint64_t intern(const std::string& s)
+    {
+      std::map<std::string, uint64_t>::iterator it = index_.find(s);
+      if (it == index_.end()) {
+        it = index_.insert(std::make_pair(s, static_cast<uint64_t>(strings_.size()))).first;
+        strings_.push_back(&it->first);
+      }
+      return it->second;
+    }
+
+    void write(std::string& o) const
+    {
+      put_varint(o, strings_.size());
+      for (size_t i = 0; i < strings_.size(); i++) {
+        put_varint(o, strings_[i]->size());
+        o += *strings_[i];
+      }
+    }
+
+  private:
+    std::map<std::string, uint64_t> index_;
+    std::vector<const std::string*> strings_;
+  };
+
+  void serialize_binary(MetaContainer& h, std::string& o)
+  {
+    StringTable strings;
+    std::string body;
+
+    put_varint(body, h.entries_.size());
+    MetaContainer::entries_t::iterator it = h.entries_.begin();
+    while (it != h.entries_.end()) {
+      put_varint(body, strings.intern(it->name()));
+      put_varint(body, it->values.size());
+      for (size_t i = 0; i < it->values.size(); i++) {
+        const char* s = it->values[i].as_str();
+        long l;
+        int64_t m;
+        int e;
+        if (typed_long(s, l)) {
+          body += static_cast<char>(META_LONG);
+          put_varint(body, zigzag(l));
+        } else if (typed_decimal(s, m, e)) {
+          body += static_cast<char>(META_DECIMAL);
+          put_varint(body, zigzag(m));
+          put_varint(body, zigzag(e));
+        } else {
+          body += static_cast<char>(META_STRING);
+          put_varint(body, strings.intern(s));
+        }
+      }
+      it++;
+    }
+
+    o.clear();
+    o.append(meta_magic, sizeof(meta_magic));
+    o += meta_format_version;
+    strings.write(o);
+    o += body;
+  }
+
+  static void deserialize_binary(const char* data, MetaContainer& h)
+  {
+    MetaReader r(data + sizeof(meta_magic), strlen(data) - sizeof(meta_magic));
+    if (r.byte() != meta_format_version) {
+      throw std::runtime_error("Unsupported binary ISMRMRD Meta attributes format version");
+    }
+
+    std::vector<std::string> strings(r.count());
+    for (size_t i = 0; i < strings.size(); i++) {
+      strings[i] = r.string();
+    }
+
+    size_t entries = r.count();
+    for (size_t i = 0; i < entries; i++) {
+      uint64_t name = r.varint();
+      if (name >= strings.size()) {
+        throw std::runtime_error("Malformed binary ISMRMRD Meta attributes");
+      }
+      size_t values = r.count();
+      for (size_t j = 0; j < values; j++) {
+        unsigned char type = r.byte();
+        uint64_t u = r.varint();
+        char buffer[64];
+        if (type == META_LONG) {
+          h.append(strings[name].c_str(), static_cast<long>(unzigzag(u)));
+        } else if (type == META_DECIMAL) {
+          int64_t m = unzigzag(u);
+          int64_t e = unzigzag(r.varint());
+          if (m == 0 || m > max_significand || m < -max_significand || e > 22 || e < -22) {
+            throw std::runtime_error("Malformed binary ISMRMRD Meta attributes");
+          }
+          format_decimal(m, static_cast<int>(e), buffer);
+          h.append(strings[name].c_str(), DecodedValue(leading_long(buffer), decimal_value(m, static_cast<int>(e)), buffer));
+        } else if (type == META_STRING && u < strings.size()) {
+          h.append(strings[name].c_str(), strings[u].c_str());
+        } else {
+          throw std::runtime_error("Malformed binary ISMRMRD Meta attributes");
+        }
+      }
+    }
+    if (!r.at_end()) {
+      throw std::runtime_error("Trailing data after binary ISMRMRD Meta attributes");
+    }
+  }
+
   void deserialize(const char* xml, MetaContainer& h)
   {
+    if (is_binary_meta(xml)) {
+      deserialize_binary(xml, h);
+      return;
+    }
+
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load(xml);
     
@@ -42,14 +516,14 @@ namespace ISMRMRD
     pugi::xml_document doc;
     pugi::xml_node root = doc.append_child("ismrmrdMeta");
     
-    MetaContainer::map_t::iterator it = h.map_.begin();
-    while (it != h.map_.end()) {
+    MetaContainer::entries_t::iterator it = h.entries_.begin();
+    while (it != h.entries_.end()) {
       pugi::xml_node meta = root.append_child("meta");
       pugi::xml_node name = meta.append_child("name");
-      name.append_child(pugi::node_pcdata).set_value(it->first.c_str());
-      for (unsigned int i = 0; i < it->second.size(); i++) {
+      name.append_child(pugi::node_pcdata).set_value(it->name());
+      for (unsigned int i = 0; i < it->values.size(); i++) {
 	pugi::xml_node name = meta.append_child("value");
-	name.append_child(pugi::node_pcdata).set_value(it->second[i].as_str());
+	name.append_child(pugi::node_pcdata).set_value(it->values[i].as_str());
       }
       it++;
     }
@@ -0,0 +1,575 @@
+#include "ismrmrd/ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ISMRMRD {
+
+static const uint32_t RING_MAGIC = 0x474e5249; // "IRNG"
+static const uint32_t RING_VERSION = 1;
+
+// The control block takes the first page of the mapping, the messages follow
+static const size_t RING_PAGE = 4096;
+static const size_t RING_ALIGNMENT = 64;
+
+// Frame id of the filler before a message that starts over at the beginning
+static const uint16_t RING_PADDING = 0;
+
+// Polls before a waiting side goes to sleep
+static const int RING_SPINS = 100;
+
+// Producer and consumer positions live on separate cache lines. Both count
+// bytes from the creation of the ring and never wrap.
+struct RingControl {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    char pad0[48];
+
+    uint64_t head;              // bytes published by the producer
+    uint32_t head_seq;          // futex word, bumped on every publish
+    uint32_t consumer_waiting;  // the consumer sleeps on head_seq
+    char pad1[48];
+
+    uint64_t tail;              // bytes released by the consumer
+    uint32_t tail_seq;
+    uint32_t producer_waiting;
+    char pad2[48];
+};
+
+static std::string system_error(const char *what)
+{
+    return std::string("ISMRMRD ring ") + what + ": " + strerror(errno);
+}
+
+static size_t message_size(uint64_t length)
+{
+    return static_cast<size_t>((sizeof(StreamFrame) + length + RING_ALIGNMENT - 1) & ~(uint64_t)(RING_ALIGNMENT - 1));
+}
+
+static size_t traj_size(const ISMRMRD_AcquisitionHeader &head)
+{
+    return (size_t)head.number_of_samples * head.trajectory_dimensions * sizeof(float);
+}
+
+static size_t data_size(const ISMRMRD_AcquisitionHeader &head)
+{
+    return (size_t)head.number_of_samples * head.active_channels * sizeof(complex_float_t);
+}
+
+static size_t image_data_size(const ISMRMRD_ImageHeader &head)
+{
+    ISMRMRD_Image probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.head = head;
+    return ismrmrd_size_of_image_data(&probe);
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+static void futex_wait(uint32_t *word, uint32_t seen)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, NULL, NULL, 0);
+#else
+    (void)word;
+    (void)seen;
+    struct timespec pause = {0, 50000};
+    nanosleep(&pause, NULL);
+#endif
+}
+
+static void futex_wake(uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+// Waits until the other side has moved pos to at least target. The waiting
+// flag is raised before pos is checked a last time, and the other side bumps
+// seq before it looks at the flag, so a publish in between is never missed.
+static void wait_until(uint64_t *pos, uint64_t target, uint32_t *seq, uint32_t *waiting)
+{
+    for (int spin = 0;; spin++) {
+        if (__atomic_load_n(pos, __ATOMIC_ACQUIRE) >= target) {
+            return;
+        }
+        if (spin < RING_SPINS) {
+            cpu_relax();
+            continue;
+        }
+        uint32_t seen = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(pos, __ATOMIC_SEQ_CST) < target) {
+            futex_wait(seq, seen);
+        }
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void publish(uint64_t *pos, uint64_t value, uint32_t *seq, uint32_t *waiting)
+{
+    __atomic_store_n(pos, value, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(seq);
+    }
+}
+
+//
+// AcquisitionView class implementation
+//
+AcquisitionView::AcquisitionView()
+    : base_(NULL)
+{
+}
+
+AcquisitionView::AcquisitionView(char *base)
+    : base_(base)
+{
+}
+
+ISMRMRD_AcquisitionHeader &AcquisitionView::head()
+{
+    return *reinterpret_cast<ISMRMRD_AcquisitionHeader *>(base_);
+}
+
+const ISMRMRD_AcquisitionHeader &AcquisitionView::head() const
+{
+    return *reinterpret_cast<const ISMRMRD_AcquisitionHeader *>(base_);
+}
+
+float *AcquisitionView::getTrajPtr()
+{
+    return reinterpret_cast<float *>(base_ + sizeof(ISMRMRD_AcquisitionHeader));
+}
+
+const float *AcquisitionView::getTrajPtr() const
+{
+    return reinterpret_cast<const float *>(base_ + sizeof(ISMRMRD_AcquisitionHeader));
+}
+
+complex_float_t *AcquisitionView::getDataPtr()
+{
+    return reinterpret_cast<complex_float_t *>(base_ + sizeof(ISMRMRD_AcquisitionHeader) + getTrajSize());
+}
+
+const complex_float_t *AcquisitionView::getDataPtr() const
+{
+    return reinterpret_cast<const complex_float_t *>(base_ + sizeof(ISMRMRD_AcquisitionHeader) + getTrajSize());
+}
+
+size_t AcquisitionView::getTrajSize() const
+{
+    return traj_size(head());
+}
+
+size_t AcquisitionView::getDataSize() const
+{
+    return data_size(head());
+}
+
+size_t AcquisitionView::getNumberOfDataElements() const
+{
+    return (size_t)head().number_of_samples * head().active_channels;
+}
+
+void AcquisitionView::copyTo(Acquisition &acq) const
+{
+    acq.acq.head = head();
+    if (ismrmrd_make_consistent_acquisition(&acq.acq) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    memcpy(acq.acq.traj, getTrajPtr(), getTrajSize());
+    memcpy(acq.acq.data, getDataPtr(), getDataSize());
+}
+
+//
+// ImageView class implementation
+//
+ImageView::ImageView()
+    : base_(NULL)
+{
+}
+
+ImageView::ImageView(const char *base)
+    : base_(base)
+{
+}
+
+const ISMRMRD_ImageHeader &ImageView::head() const
+{
+    return *reinterpret_cast<const ISMRMRD_ImageHeader *>(base_);
+}
+
+const char *ImageView::getAttributeString() const
+{
+    return base_ + sizeof(ISMRMRD_ImageHeader);
+}
+
+size_t ImageView::getAttributeStringLength() const
+{
+    return head().attribute_string_len;
+}
+
+const void *ImageView::getDataPtr() const
+{
+    return base_ + sizeof(ISMRMRD_ImageHeader) + getAttributeStringLength();
+}
+
+size_t ImageView::getDataSize() const
+{
+    return image_data_size(head());
+}
+
+template <typename T> void ImageView::copyTo(Image<T> &im) const
+{
+    if (head().data_type != im.im.head.data_type) {
+        throw std::runtime_error("ISMRMRD ring image has a different data type");
+    }
+    im.im.head = head();
+    if (ismrmrd_make_consistent_image(&im.im) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    memcpy(im.im.attribute_string, getAttributeString(), getAttributeStringLength());
+    memcpy(im.im.data, getDataPtr(), getDataSize());
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void ImageView::copyTo(Image<uint16_t> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<int16_t> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<uint32_t> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<int32_t> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<float> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<double> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<complex_float_t> &im) const;
+template EXPORTISMRMRD void ImageView::copyTo(Image<complex_double_t> &im) const;
+
+//
+// SharedRing class implementation
+//
+SharedRing::SharedRing(const std::string &name, bool create, size_t capacity)
+    : name_(name)
+    , owner_(create)
+    , map_(NULL)
+    , map_size_(0)
+    , data_(NULL)
+    , capacity_(0)
+    , head_(0)
+    , reserved_(NULL)
+    , reserved_length_(0)
+    , tail_(0)
+    , current_(NULL)
+    , current_id_(0)
+    , current_length_(0)
+{
+    int fd;
+    if (create) {
+        capacity_ = (capacity + RING_PAGE - 1) / RING_PAGE * RING_PAGE;
+        if (capacity_ == 0) {
+            capacity_ = RING_PAGE;
+        }
+        map_size_ = RING_PAGE + capacity_;
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            throw std::runtime_error(system_error("could not be created"));
+        }
+        if (ftruncate(fd, static_cast<off_t>(map_size_)) != 0) {
+            std::string error = system_error("could not be sized");
+            ::close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error(error);
+        }
+    } else {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            throw std::runtime_error(system_error("could not be opened"));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= (off_t)RING_PAGE) {
+            ::close(fd);
+            throw std::runtime_error("ISMRMRD ring " + name + " is not a ring");
+        }
+        map_size_ = static_cast<size_t>(st.st_size);
+    }
+
+    void *map = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    std::string error = system_error("could not be mapped");
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        if (owner_) {
+            shm_unlink(name.c_str());
+        }
+        throw std::runtime_error(error);
+    }
+    map_ = static_cast<char *>(map);
+    data_ = map_ + RING_PAGE;
+
+    // A new mapping is zero filled, the magic number goes in last
+    RingControl *c = reinterpret_cast<RingControl *>(map_);
+    if (create) {
+        c->version = RING_VERSION;
+        c->capacity = capacity_;
+        __atomic_store_n(&c->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        if (__atomic_load_n(&c->magic, __ATOMIC_ACQUIRE) != RING_MAGIC || c->version != RING_VERSION
+            || c->capacity != map_size_ - RING_PAGE) {
+            munmap(map_, map_size_);
+            throw std::runtime_error("ISMRMRD ring " + name + " is not a ring");
+        }
+        capacity_ = static_cast<size_t>(c->capacity);
+        head_ = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+        tail_ = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+SharedRing::~SharedRing()
+{
+    munmap(map_, map_size_);
+    if (owner_) {
+        shm_unlink(name_.c_str());
+    }
+}
+
+size_t SharedRing::capacity() const
+{
+    return capacity_;
+}
+
+// Waits for room for a message with a payload of length bytes and writes its
+// frame. A message never wraps: if it does not fit before the end of the
+// ring, the rest of the ring is padded and the message goes at the start.
+char *SharedRing::reserve(uint16_t id, size_t length)
+{
+    if (reserved_ != NULL) {
+        throw std::runtime_error("ISMRMRD ring already has a message reserved");
+    }
+    size_t total = message_size(length);
+    if (total > capacity_) {
+        throw std::runtime_error("ISMRMRD ring message is larger than the ring");
+    }
+
+    RingControl *c = reinterpret_cast<RingControl *>(map_);
+    size_t pos = static_cast<size_t>(head_ % capacity_);
+    if (pos + total > capacity_) {
+        size_t pad = capacity_ - pos;
+        wait_until(&c->tail, head_ + pad - capacity_, &c->tail_seq, &c->producer_waiting);
+        StreamFrame filler;
+        memset(&filler, 0, sizeof(filler));
+        filler.id = RING_PADDING;
+        filler.length = pad - sizeof(filler);
+        memcpy(data_ + pos, &filler, sizeof(filler));
+        head_ += pad;
+        pos = 0;
+    }
+    if (head_ + total > capacity_) {
+        wait_until(&c->tail, head_ + total - capacity_, &c->tail_seq, &c->producer_waiting);
+    }
+
+    StreamFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.length = length;
+    memcpy(data_ + pos, &frame, sizeof(frame));
+    reserved_ = data_ + pos;
+    reserved_length_ = total;
+    return reserved_ + sizeof(frame);
+}
+
+AcquisitionView SharedRing::beginAcquisition(uint16_t num_samples, uint16_t active_channels,
+                                             uint16_t trajectory_dimensions)
+{
+    ISMRMRD_AcquisitionHeader head;
+    ismrmrd_init_acquisition_header(&head);
+    head.number_of_samples = num_samples;
+    head.active_channels = active_channels;
+    head.available_channels = active_channels;
+    head.trajectory_dimensions = trajectory_dimensions;
+
+    char *payload = reserve(STREAM_ACQUISITION, sizeof(head) + traj_size(head) + data_size(head));
+    memcpy(payload, &head, sizeof(head));
+    return AcquisitionView(payload);
+}
+
+void SharedRing::commit()
+{
+    if (reserved_ == NULL) {
+        throw std::runtime_error("ISMRMRD ring has no message reserved");
+    }
+    char *message = reserved_;
+    reserved_ = NULL;
+
+    StreamFrame frame;
+    memcpy(&frame, message, sizeof(frame));
+    if (frame.id == STREAM_ACQUISITION) {
+        const ISMRMRD_AcquisitionHeader *head =
+            reinterpret_cast<const ISMRMRD_AcquisitionHeader *>(message + sizeof(frame));
+        if (frame.length != sizeof(*head) + traj_size(*head) + data_size(*head)) {
+            throw std::runtime_error("ISMRMRD ring acquisition was resized after beginAcquisition");
+        }
+    }
+
+    head_ += reserved_length_;
+    RingControl *c = reinterpret_cast<RingControl *>(map_);
+    publish(&c->head, head_, &c->head_seq, &c->consumer_waiting);
+}
+
+void SharedRing::writeHeader(const std::string &xml)
+{
+    char *payload = reserve(STREAM_HEADER, xml.size());
+    memcpy(payload, xml.data(), xml.size());
+    commit();
+}
+
+void SharedRing::writeAcquisition(const Acquisition &acq)
+{
+    const ISMRMRD_AcquisitionHeader &head = acq.acq.head;
+    size_t traj = traj_size(head);
+    size_t data = data_size(head);
+    char *payload = reserve(STREAM_ACQUISITION, sizeof(head) + traj + data);
+    memcpy(payload, &head, sizeof(head));
+    memcpy(payload + sizeof(head), acq.acq.traj, traj);
+    memcpy(payload + sizeof(head) + traj, acq.acq.data, data);
+    commit();
+}
+
+template <typename T> void SharedRing::writeImage(const Image<T> &im)
+{
+    const ISMRMRD_ImageHeader &head = im.im.head;
+    size_t attr = head.attribute_string_len;
+    size_t data = image_data_size(head);
+    char *payload = reserve(STREAM_IMAGE, sizeof(head) + attr + data);
+    memcpy(payload, &head, sizeof(head));
+    memcpy(payload + sizeof(head), im.im.attribute_string, attr);
+    memcpy(payload + sizeof(head) + attr, im.im.data, data);
+    commit();
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<uint16_t> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<int16_t> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<uint32_t> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<int32_t> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<float> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<double> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<complex_float_t> &im);
+template EXPORTISMRMRD void SharedRing::writeImage(const Image<complex_double_t> &im);
+
+void SharedRing::close()
+{
+    reserve(STREAM_CLOSE, 0);
+    commit();
+}
+
+uint16_t SharedRing::nextMessage()
+{
+    release();
+    RingControl *c = reinterpret_cast<RingControl *>(map_);
+    for (;;) {
+        wait_until(&c->head, tail_ + 1, &c->head_seq, &c->consumer_waiting);
+        size_t pos = static_cast<size_t>(tail_ % capacity_);
+        StreamFrame frame;
+        memcpy(&frame, data_ + pos, sizeof(frame));
+        if (frame.length > capacity_ || message_size(frame.length) > capacity_ - pos) {
+            throw std::runtime_error("ISMRMRD ring message runs past the end of the ring");
+        }
+        if (frame.id == RING_PADDING) {
+            tail_ += message_size(frame.length);
+            publish(&c->tail, tail_, &c->tail_seq, &c->producer_waiting);
+            continue;
+        }
+        current_ = data_ + pos;
+        current_id_ = frame.id;
+        current_length_ = frame.length;
+        return current_id_;
+    }
+}
+
+AcquisitionView SharedRing::acquisition()
+{
+    expect(STREAM_ACQUISITION);
+    const ISMRMRD_AcquisitionHeader *head =
+        reinterpret_cast<const ISMRMRD_AcquisitionHeader *>(current_ + sizeof(StreamFrame));
+    if (current_length_ < sizeof(*head) || current_length_ != sizeof(*head) + traj_size(*head) + data_size(*head)) {
+        throw std::runtime_error("ISMRMRD ring acquisition length does not match its header");
+    }
+    return AcquisitionView(current_ + sizeof(StreamFrame));
+}
+
+ImageView SharedRing::image()
+{
+    expect(STREAM_IMAGE);
+    const ISMRMRD_ImageHeader *head = reinterpret_cast<const ISMRMRD_ImageHeader *>(current_ + sizeof(StreamFrame));
+    if (current_length_ < sizeof(*head)
+        || current_length_ != sizeof(*head) + head->attribute_string_len + image_data_size(*head)) {
+        throw std::runtime_error("ISMRMRD ring image length does not match its header");
+    }
+    return ImageView(current_ + sizeof(StreamFrame));
+}
+
+void SharedRing::readHeader(std::string &xml)
+{
+    expect(STREAM_HEADER);
+    xml.assign(current_ + sizeof(StreamFrame), static_cast<size_t>(current_length_));
+}
+
+void SharedRing::readAcquisition(Acquisition &acq)
+{
+    acquisition().copyTo(acq);
+}
+
+template <typename T> void SharedRing::readImage(Image<T> &im)
+{
+    image().copyTo(im);
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void SharedRing::readImage(Image<uint16_t> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<int16_t> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<uint32_t> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<int32_t> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<float> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<double> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<complex_float_t> &im);
+template EXPORTISMRMRD void SharedRing::readImage(Image<complex_double_t> &im);
+
+void SharedRing::release()
+{
+    if (current_ == NULL) {
+        return;
+    }
+    current_ = NULL;
+    tail_ += message_size(current_length_);
+    RingControl *c = reinterpret_cast<RingControl *>(map_);
+    publish(&c->tail, tail_, &c->tail_seq, &c->producer_waiting);
+}
+
+void SharedRing::expect(uint16_t id) const
+{
+    if (current_ == NULL || current_id_ != id) {
+        throw std::runtime_error("ISMRMRD ring message has a different id");
+    }
+}
+
+} // namespace ISMRMRD
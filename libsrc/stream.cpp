@@ -0,0 +1,547 @@
+#include "ismrmrd/stream.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Without it a reader that went away raises SIGPIPE instead of EPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace ISMRMRD {
+
+// Frame, header, trajectory and data of one acquisition
+static const size_t IOV_PER_ACQUISITION = 4;
+static const size_t ACQUISITIONS_PER_WRITE = IOV_MAX / IOV_PER_ACQUISITION;
+
+// Payload parts up to half of this are copied out of the read buffer,
+// larger ones are read straight into their destination
+static const size_t READ_BUFFER_SIZE = 65536;
+
+static std::string system_error(const char *what)
+{
+    return std::string("ISMRMRD stream ") + what + ": " + strerror(errno);
+}
+
+static StreamFrame make_frame(uint16_t id, uint64_t length)
+{
+    StreamFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.length = length;
+    return frame;
+}
+
+static void add_iov(struct iovec *iov, int &count, const void *base, size_t len)
+{
+    if (len > 0) {
+        iov[count].iov_base = const_cast<void *>(base);
+        iov[count].iov_len = len;
+        count++;
+    }
+}
+
+// Writes all of iov, picking up after short writes. Sockets go through
+// sendmsg for MSG_NOSIGNAL, anything else falls back to writev.
+static void write_all(int fd, bool &socket, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n;
+        if (socket) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (n < 0 && errno == ENOTSOCK) {
+                socket = false;
+                continue;
+            }
+        } else {
+            n = writev(fd, iov, count);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(system_error("write failed"));
+        }
+
+        size_t done = static_cast<size_t>(n);
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+//
+// StreamWriter class implementation
+//
+StreamWriter::StreamWriter(int fd)
+    : fd_(fd)
+    , socket_(true)
+    , bytes_(0)
+{
+    ismrmrd_init_compression_parameters(&compression_);
+    compression_.mode = ISMRMRD_COMPRESSION_NONE;
+}
+
+void StreamWriter::setCompression(const CompressionParameters &params)
+{
+    if (params.mode != ISMRMRD_COMPRESSION_NONE && ismrmrd_compression_flag(params.mode) == 0) {
+        throw std::runtime_error("Unknown ISMRMRD compression mode");
+    }
+    compression_ = params;
+    noise_stddev_.clear();
+    if (params.noise_stddev != NULL) {
+        noise_stddev_.assign(params.noise_stddev, params.noise_stddev + params.num_noise_channels);
+    }
+    compression_.noise_stddev = noise_stddev_.empty() ? NULL : &noise_stddev_[0];
+    compression_.num_noise_channels = static_cast<uint16_t>(noise_stddev_.size());
+}
+
+void StreamWriter::writeHeader(const std::string &xml)
+{
+    StreamFrame frame = make_frame(STREAM_HEADER, xml.size());
+    struct iovec iov[2];
+    int count = 0;
+    add_iov(iov, count, &frame, sizeof(frame));
+    add_iov(iov, count, xml.data(), xml.size());
+    write_all(fd_, socket_, iov, count);
+    bytes_ += sizeof(frame) + frame.length;
+}
+
+void StreamWriter::writeAcquisition(const Acquisition &acq)
+{
+    writeAcquisitions(&acq, 1);
+}
+
+void StreamWriter::writeAcquisitions(const Acquisition *acqs, size_t n)
+{
+    if (compression_.mode != ISMRMRD_COMPRESSION_NONE) {
+        writeCompressedAcquisitions(acqs, n);
+        return;
+    }
+
+    StreamFrame frames[ACQUISITIONS_PER_WRITE];
+    struct iovec iov[ACQUISITIONS_PER_WRITE * IOV_PER_ACQUISITION];
+
+    for (size_t first = 0; first < n; first += ACQUISITIONS_PER_WRITE) {
+        size_t batch = std::min(n - first, ACQUISITIONS_PER_WRITE);
+        int count = 0;
+        for (size_t i = 0; i < batch; i++) {
+            const ISMRMRD_Acquisition &acq = acqs[first + i].acq;
+            size_t traj_size = ismrmrd_size_of_acquisition_traj(&acq);
+            size_t data_size = ismrmrd_size_of_acquisition_data(&acq);
+            frames[i] = make_frame(STREAM_ACQUISITION, sizeof(acq.head) + traj_size + data_size);
+            add_iov(iov, count, &frames[i], sizeof(frames[i]));
+            add_iov(iov, count, &acq.head, sizeof(acq.head));
+            add_iov(iov, count, acq.traj, traj_size);
+            add_iov(iov, count, acq.data, data_size);
+            bytes_ += sizeof(frames[i]) + frames[i].length;
+        }
+        write_all(fd_, socket_, iov, count);
+    }
+}
+
+// Like writeAcquisitions, the data of each batch compressed into blocks_
+// and the headers copied to be flagged
+void StreamWriter::writeCompressedAcquisitions(const Acquisition *acqs, size_t n)
+{
+    StreamFrame frames[ACQUISITIONS_PER_WRITE];
+    ISMRMRD_AcquisitionHeader heads[ACQUISITIONS_PER_WRITE];
+    void *blocks[ACQUISITIONS_PER_WRITE];
+    size_t sizes[ACQUISITIONS_PER_WRITE];
+    struct iovec iov[ACQUISITIONS_PER_WRITE * IOV_PER_ACQUISITION];
+
+    for (size_t first = 0; first < n; first += ACQUISITIONS_PER_WRITE) {
+        size_t batch = std::min(n - first, ACQUISITIONS_PER_WRITE);
+        size_t total = 0;
+        for (size_t i = 0; i < batch; i++) {
+            sizes[i] = ismrmrd_size_of_compressed_data_bound(&acqs[first + i].acq);
+            total += sizes[i];
+        }
+        if (blocks_.size() < total) {
+            blocks_.resize(total);
+        }
+        total = 0;
+        for (size_t i = 0; i < batch; i++) {
+            blocks[i] = &blocks_[total];
+            total += sizes[i];
+        }
+        if (ismrmrd_compress_acquisitions(&acqs[first].acq, static_cast<uint32_t>(batch), &compression_,
+                                          blocks, sizes) != ISMRMRD_NOERROR) {
+            throw std::runtime_error(build_exception_string());
+        }
+
+        int count = 0;
+        for (size_t i = 0; i < batch; i++) {
+            const ISMRMRD_Acquisition &acq = acqs[first + i].acq;
+            size_t traj_size = ismrmrd_size_of_acquisition_traj(&acq);
+            heads[i] = acq.head;
+            heads[i].flags |= ismrmrd_compression_flag(compression_.mode);
+            frames[i] = make_frame(STREAM_ACQUISITION, sizeof(acq.head) + traj_size + sizes[i]);
+            add_iov(iov, count, &frames[i], sizeof(frames[i]));
+            add_iov(iov, count, &heads[i], sizeof(heads[i]));
+            add_iov(iov, count, acq.traj, traj_size);
+            add_iov(iov, count, blocks[i], sizes[i]);
+            bytes_ += sizeof(frames[i]) + frames[i].length;
+        }
+        write_all(fd_, socket_, iov, count);
+    }
+}
+
+template <typename T> void StreamWriter::writeImage(const Image<T> &im)
+{
+    size_t attr_size = im.im.head.attribute_string_len;
+    size_t data_size = ismrmrd_size_of_image_data(&im.im);
+    StreamFrame frame = make_frame(STREAM_IMAGE, sizeof(im.im.head) + attr_size + data_size);
+    struct iovec iov[4];
+    int count = 0;
+    add_iov(iov, count, &frame, sizeof(frame));
+    add_iov(iov, count, &im.im.head, sizeof(im.im.head));
+    add_iov(iov, count, im.im.attribute_string, attr_size);
+    add_iov(iov, count, im.im.data, data_size);
+    write_all(fd_, socket_, iov, count);
+    bytes_ += sizeof(frame) + frame.length;
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<uint16_t> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<int16_t> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<uint32_t> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<int32_t> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<float> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<double> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<complex_float_t> &im);
+template EXPORTISMRMRD void StreamWriter::writeImage(const Image<complex_double_t> &im);
+
+template <typename T> void StreamWriter::writeNDArray(const NDArray<T> &arr)
+{
+    StreamNDArrayHeader head;
+    memset(&head, 0, sizeof(head));
+    head.version = arr.arr.version;
+    head.data_type = arr.arr.data_type;
+    head.ndim = arr.arr.ndim;
+    for (uint16_t n = 0; n < arr.arr.ndim; n++) {
+        head.dims[n] = arr.arr.dims[n];
+    }
+    size_t data_size = ismrmrd_size_of_ndarray_data(&arr.arr);
+    StreamFrame frame = make_frame(STREAM_NDARRAY, sizeof(head) + data_size);
+    struct iovec iov[3];
+    int count = 0;
+    add_iov(iov, count, &frame, sizeof(frame));
+    add_iov(iov, count, &head, sizeof(head));
+    add_iov(iov, count, arr.arr.data, data_size);
+    write_all(fd_, socket_, iov, count);
+    bytes_ += sizeof(frame) + frame.length;
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<uint16_t> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<int16_t> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<uint32_t> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<int32_t> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<float> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<double> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<complex_float_t> &arr);
+template EXPORTISMRMRD void StreamWriter::writeNDArray(const NDArray<complex_double_t> &arr);
+
+void StreamWriter::close()
+{
+    StreamFrame frame = make_frame(STREAM_CLOSE, 0);
+    struct iovec iov[1];
+    int count = 0;
+    add_iov(iov, count, &frame, sizeof(frame));
+    write_all(fd_, socket_, iov, count);
+    bytes_ += sizeof(frame);
+}
+
+uint64_t StreamWriter::bytesWritten() const
+{
+    return bytes_;
+}
+
+//
+// StreamReader class implementation
+//
+StreamReader::StreamReader(int fd)
+    : fd_(fd)
+    , buf_(READ_BUFFER_SIZE)
+    , pos_(0)
+    , end_(0)
+    , id_(0)
+    , remaining_(0)
+    , bytes_(0)
+{
+}
+
+uint16_t StreamReader::nextMessage()
+{
+    finish();
+    if (!fill(sizeof(StreamFrame))) {
+        if (pos_ != end_) {
+            throw std::runtime_error("ISMRMRD stream ended inside a message frame");
+        }
+        id_ = STREAM_CLOSE;
+        return id_;
+    }
+
+    StreamFrame frame;
+    memcpy(&frame, &buf_[pos_], sizeof(frame));
+    pos_ += sizeof(frame);
+    id_ = frame.id;
+    remaining_ = frame.length;
+    bytes_ += sizeof(frame) + frame.length;
+    return id_;
+}
+
+uint64_t StreamReader::messageLength() const
+{
+    return remaining_;
+}
+
+void StreamReader::readHeader(std::string &xml)
+{
+    expect(STREAM_HEADER);
+    xml.resize(remaining_);
+    if (!xml.empty()) {
+        take(&xml[0], xml.size());
+    }
+}
+
+void StreamReader::readAcquisition(Acquisition &acq)
+{
+    expect(STREAM_ACQUISITION);
+
+    // Sizes are checked on a copy of the header before anything is allocated
+    ISMRMRD_Acquisition probe;
+    memset(&probe, 0, sizeof(probe));
+    take(&probe.head, sizeof(probe.head));
+    size_t traj_size = ismrmrd_size_of_acquisition_traj(&probe);
+    size_t data_size = ismrmrd_size_of_acquisition_data(&probe);
+    bool compressed = ismrmrd_is_compressed(&probe.head);
+    if (compressed) {
+        data_size = static_cast<size_t>(remaining_ - std::min<uint64_t>(remaining_, traj_size));
+        if (data_size > ismrmrd_size_of_compressed_data_bound(&probe)) {
+            throw std::runtime_error("ISMRMRD stream acquisition length does not match its header");
+        }
+        probe.head.flags &= ~(ismrmrd_compression_flag(ISMRMRD_COMPRESSION_LOSSLESS)
+                              | ismrmrd_compression_flag(ISMRMRD_COMPRESSION_NEAR_LOSSLESS));
+    }
+    if (remaining_ != traj_size + data_size) {
+        throw std::runtime_error("ISMRMRD stream acquisition length does not match its header");
+    }
+
+    acq.acq.head = probe.head;
+    if (ismrmrd_make_consistent_acquisition(&acq.acq) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    take(acq.acq.traj, traj_size);
+    if (!compressed) {
+        take(acq.acq.data, data_size);
+        return;
+    }
+    if (block_.size() <= data_size) {
+        block_.resize(data_size + 1);
+    }
+    take(&block_[0], data_size);
+    if (ismrmrd_decompress_acquisition_data(&block_[0], data_size, &acq.acq) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+template <typename T> void StreamReader::readImage(Image<T> &im)
+{
+    expect(STREAM_IMAGE);
+
+    ISMRMRD_Image probe;
+    memset(&probe, 0, sizeof(probe));
+    take(&probe.head, sizeof(probe.head));
+    if (probe.head.data_type != im.im.head.data_type) {
+        throw std::runtime_error("ISMRMRD stream image has a different data type");
+    }
+    size_t attr_size = probe.head.attribute_string_len;
+    size_t data_size = ismrmrd_size_of_image_data(&probe);
+    if (remaining_ != attr_size + data_size) {
+        throw std::runtime_error("ISMRMRD stream image length does not match its header");
+    }
+
+    im.im.head = probe.head;
+    if (ismrmrd_make_consistent_image(&im.im) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    take(im.im.attribute_string, attr_size);
+    take(im.im.data, data_size);
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void StreamReader::readImage(Image<uint16_t> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<int16_t> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<uint32_t> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<int32_t> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<float> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<double> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<complex_float_t> &im);
+template EXPORTISMRMRD void StreamReader::readImage(Image<complex_double_t> &im);
+
+template <typename T> void StreamReader::readNDArray(NDArray<T> &arr)
+{
+    expect(STREAM_NDARRAY);
+
+    StreamNDArrayHeader head;
+    take(&head, sizeof(head));
+    if (head.data_type != arr.arr.data_type) {
+        throw std::runtime_error("ISMRMRD stream array has a different data type");
+    }
+    if (head.ndim > ISMRMRD_NDARRAY_MAXDIM) {
+        throw std::runtime_error("ISMRMRD stream array has too many dimensions");
+    }
+    // Counted in 64 bits, a corrupt header must not wrap around to a valid length
+    uint64_t elements = head.ndim > 0 ? 1 : 0;
+    for (uint16_t n = 0; n < head.ndim; n++) {
+        if (head.dims[n] != 0 && elements > UINT64_MAX / sizeof(T) / head.dims[n]) {
+            throw std::runtime_error("ISMRMRD stream array is too large");
+        }
+        elements *= head.dims[n];
+    }
+    if (remaining_ != elements * sizeof(T)) {
+        throw std::runtime_error("ISMRMRD stream array length does not match its header");
+    }
+
+    arr.arr.version = head.version;
+    arr.arr.ndim = head.ndim;
+    for (uint16_t n = 0; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+        arr.arr.dims[n] = n < head.ndim ? head.dims[n] : 1;
+    }
+    if (ismrmrd_make_consistent_ndarray(&arr.arr) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    take(arr.arr.data, remaining_);
+}
+
+// Specific instantiations
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<uint16_t> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<int16_t> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<uint32_t> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<int32_t> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<float> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<double> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<complex_float_t> &arr);
+template EXPORTISMRMRD void StreamReader::readNDArray(NDArray<complex_double_t> &arr);
+
+uint64_t StreamReader::bytesRead() const
+{
+    return bytes_;
+}
+
+void StreamReader::expect(uint16_t id)
+{
+    if (id_ != id) {
+        throw std::runtime_error("ISMRMRD stream message has a different id");
+    }
+}
+
+// Copies the next n bytes of the current message to dst
+void StreamReader::take(void *dst, size_t n)
+{
+    if (n > remaining_) {
+        throw std::runtime_error("ISMRMRD stream message is shorter than its header");
+    }
+    remaining_ -= n;
+
+    char *out = static_cast<char *>(dst);
+    size_t buffered = std::min(n, end_ - pos_);
+    if (buffered > 0) {
+        memcpy(out, &buf_[pos_], buffered);
+        pos_ += buffered;
+        out += buffered;
+        n -= buffered;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    if (n < buf_.size() / 2) {
+        if (!fill(n)) {
+            throw std::runtime_error("ISMRMRD stream ended inside a message");
+        }
+        memcpy(out, &buf_[pos_], n);
+        pos_ += n;
+        return;
+    }
+
+    while (n > 0) {
+        ssize_t r = ::read(fd_, out, n);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(system_error("read failed"));
+        }
+        if (r == 0) {
+            throw std::runtime_error("ISMRMRD stream ended inside a message");
+        }
+        out += r;
+        n -= r;
+    }
+}
+
+// Makes at least n bytes available in the buffer, false if the stream ends first
+bool StreamReader::fill(size_t n)
+{
+    if (end_ - pos_ >= n) {
+        return true;
+    }
+    if (pos_ > 0) {
+        memmove(&buf_[0], &buf_[pos_], end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+    }
+    while (end_ < n) {
+        ssize_t r = ::read(fd_, &buf_[end_], buf_.size() - end_);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(system_error("read failed"));
+        }
+        if (r == 0) {
+            return false;
+        }
+        end_ += r;
+    }
+    return true;
+}
+
+// Skips whatever the caller did not read of the current message
+void StreamReader::finish()
+{
+    while (remaining_ > 0) {
+        if (pos_ == end_ && !fill(1)) {
+            throw std::runtime_error("ISMRMRD stream ended inside a message");
+        }
+        size_t skip = static_cast<size_t>(std::min<uint64_t>(remaining_, end_ - pos_));
+        pos_ += skip;
+        remaining_ -= skip;
+    }
+}
+
+} // namespace ISMRMRD
@@ -1,722 +1,879 @@
 #include "ismrmrd/xml.h"
 #include "ismrmrd/version.h"
+#include "xml_fields.h"
 #include "pugixml.hpp"
 #include <cstdlib>
+#include <climits>
+#include <clocale>
+#include <cfloat>
+#include <algorithm>
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define ISMRMRD_XML_THREAD_LOCAL thread_local
+#endif
 
 namespace ISMRMRD
 {
-  //Utility Functions for deserializing Header
-  EncodingSpace parse_encoding_space(pugi::xml_node& n, const char* child) 
-  {
-    EncodingSpace e;
-    pugi::xml_node encodingSpace = n.child(child);
-    pugi::xml_node matrixSize = encodingSpace.child("matrixSize");
-    pugi::xml_node fieldOfView_mm = encodingSpace.child("fieldOfView_mm");
-    
-    if (!matrixSize) {
-      throw std::runtime_error("matrixSize not found in encodingSpace");
-    } else {
-      e.matrixSize.x = std::atoi(matrixSize.child_value("x"));
-      e.matrixSize.y = std::atoi(matrixSize.child_value("y"));
-      e.matrixSize.z = std::atoi(matrixSize.child_value("z"));
-    }
-
-    if (!fieldOfView_mm) {
-      throw std::runtime_error("fieldOfView_mm not found in encodingSpace");
-    } else {
-      e.fieldOfView_mm.x = std::atof(fieldOfView_mm.child_value("x"));
-      e.fieldOfView_mm.y = std::atof(fieldOfView_mm.child_value("y"));
-      e.fieldOfView_mm.z = std::atof(fieldOfView_mm.child_value("z"));
-    }
-
-    return e;
-  }
-  
-  Optional<Limit> parse_encoding_limit(pugi::xml_node& n, const char* child) 
+  //Locale independent number parsing. Like std::from_chars the decimal point is
+  //always '.', unlike it leading white space is skipped and trailing characters
+  //are ignored so the values parse the same way std::atol/std::atof did in the C locale.
+  static const char* skip_space(const char* p)
   {
-    Optional<Limit> o;
-    pugi::xml_node nc = n.child(child);
-    
-    if (nc) {
-      Limit l;
-      l.minimum = std::atoi(nc.child_value("minimum"));
-      l.maximum = std::atoi(nc.child_value("maximum"));
-      l.center = std::atoi(nc.child_value("center"));
-      o = l;
-    }
-
-    return o;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f' || *p == '\v') {
+      p++;
+    }
+    return p;
   }
 
-  std::string parse_string(pugi::xml_node& n, const char* child) 
+  long parse_long(const char* s)
   {
-    std::string r(n.child_value(child));
-    if (r.size() == 0) throw std::runtime_error("Null length string");
-    return r;
-  }
+    const char* p = skip_space(s);
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+      negative = (*p == '-');
+      p++;
+    }
 
-  Optional<std::string> parse_optional_string(pugi::xml_node& n, const char* child)
-  {
-    std::string s(n.child_value(child));
-    Optional<std::string> r;
-    if (s.size()) r = s;
-    return r;
+    unsigned long limit = negative ? 0ul - static_cast<unsigned long>(LONG_MIN) : static_cast<unsigned long>(LONG_MAX);
+    unsigned long v = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+      unsigned long digit = static_cast<unsigned long>(*p - '0');
+      if (v > (limit - digit) / 10) {
+        return negative ? LONG_MIN : LONG_MAX;
+      }
+      v = v * 10 + digit;
+    }
+    return negative ? static_cast<long>(0ul - v) : static_cast<long>(v);
   }
 
-  Optional<float> parse_optional_float(pugi::xml_node& n, const char* child)
+  static double parse_double_slow(const char* s)
   {
-    Optional<float> r;
-    pugi::xml_node nc = n.child(child);
-    if (nc) {
-      r = std::atof(nc.child_value());
+    //strtod honours LC_NUMERIC, so present it the decimal point it expects
+    const char* point = std::localeconv()->decimal_point;
+    if (point[0] == '.' && point[1] == '\0') {
+      return std::strtod(s, NULL);
     }
-    return r;
-  }
-
-  Optional<long> parse_optional_long(pugi::xml_node& n, const char* child) {
-    Optional<long> r;
-    pugi::xml_node nc = n.child(child);
-    if (nc) {
-      r = std::atol(nc.child_value());
+    std::string local(s);
+    size_t pos = local.find('.');
+    if (pos != std::string::npos) {
+      local.replace(pos, 1, point);
     }
-    return r;
+    return std::strtod(local.c_str(), NULL);
   }
 
-  Optional<unsigned short> parse_optional_ushort(pugi::xml_node& n, const char* child) {
-    Optional<unsigned short> r;
-    pugi::xml_node nc = n.child(child);
-    if (nc) {
-      r = static_cast<unsigned short>(std::atoi(nc.child_value()));
+  double parse_double(const char* s)
+  {
+    //Clinger's fast path: a mantissa of at most 53 bits scaled by an exactly
+    //representable power of ten is correctly rounded with a single operation.
+    static const double powers[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* p = skip_space(s);
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+      negative = (*p == '-');
+      p++;
+    }
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+      return parse_double_slow(s);
     }
-    return r;
-  }
 
-  std::vector<float> parse_vector_float(pugi::xml_node& n, const char* child) 
-  {
-    std::vector<float> r;
-    
-    pugi::xml_node nc = n.child(child);
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; *p >= '0' && *p <= '9'; p++) {
+      any = true;
+      if (mantissa == 0 && *p == '0') continue;
+      if (digits >= 19) return parse_double_slow(s);
+      mantissa = mantissa * 10 + static_cast<unsigned long long>(*p - '0');
+      digits++;
+    }
+    if (*p == '.') {
+      for (p++; *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if (mantissa == 0 && *p == '0') {
+          exponent--;
+          continue;
+        }
+        if (digits >= 19) return parse_double_slow(s);
+        mantissa = mantissa * 10 + static_cast<unsigned long long>(*p - '0');
+        digits++;
+        exponent--;
+      }
+    }
+    if (!any) {
+      //inf, nan, hexadecimal or garbage
+      return parse_double_slow(s);
+    }
+    if (*p == 'e' || *p == 'E') {
+      const char* q = p + 1;
+      bool exp_negative = false;
+      if (*q == '-' || *q == '+') {
+        exp_negative = (*q == '-');
+        q++;
+      }
+      if (*q >= '0' && *q <= '9') {
+        int e = 0;
+        for (; *q >= '0' && *q <= '9'; q++) {
+          if (e > 10000) return parse_double_slow(s);
+          e = e * 10 + (*q - '0');
+        }
+        exponent += exp_negative ? -e : e;
+      }
+    }
 
-    while (nc) {
-      float f = std::atof(nc.child_value());
-      r.push_back(f);
-      nc = nc.next_sibling(child);
+    if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+      if (mantissa == 0) return negative ? -0.0 : 0.0;
+      return parse_double_slow(s);
     }
-    
-    return r;
-  }
 
-  std::vector<std::string> parse_vector_string(pugi::xml_node& n, const char* child)
-  {
-    std::vector<std::string> r;
-    pugi::xml_node nc = n.child(child);
-    while (nc) {
-      std::string s = nc.child_value();
-      r.push_back(s);
-      nc = nc.next_sibling(child);
-    }
-    return r;
+    double v = static_cast<double>(mantissa);
+    v = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+    return negative ? -v : v;
   }
 
-  std::vector<UserParameterLong> parse_user_parameter_long(pugi::xml_node& n, const char* child) 
+  //Parses all user parameters in a single pass over the children of n
+  void parse_user_parameters(pugi::xml_node& n, UserParameters& p)
   {
-    std::vector<UserParameterLong> r;
-    pugi::xml_node nc = n.child(child);
-    while (nc) {
-      UserParameterLong v;
+    for (pugi::xml_node nc = n.first_child(); nc; nc = nc.next_sibling()) {
+      const char* type = nc.name();
+      if (strncmp(type, "userParameter", 13) != 0) {
+        continue;
+      }
+      type += 13;
+
       pugi::xml_node name = nc.child("name");
       pugi::xml_node value = nc.child("value");
 
-      if (!name || !value) {
-	throw std::runtime_error("Malformed user parameter (long)");
+      if (strcmp(type, "Long") == 0) {
+        if (!name || !value) {
+          throw std::runtime_error("Malformed user parameter (long)");
+        }
+        p.userParameterLong.push_back(UserParameterLong());
+        p.userParameterLong.back().name = name.child_value();
+        p.userParameterLong.back().value = parse_long(value.child_value());
+      } else if (strcmp(type, "Double") == 0) {
+        if (!name || !value) {
+          throw std::runtime_error("Malformed user parameter (double)");
+        }
+        p.userParameterDouble.push_back(UserParameterDouble());
+        p.userParameterDouble.back().name = name.child_value();
+        p.userParameterDouble.back().value = parse_double(value.child_value());
+      } else if (strcmp(type, "String") == 0 || strcmp(type, "Base64") == 0) {
+        if (!name || !value) {
+          throw std::runtime_error("Malformed user parameter (string)");
+        }
+        std::vector<UserParameterString>& v = (type[0] == 'S') ? p.userParameterString : p.userParameterBase64;
+        v.push_back(UserParameterString());
+        v.back().name = name.child_value();
+        v.back().value = value.child_value();
       }
-
-      v.name = std::string(name.child_value());
-      v.value = std::atoi(value.child_value());
-
-      r.push_back(v);
-
-      nc = nc.next_sibling(child);
     }
-    return r;
   }
 
-  std::vector<UserParameterDouble> parse_user_parameter_double(pugi::xml_node& n, const char* child) 
+  //Buffer the document is parsed in. It is kept per thread so repeated calls
+  //do not allocate once it has grown to the size of the largest header seen.
+  static std::vector<char>* parse_arena(std::vector<char>& fallback)
   {
-    std::vector<UserParameterDouble> r;
-    pugi::xml_node nc = n.child(child);
-    while (nc) {
-      UserParameterDouble v;
-      pugi::xml_node name = nc.child("name");
-      pugi::xml_node value = nc.child("value");
-
-      if (!name || !value) {
-	throw std::runtime_error("Malformed user parameter (double)");
-      }
-
-      char buffer[10000];
-      memcpy(buffer,name.child_value(),strlen(name.child_value())+1);
-      v.name = name.child_value();
-      v.value = std::atof(value.child_value());
+#ifdef ISMRMRD_XML_THREAD_LOCAL
+    static ISMRMRD_XML_THREAD_LOCAL std::vector<char> arena;
+    (void)fallback;
+    return &arena;
+#else
+    return &fallback;
+#endif
+  }
 
-      r.push_back(v);
+  static void deserialize_document(pugi::xml_document& doc, IsmrmrdHeader& h, unsigned int sections);
 
-      nc = nc.next_sibling(child);
-    }
-   
-    return r;
+  void deserialize(const char* xml, IsmrmrdHeader& h) 
+  {
+    deserialize(xml, strlen(xml), h);
   }
 
-  std::vector<UserParameterString> parse_user_parameter_string(pugi::xml_node& n, const char* child) 
+  void deserialize(const char* xml, size_t len, IsmrmrdHeader& h, unsigned int sections)
   {
-    std::vector<UserParameterString> r;
-    pugi::xml_node nc = n.child(child);
-    while (nc) {
-      UserParameterString v;
-      pugi::xml_node name = nc.child("name");
-      pugi::xml_node value = nc.child("value");
+    //Parse in place in the arena rather than in a fresh copy of the input
+    std::vector<char> fallback;
+    std::vector<char>& arena = *parse_arena(fallback);
+    if (arena.size() < len + 1) {
+      arena.resize(len + 1);
+    }
+    memcpy(&arena[0], xml, len);
+    arena[len] = '\0';
 
-      if (!name || !value) {
-	throw std::runtime_error("Malformed user parameter (string)");
-      }
+    pugi::xml_document doc;
+    pugi::xml_parse_result result = doc.load_buffer_inplace(&arena[0], len);
 
-      v.name = std::string(name.child_value());
-      v.value = std::string(value.child_value());
+    if (!result) {
+      throw std::runtime_error("Unable to load ISMRMRD XML header");
+    }
 
-      r.push_back(v);
+    deserialize_document(doc, h, sections);
+  }
 
-      nc = nc.next_sibling(child);
+  //Reads the elements of a struct through its field table. The children are
+  //expected in schema order and are found with a cursor, anything out of
+  //order is still found by name at the cost of a search.
+  class XmlReader
+  {
+  public:
+    XmlReader(pugi::xml_node parent, unsigned int sections)
+      : parent_(parent)
+      , next_(element_at(parent.first_child()))
+      , sections_(sections)
+    {
     }
-   
-    return r;
-  }
 
-  //End of utility functions for deserializing header
+    void begin() { }
+    void end() { }
 
-  void deserialize(const char* xml, IsmrmrdHeader& h) 
-  {
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load(xml);
-    
-    if (!result) {
-      throw std::runtime_error("Unable to load ISMRMRD XML header");
+    template <class T> void operator()(const char* name, T& v)
+    {
+      read(name, find(name), v);
     }
 
-    pugi::xml_node root = doc.child("ismrmrdHeader");
+    template <class T> void operator()(const char* name, Optional<T>& v)
+    {
+      pugi::xml_node n = find(name);
+      if (n) {
+        //Read in place rather than copying a decoded section
+        v = T();
+        read(name, n, v.get());
+      }
+    }
 
-    if (root) {
-      pugi::xml_node subjectInformation = root.child("subjectInformation");
-      pugi::xml_node studyInformation = root.child("studyInformation");
-      pugi::xml_node measurementInformation = root.child("measurementInformation");
-      pugi::xml_node acquisitionSystemInformation = root.child("acquisitionSystemInformation");
-      pugi::xml_node experimentalConditions = root.child("experimentalConditions");
-      pugi::xml_node encoding = root.child("encoding");
-      pugi::xml_node sequenceParameters = root.child("sequenceParameters");
-      pugi::xml_node userParameters = root.child("userParameters");
-
-      // Parsing version
-      h.version = parse_optional_long(root, "version");
-      
-      //Parsing experimentalConditions
-      if (!experimentalConditions) {
-	throw std::runtime_error("experimentalConditions not defined in ismrmrdHeader");
-      } else {
-	ExperimentalConditions e;
-	e.H1resonanceFrequency_Hz = std::atol(experimentalConditions.child_value("H1resonanceFrequency_Hz"));
-	h.experimentalConditions = e;
+    //Empty optional strings read as absent
+    void operator()(const char* name, Optional<std::string>& v)
+    {
+      const char* s = find(name).child_value();
+      if (*s) {
+        v = std::string();
+        v.get().assign(s);
       }
-      
-      //Parsing encoding section
-      if (!encoding) {
-	throw std::runtime_error("encoding section not found in ismrmrdHeader");
-      } else {
-	while (encoding) {
-	  Encoding e;
-	  
-	  try {
-	    e.encodedSpace = parse_encoding_space(encoding,"encodedSpace");
-	    e.reconSpace = parse_encoding_space(encoding,"reconSpace");
-	  } catch (std::runtime_error& e) {
-	    std::cout << "Unable to parse encoding section: " << e.what() << std::endl;
-	    throw;
-	  }
-
-	  pugi::xml_node encodingLimits = encoding.child("encodingLimits");
-	  
-	  if (!encodingLimits) {
-	    throw std::runtime_error("encodingLimits not found in encoding section");
-	  } else {
-	    e.encodingLimits.kspace_encoding_step_0 = parse_encoding_limit(encodingLimits,"kspace_encoding_step_0");
-	    e.encodingLimits.kspace_encoding_step_1 = parse_encoding_limit(encodingLimits,"kspace_encoding_step_1");
-	    e.encodingLimits.kspace_encoding_step_2 = parse_encoding_limit(encodingLimits,"kspace_encoding_step_2");
-	    e.encodingLimits.average                = parse_encoding_limit(encodingLimits,"average");
-	    e.encodingLimits.slice                  = parse_encoding_limit(encodingLimits,"slice");
-	    e.encodingLimits.contrast               = parse_encoding_limit(encodingLimits,"contrast");
-	    e.encodingLimits.phase                  = parse_encoding_limit(encodingLimits,"phase");
-	    e.encodingLimits.repetition             = parse_encoding_limit(encodingLimits,"repetition");
-	    e.encodingLimits.set                    = parse_encoding_limit(encodingLimits,"set");
-	    e.encodingLimits.segment                = parse_encoding_limit(encodingLimits,"segment");
-	  }
-	  
-	  pugi::xml_node trajectory = encoding.child("trajectory");
-	  if (!trajectory) {
-	    throw std::runtime_error("trajectory not found in encoding section");
-	  } else {
-	    e.trajectory = std::string(encoding.child_value("trajectory"));
-	  }
-
-	  pugi::xml_node trajectoryDescription = encoding.child("trajectoryDescription");
-	  
-	  if (trajectoryDescription) {
-	    TrajectoryDescription traj;
-	    try {
-	      traj.identifier = parse_string(trajectoryDescription,"identifier");
-	      traj.userParameterLong = 
-		parse_user_parameter_long(trajectoryDescription, "userParameterLong");
-	      traj.userParameterDouble = 
-		parse_user_parameter_double(trajectoryDescription, "userParameterDouble");
-	      traj.comment = parse_optional_string(trajectoryDescription, "comment");
-	      e.trajectoryDescription = traj;
-	    } catch (std::runtime_error& e) {
-	      std::cout << "Error parsing trajectory description" << std::endl;
-	      throw;
-	    }
-	    
-	  }
-
-	  pugi::xml_node parallelImaging = encoding.child("parallelImaging");
-	  if (parallelImaging) {
-	    ParallelImaging info;
-	    
-	    pugi::xml_node accelerationFactor = parallelImaging.child("accelerationFactor");
-	    if (!accelerationFactor) {
-	      throw std::runtime_error("Unable to accelerationFactor section in parallelImaging");
-	    } else {
-	      info.accelerationFactor.kspace_encoding_step_1 = static_cast<unsigned short>(std::atoi(accelerationFactor.child_value("kspace_encoding_step_1")));
-	      info.accelerationFactor.kspace_encoding_step_2 = static_cast<unsigned short>(std::atoi(accelerationFactor.child_value("kspace_encoding_step_2")));
-	    }
-	    
-	    info.calibrationMode = parse_optional_string(parallelImaging,"calibrationMode");
-	    info.interleavingDimension = parse_optional_string(parallelImaging,"interleavingDimension");
-	    e.parallelImaging = info;
-	  }
-
-	  e.echoTrainLength = parse_optional_long(encoding, "echoTrainLength");
-
-	  h.encoding.push_back(e);
-	  encoding = encoding.next_sibling("encoding");
-	}
+    }
 
+    template <class T> void operator()(const char* name, std::vector<T>& v)
+    {
+      pugi::xml_node last;
+      for (pugi::xml_node n = parent_.child(name); n; n = n.next_sibling(name)) {
+        v.push_back(T());
+        read(name, n, v.back());
+        last = n;
+      }
+      if (last) {
+        next_ = element_at(last.next_sibling());
       }
+    }
 
-      if (subjectInformation) {
-	SubjectInformation info;
-	info.patientName = parse_optional_string(subjectInformation, "patientName");
-	info.patientWeight_kg = parse_optional_float(subjectInformation, "patientWeight_kg");
-	info.patientID = parse_optional_string(subjectInformation, "patientID");
-	info.patientBirthdate = parse_optional_string(subjectInformation, "patientBirthdate");
-	info.patientGender = parse_optional_string(subjectInformation, "patientGender");
-	h.subjectInformation = info;
+    template <class T> void operator()(const char* name, Optional<std::vector<T> >& v)
+    {
+      std::vector<T> r;
+      (*this)(name, r);
+      if (!r.empty()) {
+        v = r;
       }
+    }
 
-      if (studyInformation) {
-	StudyInformation info;
-	info.studyDate = parse_optional_string(studyInformation,"studyDate");
-	info.studyTime = parse_optional_string(studyInformation,"studyTime");
-	info.studyID = parse_optional_string(studyInformation,"studyID");
-	info.accessionNumber = parse_optional_long(studyInformation,"accessionNumber");
-	info.referringPhysicianName = parse_optional_string(studyInformation,"referringPhysicianName");
-	info.studyDescription = parse_optional_string(studyInformation,"studyDescription");
-	info.studyInstanceUID = parse_optional_string(studyInformation,"studyInstanceUID");
-	h.studyInformation = info;
+    template <class T> void section(unsigned int section, const char* name, T& v)
+    {
+      if (sections_ & section) {
+        (*this)(name, v);
       }
+    }
 
-      if (measurementInformation) {
-	MeasurementInformation info;
-	info.measurementID = parse_optional_string(measurementInformation,"measurementID");
-	info.seriesDate = parse_optional_string(measurementInformation, "seriesDate");
-	info.seriesTime = parse_optional_string(measurementInformation, "seriesTime");
-	info.patientPosition = parse_string(measurementInformation, "patientPosition");
-	info.initialSeriesNumber = parse_optional_long(measurementInformation, "initialSeriesNumber");
-	info.protocolName = parse_optional_string(measurementInformation, "protocolName");
-	info.seriesDescription = parse_optional_string(measurementInformation, "seriesDescription");
-	
-	pugi::xml_node measurementDependency = measurementInformation.child("measurementDependency");
-	while (measurementDependency) {
-	  try {
-	    MeasurementDependency d;
-	    d.measurementID = parse_string(measurementDependency,"measurementID");
-	    d.dependencyType = parse_string(measurementDependency,"dependencyType");
-	    info.measurementDependency.push_back(d);
-	  } catch (std::runtime_error& e) {
-	    std::cout << "Error parsing measurement dependency: " << e.what() << std::endl;
-	    throw;
-	  } 
-	  measurementDependency = measurementDependency.next_sibling("measurementDependency");
-	}
-
-	info.seriesInstanceUIDRoot = parse_optional_string(measurementInformation,"seriesInstanceUIDRoot");
-	info.frameOfReferenceUID = parse_optional_string(measurementInformation,"frameOfReferenceUID");
-
-	//This part of the schema is totally messed up and needs to be fixed, but for now we will just read it. 
-	pugi::xml_node ri = measurementInformation.child("referencedImageSequence");
-	if (ri) {
-	  pugi::xml_node ric = ri.child("referencedSOPInstanceUID");
-	  while (ric) {
-	    ReferencedImageSequence r;
-	    r.referencedSOPInstanceUID = ric.child_value();
-	    info.referencedImageSequence.push_back(r);
-	    ric = ric.next_sibling("referencedSOPInstanceUID");
-	  }
-	}
-
-	h.measurementInformation = info;
+    //Each inner element holds the single field of one T, so the fields of T
+    //are read with the cursor placed on that element
+    template <class T> void wrapped(const char* outer, const char* inner, std::vector<T>& v)
+    {
+      pugi::xml_node n = find(outer);
+      for (pugi::xml_node nc = n.child(inner); nc; nc = nc.next_sibling(inner)) {
+        XmlReader item(n, sections_);
+        item.next_ = nc;
+        v.push_back(T());
+        fields(item, v.back());
       }
+    }
 
-      if (acquisitionSystemInformation) {
-	AcquisitionSystemInformation info;
-	info.systemVendor = parse_optional_string(acquisitionSystemInformation, "systemVendor");
-	info.systemModel = parse_optional_string(acquisitionSystemInformation, "systemModel");
-	info.systemFieldStrength_T = parse_optional_float(acquisitionSystemInformation, "systemFieldStrength_T");
-	info.relativeReceiverNoiseBandwidth = parse_optional_float(acquisitionSystemInformation, "relativeReceiverNoiseBandwidth");
-	info.receiverChannels = parse_optional_ushort(acquisitionSystemInformation, "receiverChannels");
-	pugi::xml_node coilLabel = acquisitionSystemInformation.child("coilLabel");
-	while (coilLabel) {
-	  CoilLabel l;
-	  l.coilNumber = std::atoi(coilLabel.child_value("coilNumber"));
-	  l.coilName = parse_string(coilLabel, "coilName");
-	  info.coilLabel.push_back(l);
-	  coilLabel = coilLabel.next_sibling("coilLabel");
-	}
-	info.institutionName = parse_optional_string(acquisitionSystemInformation, "institutionName");
-	info.stationName = parse_optional_string(acquisitionSystemInformation, "stationName");
-
-	h.acquisitionSystemInformation = info;
+  private:
+    static pugi::xml_node element_at(pugi::xml_node n)
+    {
+      while (n && n.type() != pugi::node_element) {
+        n = n.next_sibling();
       }
+      return n;
+    }
 
-      if (sequenceParameters) {
-	SequenceParameters p;
+    pugi::xml_node find(const char* name)
+    {
+      pugi::xml_node n = next_;
+      if (!n || strcmp(n.name(), name) != 0) {
+        n = parent_.child(name);
+      }
+      if (n) {
+        next_ = element_at(n.next_sibling());
+      }
+      return n;
+    }
 
-    std::vector<float> r;
-    r = parse_vector_float(sequenceParameters, "TR");
-    if (!r.empty()) p.TR = r;
+    void missing(const char* name)
+    {
+      throw std::runtime_error(std::string(name) + " not found in " + parent_.name());
+    }
 
-    r = parse_vector_float(sequenceParameters, "TE");
-    if (!r.empty()) p.TE = r;
+    //Missing numbers read as zero
+    void read(const char*, pugi::xml_node n, unsigned short& v)
+    {
+      v = static_cast<unsigned short>(parse_long(n.child_value()));
+    }
 
-    r = parse_vector_float(sequenceParameters, "TI");
-    if (!r.empty()) p.TI = r;
+    void read(const char*, pugi::xml_node n, long& v)
+    {
+      v = parse_long(n.child_value());
+    }
 
-    r = parse_vector_float(sequenceParameters, "flipAngle_deg");
-    if (!r.empty()) p.flipAngle_deg = r;
+    void read(const char*, pugi::xml_node n, float& v)
+    {
+      v = static_cast<float>(parse_double(n.child_value()));
+    }
 
-    p.sequence_type = parse_optional_string(sequenceParameters, "sequence_type");
+    void read(const char*, pugi::xml_node n, double& v)
+    {
+      v = parse_double(n.child_value());
+    }
 
-    r = parse_vector_float(sequenceParameters, "echo_spacing");
-    if (!r.empty()) p.echo_spacing = r;
+    void read(const char* name, pugi::xml_node n, std::string& v)
+    {
+      if (!n) missing(name);
+      v = n.child_value();
+    }
 
-	h.sequenceParameters = p;
-      }
+    //The four lists are commonly interleaved, read them in one pass
+    void read(const char* name, pugi::xml_node n, UserParameters& v)
+    {
+      if (!n) missing(name);
+      parse_user_parameters(n, v);
+    }
 
-      if (userParameters) {
-	UserParameters p;
- 	p.userParameterLong = parse_user_parameter_long(userParameters,"userParameterLong");
- 	p.userParameterDouble = parse_user_parameter_double(userParameters,"userParameterDouble");
- 	p.userParameterString = parse_user_parameter_string(userParameters,"userParameterString");
- 	p.userParameterBase64 = parse_user_parameter_string(userParameters,"userParameterBase64");
-	h.userParameters = p;
-      }
-    } else {
+    template <class T> void read(const char* name, pugi::xml_node n, T& v)
+    {
+      if (!n) missing(name);
+      XmlReader r(n, sections_);
+      fields(r, v);
+    }
+
+    pugi::xml_node parent_;
+    pugi::xml_node next_;
+    unsigned int sections_;
+  };
+
+  static void deserialize_document(pugi::xml_document& doc, IsmrmrdHeader& h, unsigned int sections)
+  {
+    pugi::xml_node root = doc.child("ismrmrdHeader");
+    if (!root) {
       throw std::runtime_error("Root node 'ismrmrdHeader' not found");
     }
 
+    XmlReader r(root, sections);
+    fields(r, h);
+
+    if ((sections & HEADER_ENCODING) && h.encoding.empty()) {
+      throw std::runtime_error("encoding section not found in ismrmrdHeader");
+    }
   }
 
+  struct LazyHeader::Impl
+  {
+    std::vector<char> buffer;
+    pugi::xml_document doc;
+    pugi::xml_node userParameters;
+    bool decoded;
+  };
 
-  //Utility functions for serialization
-  void to_string_val(const std::string& v, std::string& o)
+  LazyHeader::LazyHeader(const char* xml, size_t len, unsigned int sections)
+    : impl_(new Impl)
   {
-    o = v;
+    impl_->buffer.assign(xml, xml + len);
+    impl_->buffer.push_back('\0');
+    impl_->decoded = false;
+
+    try {
+      pugi::xml_parse_result result = impl_->doc.load_buffer_inplace(&impl_->buffer[0], len);
+      if (!result) {
+        throw std::runtime_error("Unable to load ISMRMRD XML header");
+      }
+      deserialize_document(impl_->doc, header_, sections & ~HEADER_USER_PARAMETERS);
+    } catch (...) {
+      delete impl_;
+      throw;
+    }
+
+    impl_->userParameters = impl_->doc.child("ismrmrdHeader").child("userParameters");
+    if (sections & HEADER_USER_PARAMETERS) {
+      userParameters();
+    }
   }
 
-  void to_string_val(const float& v, std::string& o)
+  LazyHeader::~LazyHeader()
   {
-    char buffer[256];
-    sprintf(buffer,"%f",v);
-    o = std::string(buffer);
+    delete impl_;
   }
 
-  void to_string_val(const double& v, std::string& o)
+  const IsmrmrdHeader& LazyHeader::header() const
   {
-    char buffer[256];
-    sprintf(buffer,"%f",v);
-    o = std::string(buffer);
+    return header_;
   }
 
-  void to_string_val(const unsigned short& v, std::string& o)
+  const Optional<UserParameters>& LazyHeader::userParameters()
   {
-    char buffer[256];
-    sprintf(buffer,"%d",v);
-    o = std::string(buffer);
+    if (!impl_->decoded && impl_->userParameters) {
+      header_.userParameters = UserParameters();
+      parse_user_parameters(impl_->userParameters, header_.userParameters.get());
+    }
+    impl_->decoded = true;
+    return header_.userParameters;
   }
 
-  void to_string_val(const long& v, std::string& o)
+  void LazyHeader::userParameterViews(std::vector<UserParameterView>& views) const
   {
-    char buffer[256];
-    sprintf(buffer,"%ld",v);
-    o = std::string(buffer);
+    views.clear();
+    for (pugi::xml_node nc = impl_->userParameters.first_child(); nc; nc = nc.next_sibling()) {
+      if (strncmp(nc.name(), "userParameter", 13) != 0) {
+        continue;
+      }
+      UserParameterView v;
+      v.type = nc.name() + 13;
+      v.name = nc.child_value("name");
+      v.value = nc.child_value("value");
+      views.push_back(v);
+    }
   }
 
-  template <class T> void append_optional_node(pugi::xml_node& n, const char* child, const Optional<T>& v) 
-  {
-    if (v) {
-      pugi::xml_node n2 = n.append_child(child);
-      std::string v_as_string;
-      to_string_val(*v, v_as_string);
-      n2.append_child(pugi::node_pcdata).set_value(v_as_string.c_str());
-    }
-  } 
-  
-  template <class T> void append_node(pugi::xml_node& n, const char* child, const T& v) 
+  const char* LazyHeader::findUserParameter(const char* name) const
   {
-    pugi::xml_node n2 = n.append_child(child);
-    std::string v_as_string;
-    to_string_val(v, v_as_string);
-    n2.append_child(pugi::node_pcdata).set_value(v_as_string.c_str());
-  } 
+    for (pugi::xml_node nc = impl_->userParameters.first_child(); nc; nc = nc.next_sibling()) {
+      if (strcmp(nc.child_value("name"), name) == 0) {
+        return nc.child_value("value");
+      }
+    }
+    return NULL;
+  }
+
 
-  void append_encoding_space(pugi::xml_node& n, const char* child, const EncodingSpace& s) 
+  //Utility functions for serialization
+
+  //Replaces the decimal point of the current locale with '.'
+  static void fix_decimal_point(char* buffer)
   {
-    pugi::xml_node n2 = n.append_child(child);
-    pugi::xml_node n3 = n2.append_child("matrixSize");
-    append_node(n3,"x",s.matrixSize.x);
-    append_node(n3,"y",s.matrixSize.y);
-    append_node(n3,"z",s.matrixSize.z);
-    n3 = n2.append_child("fieldOfView_mm");
-    append_node(n3,"x",s.fieldOfView_mm.x);
-    append_node(n3,"y",s.fieldOfView_mm.y);
-    append_node(n3,"z",s.fieldOfView_mm.z);
+    const char* point = std::localeconv()->decimal_point;
+    if (point[0] == '.' && point[1] == '\0') {
+      return;
+    }
+    size_t point_len = strlen(point);
+    char* p = strstr(buffer, point);
+    if (p) {
+      *p = '.';
+      memmove(p + 1, p + point_len, strlen(p + point_len) + 1);
+    }
   }
-  
-  void append_encoding_limit(pugi::xml_node& n, const char* child, const Optional<Limit>& l) 
+
+  //Spells infinities and NaN the way xs:float and xs:double do
+  static bool format_special(double v, char* buffer)
   {
-    if (l) {
-      pugi::xml_node n2 = n.append_child(child);
-      append_node(n2,"minimum",l->minimum);
-      append_node(n2,"maximum",l->maximum);
-      append_node(n2,"center",l->center);
+    if (v != v) {
+      strcpy(buffer, "NaN");
+      return true;
+    }
+    if (v > DBL_MAX || v < -DBL_MAX) {
+      strcpy(buffer, v < 0 ? "-INF" : "INF");
+      return true;
     }
+    return false;
   }
 
-  template <class T> 
-  void append_user_parameter(pugi::xml_node& n, const char* child, 
-			     const std::vector<T>& v) 
+  //Whole numbers below limit print the same with %g as plain integers, and
+  //header values are mostly whole numbers, so skip the formatting round trips
+  static bool format_integral(double v, double limit, char* buffer)
   {
-    for (size_t i = 0; i < v.size(); i++) {
-      pugi::xml_node n2 = n.append_child(child);
-      append_node(n2,"name",v[i].name);
-      append_node(n2,"value",v[i].value);
+    if (!(v > -limit && v < limit) || v != static_cast<double>(static_cast<long long>(v))) {
+      return false;
     }
+    if (v == 0 && 1 / v < 0) {
+      //-0 keeps its sign
+      return false;
+    }
+    long long i = static_cast<long long>(v);
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    unsigned long long u = i < 0 ? 0ull - static_cast<unsigned long long>(i) : static_cast<unsigned long long>(i);
+    *--p = '\0';
+    do {
+      *--p = static_cast<char>('0' + u % 10);
+      u /= 10;
+    } while (u);
+    if (i < 0) {
+      *--p = '-';
+    }
+    memcpy(buffer, p, digits + sizeof(digits) - p);
+    return true;
   }
 
-  //End utility functions for serialization
-
-  void serialize(const IsmrmrdHeader& h, std::ostream& o)
+  //Shortest representation that parses back to the same float. %g drops
+  //trailing zeros, so below 7 significant digits the first precision that
+  //round trips is already the shortest one.
+  void format_float(float v, char* buffer)
   {
-    pugi::xml_document doc;
-    pugi::xml_node root = doc.append_child();
-    pugi::xml_node n1,n2,n3;
-    pugi::xml_attribute a;
-
-    root.set_name("ismrmrdHeader");
-
-    a = root.append_attribute("xmlns");
-    a.set_value("http://www.ismrm.org/ISMRMRD");
-
-    a = root.append_attribute("xmlns:xsi");
-    a.set_value("http://www.w3.org/2001/XMLSchema-instance");
-  
-    a = root.append_attribute("xmlns:xs");
-    a.set_value("http://www.w3.org/2001/XMLSchema");
-    
-    a = root.append_attribute("xsi:schemaLocation");
-    a.set_value("http://www.ismrm.org/ISMRMRD ismrmrd.xsd");
-
-    if (h.version) {
-      if (*h.version != ISMRMRD_XMLHDR_VERSION) {
-        throw std::runtime_error("XML header version does not match library schema version.");
+    if (format_integral(v, 1e6, buffer) || format_special(v, buffer)) {
+      return;
+    }
+    for (int precision = 6; precision <= 9; precision++) {
+      sprintf(buffer, "%.*g", precision, v);
+      fix_decimal_point(buffer);
+      if (static_cast<float>(parse_double(buffer)) == v) {
+        return;
       }
-      append_optional_node(root,"version",h.version);
-    }
-    
-    if (h.subjectInformation) {
-      n1 = root.append_child();
-      n1.set_name("subjectInformation");
-      append_optional_node(n1,"patientName",h.subjectInformation->patientName);
-      append_optional_node(n1,"patientWeight_kg",h.subjectInformation->patientWeight_kg);
-      append_optional_node(n1,"patientID",h.subjectInformation->patientID);
-      append_optional_node(n1,"patientBirthdate",h.subjectInformation->patientBirthdate);
-      append_optional_node(n1,"patientGender",h.subjectInformation->patientGender);
-    }
-
-    if (h.studyInformation) {
-      n1 = root.append_child();
-      n1.set_name("studyInformation");
-      append_optional_node(n1,"studyDate",h.studyInformation->studyDate);
-      append_optional_node(n1,"studyTime",h.studyInformation->studyTime);
-      append_optional_node(n1,"studyID",h.studyInformation->studyID);
-      append_optional_node(n1,"accessionNumber",h.studyInformation->accessionNumber);
-      append_optional_node(n1,"referringPhysicianName",h.studyInformation->referringPhysicianName);
-      append_optional_node(n1,"studyDescription",h.studyInformation->studyDescription);
-      append_optional_node(n1,"studyInstanceUID",h.studyInformation->studyInstanceUID);
-    }
-
-    if (h.measurementInformation) {
-      n1 = root.append_child();
-      n1.set_name("measurementInformation");
-      append_optional_node(n1,"measurementID",h.measurementInformation->measurementID);
-      append_optional_node(n1,"seriesDate",h.measurementInformation->seriesDate);
-      append_optional_node(n1,"seriesTime",h.measurementInformation->seriesTime);
-      append_node(n1,"patientPosition",h.measurementInformation->patientPosition);
-      append_optional_node(n1,"initialSeriesNumber",h.measurementInformation->initialSeriesNumber);
-      append_optional_node(n1,"protocolName",h.measurementInformation->protocolName);
-      append_optional_node(n1,"seriesDescription",h.measurementInformation->seriesDescription);
-
-      for (size_t i = 0; i < h.measurementInformation->measurementDependency.size(); i++) {
-	n2 = n1.append_child();
-	n2.set_name("measurementDependency");
-	append_node(n2,"dependencyType",h.measurementInformation->measurementDependency[i].dependencyType);
-	append_node(n2,"measurementID",h.measurementInformation->measurementDependency[i].measurementID);
+    }
+  }
+
+  //Shortest representation that parses back to the same double
+  void format_double(double v, char* buffer)
+  {
+    if (format_integral(v, 1e15, buffer) || format_special(v, buffer)) {
+      return;
+    }
+    for (int precision = 15; precision <= 17; precision++) {
+      sprintf(buffer, "%.*g", precision, v);
+      fix_decimal_point(buffer);
+      if (parse_double(buffer) == v) {
+        return;
       }
-      
-      append_optional_node(n1,"seriesInstanceUIDRoot",h.measurementInformation->seriesInstanceUIDRoot);
-      append_optional_node(n1,"frameOfReferenceUID",h.measurementInformation->frameOfReferenceUID);
-      
-      //TODO: Sort out stuff with this referenced image sequence. This is all messed up. 
-      if (h.measurementInformation->referencedImageSequence.size()) {
-	n2 = n1.append_child("referencedImageSequence");
-	for (size_t i = 0; i < h.measurementInformation->referencedImageSequence.size(); i++) {
-	  append_node(n2,"referencedSOPInstanceUID", h.measurementInformation->referencedImageSequence[i].referencedSOPInstanceUID);
-	}
+    }
+  }
+
+  //Emits XML directly into a string, indented the way pugixml saves a
+  //document, so no DOM has to be built for the header. Each element is
+  //written through a single reservation, finish() trims the string.
+  class XmlWriter
+  {
+  public:
+    XmlWriter(std::string& out)
+      : out_(out)
+      , pos_(0)
+      , depth_(0)
+      , pending_(false)
+    {
+      //Reuse whatever the string already holds
+      out_.resize(out_.capacity());
+    }
+
+    void declaration()
+    {
+      put("<?xml version=\"1.0\"?>\n");
+    }
+
+    void start(const char* name)
+    {
+      close_pending();
+      size_t n = strlen(name);
+      char* p = reserve(depth_ + n + 1);
+      p = indent(p);
+      *p++ = '<';
+      memcpy(p, name, n);
+      commit(p + n);
+      pending_ = true;
+      depth_++;
+    }
+
+    //Only valid directly after start
+    void attribute(const char* name, const char* value)
+    {
+      size_t n = strlen(name);
+      char* p = reserve(n + 4 + escaped_size(strlen(value)));
+      *p++ = ' ';
+      memcpy(p, name, n);
+      p += n;
+      *p++ = '=';
+      *p++ = '"';
+      p = escape(p, value, true);
+      *p++ = '"';
+      commit(p);
+    }
+
+    void end(const char* name)
+    {
+      depth_--;
+      if (pending_) {
+        put(" />\n");
+        pending_ = false;
+      } else {
+        size_t n = strlen(name);
+        char* p = indent(reserve(depth_ + n + 4));
+        *p++ = '<';
+        *p++ = '/';
+        memcpy(p, name, n);
+        p += n;
+        *p++ = '>';
+        *p++ = '\n';
+        commit(p);
       }
-      
-
-    }
-
-    if (h.acquisitionSystemInformation) {
-      n1 = root.append_child();
-      n1.set_name("acquisitionSystemInformation");
-      append_optional_node(n1,"systemVendor",h.acquisitionSystemInformation->systemVendor);
-      append_optional_node(n1,"systemModel",h.acquisitionSystemInformation->systemModel);
-      append_optional_node(n1,"systemFieldStrength_T",h.acquisitionSystemInformation->systemFieldStrength_T);
-      append_optional_node(n1,"relativeReceiverNoiseBandwidth",h.acquisitionSystemInformation->relativeReceiverNoiseBandwidth);
-      append_optional_node(n1,"receiverChannels",h.acquisitionSystemInformation->receiverChannels);
-      for (size_t i = 0; i < h.acquisitionSystemInformation->coilLabel.size(); i++) {
-	n2 = n1.append_child();
-	n2.set_name("coilLabel");
-	append_node(n2,"coilNumber",h.acquisitionSystemInformation->coilLabel[i].coilNumber);
-	append_node(n2,"coilName",h.acquisitionSystemInformation->coilLabel[i].coilName);
+    }
+
+    template <class T> void element(const char* name, const T& v)
+    {
+      close_pending();
+      size_t n = strlen(name);
+      char* p = indent(reserve(depth_ + 2 * n + 5 + value_size(v)));
+      *p++ = '<';
+      memcpy(p, name, n);
+      p += n;
+      *p++ = '>';
+      p = value(p, v);
+      *p++ = '<';
+      *p++ = '/';
+      memcpy(p, name, n);
+      p += n;
+      *p++ = '>';
+      *p++ = '\n';
+      commit(p);
+    }
+
+    void finish()
+    {
+      out_.resize(pos_);
+    }
+
+  private:
+    char* reserve(size_t n)
+    {
+      if (out_.size() - pos_ < n) {
+        out_.resize(std::max(out_.size() * 2, pos_ + n));
       }
-      append_optional_node(n1,"institutionName",h.acquisitionSystemInformation->institutionName);
-      append_optional_node(n1,"stationName",h.acquisitionSystemInformation->stationName);
+      return &out_[pos_];
     }
 
-    n1 = root.append_child();
-    n1.set_name("experimentalConditions");
-    append_node(n1,"H1resonanceFrequency_Hz", h.experimentalConditions.H1resonanceFrequency_Hz);
+    void commit(char* p)
+    {
+      pos_ = p - &out_[0];
+    }
 
-    if (!h.encoding.size()) {
-      throw std::runtime_error("Encoding array is empty. Invalid ISMRMRD header structure");
+    void put(const char* s)
+    {
+      size_t n = strlen(s);
+      memcpy(reserve(n), s, n);
+      pos_ += n;
     }
 
-    for (size_t i = 0; i < h.encoding.size(); i++) {
-      n1 = root.append_child("encoding");
-      append_encoding_space(n1,"encodedSpace",h.encoding[i].encodedSpace);
-      append_encoding_space(n1,"reconSpace",h.encoding[i].reconSpace);
-      n2 = n1.append_child("encodingLimits");
-      append_encoding_limit(n2,"kspace_encoding_step_0",h.encoding[i].encodingLimits.kspace_encoding_step_0);
-      append_encoding_limit(n2,"kspace_encoding_step_1",h.encoding[i].encodingLimits.kspace_encoding_step_1);
-      append_encoding_limit(n2,"kspace_encoding_step_2",h.encoding[i].encodingLimits.kspace_encoding_step_2);
-      append_encoding_limit(n2,"average",h.encoding[i].encodingLimits.average);
-      append_encoding_limit(n2,"slice",h.encoding[i].encodingLimits.slice);
-      append_encoding_limit(n2,"contrast",h.encoding[i].encodingLimits.contrast);
-      append_encoding_limit(n2,"phase",h.encoding[i].encodingLimits.phase);
-      append_encoding_limit(n2,"repetition",h.encoding[i].encodingLimits.repetition);
-      append_encoding_limit(n2,"set",h.encoding[i].encodingLimits.set);
-      append_encoding_limit(n2,"segment",h.encoding[i].encodingLimits.segment);
-      append_node(n1,"trajectory",h.encoding[i].trajectory);
-      
-      if (h.encoding[i].trajectoryDescription) {
-	n2 = n1.append_child("trajectoryDescription");
-	append_node(n2,"identifier",h.encoding[i].trajectoryDescription->identifier);
-	append_user_parameter(n2,"userParameterLong",h.encoding[i].trajectoryDescription->userParameterLong); 
-	append_user_parameter(n2,"userParameterDouble",h.encoding[i].trajectoryDescription->userParameterDouble); 
-	append_optional_node(n2,"comment",h.encoding[i].trajectoryDescription->comment);
+    void close_pending()
+    {
+      if (pending_) {
+        put(">\n");
+        pending_ = false;
       }
+    }
+
+    char* indent(char* p)
+    {
+      memset(p, '\t', depth_);
+      return p + depth_;
+    }
+
+    //The longest entity is six characters
+    static size_t escaped_size(size_t n)
+    {
+      return 6 * n;
+    }
 
-      if (h.encoding[i].parallelImaging) {
-	n2 = n1.append_child("parallelImaging");
-	n3 = n2.append_child("accelerationFactor");
-	append_node(n3,"kspace_encoding_step_1",h.encoding[i].parallelImaging->accelerationFactor.kspace_encoding_step_1);
-	append_node(n3,"kspace_encoding_step_2",h.encoding[i].parallelImaging->accelerationFactor.kspace_encoding_step_2);
-	append_optional_node(n2, "calibrationMode", h.encoding[i].parallelImaging->calibrationMode);
-	append_optional_node(n2, "interleavingDimension", h.encoding[i].parallelImaging->interleavingDimension);
+    static char* escape(char* p, const char* s, bool attribute)
+    {
+      for (; *s; s++) {
+        unsigned char c = static_cast<unsigned char>(*s);
+        if (c > '>') {
+          //Letters and everything above never need an entity
+          *p++ = *s;
+          continue;
+        }
+        const char* entity;
+        char code[6];
+        if (c == '&') {
+          entity = "&amp;";
+        } else if (c == '<') {
+          entity = "&lt;";
+        } else if (c == '>') {
+          entity = "&gt;";
+        } else if (c == '"' && attribute) {
+          entity = "&quot;";
+        } else if (c < 32 && c != '\t' && (attribute || (c != '\r' && c != '\n'))) {
+          code[0] = '&';
+          code[1] = '#';
+          code[2] = static_cast<char>('0' + c / 10);
+          code[3] = static_cast<char>('0' + c % 10);
+          code[4] = ';';
+          code[5] = '\0';
+          entity = code;
+        } else {
+          *p++ = *s;
+          continue;
+        }
+        size_t n = strlen(entity);
+        memcpy(p, entity, n);
+        p += n;
       }
+      return p;
+    }
 
-      append_optional_node(n1, "echoTrainLength", h.encoding[i].echoTrainLength);
+    static size_t value_size(const std::string& v)
+    {
+      return escaped_size(v.size());
+    }
 
+    //Enough for any formatted number
+    template <class T> static size_t value_size(const T&)
+    {
+      return 32;
     }
 
-    if (h.sequenceParameters) {
-      n1 = root.append_child("sequenceParameters");
+    static char* value(char* p, const std::string& v)
+    {
+      return escape(p, v.c_str(), false);
+    }
 
-      if (h.sequenceParameters->TR.is_present())
-      {
-          for (size_t i = 0; i < h.sequenceParameters->TR->size(); i++) {
-              append_node(n1, "TR", h.sequenceParameters->TR->operator[](i));
-          }
-      }
+    static char* value(char* p, float v)
+    {
+      format_float(v, p);
+      return p + strlen(p);
+    }
+
+    static char* value(char* p, double v)
+    {
+      format_double(v, p);
+      return p + strlen(p);
+    }
+
+    static char* value(char* p, unsigned short v)
+    {
+      return value(p, static_cast<long>(v));
+    }
 
-      if (h.sequenceParameters->TE.is_present())
-      {
-          for (size_t i = 0; i < h.sequenceParameters->TE->size(); i++) {
-              append_node(n1, "TE", h.sequenceParameters->TE->operator[](i));
-          }
+    static char* value(char* p, long v)
+    {
+      char buffer[24];
+      char* d = buffer + sizeof(buffer);
+      unsigned long u = v < 0 ? 0ul - static_cast<unsigned long>(v) : static_cast<unsigned long>(v);
+      do {
+        *--d = static_cast<char>('0' + u % 10);
+        u /= 10;
+      } while (u);
+      if (v < 0) {
+        *--d = '-';
       }
+      size_t n = buffer + sizeof(buffer) - d;
+      memcpy(p, d, n);
+      return p + n;
+    }
+
+    std::string& out_;
+    size_t pos_;
+    size_t depth_;
+    bool pending_;
+  };
+
+  //Writes the elements of a struct through its field table
+  class FieldWriter
+  {
+  public:
+    FieldWriter(XmlWriter& w)
+      : w_(w)
+    {
+    }
 
-      if (h.sequenceParameters->TI.is_present())
-      {
-          for (size_t i = 0; i < h.sequenceParameters->TI->size(); i++) {
-              append_node(n1, "TI", h.sequenceParameters->TI->operator[](i));
-          }
+    void begin() { }
+    void end() { }
+
+    void operator()(const char* name, unsigned short& v) { w_.element(name, v); }
+    void operator()(const char* name, long& v) { w_.element(name, v); }
+    void operator()(const char* name, float& v) { w_.element(name, v); }
+    void operator()(const char* name, double& v) { w_.element(name, v); }
+    void operator()(const char* name, std::string& v) { w_.element(name, v); }
+
+    template <class T> void operator()(const char* name, T& v)
+    {
+      w_.start(name);
+      fields(*this, v);
+      w_.end(name);
+    }
+
+    template <class T> void operator()(const char* name, Optional<T>& v)
+    {
+      if (v) {
+        (*this)(name, v.get());
       }
+    }
 
-      if (h.sequenceParameters->flipAngle_deg.is_present())
-      {
-          for (size_t i = 0; i < h.sequenceParameters->flipAngle_deg->size(); i++) {
-              append_node(n1, "flipAngle_deg", h.sequenceParameters->flipAngle_deg->operator[](i));
-          }
+    template <class T> void operator()(const char* name, std::vector<T>& v)
+    {
+      for (size_t i = 0; i < v.size(); i++) {
+        (*this)(name, v[i]);
       }
+    }
 
-      append_optional_node(n1, "sequence_type", h.sequenceParameters->sequence_type);
+    template <class T> void section(unsigned int, const char* name, T& v)
+    {
+      (*this)(name, v);
+    }
 
-      if (h.sequenceParameters->echo_spacing.is_present())
-      {
-          for (size_t i = 0; i < h.sequenceParameters->echo_spacing->size(); i++) {
-              append_node(n1, "echo_spacing", h.sequenceParameters->echo_spacing->operator[](i));
-          }
+    template <class T> void wrapped(const char* outer, const char*, std::vector<T>& v)
+    {
+      if (v.size()) {
+        w_.start(outer);
+        for (size_t i = 0; i < v.size(); i++) {
+          fields(*this, v[i]);
+        }
+        w_.end(outer);
       }
     }
 
-    if (h.userParameters) {
-      n1 = root.append_child("userParameters");
-      append_user_parameter(n1,"userParameterLong",h.userParameters->userParameterLong);
-      append_user_parameter(n1,"userParameterDouble",h.userParameters->userParameterDouble);
-      append_user_parameter(n1,"userParameterString",h.userParameters->userParameterString);
-      append_user_parameter(n1,"userParameterBase64",h.userParameters->userParameterBase64);
+  private:
+    XmlWriter& w_;
+  };
+
+  //End utility functions for serialization
+
+  void serialize(const IsmrmrdHeader& h, std::ostream& o)
+  {
+    std::string s;
+    serialize(h, s);
+    o.write(s.data(), s.size());
+  }
+
+  void serialize(const IsmrmrdHeader& h, std::string& o)
+  {
+    if (h.version && *h.version != ISMRMRD_XMLHDR_VERSION) {
+      throw std::runtime_error("XML header version does not match library schema version.");
+    }
+
+    if (!h.encoding.size()) {
+      throw std::runtime_error("Encoding array is empty. Invalid ISMRMRD header structure");
     }
 
-    doc.save(o);
+    o.clear();
+    XmlWriter w(o);
+
+    w.declaration();
+    w.start("ismrmrdHeader");
+    w.attribute("xmlns", "http://www.ismrm.org/ISMRMRD");
+    w.attribute("xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance");
+    w.attribute("xmlns:xs", "http://www.w3.org/2001/XMLSchema");
+    w.attribute("xsi:schemaLocation", "http://www.ismrm.org/ISMRMRD ismrmrd.xsd");
+
+    //The writer only reads through the non-const field tables
+    FieldWriter f(w);
+    fields(f, const_cast<IsmrmrdHeader&>(h));
+
+    w.end("ismrmrdHeader");
+    w.finish();
   }
 
 
@@ -0,0 +1,463 @@
+#include "ismrmrd/xml.h"
+#include "ismrmrd/version.h"
+#include "xml_fields.h"
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+
+/* Binary encoding of the IsmrmrdHeader
+ *
+ * The encoding starts with the magic bytes "ISMB", a 16 bit format version,
+ * the 16 bit ISMRMRD_XMLHDR_VERSION and a 32 bit signature of the tables in
+ * xml_fields.h, all little endian. Data written for other tables is rejected,
+ * as its fields would be read into the wrong members. The fields follow in
+ * the order of the tables, element names are not stored:
+ *
+ *   unsigned short   unsigned LEB128 varint
+ *   long             zigzag LEB128 varint
+ *   float, double    IEEE 754 bits, little endian
+ *   std::string      varint length followed by the bytes
+ *   std::vector      varint element count followed by the elements
+ *
+ * Every struct with Optional members starts with a 32 bit little endian mask
+ * with bit i set when its i-th Optional member is present. Absent members are
+ * not encoded at all.
+ */
+
+namespace ISMRMRD
+{
+  static const char binary_magic[4] = {'I', 'S', 'M', 'B'};
+  static const uint16_t binary_format_version = 2;
+
+  // FNV-1a over the element names, types and cardinalities of the tables
+  class SchemaSignature
+  {
+  public:
+    SchemaSignature()
+      : h_(2166136261u)
+    {
+    }
+
+    uint32_t value() const
+    {
+      return h_;
+    }
+
+    void begin()
+    {
+      mix('{');
+    }
+
+    void end()
+    {
+      mix('}');
+    }
+
+    void operator()(const char* name, unsigned short&)
+    {
+      field(name, 'u');
+    }
+
+    void operator()(const char* name, long&)
+    {
+      field(name, 'l');
+    }
+
+    void operator()(const char* name, float&)
+    {
+      field(name, 'f');
+    }
+
+    void operator()(const char* name, double&)
+    {
+      field(name, 'd');
+    }
+
+    void operator()(const char* name, std::string&)
+    {
+      field(name, 's');
+    }
+
+    template <class T> void operator()(const char* name, std::vector<T>&)
+    {
+      mix('[');
+      T element;
+      (*this)(name, element);
+      mix(']');
+    }
+
+    template <class T> void operator()(const char* name, Optional<T>&)
+    {
+      mix('?');
+      T value;
+      (*this)(name, value);
+    }
+
+    template <class T> void operator()(const char* name, T& v)
+    {
+      field(name, 'S');
+      fields(*this, v);
+    }
+
+    template <class T> void section(unsigned int, const char* name, T& v)
+    {
+      (*this)(name, v);
+    }
+
+    template <class T> void wrapped(const char* outer, const char* inner, std::vector<T>& v)
+    {
+      field(outer, 'W');
+      (*this)(inner, v);
+    }
+
+  private:
+    void field(const char* name, char type)
+    {
+      for (; *name; name++) {
+        mix(*name);
+      }
+      mix(0);
+      mix(type);
+    }
+
+    void mix(char c)
+    {
+      h_ = (h_ ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+
+    uint32_t h_;
+  };
+
+  static uint32_t compute_schema_signature()
+  {
+    SchemaSignature s;
+    IsmrmrdHeader h;
+    fields(s, h);
+    return s.value();
+  }
+
+  // Computed once, the initialization of a local static is thread safe
+  static uint32_t schema_signature()
+  {
+    static const uint32_t signature = compute_schema_signature();
+    return signature;
+  }
+
+  class BinaryWriter
+  {
+  public:
+    BinaryWriter(std::string& out)
+      : out_(out)
+    {
+    }
+
+    void begin()
+    {
+      masks_.push_back(Mask(out_.size()));
+      out_.append(4, '\0');
+    }
+
+    void end()
+    {
+      Mask m = masks_.back();
+      masks_.pop_back();
+      for (int i = 0; i < 4; i++) {
+        out_[m.offset + i] = static_cast<char>((m.bits >> (8 * i)) & 0xFF);
+      }
+    }
+
+    void bytes(const void* p, size_t n)
+    {
+      out_.append(static_cast<const char*>(p), n);
+    }
+
+    void varint(uint64_t v)
+    {
+      while (v >= 0x80) {
+        out_ += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+      }
+      out_ += static_cast<char>(v);
+    }
+
+    void fixed(uint64_t v, int n)
+    {
+      for (int i = 0; i < n; i++) {
+        out_ += static_cast<char>((v >> (8 * i)) & 0xFF);
+      }
+    }
+
+    void operator()(const char*, unsigned short& v)
+    {
+      varint(v);
+    }
+
+    void operator()(const char*, long& v)
+    {
+      uint64_t u = static_cast<uint64_t>(static_cast<int64_t>(v));
+      varint((u << 1) ^ (v < 0 ? ~static_cast<uint64_t>(0) : 0));
+    }
+
+    void operator()(const char*, float& v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, sizeof(u));
+      fixed(u, 4);
+    }
+
+    void operator()(const char*, double& v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, sizeof(u));
+      fixed(u, 8);
+    }
+
+    void operator()(const char*, std::string& v)
+    {
+      varint(v.size());
+      bytes(v.data(), v.size());
+    }
+
+    template <class T> void operator()(const char* name, std::vector<T>& v)
+    {
+      varint(v.size());
+      for (size_t i = 0; i < v.size(); i++) {
+        (*this)(name, v[i]);
+      }
+    }
+
+    template <class T> void operator()(const char* name, Optional<T>& v)
+    {
+      // By index, encoding the value may grow masks_
+      size_t m = masks_.size() - 1;
+      int bit = masks_[m].count++;
+      if (v) {
+        masks_[m].bits |= static_cast<uint32_t>(1) << bit;
+        (*this)(name, v.get());
+      }
+    }
+
+    template <class T> void operator()(const char*, T& v)
+    {
+      fields(*this, v);
+    }
+
+    template <class T> void section(unsigned int, const char* name, T& v)
+    {
+      (*this)(name, v);
+    }
+
+    template <class T> void wrapped(const char*, const char* inner, std::vector<T>& v)
+    {
+      (*this)(inner, v);
+    }
+
+  private:
+    struct Mask
+    {
+      Mask(size_t offset) : offset(offset), bits(0), count(0) { }
+      size_t offset;
+      uint32_t bits;
+      int count;
+    };
+
+    std::string& out_;
+    std::vector<Mask> masks_;
+  };
+
+  class BinaryReader
+  {
+  public:
+    BinaryReader(const char* data, size_t len)
+      : p_(reinterpret_cast<const unsigned char*>(data))
+      , end_(reinterpret_cast<const unsigned char*>(data) + len)
+    {
+    }
+
+    bool at_end() const
+    {
+      return p_ == end_;
+    }
+
+    void begin()
+    {
+      Mask m;
+      m.bits = static_cast<uint32_t>(fixed(4));
+      m.count = 0;
+      masks_.push_back(m);
+    }
+
+    void end()
+    {
+      masks_.pop_back();
+    }
+
+    void bytes(void* p, size_t n)
+    {
+      need(n);
+      memcpy(p, p_, n);
+      p_ += n;
+    }
+
+    uint64_t varint()
+    {
+      uint64_t v = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        need(1);
+        unsigned char b = *p_++;
+        v |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+          return v;
+        }
+      }
+      throw std::runtime_error("Malformed varint in binary ISMRMRD header");
+    }
+
+    uint64_t fixed(int n)
+    {
+      need(n);
+      uint64_t v = 0;
+      for (int i = 0; i < n; i++) {
+        v |= static_cast<uint64_t>(p_[i]) << (8 * i);
+      }
+      p_ += n;
+      return v;
+    }
+
+    void operator()(const char*, unsigned short& v)
+    {
+      v = static_cast<unsigned short>(varint());
+    }
+
+    void operator()(const char*, long& v)
+    {
+      uint64_t u = varint();
+      v = static_cast<long>(static_cast<int64_t>((u >> 1) ^ (~(u & 1) + 1)));
+    }
+
+    void operator()(const char*, float& v)
+    {
+      uint32_t u = static_cast<uint32_t>(fixed(4));
+      memcpy(&v, &u, sizeof(v));
+    }
+
+    void operator()(const char*, double& v)
+    {
+      uint64_t u = fixed(8);
+      memcpy(&v, &u, sizeof(v));
+    }
+
+    void operator()(const char*, std::string& v)
+    {
+      size_t n = count(1);
+      v.assign(reinterpret_cast<const char*>(p_), n);
+      p_ += n;
+    }
+
+    template <class T> void operator()(const char* name, std::vector<T>& v)
+    {
+      // Every element takes at least one byte, which bounds the allocation
+      size_t n = count(1);
+      v.resize(n);
+      for (size_t i = 0; i < n; i++) {
+        (*this)(name, v[i]);
+      }
+    }
+
+    template <class T> void operator()(const char* name, Optional<T>& v)
+    {
+      Mask& m = masks_.back();
+      bool present = (m.bits >> m.count) & 1;
+      m.count++;
+      if (present) {
+        T value;
+        (*this)(name, value);
+        v = value;
+      }
+    }
+
+    template <class T> void operator()(const char*, T& v)
+    {
+      fields(*this, v);
+    }
+
+    template <class T> void section(unsigned int, const char* name, T& v)
+    {
+      (*this)(name, v);
+    }
+
+    template <class T> void wrapped(const char*, const char* inner, std::vector<T>& v)
+    {
+      (*this)(inner, v);
+    }
+
+  private:
+    struct Mask
+    {
+      uint32_t bits;
+      int count;
+    };
+
+    void need(size_t n)
+    {
+      if (static_cast<size_t>(end_ - p_) < n) {
+        throw std::runtime_error("Truncated binary ISMRMRD header");
+      }
+    }
+
+    size_t count(size_t element_size)
+    {
+      uint64_t n = varint();
+      if (n > static_cast<uint64_t>(end_ - p_) / element_size) {
+        throw std::runtime_error("Truncated binary ISMRMRD header");
+      }
+      return static_cast<size_t>(n);
+    }
+
+    const unsigned char* p_;
+    const unsigned char* end_;
+    std::vector<Mask> masks_;
+  };
+
+  void serialize_binary(const IsmrmrdHeader& h, std::string& o)
+  {
+    o.clear();
+    BinaryWriter w(o);
+    w.bytes(binary_magic, sizeof(binary_magic));
+    w.fixed(binary_format_version, 2);
+    w.fixed(ISMRMRD_XMLHDR_VERSION, 2);
+    w.fixed(schema_signature(), 4);
+    // The writer only reads through the non-const field lists
+    fields(w, const_cast<IsmrmrdHeader&>(h));
+  }
+
+  bool is_binary_header(const char* data, size_t len)
+  {
+    return len >= sizeof(binary_magic) + 2 && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+  }
+
+  void deserialize_binary(const char* data, size_t len, IsmrmrdHeader& h)
+  {
+    if (!is_binary_header(data, len)) {
+      throw std::runtime_error("Not a binary ISMRMRD header");
+    }
+
+    BinaryReader r(data + sizeof(binary_magic), len - sizeof(binary_magic));
+    uint16_t version = static_cast<uint16_t>(r.fixed(2));
+    if (version != binary_format_version) {
+      throw std::runtime_error("Unsupported binary ISMRMRD header format version");
+    }
+    uint16_t header_version = static_cast<uint16_t>(r.fixed(2));
+    uint32_t signature = static_cast<uint32_t>(r.fixed(4));
+    if (header_version != ISMRMRD_XMLHDR_VERSION || signature != schema_signature()) {
+      throw std::runtime_error("Binary ISMRMRD header was written for other header fields");
+    }
+
+    IsmrmrdHeader decoded;
+    fields(r, decoded);
+    if (!r.at_end()) {
+      throw std::runtime_error("Trailing data after binary ISMRMRD header");
+    }
+    std::swap(h, decoded);
+  }
+}
@@ -0,0 +1,239 @@
+#ifndef ISMRMRDXMLFIELDS_H
+#define ISMRMRDXMLFIELDS_H
+
+#include "ismrmrd/xml.h"
+
+/* Field tables of the IsmrmrdHeader structs
+ *
+ * Every struct of the header lists its members with their element names, in
+ * the order the elements appear in schema/ismrmrd.xsd. The XML writer, the
+ * XML reader and the binary encoding are all visitors over these tables, so
+ * a field only has to be added here once. tests/test_xml.cpp checks the
+ * names, order and cardinality of each table against the schema.
+ *
+ * A visitor A provides:
+ *
+ *   a(name, member)                   one element per member; Optional and
+ *                                     std::vector give its cardinality
+ *   a.section(bit, name, member)      a top level section of the header,
+ *                                     bit is its HeaderSection flag
+ *   a.wrapped(outer, inner, members)  repeated inner elements nested in a
+ *                                     single outer element
+ *   a.begin(), a.end()                bracket structs with Optional members
+ */
+
+namespace ISMRMRD
+{
+  template <class A> void fields(A& a, SubjectInformation& s)
+  {
+    a.begin();
+    a("patientName", s.patientName);
+    a("patientWeight_kg", s.patientWeight_kg);
+    a("patientID", s.patientID);
+    a("patientBirthdate", s.patientBirthdate);
+    a("patientGender", s.patientGender);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, StudyInformation& s)
+  {
+    a.begin();
+    a("studyDate", s.studyDate);
+    a("studyTime", s.studyTime);
+    a("studyID", s.studyID);
+    a("accessionNumber", s.accessionNumber);
+    a("referringPhysicianName", s.referringPhysicianName);
+    a("studyDescription", s.studyDescription);
+    a("studyInstanceUID", s.studyInstanceUID);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, MeasurementDependency& s)
+  {
+    a("dependencyType", s.dependencyType);
+    a("measurementID", s.measurementID);
+  }
+
+  template <class A> void fields(A& a, ReferencedImageSequence& s)
+  {
+    a("referencedSOPInstanceUID", s.referencedSOPInstanceUID);
+  }
+
+  template <class A> void fields(A& a, MeasurementInformation& s)
+  {
+    a.begin();
+    a("measurementID", s.measurementID);
+    a("seriesDate", s.seriesDate);
+    a("seriesTime", s.seriesTime);
+    a("patientPosition", s.patientPosition);
+    a("initialSeriesNumber", s.initialSeriesNumber);
+    a("protocolName", s.protocolName);
+    a("seriesDescription", s.seriesDescription);
+    a("measurementDependency", s.measurementDependency);
+    a("seriesInstanceUIDRoot", s.seriesInstanceUIDRoot);
+    a("frameOfReferenceUID", s.frameOfReferenceUID);
+    a.wrapped("referencedImageSequence", "referencedSOPInstanceUID", s.referencedImageSequence);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, CoilLabel& s)
+  {
+    a("coilNumber", s.coilNumber);
+    a("coilName", s.coilName);
+  }
+
+  template <class A> void fields(A& a, AcquisitionSystemInformation& s)
+  {
+    a.begin();
+    a("systemVendor", s.systemVendor);
+    a("systemModel", s.systemModel);
+    a("systemFieldStrength_T", s.systemFieldStrength_T);
+    a("relativeReceiverNoiseBandwidth", s.relativeReceiverNoiseBandwidth);
+    a("receiverChannels", s.receiverChannels);
+    a("coilLabel", s.coilLabel);
+    a("institutionName", s.institutionName);
+    a("stationName", s.stationName);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, ExperimentalConditions& s)
+  {
+    a("H1resonanceFrequency_Hz", s.H1resonanceFrequency_Hz);
+  }
+
+  template <class A> void fields(A& a, MatrixSize& s)
+  {
+    a("x", s.x);
+    a("y", s.y);
+    a("z", s.z);
+  }
+
+  template <class A> void fields(A& a, FieldOfView_mm& s)
+  {
+    a("x", s.x);
+    a("y", s.y);
+    a("z", s.z);
+  }
+
+  template <class A> void fields(A& a, EncodingSpace& s)
+  {
+    a("matrixSize", s.matrixSize);
+    a("fieldOfView_mm", s.fieldOfView_mm);
+  }
+
+  template <class A> void fields(A& a, Limit& s)
+  {
+    a("minimum", s.minimum);
+    a("maximum", s.maximum);
+    a("center", s.center);
+  }
+
+  template <class A> void fields(A& a, EncodingLimits& s)
+  {
+    a.begin();
+    a("kspace_encoding_step_0", s.kspace_encoding_step_0);
+    a("kspace_encoding_step_1", s.kspace_encoding_step_1);
+    a("kspace_encoding_step_2", s.kspace_encoding_step_2);
+    a("average", s.average);
+    a("slice", s.slice);
+    a("contrast", s.contrast);
+    a("phase", s.phase);
+    a("repetition", s.repetition);
+    a("set", s.set);
+    a("segment", s.segment);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, UserParameterLong& s)
+  {
+    a("name", s.name);
+    a("value", s.value);
+  }
+
+  template <class A> void fields(A& a, UserParameterDouble& s)
+  {
+    a("name", s.name);
+    a("value", s.value);
+  }
+
+  template <class A> void fields(A& a, UserParameterString& s)
+  {
+    a("name", s.name);
+    a("value", s.value);
+  }
+
+  template <class A> void fields(A& a, UserParameters& s)
+  {
+    a("userParameterLong", s.userParameterLong);
+    a("userParameterDouble", s.userParameterDouble);
+    a("userParameterString", s.userParameterString);
+    a("userParameterBase64", s.userParameterBase64);
+  }
+
+  template <class A> void fields(A& a, TrajectoryDescription& s)
+  {
+    a.begin();
+    a("identifier", s.identifier);
+    a("userParameterLong", s.userParameterLong);
+    a("userParameterDouble", s.userParameterDouble);
+    a("comment", s.comment);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, AccelerationFactor& s)
+  {
+    a("kspace_encoding_step_1", s.kspace_encoding_step_1);
+    a("kspace_encoding_step_2", s.kspace_encoding_step_2);
+  }
+
+  template <class A> void fields(A& a, ParallelImaging& s)
+  {
+    a.begin();
+    a("accelerationFactor", s.accelerationFactor);
+    a("calibrationMode", s.calibrationMode);
+    a("interleavingDimension", s.interleavingDimension);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, Encoding& s)
+  {
+    a.begin();
+    a("encodedSpace", s.encodedSpace);
+    a("reconSpace", s.reconSpace);
+    a("encodingLimits", s.encodingLimits);
+    a("trajectory", s.trajectory);
+    a("trajectoryDescription", s.trajectoryDescription);
+    a("parallelImaging", s.parallelImaging);
+    a("echoTrainLength", s.echoTrainLength);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, SequenceParameters& s)
+  {
+    a.begin();
+    a("TR", s.TR);
+    a("TE", s.TE);
+    a("TI", s.TI);
+    a("flipAngle_deg", s.flipAngle_deg);
+    a("sequence_type", s.sequence_type);
+    a("echo_spacing", s.echo_spacing);
+    a.end();
+  }
+
+  template <class A> void fields(A& a, IsmrmrdHeader& s)
+  {
+    a.begin();
+    a("version", s.version);
+    a.section(HEADER_SUBJECT_INFORMATION, "subjectInformation", s.subjectInformation);
+    a.section(HEADER_STUDY_INFORMATION, "studyInformation", s.studyInformation);
+    a.section(HEADER_MEASUREMENT_INFORMATION, "measurementInformation", s.measurementInformation);
+    a.section(HEADER_ACQUISITION_SYSTEM_INFORMATION, "acquisitionSystemInformation", s.acquisitionSystemInformation);
+    a.section(HEADER_EXPERIMENTAL_CONDITIONS, "experimentalConditions", s.experimentalConditions);
+    a.section(HEADER_ENCODING, "encoding", s.encoding);
+    a.section(HEADER_SEQUENCE_PARAMETERS, "sequenceParameters", s.sequenceParameters);
+    a.section(HEADER_USER_PARAMETERS, "userParameters", s.userParameters);
+    a.end();
+  }
+}
+
+#endif //ISMRMRDXMLFIELDS_H
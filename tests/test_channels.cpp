@@ -38,7 +38,7 @@ BOOST_AUTO_TEST_CASE(test_set_channel_on)
 
     for (int chan = 0; chan < 64 * ISMRMRD_CHANNEL_MASKS; chan++) {
         BOOST_CHECK_EQUAL(ismrmrd_set_channel_on(channel_mask, chan), ISMRMRD_NOERROR);
-        uint64_t bitmask = 1 << (chan % 64);
+        uint64_t bitmask = (uint64_t)1 << (chan % 64);
         size_t offset = chan / 64;
         BOOST_REQUIRE((channel_mask[offset] & bitmask) != 0);
     }
@@ -54,7 +54,7 @@ BOOST_AUTO_TEST_CASE(test_set_channel_off)
     for (int chan = 0; chan < 64 * ISMRMRD_CHANNEL_MASKS; chan++) {
         BOOST_CHECK_EQUAL(ismrmrd_set_channel_off(channel_mask, chan), ISMRMRD_NOERROR);
 
-        uint64_t bitmask = 1 << (chan % 64);
+        uint64_t bitmask = (uint64_t)1 << (chan % 64);
         size_t offset = chan / 64;
         BOOST_REQUIRE((channel_mask[offset] & bitmask) == 0);
     }
@@ -73,4 +73,136 @@ BOOST_AUTO_TEST_CASE(test_set_all_channels_off)
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_channel_ranges)
+{
+    uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS] = {0};
+
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_on(NULL, 0, 1), ISMRMRD_RUNTIMEERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_on(channel_mask, 1000, 25), ISMRMRD_RUNTIMEERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channel_on(channel_mask, 64 * ISMRMRD_CHANNEL_MASKS), ISMRMRD_RUNTIMEERROR);
+
+    // Ranges within a word, across words and up to the last channel
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_on(channel_mask, 3, 5), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_on(channel_mask, 60, 200), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_on(channel_mask, 1000, 24), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_off(channel_mask, 64, 64), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channels_on(channel_mask, 500, 0), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_count_channels_on(channel_mask), 5 + 136 + 24);
+    for (int chan = 0; chan < 64 * ISMRMRD_CHANNEL_MASKS; chan++) {
+        bool on = (chan >= 3 && chan < 8) || (chan >= 60 && chan < 64) || (chan >= 128 && chan < 260) || chan >= 1000;
+        BOOST_REQUIRE_EQUAL(ismrmrd_is_channel_on(channel_mask, chan), on);
+    }
+
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 0), 3);
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 7), 7);
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 8), 60);
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 64), 128);
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 260), 1000);
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 1023), 1023);
+    ismrmrd_set_channel_off(channel_mask, 1023);
+    BOOST_CHECK_EQUAL(ismrmrd_next_channel_on(channel_mask, 1023), -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_channel_list)
+{
+    uint64_t channel_mask[ISMRMRD_CHANNEL_MASKS];
+    fill_channels(channel_mask);
+
+    const uint16_t list[] = {900, 2, 63, 64, 2, 511};
+    BOOST_CHECK_EQUAL(ismrmrd_set_channel_list(channel_mask, list, 6), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_count_channels_on(channel_mask), 5);
+
+    uint16_t channels[64 * ISMRMRD_CHANNEL_MASKS];
+    BOOST_REQUIRE_EQUAL(ismrmrd_get_channels_on(channel_mask, channels), 5);
+    const uint16_t sorted[] = {2, 63, 64, 511, 900};
+    BOOST_CHECK_EQUAL_COLLECTIONS(channels, channels + 5, sorted, sorted + 5);
+
+    // A bad channel leaves the mask as it was
+    const uint16_t bad[] = {1, 1024};
+    BOOST_CHECK_EQUAL(ismrmrd_set_channel_list(channel_mask, bad, 2), ISMRMRD_RUNTIMEERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_count_channels_on(channel_mask), 5);
+    BOOST_CHECK_EQUAL(ismrmrd_set_channel_list(channel_mask, NULL, 0), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_count_channels_on(channel_mask), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_channel_mask_class)
+{
+    ChannelMask mask = ChannelMask::range(10, 100);
+    BOOST_CHECK_EQUAL(mask.count(), 100);
+    BOOST_CHECK(!mask.empty());
+    BOOST_CHECK(mask.isActive(10) && mask.isActive(109) && !mask.isActive(110));
+
+    mask.setRangeNotActive(20, 80).setActive(700).setNotActive(15);
+    std::vector<uint16_t> expected;
+    for (uint16_t chan = 10; chan < 20; chan++) {
+        if (chan != 15) {
+            expected.push_back(chan);
+        }
+    }
+    for (uint16_t chan = 100; chan < 110; chan++) {
+        expected.push_back(chan);
+    }
+    expected.push_back(700);
+
+    std::vector<uint16_t> iterated(mask.begin(), mask.end());
+    BOOST_CHECK_EQUAL_COLLECTIONS(iterated.begin(), iterated.end(), expected.begin(), expected.end());
+    std::vector<uint16_t> listed = mask.channels();
+    BOOST_CHECK_EQUAL_COLLECTIONS(listed.begin(), listed.end(), expected.begin(), expected.end());
+    BOOST_CHECK(ChannelMask(expected) == mask);
+    BOOST_CHECK(ChannelMask(mask.bits()) == mask);
+
+    ChannelMask other = ChannelMask::range(0, 12);
+    BOOST_CHECK_EQUAL((mask & other).count(), 2);
+    BOOST_CHECK_EQUAL((mask | other).count(), mask.count() + 10);
+    BOOST_CHECK(mask != other);
+    BOOST_CHECK(ChannelMask().empty());
+    BOOST_CHECK(ChannelMask().begin() == ChannelMask().end());
+    BOOST_CHECK(other.setAllNotActive().empty());
+
+    BOOST_CHECK_THROW(mask.setActive(1024), std::runtime_error);
+    BOOST_CHECK_THROW(ChannelMask::range(1000, 100), std::runtime_error);
+}
+
+static void fill_by_channel(Acquisition &acq, const std::vector<uint16_t> &channels)
+{
+    for (size_t c = 0; c < channels.size(); c++) {
+        for (uint16_t s = 0; s < acq.number_of_samples(); s++) {
+            acq.data(s, static_cast<uint16_t>(c)) = complex_float_t(channels[c], s);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_compact_expand_channels)
+{
+    // Without a mask the channels are 0 to active_channels - 1
+    Acquisition acq(32, 8);
+    std::vector<uint16_t> all = ChannelMask::range(0, 8).channels();
+    fill_by_channel(acq, all);
+    BOOST_CHECK(acq.getActiveChannels() == ChannelMask::range(0, 8));
+
+    const uint16_t keep_list[] = {1, 4, 5, 7, 200};
+    acq.compactChannels(ChannelMask(keep_list, 5));
+    BOOST_REQUIRE_EQUAL(acq.active_channels(), 4);
+    const uint16_t kept[] = {1, 4, 5, 7};
+    std::vector<uint16_t> active = acq.getActiveChannels().channels();
+    BOOST_CHECK_EQUAL_COLLECTIONS(active.begin(), active.end(), kept, kept + 4);
+    for (uint16_t c = 0; c < 4; c++) {
+        BOOST_CHECK_EQUAL(acq.data(31, c), complex_float_t(kept[c], 31));
+    }
+
+    // Back to 10 channels, zeros where nothing was kept
+    acq.expandChannels(10);
+    BOOST_REQUIRE_EQUAL(acq.active_channels(), 10);
+    BOOST_CHECK(acq.getActiveChannels() == ChannelMask::range(0, 10));
+    for (uint16_t c = 0; c < 10; c++) {
+        bool was_kept = c == 1 || c == 4 || c == 5 || c == 7;
+        BOOST_CHECK_EQUAL(acq.data(17, c), was_kept ? complex_float_t(c, 17) : complex_float_t(0, 0));
+    }
+    BOOST_CHECK_THROW(acq.expandChannels(5), std::runtime_error);
+
+    // A mask that does not match active_channels is an error
+    acq.setChannelMask(ChannelMask::range(0, 3));
+    BOOST_CHECK_THROW(acq.compactChannels(ChannelMask::range(0, 1)), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
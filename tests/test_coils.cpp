@@ -0,0 +1,396 @@
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/coils.h"
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdlib>
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(CoilsTest)
+
+static float uniform()
+{
+    return static_cast<float>(rand()) / RAND_MAX - 0.5f;
+}
+
+// Channels mixing sources signals, each source a random complex sequence,
+// with a little independent noise on every channel
+static void fill_mixed(Acquisition &acq, const std::vector<complex_float_t> &mixing, size_t sources, float noise)
+{
+    uint16_t samples = acq.number_of_samples(), channels = acq.active_channels();
+    std::vector<complex_float_t> src(sources * samples);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = complex_float_t(uniform(), uniform());
+    }
+    for (uint16_t c = 0; c < channels; c++) {
+        for (uint16_t s = 0; s < samples; s++) {
+            complex_float_t x(noise * uniform(), noise * uniform());
+            for (size_t k = 0; k < sources; k++) {
+                x += mixing[c * sources + k] * src[k * samples + s];
+            }
+            acq.data(s, c) = x;
+        }
+    }
+}
+
+static std::vector<complex_float_t> random_mixing(size_t channels, size_t sources)
+{
+    std::vector<complex_float_t> mixing(channels * sources);
+    for (size_t i = 0; i < mixing.size(); i++) {
+        mixing[i] = complex_float_t(uniform(), uniform());
+    }
+    return mixing;
+}
+
+static double energy(const Acquisition &acq)
+{
+    double e = 0;
+    for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+        e += std::norm(acq.getDataPtr()[i]);
+    }
+    return e;
+}
+
+BOOST_AUTO_TEST_CASE(test_coil_compression)
+{
+    srand(11);
+    std::vector<complex_float_t> mixing = random_mixing(12, 3);
+
+    CoilCompressor cc;
+    for (int line = 0; line < 24; line++) {
+        Acquisition acq(128, 12);
+        fill_mixed(acq, mixing, 3, 1e-3f);
+        if (line % 2 == 0) {
+            acq.setFlag(ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION);
+        }
+        BOOST_CHECK_EQUAL(cc.addCalibration(acq), line % 2 == 0);
+    }
+    BOOST_CHECK_EQUAL(cc.getNumberOfCalibrationSamples(), 12u * 128);
+    BOOST_CHECK(cc.getChannels() == ChannelMask::range(0, 12));
+
+    // Three sources, three channels carry nearly all of the energy
+    const std::vector<double> &eig = cc.getEigenvalues();
+    BOOST_REQUIRE_EQUAL(eig.size(), 12u);
+    for (size_t k = 1; k < eig.size(); k++) {
+        BOOST_CHECK(eig[k] <= eig[k - 1]);
+    }
+    BOOST_CHECK(eig[3] < 1e-4 * eig[2]);
+    BOOST_CHECK_EQUAL(cc.channelsForEnergy(0.9999), 3);
+    BOOST_CHECK_EQUAL(cc.channelsForEnergy(0), 1);
+    BOOST_CHECK_EQUAL(cc.channelsForEnergy(1.0), 12);
+
+    BOOST_CHECK_THROW(cc.computeMatrix(0), std::runtime_error);
+    BOOST_CHECK_THROW(cc.computeMatrix(13), std::runtime_error);
+    cc.computeMatrix(5);
+    BOOST_REQUIRE_EQUAL(cc.getNumberOfVirtualChannels(), 5);
+
+    // The rows of the matrix are orthonormal
+    const std::vector<complex_float_t> &m = cc.getMatrix();
+    BOOST_REQUIRE_EQUAL(m.size(), 5u * 12);
+    for (size_t i = 0; i < 5; i++) {
+        for (size_t j = 0; j < 5; j++) {
+            complex_float_t dot(0);
+            for (size_t c = 0; c < 12; c++) {
+                dot += m[i * 12 + c] * std::conj(m[j * 12 + c]);
+            }
+            BOOST_CHECK_SMALL(std::abs(dot - complex_float_t(i == j ? 1.0f : 0.0f)), 1e-5f);
+        }
+    }
+
+    // Imaging data of the same sources: the product, the energy is kept
+    Acquisition acq(200, 12, 2);
+    fill_mixed(acq, mixing, 3, 1e-3f);
+    acq.traj(1, 199) = 0.5f;
+    acq.scan_counter() = 42;
+    Acquisition original(acq);
+    cc.compress(acq);
+
+    BOOST_REQUIRE_EQUAL(acq.active_channels(), 5);
+    BOOST_CHECK_EQUAL(acq.number_of_samples(), 200);
+    BOOST_CHECK(acq.getActiveChannels() == ChannelMask::range(0, 5));
+    BOOST_CHECK_EQUAL(ismrmrd_count_channels_on(acq.getHead().channel_mask), 5);
+    BOOST_CHECK_EQUAL(acq.traj(1, 199), 0.5f);
+    BOOST_CHECK_EQUAL(acq.scan_counter(), 42u);
+    for (uint16_t k = 0; k < 5; k++) {
+        for (uint16_t s = 0; s < 200; s += 13) {
+            complex_float_t y(0);
+            for (uint16_t c = 0; c < 12; c++) {
+                y += m[k * 12 + c] * original.data(s, c);
+            }
+            BOOST_CHECK_SMALL(std::abs(acq.data(s, k) - y), 1e-4f);
+        }
+    }
+    BOOST_CHECK_CLOSE(energy(acq), energy(original), 0.01);
+}
+
+BOOST_AUTO_TEST_CASE(test_coil_eigenvectors)
+{
+    // One source and strong noise on every channel, so the covariance has full rank
+    srand(7);
+    std::vector<complex_float_t> mixing = random_mixing(6, 1);
+    CoilCompressor cc;
+    std::vector<Acquisition> cal(4, Acquisition(50, 6));
+    for (size_t i = 0; i < cal.size(); i++) {
+        fill_mixed(cal[i], mixing, 1, 0.3f);
+        cc.addCalibrationData(cal[i]);
+    }
+    cc.computeMatrix(6);
+
+    std::vector<complex_double_t> a(36, complex_double_t(0));
+    for (size_t i = 0; i < cal.size(); i++) {
+        for (uint16_t p = 0; p < 6; p++) {
+            for (uint16_t q = 0; q < 6; q++) {
+                for (uint16_t s = 0; s < 50; s++) {
+                    complex_float_t x = cal[i].data(s, p) * std::conj(cal[i].data(s, q));
+                    a[p * 6 + q] += complex_double_t(x.real(), x.imag());
+                }
+            }
+        }
+    }
+
+    // Row k of the matrix is the conjugate of eigenvector k
+    const std::vector<double> &eig = cc.getEigenvalues();
+    const std::vector<complex_float_t> &m = cc.getMatrix();
+    for (size_t k = 0; k < 6; k++) {
+        for (size_t p = 0; p < 6; p++) {
+            complex_double_t av = 0;
+            for (size_t q = 0; q < 6; q++) {
+                av += a[p * 6 + q] * complex_double_t(std::conj(m[k * 6 + q]));
+            }
+            complex_double_t lv = eig[k] * complex_double_t(std::conj(m[k * 6 + p]));
+            BOOST_CHECK_SMALL(std::abs(av - lv), 1e-4 * eig[0]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_coil_compression_selection)
+{
+    srand(5);
+    std::vector<complex_float_t> mixing = random_mixing(16, 2);
+
+    // Sixteen channels on every other input of the array
+    std::vector<uint16_t> inputs;
+    for (uint16_t c = 1; c < 32; c += 2) {
+        inputs.push_back(c);
+    }
+    ChannelMask mask(inputs);
+
+    CoilCompressor cc;
+    cc.selectChannels(ChannelMask::range(0, 16));
+    Acquisition cal(64, 16);
+    fill_mixed(cal, mixing, 2, 0);
+    cal.setChannelMask(mask);
+    cc.addCalibrationData(cal);
+    BOOST_CHECK_THROW(cc.selectChannels(ChannelMask::range(0, 8)), std::runtime_error);
+
+    // Only the eight inputs below 16 are calibrated
+    BOOST_CHECK_EQUAL(cc.getChannels().count(), 8);
+    BOOST_CHECK(cc.getChannels() == (mask & ChannelMask::range(0, 16)));
+    BOOST_CHECK_EQUAL(cc.channelsForEnergy(0.99999), 2);
+    cc.computeMatrix(2);
+
+    std::vector<Acquisition> acqs(3, cal);
+    cc.compress(acqs);
+    for (size_t i = 0; i < acqs.size(); i++) {
+        BOOST_CHECK_EQUAL(acqs[i].active_channels(), 2);
+        BOOST_CHECK(acqs[i].getActiveChannels() == ChannelMask::range(0, 2));
+    }
+
+    // The eight channels hold all the energy of their part of the data
+    double selected = 0;
+    for (uint16_t c = 0; c < 8; c++) {
+        for (uint16_t s = 0; s < 64; s++) {
+            selected += std::norm(cal.data(s, c));
+        }
+    }
+    BOOST_CHECK_CLOSE(energy(acqs[0]), selected, 0.01);
+
+    // An acquisition without the calibrated channels, one already compressed
+    Acquisition missing(64, 4);
+    BOOST_CHECK_THROW(cc.compress(missing), std::runtime_error);
+    BOOST_CHECK_THROW(cc.compress(acqs[0]), std::runtime_error);
+
+    cc.reset();
+    BOOST_CHECK_THROW(cc.compress(cal), std::runtime_error);
+    BOOST_CHECK_THROW(cc.getEigenvalues(), std::runtime_error);
+}
+
+// Complex Gaussian noise with unit variance of the real and imaginary parts
+static complex_float_t gaussian()
+{
+    float u = (rand() + 1.0f) / (RAND_MAX + 2.0f), v = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+    float r = std::sqrt(-2 * std::log(u));
+    return complex_float_t(r * std::cos(6.2831853f * v), r * std::sin(6.2831853f * v));
+}
+
+// Noise correlated between the channels by the lower triangular mixing
+static void fill_noise(Acquisition &acq, const std::vector<complex_float_t> &mixing)
+{
+    uint16_t samples = acq.number_of_samples(), channels = acq.active_channels();
+    std::vector<complex_float_t> z(channels);
+    for (uint16_t s = 0; s < samples; s++) {
+        for (uint16_t c = 0; c < channels; c++) {
+            z[c] = gaussian();
+        }
+        for (uint16_t c = 0; c < channels; c++) {
+            complex_float_t x(0);
+            for (uint16_t k = 0; k <= c; k++) {
+                x += mixing[c * channels + k] * z[k];
+            }
+            acq.data(s, c) = x;
+        }
+    }
+}
+
+static std::vector<complex_double_t> sample_covariance(const std::vector<Acquisition> &acqs, uint16_t channels)
+{
+    std::vector<complex_double_t> cov(channels * channels, complex_double_t(0));
+    size_t count = 0;
+    for (size_t i = 0; i < acqs.size(); i++) {
+        const Acquisition &acq = acqs[i];
+        uint16_t samples = acq.getHead().number_of_samples;
+        for (uint16_t p = 0; p < channels; p++) {
+            for (uint16_t q = 0; q < channels; q++) {
+                for (uint16_t s = 0; s < samples; s++) {
+                    complex_float_t x = acq.getDataPtr()[p * samples + s] * std::conj(acq.getDataPtr()[q * samples + s]);
+                    cov[p * channels + q] += complex_double_t(x.real(), x.imag());
+                }
+            }
+        }
+        count += samples;
+    }
+    for (size_t i = 0; i < cov.size(); i++) {
+        cov[i] /= static_cast<double>(count);
+    }
+    return cov;
+}
+
+BOOST_AUTO_TEST_CASE(test_noise_prewhitening)
+{
+    srand(3);
+    const uint16_t channels = 10;
+    std::vector<complex_float_t> mixing(channels * channels, complex_float_t(0));
+    for (uint16_t c = 0; c < channels; c++) {
+        for (uint16_t k = 0; k < c; k++) {
+            mixing[c * channels + k] = complex_float_t(uniform(), uniform());
+        }
+        mixing[c * channels + c] = 0.5f + c;
+    }
+
+    NoisePrewhitener pw;
+    std::vector<Acquisition> noise(32, Acquisition(256, channels));
+    for (size_t i = 0; i < noise.size(); i++) {
+        fill_noise(noise[i], mixing);
+        noise[i].setFlag(ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+        noise[i].sample_time_us() = 5.0f;
+        BOOST_CHECK(pw.addNoise(noise[i]));
+    }
+    Acquisition imaging(128, channels);
+    BOOST_CHECK(!pw.addNoise(imaging));
+    BOOST_CHECK_EQUAL(pw.getNumberOfNoiseSamples(), 32u * 256);
+    BOOST_CHECK(pw.getChannels() == ChannelMask::range(0, channels));
+
+    std::vector<complex_double_t> expected = sample_covariance(noise, channels);
+    std::vector<complex_float_t> cov = pw.getNoiseCovariance();
+    for (size_t i = 0; i < cov.size(); i++) {
+        BOOST_CHECK_SMALL(std::abs(complex_double_t(cov[i]) - expected[i]), 1e-4 * std::abs(expected[0]));
+    }
+
+    // W cov W^H is the identity
+    pw.computeWhitening();
+    const std::vector<complex_float_t> &w = pw.getWhiteningMatrix();
+    for (uint16_t i = 0; i < channels; i++) {
+        for (uint16_t j = 0; j < channels; j++) {
+            complex_double_t sum = 0;
+            for (uint16_t p = 0; p < channels; p++) {
+                for (uint16_t q = 0; q < channels; q++) {
+                    sum += complex_double_t(w[i * channels + p]) * expected[p * channels + q]
+                           * std::conj(complex_double_t(w[j * channels + q]));
+                }
+            }
+            BOOST_CHECK_SMALL(std::abs(sum - (i == j ? 1.0 : 0.0)), 1e-3);
+            if (j > i) {
+                BOOST_CHECK_EQUAL(w[i * channels + j], complex_float_t(0));
+            }
+        }
+    }
+
+    // New noise, whitened, has about twice the identity as covariance
+    std::vector<Acquisition> data(16, Acquisition(256, channels));
+    for (size_t i = 0; i < data.size(); i++) {
+        fill_noise(data[i], mixing);
+        data[i].sample_time_us() = 5.0f;
+    }
+    pw.whiten(data);
+    std::vector<complex_double_t> white = sample_covariance(data, channels);
+    for (uint16_t i = 0; i < channels; i++) {
+        for (uint16_t j = 0; j < channels; j++) {
+            BOOST_CHECK_SMALL(std::abs(white[i * channels + j] - (i == j ? 2.0 : 0.0)), 0.15);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_noise_prewhitening_scale)
+{
+    srand(9);
+    IsmrmrdHeader header;
+    AcquisitionSystemInformation info;
+    info.relativeReceiverNoiseBandwidth = 0.8f;
+    header.acquisitionSystemInformation = info;
+    NoisePrewhitener pw(header);
+    BOOST_CHECK_EQUAL(pw.getRelativeReceiverNoiseBandwidth(), 0.8f);
+    BOOST_CHECK_THROW(pw.setRelativeReceiverNoiseBandwidth(0), std::runtime_error);
+    BOOST_CHECK_THROW(pw.computeWhitening(), std::runtime_error);
+
+    // Noise of channels 2, 3 and 5, sampled at 5 us
+    Acquisition noise(512, 3);
+    std::vector<complex_float_t> mixing(9, complex_float_t(0));
+    mixing[0] = 1.0f;
+    mixing[3] = complex_float_t(0.3f, 0.2f);
+    mixing[4] = 2.0f;
+    mixing[6] = complex_float_t(0, -0.1f);
+    mixing[7] = 0.5f;
+    mixing[8] = 0.7f;
+    fill_noise(noise, mixing);
+    const uint16_t noise_channels[] = {2, 3, 5};
+    noise.setChannelMask(ChannelMask(noise_channels, 3));
+    noise.sample_time_us() = 5.0f;
+    pw.addNoiseData(noise);
+
+    // Imaging at 2.5 us with channel 4 too, which is left alone
+    Acquisition acq(100, 4, 1);
+    for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+        acq.getDataPtr()[i] = complex_float_t(uniform(), uniform());
+    }
+    acq.setChannelMask(ChannelMask::range(2, 4));
+    acq.sample_time_us() = 2.5f;
+    Acquisition original(acq);
+    pw.whiten(acq);
+
+    BOOST_CHECK_EQUAL(acq.active_channels(), 4);
+    const std::vector<complex_float_t> &w = pw.getWhiteningMatrix();
+    const uint16_t rows[] = {0, 1, 3};
+    float scale = std::sqrt(2 * 0.5f * 0.8f);
+    for (uint16_t s = 0; s < 100; s++) {
+        for (uint16_t i = 0; i < 3; i++) {
+            complex_float_t y(0);
+            for (uint16_t j = 0; j < 3; j++) {
+                y += w[i * 3 + j] * original.data(s, rows[j]);
+            }
+            BOOST_CHECK_SMALL(std::abs(acq.data(s, rows[i]) - scale * y), 1e-5f);
+        }
+        BOOST_CHECK_EQUAL(acq.data(s, 2), original.data(s, 2));
+    }
+
+    // Without all the noise channels, and with a channel without noise
+    Acquisition missing(100, 2);
+    BOOST_CHECK_THROW(pw.whiten(missing), std::runtime_error);
+    pw.reset();
+    Acquisition dead(64, 2);
+    std::fill(dead.data_begin(), dead.data_end(), complex_float_t(0));
+    dead.data(10, 0) = 1.0f;
+    pw.addNoiseData(dead);
+    BOOST_CHECK_THROW(pw.computeWhitening(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
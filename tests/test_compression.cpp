@@ -0,0 +1,197 @@
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/compression.h"
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(CompressionTest)
+
+// A readout of the centre of k-space: a peak over noise of standard deviation sigma
+static void make_readout(Acquisition &acq, uint32_t n, uint16_t samples, uint16_t channels, float sigma)
+{
+    acq.resize(samples, channels, 2);
+    acq.scan_counter() = n;
+    uint32_t state = 12345 + n;
+    for (uint16_t c = 0; c < channels; c++) {
+        for (uint16_t s = 0; s < samples; s++) {
+            float noise[2];
+            for (int k = 0; k < 2; k++) {
+                // Sum of uniforms, near enough to Gaussian with this sigma
+                float sum = 0;
+                for (int j = 0; j < 12; j++) {
+                    state = state * 1664525u + 1013904223u;
+                    sum += static_cast<float>(state >> 8) / 16777216.0f;
+                }
+                noise[k] = (sum - 6.0f) * sigma;
+            }
+            float x = static_cast<float>(s) - samples / 2;
+            float peak = 1000.0f * (c + 1) / (1.0f + x * x);
+            acq.data(s, c) = complex_float_t(peak + noise[0], noise[1]);
+        }
+    }
+    for (size_t i = 0; i < acq.getNumberOfTrajElements(); i++) {
+        acq.getTrajPtr()[i] = static_cast<float>(i);
+    }
+}
+
+static std::vector<char> compress(const Acquisition &acq, const CompressionParameters &params)
+{
+    const ISMRMRD_Acquisition *c_acq = reinterpret_cast<const ISMRMRD_Acquisition *>(&acq);
+    size_t size = ismrmrd_size_of_compressed_data_bound(c_acq);
+    std::vector<char> block(size);
+    BOOST_REQUIRE_EQUAL(ismrmrd_compress_acquisition_data(c_acq, &params, &block[0], &size), ISMRMRD_NOERROR);
+    block.resize(size);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_lossless)
+{
+    CompressionParameters params;
+    ismrmrd_init_compression_parameters(&params);
+
+    const uint16_t sizes[][2] = {{256, 8}, {1, 1}, {3, 2}, {512, 1}};
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        Acquisition acq, copy;
+        make_readout(acq, static_cast<uint32_t>(k), sizes[k][0], sizes[k][1], 2.0f);
+        std::vector<char> block = compress(acq, params);
+        BOOST_CHECK_LE(block.size(), ismrmrd_size_of_compressed_data_bound(reinterpret_cast<ISMRMRD_Acquisition *>(&acq)));
+
+        copy.resize(sizes[k][0], sizes[k][1]);
+        BOOST_REQUIRE_EQUAL(ismrmrd_decompress_acquisition_data(&block[0], block.size(),
+                                                                reinterpret_cast<ISMRMRD_Acquisition *>(&copy)),
+                            ISMRMRD_NOERROR);
+        BOOST_CHECK(memcmp(copy.getDataPtr(), acq.getDataPtr(), acq.getDataSize()) == 0);
+    }
+
+    // Constant data takes a few bytes per plane
+    Acquisition zeros(1024, 4);
+    std::fill(zeros.getDataPtr(), zeros.getDataPtr() + zeros.getNumberOfDataElements(), complex_float_t(0, 0));
+    BOOST_CHECK_LT(compress(zeros, params).size(), 64u);
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_near_lossless)
+{
+    const float sigma = 2.0f;
+    std::vector<float> noise(4, sigma);
+    CompressionParameters params;
+    ismrmrd_init_compression_parameters(&params);
+    params.mode = ISMRMRD_COMPRESSION_NEAR_LOSSLESS;
+    params.tolerance = 0.25f;
+
+    CompressionParameters lossless;
+    ismrmrd_init_compression_parameters(&lossless);
+
+    // With the given noise levels and with the estimate from the readout edges
+    for (int given = 0; given < 2; given++) {
+        params.noise_stddev = given ? &noise[0] : NULL;
+        params.num_noise_channels = given ? static_cast<uint16_t>(noise.size()) : 0;
+
+        Acquisition acq, copy;
+        make_readout(acq, 7, 256, 4, sigma);
+        std::vector<char> block = compress(acq, params);
+        BOOST_CHECK_LT(block.size(), compress(acq, lossless).size());
+
+        copy.resize(256, 4);
+        BOOST_REQUIRE_EQUAL(ismrmrd_decompress_acquisition_data(&block[0], block.size(),
+                                                                reinterpret_cast<ISMRMRD_Acquisition *>(&copy)),
+                            ISMRMRD_NOERROR);
+        // Half a step, with some room for the estimate of sigma
+        float max_error = 0;
+        for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+            max_error = std::max(max_error, std::abs(copy.getDataPtr()[i].real() - acq.getDataPtr()[i].real()));
+            max_error = std::max(max_error, std::abs(copy.getDataPtr()[i].imag() - acq.getDataPtr()[i].imag()));
+        }
+        BOOST_CHECK_GT(max_error, 0.0f);
+        BOOST_CHECK_LE(max_error, 0.5f * params.tolerance * sigma * (given ? 1.0001f : 1.5f));
+    }
+
+    // Noise free data is kept to the float resolution of its peak
+    params.noise_stddev = NULL;
+    params.num_noise_channels = 0;
+    Acquisition flat(64, 1), copy(64, 1);
+    for (size_t i = 0; i < flat.getNumberOfDataElements(); i++) {
+        flat.getDataPtr()[i] = complex_float_t(100.0f, -100.0f);
+    }
+    std::vector<char> block = compress(flat, params);
+    BOOST_REQUIRE_EQUAL(ismrmrd_decompress_acquisition_data(&block[0], block.size(),
+                                                            reinterpret_cast<ISMRMRD_Acquisition *>(&copy)),
+                        ISMRMRD_NOERROR);
+    BOOST_CHECK_CLOSE(copy.getDataPtr()[10].real(), 100.0f, 1e-4);
+
+    params.tolerance = 0;
+    size_t size = 1 << 16;
+    std::vector<char> out(size);
+    BOOST_CHECK_NE(ismrmrd_compress_acquisition_data(reinterpret_cast<ISMRMRD_Acquisition *>(&flat), &params,
+                                                     &out[0], &size),
+                   ISMRMRD_NOERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_batch)
+{
+    CompressionParameters params;
+    ismrmrd_init_compression_parameters(&params);
+    params.threads = 3;
+
+    std::vector<Acquisition> acqs(10), copies(10);
+    std::vector<std::vector<char> > blocks(10);
+    std::vector<void *> out(10);
+    std::vector<const void *> in(10);
+    std::vector<size_t> sizes(10);
+    for (uint32_t n = 0; n < acqs.size(); n++) {
+        make_readout(acqs[n], n, 128, n % 3 + 1, 1.0f);
+        sizes[n] = ismrmrd_size_of_compressed_data_bound(reinterpret_cast<ISMRMRD_Acquisition *>(&acqs[n]));
+        blocks[n].resize(sizes[n]);
+        out[n] = &blocks[n][0];
+        in[n] = &blocks[n][0];
+        copies[n].resize(128, n % 3 + 1);
+    }
+    BOOST_REQUIRE_EQUAL(ismrmrd_compress_acquisitions(reinterpret_cast<ISMRMRD_Acquisition *>(&acqs[0]), 10,
+                                                      &params, &out[0], &sizes[0]),
+                        ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_decompress_acquisitions(&in[0], &sizes[0], 10,
+                                                        reinterpret_cast<ISMRMRD_Acquisition *>(&copies[0]), 2),
+                        ISMRMRD_NOERROR);
+    for (uint32_t n = 0; n < acqs.size(); n++) {
+        BOOST_CHECK(memcmp(copies[n].getDataPtr(), acqs[n].getDataPtr(), acqs[n].getDataSize()) == 0);
+    }
+
+    // An error on a worker thread reaches the caller
+    sizes[4] = 10;
+    BOOST_CHECK_NE(ismrmrd_decompress_acquisitions(&in[0], &sizes[0], 10,
+                                                   reinterpret_cast<ISMRMRD_Acquisition *>(&copies[0]), 4),
+                   ISMRMRD_NOERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_corrupt)
+{
+    CompressionParameters params;
+    ismrmrd_init_compression_parameters(&params);
+    Acquisition acq, copy(256, 8), other(128, 8);
+    make_readout(acq, 1, 256, 8, 2.0f);
+    std::vector<char> block = compress(acq, params);
+    ISMRMRD_Acquisition *c_copy = reinterpret_cast<ISMRMRD_Acquisition *>(&copy);
+
+    // Every truncation is caught
+    for (size_t size = 0; size < block.size(); size += 97) {
+        BOOST_CHECK_NE(ismrmrd_decompress_acquisition_data(&block[0], size, c_copy), ISMRMRD_NOERROR);
+    }
+    // A block of another shape
+    BOOST_CHECK_NE(ismrmrd_decompress_acquisition_data(&block[0], block.size(),
+                                                       reinterpret_cast<ISMRMRD_Acquisition *>(&other)),
+                   ISMRMRD_NOERROR);
+    // Flipped bits either fail the final state check or decode to other data,
+    // but never read or write out of bounds
+    for (size_t i = 16; i < block.size(); i += 31) {
+        std::vector<char> bad(block);
+        bad[i] ^= 0x10;
+        ismrmrd_decompress_acquisition_data(&bad[0], bad.size(), c_copy);
+    }
+    block[0] = 9;
+    BOOST_CHECK_NE(ismrmrd_decompress_acquisition_data(&block[0], block.size(), c_copy), ISMRMRD_NOERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,600 @@
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/compression.h"
+#include "ismrmrd/version.h"
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <atomic>
+#include <chrono>
+#include <thread>
+#define ISMRMRD_TEST_THREADS
+#endif
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(DatasetTest)
+
+static std::string temp_dataset_name(const char *tag)
+{
+    return std::string("test_dataset_") + tag + ".h5";
+}
+
+BOOST_AUTO_TEST_CASE(test_dataset_stats)
+{
+    std::string filename = temp_dataset_name("stats");
+    std::remove(filename.c_str());
+
+    Acquisition acq(256, 4, 2);
+    {
+        Dataset d(filename.c_str(), "dataset", true);
+
+        // Off by default: counters read back as zero
+        ISMRMRD_DatasetStats stats = d.getStats();
+        BOOST_CHECK_EQUAL(stats.writes.count, 0u);
+
+        d.enableStats();
+        d.appendAcquisition(acq);
+        d.appendAcquisition(acq);
+        stats = d.getStats();
+        BOOST_CHECK_EQUAL(stats.writes.count, 2u);
+        BOOST_CHECK_EQUAL(stats.extent_changes.count, 1u);
+        BOOST_CHECK_EQUAL(stats.type_constructions.count, 2u);
+        BOOST_CHECK(stats.link_lookups.count >= 2u);
+        BOOST_CHECK_EQUAL(stats.bytes_written, 2 * (sizeof(AcquisitionHeader) +
+                    acq.getNumberOfTrajElements() * sizeof(float) +
+                    acq.getNumberOfDataElements() * sizeof(complex_float_t)));
+        BOOST_CHECK_EQUAL(stats.reads.count, 0u);
+
+        d.resetStats();
+        Acquisition in;
+        d.readAcquisition(1, in);
+        stats = d.getStats();
+        BOOST_CHECK_EQUAL(stats.writes.count, 0u);
+        BOOST_CHECK_EQUAL(stats.reads.count, 1u);
+        BOOST_CHECK_EQUAL(stats.vlen_allocations, 2u);
+        BOOST_CHECK_EQUAL(stats.bytes_read, stats.bytes_written + (sizeof(AcquisitionHeader) +
+                    acq.getNumberOfTrajElements() * sizeof(float) +
+                    acq.getNumberOfDataElements() * sizeof(complex_float_t)));
+
+        d.enableStats(false);
+        d.readAcquisition(0, in);
+        BOOST_CHECK_EQUAL(d.getStats().reads.count, 0u);
+    }
+    std::remove(filename.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_dataset_batched_acquisitions)
+{
+    std::string filename = temp_dataset_name("batched");
+    std::remove(filename.c_str());
+
+    // Sizes vary, so the batches carry different variable length buffers
+    std::vector<Acquisition> acqs;
+    for (uint16_t n = 0; n < 50; n++) {
+        Acquisition acq(64 + n, n % 4 + 1, n % 3);
+        acq.scan_counter() = n;
+        for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+            acq.getDataPtr()[i] = complex_float_t(n, static_cast<float>(i));
+        }
+        for (size_t i = 0; i < acq.getNumberOfTrajElements(); i++) {
+            acq.getTrajPtr()[i] = static_cast<float>(n * i);
+        }
+        acqs.push_back(acq);
+    }
+    {
+        Dataset d(filename.c_str(), "dataset", true);
+        d.enableStats();
+        d.appendAcquisitions(&acqs[0], 20);
+        d.appendAcquisition(acqs[20]);
+        d.appendAcquisitions(&acqs[21], 29);
+        d.appendAcquisitions(&acqs[0], 0);
+        BOOST_CHECK_EQUAL(d.getNumberOfAcquisitions(), 50u);
+        BOOST_CHECK_EQUAL(d.getStats().writes.count, 3u);
+
+        std::vector<Acquisition> in(30);
+        d.resetStats();
+        d.readAcquisitions(15, in.size(), &in[0]);
+        BOOST_CHECK_EQUAL(d.getStats().reads.count, 1u);
+        for (size_t n = 0; n < in.size(); n++) {
+            const Acquisition &expected = acqs[15 + n];
+            BOOST_CHECK(memcmp(&in[n].getHead(), &expected.getHead(), sizeof(ISMRMRD_AcquisitionHeader)) == 0);
+            BOOST_REQUIRE_EQUAL(in[n].getDataSize(), expected.getDataSize());
+            BOOST_CHECK(memcmp(in[n].getDataPtr(), expected.getDataPtr(), expected.getDataSize()) == 0);
+            BOOST_REQUIRE_EQUAL(in[n].getTrajSize(), expected.getTrajSize());
+            if (expected.getTrajSize() > 0) {
+                BOOST_CHECK(memcmp(in[n].getTrajPtr(), expected.getTrajPtr(), expected.getTrajSize()) == 0);
+            }
+        }
+
+        BOOST_CHECK_THROW(d.readAcquisitions(40, 11, &in[0]), std::runtime_error);
+        d.readAcquisitions(40, 10, &in[0]);
+        BOOST_CHECK_EQUAL(in[9].scan_counter(), 49u);
+    }
+    std::remove(filename.c_str());
+}
+
+// Rewrites groupname/xml the way other HDF5 writers do, leaving xml_bin alone:
+// in place, or by deleting and recreating the dataset
+// Replaces the XML header the way other writers do, without the hash tag
+static void rewrite_xml(const std::string &filename, const std::string &xml)
+{
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    BOOST_REQUIRE(file >= 0);
+    hid_t type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, H5T_VARIABLE);
+    H5Ldelete(file, "/dataset/xml", H5P_DEFAULT);
+    hsize_t dims[1] = {1};
+    hid_t space = H5Screate_simple(1, dims, NULL);
+    hid_t dataset = H5Dcreate2(file, "/dataset/xml", type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Sclose(space);
+    BOOST_REQUIRE(dataset >= 0);
+    const char *buf[1] = {xml.c_str()};
+    BOOST_CHECK(H5Dwrite(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf) >= 0);
+    H5Dclose(dataset);
+    H5Tclose(type);
+    H5Fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_dataset_binary_header)
+{
+    std::string filename = temp_dataset_name("header");
+    std::remove(filename.c_str());
+
+    IsmrmrdHeader h;
+    h.experimentalConditions.H1resonanceFrequency_Hz = 63500000;
+    h.encoding.push_back(Encoding());
+    h.encoding[0].trajectory = "cartesian";
+    h.encoding[0].encodedSpace.fieldOfView_mm.x = 1.0e-3f;
+    h.encoding[0].reconSpace = h.encoding[0].encodedSpace;
+    {
+        Dataset d(filename.c_str(), "dataset", true);
+        d.writeHeader(h);
+
+        IsmrmrdHeader h2;
+        d.readHeader(h2);
+        BOOST_CHECK_EQUAL(h2.experimentalConditions.H1resonanceFrequency_Hz, 63500000);
+        BOOST_CHECK_EQUAL(h2.encoding[0].encodedSpace.fieldOfView_mm.x, 1.0e-3f);
+    }
+
+    ISMRMRD_Dataset dset;
+    BOOST_REQUIRE_EQUAL(ismrmrd_init_dataset(&dset, filename.c_str(), "dataset"), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_open_dataset(&dset, false), ISMRMRD_NOERROR);
+
+    size_t length;
+    void *bin = ismrmrd_read_binary_header(&dset, &length);
+    BOOST_REQUIRE(bin != NULL);
+    BOOST_CHECK(is_binary_header(static_cast<char*>(bin), length));
+    free(bin);
+
+    // Writing the XML alone drops the stale binary copy
+    h.experimentalConditions.H1resonanceFrequency_Hz = 127700000;
+    std::string xml;
+    serialize(h, xml);
+    BOOST_CHECK_EQUAL(ismrmrd_write_header(&dset, xml.c_str()), ISMRMRD_NOERROR);
+    bin = ismrmrd_read_binary_header(&dset, &length);
+    BOOST_CHECK(bin == NULL);
+    BOOST_CHECK_EQUAL(length, 0u);
+    BOOST_CHECK_EQUAL(ismrmrd_close_dataset(&dset), ISMRMRD_NOERROR);
+
+    {
+        Dataset d(filename.c_str(), "dataset", false);
+        IsmrmrdHeader h3;
+        d.readHeader(h3);
+        BOOST_CHECK_EQUAL(h3.experimentalConditions.H1resonanceFrequency_Hz, 127700000);
+    }
+
+    // Other writers replace the XML and keep the binary copy, which is then
+    // ignored
+    h.experimentalConditions.H1resonanceFrequency_Hz = 63500000;
+    {
+        Dataset d(filename.c_str(), "dataset", false);
+        d.writeHeader(h);
+    }
+    h.experimentalConditions.H1resonanceFrequency_Hz = 123200000;
+    serialize(h, xml);
+    rewrite_xml(filename, xml);
+    {
+        Dataset d(filename.c_str(), "dataset", false);
+        IsmrmrdHeader h4;
+        d.readHeader(h4);
+        BOOST_CHECK_EQUAL(h4.experimentalConditions.H1resonanceFrequency_Hz, 123200000);
+#ifdef ISMRMRD_HEADER_CACHE
+        BOOST_CHECK_EQUAL(d.readParsedHeader()->experimentalConditions.H1resonanceFrequency_Hz, 123200000);
+#endif
+    }
+
+    // A binary copy of an untagged XML header tags the XML as well
+    std::string encoded;
+    serialize_binary(h, encoded);
+    BOOST_REQUIRE_EQUAL(ismrmrd_init_dataset(&dset, filename.c_str(), "dataset"), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_open_dataset(&dset, false), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_write_binary_header(&dset, encoded.data(), encoded.size()), ISMRMRD_NOERROR);
+    bin = ismrmrd_read_binary_header(&dset, &length);
+    BOOST_CHECK(bin != NULL);
+    BOOST_CHECK_EQUAL(length, encoded.size());
+    free(bin);
+    BOOST_CHECK_EQUAL(ismrmrd_close_dataset(&dset), ISMRMRD_NOERROR);
+    std::remove(filename.c_str());
+}
+
+// A peak over a little noise, the kind of readout compression is made for
+static void make_peak_readout(Acquisition &acq, uint32_t n)
+{
+    acq.resize(192, 4, 2);
+    acq.scan_counter() = n;
+    uint32_t state = 12345 + n;
+    for (uint16_t c = 0; c < 4; c++) {
+        for (uint16_t s = 0; s < 192; s++) {
+            state = state * 1664525u + 1013904223u;
+            float noise = static_cast<float>(state >> 8) / 16777216.0f - 0.5f;
+            float x = static_cast<float>(s) - 96;
+            acq.data(s, c) = complex_float_t(1000.0f * (c + 1) / (1.0f + x * x) + 4 * noise, 4 * noise);
+        }
+    }
+    for (size_t i = 0; i < acq.getNumberOfTrajElements(); i++) {
+        acq.getTrajPtr()[i] = static_cast<float>(i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_dataset_compression)
+{
+    std::string filename = temp_dataset_name("compression");
+    std::remove(filename.c_str());
+
+    std::vector<Acquisition> acqs(6);
+    for (uint32_t n = 0; n < acqs.size(); n++) {
+        make_peak_readout(acqs[n], n);
+    }
+    acqs[5].setFlag(ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+
+    uint64_t lossless_bytes, near_lossless_bytes;
+    {
+        Dataset d(filename.c_str(), "dataset", true);
+        d.enableStats();
+        CompressionParameters params;
+        ismrmrd_init_compression_parameters(&params);
+        d.setCompression(params);
+        d.appendAcquisitions(&acqs[0], 3);
+        lossless_bytes = d.getStats().bytes_written;
+
+        params.mode = ISMRMRD_COMPRESSION_NEAR_LOSSLESS;
+        d.setCompression(params);
+        d.appendAcquisitions(&acqs[3], 2);
+        near_lossless_bytes = d.getStats().bytes_written - lossless_bytes;
+
+        params.mode = ISMRMRD_COMPRESSION_NONE;
+        d.setCompression(params);
+        d.appendAcquisition(acqs[5]);
+    }
+    BOOST_CHECK_LT(lossless_bytes, 3 * (sizeof(ISMRMRD_AcquisitionHeader) + acqs[0].getTrajSize() + acqs[0].getDataSize()));
+    BOOST_CHECK_LT(near_lossless_bytes, lossless_bytes);
+
+    // None of it is where readers that predate compression look
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    BOOST_REQUIRE(file >= 0);
+    BOOST_CHECK(H5Lexists(file, "/dataset/data", H5P_DEFAULT) == 0);
+    BOOST_CHECK(H5Lexists(file, "/dataset/data_compressed", H5P_DEFAULT) > 0);
+    H5Fclose(file);
+
+    {
+        Dataset d(filename.c_str(), "dataset", false);
+        BOOST_REQUIRE_EQUAL(d.getNumberOfAcquisitions(), 6u);
+        // A batch of mixed acquisitions, with the flags cleared on read
+        std::vector<Acquisition> copies(6);
+        d.readAcquisitions(0, 6, &copies[0]);
+        for (uint32_t n = 0; n < acqs.size(); n++) {
+            BOOST_CHECK(memcmp(&copies[n].getHead(), &acqs[n].getHead(), sizeof(ISMRMRD_AcquisitionHeader)) == 0);
+            BOOST_CHECK(memcmp(copies[n].getTrajPtr(), acqs[n].getTrajPtr(), acqs[n].getTrajSize()) == 0);
+            if (n < 3 || n == 5) {
+                BOOST_CHECK(memcmp(copies[n].getDataPtr(), acqs[n].getDataPtr(), acqs[n].getDataSize()) == 0);
+            } else {
+                BOOST_CHECK_CLOSE(copies[n].data(96, 3).real(), acqs[n].data(96, 3).real(), 0.1);
+            }
+        }
+        Acquisition one;
+        d.readAcquisition(1, one);
+        BOOST_CHECK(memcmp(one.getDataPtr(), acqs[1].getDataPtr(), acqs[1].getDataSize()) == 0);
+    }
+    std::remove(filename.c_str());
+
+    // A group with uncompressed acquisitions stays readable by everyone
+    {
+        Dataset d(filename.c_str(), "dataset", true);
+        d.appendAcquisition(acqs[0]);
+        CompressionParameters params;
+        ismrmrd_init_compression_parameters(&params);
+        d.setCompression(params);
+        BOOST_CHECK_THROW(d.appendAcquisition(acqs[1]), std::runtime_error);
+        BOOST_CHECK_EQUAL(d.getNumberOfAcquisitions(), 1u);
+    }
+    std::remove(filename.c_str());
+}
+
+// Older files may set the compression flags on plain data, which is not
+// compressed and read as it is
+BOOST_AUTO_TEST_CASE(test_dataset_flagged_plain_data)
+{
+    std::string filename = temp_dataset_name("flagged");
+    std::remove(filename.c_str());
+
+    Acquisition acq;
+    make_peak_readout(acq, 0);
+    acq.setFlag(ISMRMRD_ACQ_COMPRESSION1);
+    {
+        Dataset d(filename.c_str(), "dataset", true);
+        d.appendAcquisition(acq);
+    }
+
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    BOOST_REQUIRE(file >= 0);
+    BOOST_CHECK(H5Lexists(file, "/dataset/data", H5P_DEFAULT) > 0);
+    H5Fclose(file);
+
+    Dataset d(filename.c_str(), "dataset", false);
+    Acquisition back;
+    d.readAcquisition(0, back);
+    BOOST_CHECK(back.isFlagSet(ISMRMRD_ACQ_COMPRESSION1));
+    BOOST_REQUIRE_EQUAL(back.number_of_samples(), acq.number_of_samples());
+    BOOST_REQUIRE_EQUAL(back.active_channels(), acq.active_channels());
+    BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), back.data_begin()));
+    std::remove(filename.c_str());
+}
+
+#ifdef ISMRMRD_HEADER_CACHE
+// Overwrites the XML header without touching the dataset, so it keeps its tag
+static void overwrite_xml(const std::string &filename, const std::string &xml)
+{
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    BOOST_REQUIRE(file >= 0);
+    hid_t type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, H5T_VARIABLE);
+    hid_t dataset = H5Dopen2(file, "/dataset/xml", H5P_DEFAULT);
+    BOOST_REQUIRE(dataset >= 0);
+    const char *buf[1] = {xml.c_str()};
+    BOOST_CHECK(H5Dwrite(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf) >= 0);
+    H5Dclose(dataset);
+    H5Tclose(type);
+    H5Fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_dataset_header_cache)
+{
+    clearHeaderCache();
+    std::string names[4];
+    for (int i = 0; i < 4; i++) {
+        names[i] = temp_dataset_name(("cache" + std::string(1, '0' + i)).c_str());
+    }
+
+    // Two files with a binary copy, two more with another header as XML only
+    IsmrmrdHeader h;
+    h.experimentalConditions.H1resonanceFrequency_Hz = 63500000;
+    h.encoding.push_back(Encoding());
+    h.encoding[0].trajectory = "cartesian";
+    for (int i = 0; i < 4; i++) {
+        std::remove(names[i].c_str());
+        Dataset d(names[i].c_str(), "dataset", true);
+        if (i == 2) {
+            h.encoding[0].trajectory = "radial";
+        }
+        d.writeHeader(h, i < 2);
+    }
+
+    std::shared_ptr<const IsmrmrdHeader> p[4];
+    for (int i = 0; i < 4; i++) {
+        Dataset d(names[i].c_str(), "dataset", false);
+        d.enableStats();
+        p[i] = d.readParsedHeader();
+        // The second file of each pair is answered by the cache
+        BOOST_CHECK_EQUAL(d.getStats().header_cache_hits, i % 2 ? 1u : 0u);
+        BOOST_CHECK_EQUAL(d.getStats().header_cache_misses, i % 2 ? 0u : 1u);
+        // A hit only reads the tag of the XML, not the header itself
+        if (i % 2) {
+            BOOST_CHECK_EQUAL(d.getStats().reads.count, 0u);
+            BOOST_CHECK_EQUAL(d.getStats().bytes_read, 0u);
+        }
+    }
+    BOOST_CHECK(p[0] == p[1]);
+    BOOST_CHECK(p[2] == p[3]);
+    BOOST_CHECK(p[0] != p[2]);
+    BOOST_CHECK_EQUAL(p[0]->encoding[0].trajectory, "cartesian");
+    BOOST_CHECK_EQUAL(p[2]->encoding[0].trajectory, "radial");
+
+    HeaderCacheStats stats = getHeaderCacheStats();
+    BOOST_CHECK_EQUAL(stats.hits, 2u);
+    BOOST_CHECK_EQUAL(stats.misses, 2u);
+    BOOST_CHECK_EQUAL(stats.entries, 2u);
+
+    // Shrinking evicts the least recently used entry
+    setHeaderCacheCapacity(stats.bytes - 1);
+    stats = getHeaderCacheStats();
+    BOOST_CHECK_EQUAL(stats.entries, 1u);
+    BOOST_CHECK_EQUAL(stats.evictions, 1u);
+    {
+        Dataset d(names[2].c_str(), "dataset", false);
+        BOOST_CHECK(d.readParsedHeader() == p[2]);
+    }
+    {
+        Dataset d(names[0].c_str(), "dataset", false);
+        std::shared_ptr<const IsmrmrdHeader> again = d.readParsedHeader();
+        BOOST_CHECK(again != p[0]);
+        BOOST_CHECK_EQUAL(again->encoding[0].trajectory, "cartesian");
+    }
+
+    // Off: every call decodes
+    setHeaderCacheCapacity(0);
+    BOOST_CHECK_EQUAL(getHeaderCacheStats().entries, 0u);
+    {
+        Dataset d(names[2].c_str(), "dataset", false);
+        BOOST_CHECK(d.readParsedHeader() != p[2]);
+    }
+
+    setHeaderCacheCapacity(16 << 20);
+    clearHeaderCache();
+    for (int i = 0; i < 4; i++) {
+        std::remove(names[i].c_str());
+    }
+
+    // A binary copy that does not decode: the header from the XML is cached
+    // under the tag, which is what the next open looks up
+    {
+        Dataset d(names[0].c_str(), "dataset", true);
+        d.writeHeader(h, false);
+    }
+    ISMRMRD_Dataset dset;
+    BOOST_REQUIRE_EQUAL(ismrmrd_init_dataset(&dset, names[0].c_str(), "dataset"), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_open_dataset(&dset, false), ISMRMRD_NOERROR);
+    const char foreign[] = "ISMB\x63\x00";
+    BOOST_CHECK_EQUAL(ismrmrd_write_binary_header(&dset, foreign, sizeof(foreign) - 1), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_close_dataset(&dset), ISMRMRD_NOERROR);
+    for (int i = 0; i < 2; i++) {
+        Dataset d(names[0].c_str(), "dataset", false);
+        d.enableStats();
+        BOOST_CHECK_EQUAL(d.readParsedHeader()->encoding[0].trajectory, "radial");
+        BOOST_CHECK_EQUAL(d.getStats().header_cache_hits, i == 1 ? 1u : 0u);
+    }
+    clearHeaderCache();
+
+    // Entries are charged for the decoded header, not only the compact key
+    h.userParameters = UserParameters();
+    for (int i = 0; i < 1000; i++) {
+        UserParameterString p;
+        p.name = "p";
+        p.value = "v";
+        h.userParameters().userParameterString.push_back(p);
+    }
+    {
+        Dataset d(names[0].c_str(), "dataset", true);
+        d.writeHeader(h);
+        d.readParsedHeader();
+    }
+    std::string bin;
+    serialize_binary(h, bin);
+    BOOST_CHECK_GT(getHeaderCacheStats().bytes, bin.size() + 1000 * sizeof(UserParameterString));
+    clearHeaderCache();
+
+    // A tag that does not match the XML is not cached under
+    h = IsmrmrdHeader();
+    h.encoding.push_back(Encoding());
+    h.encoding[0].trajectory = "spiral";
+    std::string xml;
+    serialize(h, xml);
+    overwrite_xml(names[0], xml);
+    for (int i = 0; i < 2; i++) {
+        Dataset d(names[0].c_str(), "dataset", false);
+        d.enableStats();
+        BOOST_CHECK_EQUAL(d.readParsedHeader()->encoding[0].trajectory, "spiral");
+        BOOST_CHECK_EQUAL(d.getStats().header_cache_hits, 0u);
+    }
+    clearHeaderCache();
+    std::remove(names[0].c_str());
+}
+#endif
+
+#ifdef ISMRMRD_TEST_THREADS
+static const int STRESS_ACQUISITIONS = 64;
+
+static void stress_write(const std::string& filename, uint32_t seed, std::atomic<int>& failures)
+{
+    try {
+        Dataset d(filename.c_str(), "dataset", true);
+        Acquisition acq(128, 4);
+        for (int i = 0; i < STRESS_ACQUISITIONS; i++) {
+            acq.scan_counter() = seed + i;
+            acq.data(0, 0) = complex_float_t(static_cast<float>(seed), static_cast<float>(i));
+            d.appendAcquisition(acq);
+        }
+        std::vector<size_t> dims(2, 32);
+        NDArray<float> arr(dims);
+        arr(0, 0) = static_cast<float>(seed);
+        d.appendNDArray("array", arr);
+    } catch (std::exception&) {
+        failures++;
+    }
+}
+
+static void stress_read(const std::string& filename, uint32_t seed, int rounds, std::atomic<int>& failures)
+{
+    try {
+        // Every thread opens its own Dataset, also on a shared file
+        Dataset d(filename.c_str(), "dataset", false);
+        Acquisition acq;
+        NDArray<float> arr;
+        for (int r = 0; r < rounds; r++) {
+            if (d.getNumberOfAcquisitions() != STRESS_ACQUISITIONS) {
+                failures++;
+            }
+            for (int i = 0; i < STRESS_ACQUISITIONS; i++) {
+                d.readAcquisition(i, acq);
+                if (acq.scan_counter() != seed + i || acq.data(0, 0).real() != static_cast<float>(seed)
+                        || acq.data(0, 0).imag() != static_cast<float>(i)) {
+                    failures++;
+                }
+            }
+            d.readNDArray("array", 0, arr);
+            if (arr(0, 0) != static_cast<float>(seed)) {
+                failures++;
+            }
+        }
+    } catch (std::exception&) {
+        failures++;
+    }
+}
+
+// N datasets hammered by M threads, reports the read throughput against one thread
+BOOST_AUTO_TEST_CASE(test_dataset_threads)
+{
+    const int num_datasets = 4;
+    const int num_threads = 8;
+    const int rounds = 4;
+    std::atomic<int> failures(0);
+
+    std::vector<std::string> names;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_datasets; i++) {
+        names.push_back(temp_dataset_name(("threads" + std::string(1, '0' + i)).c_str()));
+        std::remove(names[i].c_str());
+        threads.push_back(std::thread(stress_write, names[i], 1000u * i, std::ref(failures)));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    BOOST_REQUIRE_EQUAL(failures.load(), 0);
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int t = 0; t < num_threads; t++) {
+        stress_read(names[t % num_datasets], 1000u * (t % num_datasets), rounds, failures);
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    threads.clear();
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread(stress_read, names[t % num_datasets], 1000u * (t % num_datasets),
+                                      rounds, std::ref(failures)));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    BOOST_CHECK_EQUAL(failures.load(), 0);
+
+    double reads = static_cast<double>(num_threads) * rounds * STRESS_ACQUISITIONS;
+    double serial = std::chrono::duration<double>(t1 - t0).count();
+    double parallel = std::chrono::duration<double>(t2 - t1).count();
+    BOOST_TEST_MESSAGE("dataset threads: " << num_datasets << " datasets, " << num_threads << " threads, "
+                       << (ismrmrd_dataset_serializes_hdf5() ? "serialized" : "thread-safe") << " HDF5, "
+                       << reads / serial << " acquisitions/s on one thread, "
+                       << reads / parallel << " acquisitions/s on " << num_threads
+                       << " (x" << serial / parallel << ")");
+
+    for (int i = 0; i < num_datasets; i++) {
+        std::remove(names[i].c_str());
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+#include "ismrmrd/ismrmrd.h"
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <thread>
+#define ISMRMRD_TEST_THREADS
+#endif
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(ErrorTest)
+
+static const char* messages[] = { "first", "second", "third", "fourth", "fifth", "sixth", "seventh", "eighth" };
+
+BOOST_AUTO_TEST_CASE(test_error_stack_order)
+{
+    build_exception_string();
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(ismrmrd_push_error("file.c", 10 + i, "func", ISMRMRD_RUNTIMEERROR, messages[i]),
+                          ISMRMRD_RUNTIMEERROR);
+    }
+
+    // Most recent error first
+    char *file, *func, *msg;
+    int line, code;
+    BOOST_REQUIRE(ismrmrd_pop_error(&file, &line, &func, &code, &msg));
+    BOOST_CHECK_EQUAL(std::string(msg), "third");
+    BOOST_CHECK_EQUAL(line, 12);
+    BOOST_CHECK_EQUAL(code, ISMRMRD_RUNTIMEERROR);
+
+    std::string s = build_exception_string();
+    BOOST_CHECK(s.find("second") < s.find("first"));
+    BOOST_CHECK(s.find("third") == std::string::npos);
+    BOOST_CHECK(!ismrmrd_pop_error(NULL, NULL, NULL, NULL, NULL));
+    BOOST_CHECK(build_exception_string().empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_error_stack_overflow)
+{
+    build_exception_string();
+    for (int i = 0; i < 100; i++) {
+        ismrmrd_push_error("file.c", i, "func", ISMRMRD_FILEERROR, messages[i % 8]);
+    }
+    BOOST_CHECK_EQUAL(ismrmrd_error_stack_overflow(), 36);
+
+    // The oldest errors were dropped
+    int line = -1, popped = 0;
+    while (ismrmrd_pop_error(NULL, &line, NULL, NULL, NULL)) {
+        BOOST_CHECK_EQUAL(line, 99 - popped);
+        popped++;
+    }
+    BOOST_CHECK_EQUAL(popped, 64);
+    BOOST_CHECK_EQUAL(line, 36);
+
+    std::string s = build_exception_string();
+    BOOST_CHECK(s.find("36 earlier errors dropped") != std::string::npos);
+    BOOST_CHECK_EQUAL(ismrmrd_error_stack_overflow(), 0);
+
+    ismrmrd_push_error("file.c", 1, "func", ISMRMRD_FILEERROR, "kept");
+    ismrmrd_clear_error_stack();
+    BOOST_CHECK(!ismrmrd_pop_error(NULL, NULL, NULL, NULL, NULL));
+}
+
+#ifdef ISMRMRD_TEST_THREADS
+static void push_and_check(int thread, std::vector<std::string>* result)
+{
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < 3; i++) {
+            ismrmrd_push_error("file.c", thread, "func", ISMRMRD_RUNTIMEERROR, messages[thread]);
+        }
+        std::string s = build_exception_string();
+        if (round == 0) {
+            result->push_back(s);
+        }
+        // Only this thread's errors, all of them
+        if (s.find(messages[thread]) == std::string::npos) {
+            result->push_back("missing");
+        }
+        for (int other = 0; other < 8; other++) {
+            if (other != thread && s.find(messages[other]) != std::string::npos) {
+                result->push_back("foreign");
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_error_stack_per_thread)
+{
+    build_exception_string();
+    ismrmrd_push_error("file.c", 1, "func", ISMRMRD_RUNTIMEERROR, "main thread");
+
+    std::vector<std::vector<std::string> > results(8);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.push_back(std::thread(push_and_check, t, &results[t]));
+    }
+    for (int t = 0; t < 8; t++) {
+        threads[t].join();
+        BOOST_CHECK_EQUAL(results[t].size(), 1);
+    }
+
+    // Untouched by the other threads
+    std::string s = build_exception_string();
+    BOOST_CHECK(s.find("main thread") != std::string::npos);
+    BOOST_CHECK(s.find("\n") == std::string::npos);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,265 @@
+#include "ismrmrd/meta.h"
+#include "ismrmrd/ismrmrd.h"
+#include <boost/test/unit_test.hpp>
+#include <climits>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(MetaTest)
+
+// Values that may or may not be stored typed by the binary encoding
+static const char* tricky_values[] = {
+    "0", "-0", "007", "42", "-42", "9223372036854775807", "-9223372036854775808",
+    "99999999999999999999", "1.456", "-0.5", "1e+06", "1.5e-05", "3.14159265358979",
+    "0.1", "nan", "inf", "12abc", "", "ISMRMRD"
+};
+
+static const size_t num_tricky_values = sizeof(tricky_values) / sizeof(tricky_values[0]);
+
+static void make_meta(MetaContainer& meta)
+{
+    meta.set("GADGETRON_DataRole", "Image");
+    meta.set("GADGETRON_ImageNumber", 17L);
+    meta.set("GADGETRON_WindowCenter", 1234.5678);
+    meta.set("GADGETRON_WindowWidth", -2048L);
+    meta.set("GADGETRON_ImageProcessingHistory", "FFT");
+    meta.append("GADGETRON_ImageProcessingHistory", "COMBINE");
+    meta.append("GADGETRON_ImageProcessingHistory", "FFT");
+    meta.set("GADGETRON_ImageComment", "Image");
+    meta.set("read_dir", 1.0);
+    meta.append("read_dir", 0.0);
+    meta.append("read_dir", -0.0);
+    meta.set("mixed", 1.456);
+    meta.append("mixed", 66797L);
+    meta.append("mixed", "hsjdhaks");
+    meta.set("tricky", tricky_values[0]);
+    for (size_t i = 1; i < num_tricky_values; i++) {
+        meta.append("tricky", tricky_values[i]);
+    }
+}
+
+static void check_same(const MetaContainer& a, const MetaContainer& b, const char* name)
+{
+    BOOST_REQUIRE_EQUAL(a.length(name), b.length(name));
+    for (size_t i = 0; i < a.length(name); i++) {
+        BOOST_CHECK_EQUAL(std::string(a.as_str(name, i)), std::string(b.as_str(name, i)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_meta_value_conversions)
+{
+    const double doubles[] = { 0.0, -0.0, 1234.5678, -0.5, 1e20, 1.5e-05, 123456.0, 1234567.0 };
+    for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+        std::stringstream s;
+        s << doubles[i];
+        MetaValue v(doubles[i]);
+        BOOST_CHECK_EQUAL(std::string(v.as_str()), s.str());
+        BOOST_CHECK_EQUAL(v.as_double(), doubles[i]);
+        BOOST_CHECK_EQUAL(v.as_long(), static_cast<long>(doubles[i]));
+    }
+
+    const long longs[] = { 0, 42, -42, LONG_MAX, LONG_MIN };
+    for (size_t i = 0; i < sizeof(longs) / sizeof(longs[0]); i++) {
+        std::stringstream s;
+        s << longs[i];
+        MetaValue v(longs[i]);
+        BOOST_CHECK_EQUAL(v.as_long(), longs[i]);
+        BOOST_CHECK_EQUAL(v.as_double(), static_cast<double>(longs[i]));
+        BOOST_CHECK_EQUAL(std::string(v.as_str()), s.str());
+    }
+
+    MetaValue v("12.75abc");
+    BOOST_CHECK_EQUAL(v.as_long(), 12);
+    BOOST_CHECK_EQUAL(v.as_double(), 12.75);
+    const char* str = v.as_str();
+    BOOST_CHECK_EQUAL(std::string(str), "12.75abc");
+    BOOST_CHECK(v.as_str() == str);
+
+    // Assignment replaces every cached representation
+    v = 3L;
+    BOOST_CHECK_EQUAL(std::string(v.as_str()), "3");
+    BOOST_CHECK_EQUAL(v.as_double(), 3.0);
+    v = "ISMRMRD";
+    BOOST_CHECK_EQUAL(v.as_long(), 0);
+    BOOST_CHECK_EQUAL(v.as_double(), 0.0);
+    v = 2.5;
+    BOOST_CHECK_EQUAL(v.as_long(), 2);
+    BOOST_CHECK_EQUAL(std::string(v.as_str()), "2.5");
+
+    MetaValue copy(v);
+    BOOST_CHECK_EQUAL(std::string(copy.as_str()), "2.5");
+    BOOST_CHECK_EQUAL(MetaValue().as_long(), 0);
+    BOOST_CHECK_EQUAL(std::string(MetaValue().as_str()), "0");
+}
+
+BOOST_AUTO_TEST_CASE(test_meta_container)
+{
+    MetaContainer meta;
+    BOOST_CHECK(meta.empty());
+
+    // Out of order inserts end up sorted by name, as serialize writes them
+    const char* names[] = { "slice", "GADGETRON_DataRole", "phase", "average", "b", "a", "phase_dir" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        meta.append(names[i], static_cast<long>(i));
+        meta.append(names[i], static_cast<long>(10 * i));
+    }
+    BOOST_CHECK(!meta.empty());
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        std::string name(names[i]);
+        BOOST_CHECK_EQUAL(meta.length(name.c_str()), 2);
+        BOOST_CHECK_EQUAL(meta.as_long(name.c_str(), 1), static_cast<long>(10 * i));
+    }
+
+    std::stringstream xml;
+    serialize(meta, xml);
+    std::string s = xml.str();
+    const char* sorted[] = { "GADGETRON_DataRole", "a", "average", "b", "phase", "phase_dir", "slice" };
+    size_t last = 0;
+    for (size_t i = 0; i < sizeof(sorted) / sizeof(sorted[0]); i++) {
+        size_t pos = s.find(std::string("<name>") + sorted[i] + "</name>");
+        BOOST_REQUIRE(pos != std::string::npos);
+        BOOST_CHECK_GT(pos, last);
+        last = pos;
+    }
+
+    // set replaces the whole array
+    meta.set("phase", "single");
+    BOOST_CHECK_EQUAL(meta.length("phase"), 1);
+    BOOST_CHECK_EQUAL(std::string(meta.as_str("phase")), "single");
+    BOOST_CHECK_THROW(meta.value("phase", 1), std::runtime_error);
+    BOOST_CHECK_THROW(meta.value("phas"), std::runtime_error);
+    BOOST_CHECK_EQUAL(meta.length("zzz"), 0);
+
+    // Copies are independent
+    MetaContainer copy(meta);
+    copy.append("phase", 2L);
+    BOOST_CHECK_EQUAL(copy.length("phase"), 2);
+    BOOST_CHECK_EQUAL(meta.length("phase"), 1);
+
+    std::string a("GADGETRON_ImageNumber"), b("GADGETRON_ImageNumber");
+    BOOST_CHECK(intern_meta_name(a.c_str()) == intern_meta_name(b.c_str()));
+    BOOST_CHECK(intern_meta_name(a.c_str()) != a.c_str());
+    BOOST_CHECK(intern_meta_name("GADGETRON_ImageIndex") != intern_meta_name(a.c_str()));
+}
+
+BOOST_AUTO_TEST_CASE(test_meta_binary_matches_xml)
+{
+    MetaContainer meta;
+    make_meta(meta);
+
+    std::stringstream xml;
+    serialize(meta, xml);
+    std::string bin;
+    serialize_binary(meta, bin);
+
+    // Binary attributes are stored as null terminated strings
+    BOOST_CHECK_EQUAL(strlen(bin.c_str()), bin.size());
+    BOOST_CHECK_LT(bin.size(), xml.str().size());
+    BOOST_CHECK(is_binary_meta(bin.c_str()));
+    BOOST_CHECK(!is_binary_meta(xml.str().c_str()));
+
+    MetaContainer from_xml, from_bin;
+    deserialize(xml.str().c_str(), from_xml);
+    deserialize(bin.c_str(), from_bin);
+
+    const char* names[] = {
+        "GADGETRON_DataRole", "GADGETRON_ImageNumber", "GADGETRON_WindowCenter",
+        "GADGETRON_WindowWidth", "GADGETRON_ImageProcessingHistory", "GADGETRON_ImageComment",
+        "read_dir", "mixed", "tricky"
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        check_same(from_xml, from_bin, names[i]);
+    }
+    BOOST_CHECK_EQUAL(from_bin.length("unknown"), 0);
+
+    // Numbers convert the same way through either encoding
+    BOOST_CHECK_EQUAL(from_bin.as_long("GADGETRON_ImageNumber"), 17);
+    BOOST_CHECK_EQUAL(from_bin.as_long("GADGETRON_WindowWidth"), -2048);
+    BOOST_CHECK_EQUAL(from_bin.as_double("GADGETRON_WindowCenter"), from_xml.as_double("GADGETRON_WindowCenter"));
+    BOOST_CHECK_EQUAL(from_bin.as_long("mixed", 0), from_xml.as_long("mixed", 0));
+    BOOST_CHECK_EQUAL(from_bin.as_double("mixed", 1), 66797.0);
+    for (size_t i = 0; i < 14; i++) {
+        BOOST_CHECK_EQUAL(from_bin.as_long("tricky", i), from_xml.as_long("tricky", i));
+        BOOST_CHECK_EQUAL(from_bin.as_double("tricky", i), from_xml.as_double("tricky", i));
+    }
+    BOOST_CHECK_EQUAL(from_bin.as_long("tricky", 6), LONG_MIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_meta_binary_in_image_attributes)
+{
+    MetaContainer meta;
+    make_meta(meta);
+    std::string bin;
+    serialize_binary(meta, bin);
+
+    Image<float> im(16, 16);
+    im.setAttributeString(bin);
+    std::string stored;
+    im.getAttributeString(stored);
+    BOOST_CHECK(stored == bin);
+
+    MetaContainer decoded;
+    deserialize(stored.c_str(), decoded);
+    check_same(meta, decoded, "GADGETRON_ImageProcessingHistory");
+    check_same(meta, decoded, "mixed");
+}
+
+BOOST_AUTO_TEST_CASE(test_meta_binary_malformed)
+{
+    MetaContainer meta;
+    make_meta(meta);
+    std::string bin;
+    serialize_binary(meta, bin);
+
+    for (size_t n = 5; n < bin.size(); n += 7) {
+        MetaContainer m;
+        BOOST_CHECK_THROW(deserialize(bin.substr(0, n).c_str(), m), std::runtime_error);
+    }
+
+    std::string version = bin;
+    version[4] = 2;
+    MetaContainer m;
+    BOOST_CHECK_THROW(deserialize(version.c_str(), m), std::runtime_error);
+}
+
+// Fills the process wide name pool, names seen later are owned
+BOOST_AUTO_TEST_CASE(test_meta_name_pool_is_bounded)
+{
+    MetaContainer meta;
+    meta.set("pool_known", 1L);
+
+    size_t i = 0;
+    for (; i < 1000000; i++) {
+        std::stringstream name;
+        name << "pool_filler_" << i;
+        if (!intern_meta_name(name.str().c_str())) {
+            break;
+        }
+    }
+    BOOST_REQUIRE(i < 1000000);
+
+    // Names already in the pool are still interned, new ones are owned
+    BOOST_CHECK(intern_meta_name("pool_known") != NULL);
+    BOOST_CHECK(intern_meta_name("pool_unseen_name_longer_than_the_fillers") == NULL);
+
+    meta.set("pool_unseen_name_longer_than_the_fillers", 2L);
+    meta.set("pool_another_name_longer_than_the_fillers", "value");
+    MetaContainer copy(meta);
+    meta.set("pool_unseen_name_longer_than_the_fillers", 3L);
+    BOOST_CHECK_EQUAL(copy.as_long("pool_unseen_name_longer_than_the_fillers"), 2);
+    BOOST_CHECK_EQUAL(meta.as_long("pool_unseen_name_longer_than_the_fillers"), 3);
+    BOOST_CHECK_EQUAL(std::string(copy.as_str("pool_another_name_longer_than_the_fillers")), "value");
+
+    std::string binary;
+    serialize_binary(copy, binary);
+    MetaContainer back;
+    deserialize(binary.c_str(), back);
+    BOOST_CHECK_EQUAL(back.as_long("pool_known"), 1);
+    BOOST_CHECK_EQUAL(back.as_long("pool_unseen_name_longer_than_the_fillers"), 2);
+    BOOST_CHECK_EQUAL(std::string(back.as_str("pool_another_name_longer_than_the_fillers")), "value");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd_fftw.h"
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(OversamplingTest)
+
+static const double pi = 3.14159265358979323846;
+
+// A point at pixel position in channel 0, one pixel further in channel 1
+static void fill_point(Acquisition &acq, double position)
+{
+    uint16_t n = acq.number_of_samples();
+    for (uint16_t c = 0; c < acq.active_channels(); c++) {
+        for (uint16_t s = 0; s < n; s++) {
+            double phase = -2 * pi * (s - static_cast<double>(acq.center_sample())) * (position + c) / n;
+            acq.data(s, c) = complex_float_t(static_cast<float>(std::cos(phase)), static_cast<float>(std::sin(phase)));
+        }
+    }
+}
+
+// The largest difference from the point at position after the removal,
+// which scales the samples by sqrt(encoded / recon)
+static float point_error(Acquisition &acq, double position, float amplitude)
+{
+    uint16_t m = acq.number_of_samples();
+    float error = 0;
+    for (uint16_t c = 0; c < acq.active_channels(); c++) {
+        for (uint16_t s = 0; s < m; s++) {
+            double phase = -2 * pi * (s - static_cast<double>(acq.center_sample())) * (position + c) / m;
+            complex_float_t expected(static_cast<float>(amplitude * std::cos(phase)), static_cast<float>(amplitude * std::sin(phase)));
+            error = std::max(error, std::abs(acq.data(s, c) - expected));
+        }
+    }
+    return error;
+}
+
+// Cartesian coordinates: kx from the center of the readout, a fixed ky
+static void fill_coordinates(Acquisition &acq)
+{
+    uint16_t n = acq.number_of_samples();
+    for (uint16_t s = 0; s < n; s++) {
+        acq.traj(0, s) = (s - static_cast<float>(acq.center_sample())) / n;
+        acq.traj(1, s) = 0.25f;
+    }
+}
+
+static float coordinate_error(Acquisition &acq)
+{
+    uint16_t m = acq.number_of_samples();
+    float error = 0;
+    for (uint16_t s = 0; s < m; s++) {
+        float kx = (s - static_cast<float>(acq.center_sample())) / m;
+        error = std::max(error, std::abs(acq.traj(0, s) - kx));
+        error = std::max(error, std::abs(acq.traj(1, s) - 0.25f));
+    }
+    return error;
+}
+
+static void check_points(uint16_t encoded, uint16_t recon, uint16_t center, uint16_t trajectory_dimensions = 0)
+{
+    OversamplingRemover remover(encoded, recon);
+    float amplitude = std::sqrt(static_cast<float>(encoded) / recon);
+    // Points across the whole reconstructed field of view, -(recon / 2) to
+    // (recon - 1) / 2, both edges included
+    int first = -(recon / 2), last = (recon + 1) / 2 - 2;
+    for (int position = first; position <= last; position++) {
+        Acquisition acq(encoded, 2, trajectory_dimensions);
+        acq.center_sample() = center;
+        acq.sample_time_us() = 2.5f;
+        fill_point(acq, position);
+        if (trajectory_dimensions > 0) {
+            fill_coordinates(acq);
+        }
+        remover.remove(acq);
+
+        BOOST_CHECK_EQUAL(acq.number_of_samples(), recon);
+        BOOST_CHECK_EQUAL(acq.active_channels(), 2);
+        BOOST_CHECK_CLOSE(acq.sample_time_us(), 2.5f * encoded / recon, 1e-3);
+        BOOST_CHECK_SMALL(point_error(acq, position, amplitude), 1e-4f);
+        BOOST_CHECK_EQUAL(acq.trajectory_dimensions(), trajectory_dimensions);
+        if (trajectory_dimensions > 0) {
+            BOOST_CHECK_SMALL(coordinate_error(acq), 1e-5f);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_oversampling_even)
+{
+    check_points(128, 64, 64);
+    // Asymmetric echo, the center does not land on a sample
+    check_points(128, 64, 41);
+}
+
+BOOST_AUTO_TEST_CASE(test_oversampling_odd)
+{
+    check_points(66, 33, 33);
+    check_points(62, 31, 31);
+    check_points(66, 33, 20);
+}
+
+// Cartesian readouts that store their coordinates, the coordinates are
+// resampled with the data
+BOOST_AUTO_TEST_CASE(test_oversampling_coordinates)
+{
+    check_points(128, 64, 64, 2);
+    check_points(128, 64, 41, 2);
+    check_points(66, 33, 20, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
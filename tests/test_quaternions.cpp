@@ -1,5 +1,8 @@
 #include "ismrmrd/ismrmrd.h"
 #include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
 
 using namespace ISMRMRD;
 
@@ -57,4 +60,129 @@ BOOST_AUTO_TEST_CASE(test_sign_of_directions)
     BOOST_REQUIRE(ismrmrd_sign_of_directions(read_dir, phase_dir, slice_dir) < 0);
 }
 
+// Random rotations, every third one improper, and the half turns about each
+// axis that take the scalar fallback of ismrmrd_directions_to_quaternion
+static void make_orientations(size_t n, std::vector<float>& dirs)
+{
+    srand(11);
+    dirs.resize(9 * n);
+    for (size_t i = 0; i < n; i++) {
+        float q[4];
+        double norm = 0;
+        for (int k = 0; k < 4; k++) {
+            q[k] = (float)(rand() / (double)RAND_MAX - 0.5);
+            norm += q[k] * q[k];
+        }
+        for (int k = 0; k < 4; k++) {
+            q[k] = (float)(q[k] / std::sqrt(norm));
+        }
+        if (i % 7 < 3) {
+            // Half turns about x, y and z
+            for (int k = 0; k < 4; k++) {
+                q[k] = k == (int)(i % 7) ? 1.0f : 0.0f;
+            }
+        }
+        float* d = &dirs[9 * i];
+        ismrmrd_quaternion_to_directions(q, d, d + 3, d + 6);
+        if (i % 3 == 0) {
+            for (int k = 6; k < 9; k++) {
+                d[k] = -d[k];
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_orientations_batch)
+{
+    // Not a multiple of the block size
+    const size_t n = 1000;
+    std::vector<float> dirs;
+    make_orientations(n, dirs);
+
+    std::vector<float> soa(9 * n), quat(4 * n), back(9 * n);
+    std::vector<int> sign(n);
+    ISMRMRD_Directions d, b;
+    float* q[4];
+    for (int k = 0; k < 3; k++) {
+        d.read_dir[k] = &soa[k * n];
+        d.phase_dir[k] = &soa[(3 + k) * n];
+        d.slice_dir[k] = &soa[(6 + k) * n];
+        b.read_dir[k] = &back[k * n];
+        b.phase_dir[k] = &back[(3 + k) * n];
+        b.slice_dir[k] = &back[(6 + k) * n];
+    }
+    for (int k = 0; k < 4; k++) {
+        q[k] = &quat[k * n];
+    }
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            d.read_dir[k][i] = dirs[9 * i + k];
+            d.phase_dir[k][i] = dirs[9 * i + 3 + k];
+            d.slice_dir[k][i] = dirs[9 * i + 6 + k];
+        }
+    }
+
+    BOOST_REQUIRE_EQUAL(ismrmrd_sign_of_directions_n(&d, n, &sign[0]), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_directions_to_quaternion_n(&d, n, q), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_quaternion_to_directions_n(q, n, &b), ISMRMRD_NOERROR);
+
+    for (size_t i = 0; i < n; i++) {
+        float* r = &dirs[9 * i];
+        float expected[4], back_dirs[9];
+        BOOST_CHECK_EQUAL(sign[i], ismrmrd_sign_of_directions(r, r + 3, r + 6));
+        BOOST_CHECK_EQUAL(sign[i], i % 3 == 0 ? -1 : 1);
+        ismrmrd_directions_to_quaternion(r, r + 3, r + 6, expected);
+        for (int k = 0; k < 4; k++) {
+            BOOST_CHECK_SMALL(q[k][i] - expected[k], 1e-6f);
+        }
+        ismrmrd_quaternion_to_directions(expected, back_dirs, back_dirs + 3, back_dirs + 6);
+        for (int k = 0; k < 3; k++) {
+            BOOST_CHECK_SMALL(b.read_dir[k][i] - back_dirs[k], 1e-6f);
+            BOOST_CHECK_SMALL(b.phase_dir[k][i] - back_dirs[3 + k], 1e-6f);
+            BOOST_CHECK_SMALL(b.slice_dir[k][i] - back_dirs[6 + k], 1e-6f);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_header_orientations)
+{
+    const size_t n = 130;
+    std::vector<float> dirs;
+    make_orientations(n, dirs);
+
+    std::vector<ISMRMRD_AcquisitionHeader> acq(n);
+    std::vector<ISMRMRD_ImageHeader> img(n);
+    for (size_t i = 0; i < n; i++) {
+        ismrmrd_init_acquisition_header(&acq[i]);
+        ismrmrd_init_image_header(&img[i]);
+        for (int k = 0; k < 3; k++) {
+            acq[i].read_dir[k] = img[i].read_dir[k] = dirs[9 * i + k];
+            acq[i].phase_dir[k] = img[i].phase_dir[k] = dirs[9 * i + 3 + k];
+            acq[i].slice_dir[k] = img[i].slice_dir[k] = dirs[9 * i + 6 + k];
+        }
+    }
+
+    std::vector<float> quat(4 * n), rot(9 * n), image_quat(4 * n);
+    std::vector<int> sign(n);
+    BOOST_REQUIRE_EQUAL(ismrmrd_acquisition_orientations(&acq[0], n, &quat[0], &sign[0], &rot[0]), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_image_orientations(&img[0], n, &image_quat[0], NULL, NULL), ISMRMRD_NOERROR);
+
+    for (size_t i = 0; i < n; i++) {
+        float expected[4];
+        ismrmrd_directions_to_quaternion(acq[i].read_dir, acq[i].phase_dir, acq[i].slice_dir, expected);
+        for (int k = 0; k < 4; k++) {
+            BOOST_CHECK_SMALL(quat[4 * i + k] - expected[k], 1e-6f);
+            BOOST_CHECK_EQUAL(image_quat[4 * i + k], quat[4 * i + k]);
+        }
+        BOOST_CHECK_EQUAL(sign[i], ismrmrd_sign_of_directions(acq[i].read_dir, acq[i].phase_dir, acq[i].slice_dir));
+        for (int k = 0; k < 3; k++) {
+            BOOST_CHECK_EQUAL(rot[9 * i + 3 * k + 0], acq[i].read_dir[k]);
+            BOOST_CHECK_EQUAL(rot[9 * i + 3 * k + 1], acq[i].phase_dir[k]);
+            BOOST_CHECK_EQUAL(rot[9 * i + 3 * k + 2], acq[i].slice_dir[k]);
+        }
+    }
+
+    BOOST_CHECK_EQUAL(ismrmrd_acquisition_orientations(&acq[0], 0, NULL, NULL, NULL), ISMRMRD_NOERROR);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
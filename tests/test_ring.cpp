@@ -0,0 +1,177 @@
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/ring.h"
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <thread>
+#define ISMRMRD_TEST_THREADS
+#endif
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(RingTest)
+
+static std::string ring_name(const char *test)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/ismrmrd_%s_%d", test, static_cast<int>(getpid()));
+    return name;
+}
+
+// Fills an acquisition in place the way a producer builds it in the ring
+static void fill_view(AcquisitionView &view, uint32_t n)
+{
+    view.head().scan_counter = n;
+    for (size_t i = 0; i < view.getNumberOfDataElements(); i++) {
+        view.getDataPtr()[i] = complex_float_t(static_cast<float>(n), static_cast<float>(i));
+    }
+    for (size_t i = 0; i < view.getTrajSize() / sizeof(float); i++) {
+        view.getTrajPtr()[i] = static_cast<float>(n + i);
+    }
+}
+
+static void check_view(const AcquisitionView &view, uint32_t n, uint16_t samples, uint16_t channels, uint16_t traj)
+{
+    BOOST_CHECK_EQUAL(view.head().scan_counter, n);
+    BOOST_REQUIRE_EQUAL(view.head().number_of_samples, samples);
+    BOOST_REQUIRE_EQUAL(view.head().active_channels, channels);
+    BOOST_REQUIRE_EQUAL(view.head().trajectory_dimensions, traj);
+    size_t last = view.getNumberOfDataElements() - 1;
+    BOOST_CHECK_EQUAL(view.getDataPtr()[0], complex_float_t(static_cast<float>(n), 0.0f));
+    BOOST_CHECK_EQUAL(view.getDataPtr()[last], complex_float_t(static_cast<float>(n), static_cast<float>(last)));
+    if (traj > 0) {
+        BOOST_CHECK_EQUAL(view.getTrajPtr()[1], static_cast<float>(n + 1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_round_trip)
+{
+    // A small ring, so the messages wrap around many times
+    std::string name = ring_name("round_trip");
+    SharedRing consumer(name, true, 16384);
+    SharedRing producer(name, false);
+    BOOST_CHECK_EQUAL(producer.capacity(), 16384u);
+
+    std::string xml("<?xml version=\"1.0\"?><ismrmrdHeader></ismrmrdHeader>");
+    producer.writeHeader(xml);
+    BOOST_REQUIRE_EQUAL(consumer.nextMessage(), STREAM_HEADER);
+    std::string received;
+    consumer.readHeader(received);
+    BOOST_CHECK_EQUAL(received, xml);
+
+    for (uint32_t n = 0; n < 500; n++) {
+        uint16_t samples = 16 + n % 200, channels = n % 4 + 1, traj = n % 3;
+        AcquisitionView view = producer.beginAcquisition(samples, channels, traj);
+        fill_view(view, n);
+        producer.commit();
+
+        BOOST_REQUIRE_EQUAL(consumer.nextMessage(), STREAM_ACQUISITION);
+        check_view(consumer.acquisition(), n, samples, channels, traj);
+        // Single threaded, the producer must not wait for this space
+        consumer.release();
+    }
+
+    // The copying shortcuts
+    Acquisition acq(128, 8, 2);
+    acq.scan_counter() = 77;
+    acq.setChannelActive(7);
+    acq.getDataPtr()[100] = complex_float_t(1.0f, -1.0f);
+    acq.getTrajPtr()[3] = 0.25f;
+    producer.writeAcquisition(acq);
+    BOOST_REQUIRE_EQUAL(consumer.nextMessage(), STREAM_ACQUISITION);
+    Acquisition copy;
+    consumer.readAcquisition(copy);
+    BOOST_CHECK(memcmp(&copy.getHead(), &acq.getHead(), sizeof(ISMRMRD_AcquisitionHeader)) == 0);
+    BOOST_CHECK(memcmp(copy.getDataPtr(), acq.getDataPtr(), acq.getDataSize()) == 0);
+    BOOST_CHECK(memcmp(copy.getTrajPtr(), acq.getTrajPtr(), acq.getTrajSize()) == 0);
+    consumer.release();
+
+    Image<float> im(16, 8, 1, 2);
+    im.setAttributeString("<ismrmrdMeta><meta><name>a</name><value>1</value></meta></ismrmrdMeta>");
+    im.setImageIndex(3);
+    for (size_t i = 0; i < im.getNumberOfDataElements(); i++) {
+        im.getDataPtr()[i] = static_cast<float>(i);
+    }
+    producer.writeImage(im);
+    producer.close();
+
+    BOOST_REQUIRE_EQUAL(consumer.nextMessage(), STREAM_IMAGE);
+    ImageView view = consumer.image();
+    BOOST_CHECK_EQUAL(view.head().image_index, 3);
+    BOOST_CHECK_EQUAL(std::string(view.getAttributeString(), view.getAttributeStringLength()),
+                      "<ismrmrdMeta><meta><name>a</name><value>1</value></meta></ismrmrdMeta>");
+    Image<double> wrong_type;
+    BOOST_CHECK_THROW(consumer.readImage(wrong_type), std::runtime_error);
+    BOOST_CHECK_THROW(consumer.acquisition(), std::runtime_error);
+    Image<float> im_copy;
+    consumer.readImage(im_copy);
+    BOOST_CHECK_EQUAL(im_copy.getMatrixSizeX(), 16);
+    BOOST_CHECK_EQUAL(im_copy.getNumberOfChannels(), 2);
+    BOOST_CHECK_EQUAL(im_copy(15, 7, 0, 1), static_cast<float>(16 * 8 + 7 * 16 + 15));
+    std::string attr;
+    im_copy.getAttributeString(attr);
+    BOOST_CHECK_EQUAL(attr, std::string(view.getAttributeString(), view.getAttributeStringLength()));
+
+    BOOST_CHECK_EQUAL(consumer.nextMessage(), STREAM_CLOSE);
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_errors)
+{
+    std::string name = ring_name("errors");
+    BOOST_CHECK_THROW(SharedRing(name, false), std::runtime_error);
+
+    SharedRing ring(name, true, 4096);
+    BOOST_CHECK_THROW(ring.beginAcquisition(4096, 1, 0), std::runtime_error);
+    BOOST_CHECK_THROW(ring.commit(), std::runtime_error);
+    BOOST_CHECK_THROW(ring.acquisition(), std::runtime_error);
+
+    // The sizes are fixed by beginAcquisition
+    AcquisitionView view = ring.beginAcquisition(64, 2, 0);
+    BOOST_CHECK_THROW(ring.beginAcquisition(64, 2, 0), std::runtime_error);
+    view.head().active_channels = 4;
+    BOOST_CHECK_THROW(ring.commit(), std::runtime_error);
+
+    view = ring.beginAcquisition(64, 2, 0);
+    fill_view(view, 5);
+    ring.commit();
+    BOOST_REQUIRE_EQUAL(ring.nextMessage(), STREAM_ACQUISITION);
+    std::string xml;
+    BOOST_CHECK_THROW(ring.readHeader(xml), std::runtime_error);
+    check_view(ring.acquisition(), 5, 64, 2, 0);
+}
+
+#ifdef ISMRMRD_TEST_THREADS
+static void produce(const std::string *name, uint32_t count)
+{
+    SharedRing producer(*name, false);
+    for (uint32_t n = 0; n < count; n++) {
+        AcquisitionView view = producer.beginAcquisition(128, n % 8 + 1, 0);
+        fill_view(view, n);
+        producer.commit();
+    }
+    producer.close();
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_threads)
+{
+    // The producer fills the ring and waits for the consumer, and the other way round
+    std::string name = ring_name("threads");
+    SharedRing consumer(name, true, 32768);
+    std::thread producer(produce, &name, 5000u);
+
+    uint32_t n = 0;
+    uint16_t id;
+    while ((id = consumer.nextMessage()) == STREAM_ACQUISITION) {
+        check_view(consumer.acquisition(), n, 128, n % 8 + 1, 0);
+        n++;
+    }
+    producer.join();
+    BOOST_CHECK_EQUAL(id, STREAM_CLOSE);
+    BOOST_CHECK_EQUAL(n, 5000u);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
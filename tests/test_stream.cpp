@@ -0,0 +1,258 @@
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/stream.h"
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <thread>
+#define ISMRMRD_TEST_THREADS
+#endif
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(StreamTest)
+
+static const char *test_xml = "<?xml version=\"1.0\"?><ismrmrdHeader></ismrmrdHeader>";
+
+static void make_acquisition(Acquisition &acq, uint32_t n, uint16_t samples, uint16_t channels, uint16_t traj)
+{
+    acq.resize(samples, channels, traj);
+    acq.scan_counter() = n;
+    acq.setChannelActive(channels - 1);
+    for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+        acq.getDataPtr()[i] = complex_float_t(static_cast<float>(n), static_cast<float>(i));
+    }
+    for (size_t i = 0; i < acq.getNumberOfTrajElements(); i++) {
+        acq.getTrajPtr()[i] = static_cast<float>(n + i);
+    }
+}
+
+static void check_acquisition(Acquisition &acq, uint32_t n, uint16_t samples, uint16_t channels, uint16_t traj)
+{
+    Acquisition expected;
+    make_acquisition(expected, n, samples, channels, traj);
+    BOOST_CHECK_EQUAL(acq.scan_counter(), n);
+    BOOST_CHECK(memcmp(&acq.getHead(), &expected.getHead(), sizeof(ISMRMRD_AcquisitionHeader)) == 0);
+    BOOST_REQUIRE_EQUAL(acq.getDataSize(), expected.getDataSize());
+    BOOST_REQUIRE_EQUAL(acq.getTrajSize(), expected.getTrajSize());
+    BOOST_CHECK(memcmp(acq.getDataPtr(), expected.getDataPtr(), acq.getDataSize()) == 0);
+    if (traj > 0) {
+        BOOST_CHECK(memcmp(acq.getTrajPtr(), expected.getTrajPtr(), acq.getTrajSize()) == 0);
+    }
+}
+
+// Everything the format carries, small and large payloads, a batch larger than one writev
+static void write_everything(int fd, uint32_t num_acquisitions)
+{
+    StreamWriter writer(fd);
+    writer.writeHeader(test_xml);
+
+    std::vector<Acquisition> acqs(num_acquisitions);
+    for (uint32_t n = 0; n < num_acquisitions; n++) {
+        make_acquisition(acqs[n], n, 64, n % 4 + 1, n % 3);
+    }
+    writer.writeAcquisitions(acqs.data(), acqs.size());
+
+    Acquisition big;
+    make_acquisition(big, 9999, 1024, 32, 2);
+    writer.writeAcquisition(big);
+
+    Image<float> im(32, 16, 1, 2);
+    im.setAttributeString("<ismrmrdMeta><meta><name>a</name><value>1</value></meta></ismrmrdMeta>");
+    im.setImageIndex(7);
+    for (size_t i = 0; i < im.getNumberOfDataElements(); i++) {
+        im.getDataPtr()[i] = static_cast<float>(i);
+    }
+    writer.writeImage(im);
+
+    NDArray<double> arr;
+    std::vector<size_t> dims;
+    dims.push_back(5);
+    dims.push_back(3);
+    arr.resize(dims);
+    for (size_t i = 0; i < arr.getNumberOfElements(); i++) {
+        arr.getDataPtr()[i] = 0.5 * i;
+    }
+    writer.writeNDArray(arr);
+    writer.close();
+}
+
+static void read_everything(int fd, uint32_t num_acquisitions)
+{
+    StreamReader reader(fd);
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_HEADER);
+    std::string xml;
+    reader.readHeader(xml);
+    BOOST_CHECK_EQUAL(xml, test_xml);
+
+    Acquisition acq;
+    for (uint32_t n = 0; n < num_acquisitions; n++) {
+        BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+        reader.readAcquisition(acq);
+        check_acquisition(acq, n, 64, n % 4 + 1, n % 3);
+    }
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+    reader.readAcquisition(acq);
+    check_acquisition(acq, 9999, 1024, 32, 2);
+
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_IMAGE);
+    Image<double> wrong_type;
+    BOOST_CHECK_THROW(reader.readImage(wrong_type), std::runtime_error);
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_NDARRAY);
+    NDArray<double> arr;
+    reader.readNDArray(arr);
+    BOOST_CHECK_EQUAL(arr.getNDim(), 2);
+    BOOST_CHECK_EQUAL(arr.getDims()[0], 5);
+    BOOST_CHECK_EQUAL(arr.getDims()[1], 3);
+    BOOST_CHECK_EQUAL(arr(4, 2), 0.5 * 14);
+
+    BOOST_CHECK_EQUAL(reader.nextMessage(), STREAM_CLOSE);
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_file)
+{
+    std::string filename("test_stream_file.bin");
+    int fd = open(filename.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    BOOST_REQUIRE(fd >= 0);
+    write_everything(fd, 600);
+    lseek(fd, 0, SEEK_SET);
+    read_everything(fd, 600);
+
+    // The image skipped above, read this time
+    lseek(fd, 0, SEEK_SET);
+    StreamReader reader(fd);
+    uint16_t id;
+    while ((id = reader.nextMessage()) != STREAM_IMAGE) {
+        BOOST_REQUIRE(id != STREAM_CLOSE);
+    }
+    Image<float> im;
+    reader.readImage(im);
+    BOOST_CHECK_EQUAL(im.getMatrixSizeX(), 32);
+    BOOST_CHECK_EQUAL(im.getNumberOfChannels(), 2);
+    BOOST_CHECK_EQUAL(im.getImageIndex(), 7);
+    BOOST_CHECK_EQUAL(im(31, 15, 0, 1), static_cast<float>(32 * 16 + 15 * 32 + 31));
+    std::string attr;
+    im.getAttributeString(attr);
+    BOOST_CHECK_EQUAL(attr, "<ismrmrdMeta><meta><name>a</name><value>1</value></meta></ismrmrdMeta>");
+    Acquisition acq;
+    BOOST_CHECK_THROW(reader.readAcquisition(acq), std::runtime_error);
+
+    // The end of the file after the last message reads as a close too
+    while (reader.nextMessage() != STREAM_CLOSE) {
+    }
+    BOOST_CHECK_EQUAL(reader.nextMessage(), STREAM_CLOSE);
+
+    ::close(fd);
+    std::remove(filename.c_str());
+}
+
+#ifdef ISMRMRD_TEST_THREADS
+BOOST_AUTO_TEST_CASE(test_stream_socket)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    std::thread writer(write_everything, fds[0], 600);
+    read_everything(fds[1], 600);
+    writer.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_stream_compressed)
+{
+    std::string filename("test_stream_compressed.bin");
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    BOOST_REQUIRE(fd >= 0);
+
+    std::vector<Acquisition> acqs(300);
+    for (uint32_t n = 0; n < acqs.size(); n++) {
+        make_acquisition(acqs[n], n, 64, n % 4 + 1, n % 3);
+    }
+    StreamWriter writer(fd);
+    CompressionParameters params;
+    ismrmrd_init_compression_parameters(&params);
+    writer.setCompression(params);
+    writer.writeAcquisitions(acqs.data(), acqs.size());
+    params.mode = ISMRMRD_COMPRESSION_NONE;
+    writer.setCompression(params);
+    writer.writeAcquisition(acqs[0]);
+    writer.close();
+
+    // The repetitive test data compresses well
+    uint64_t plain = 0;
+    for (uint32_t n = 0; n < acqs.size(); n++) {
+        plain += sizeof(StreamFrame) + sizeof(ISMRMRD_AcquisitionHeader) + acqs[n].getTrajSize() + acqs[n].getDataSize();
+    }
+    BOOST_CHECK_LT(writer.bytesWritten(), plain);
+
+    BOOST_REQUIRE_EQUAL(lseek(fd, 0, SEEK_SET), 0);
+    StreamReader reader(fd);
+    Acquisition in;
+    for (uint32_t n = 0; n < acqs.size(); n++) {
+        BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+        reader.readAcquisition(in);
+        check_acquisition(in, n, 64, n % 4 + 1, n % 3);
+    }
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+    reader.readAcquisition(in);
+    check_acquisition(in, 0, 64, 1, 0);
+    BOOST_CHECK_EQUAL(reader.nextMessage(), STREAM_CLOSE);
+
+    ::close(fd);
+    std::remove(filename.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_corrupt)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    Acquisition acq;
+    make_acquisition(acq, 1, 32, 2, 0);
+    StreamWriter writer(fds[1]);
+    writer.writeAcquisition(acq);
+
+    // A frame whose length disagrees with the acquisition header
+    StreamFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = STREAM_ACQUISITION;
+    frame.length = sizeof(ISMRMRD_AcquisitionHeader) + 8;
+    BOOST_REQUIRE_EQUAL(write(fds[1], &frame, sizeof(frame)), static_cast<ssize_t>(sizeof(frame)));
+    BOOST_REQUIRE_EQUAL(write(fds[1], &acq.getHead(), sizeof(ISMRMRD_AcquisitionHeader)),
+                        static_cast<ssize_t>(sizeof(ISMRMRD_AcquisitionHeader)));
+    char pad[8] = { 0 };
+    BOOST_REQUIRE_EQUAL(write(fds[1], pad, sizeof(pad)), static_cast<ssize_t>(sizeof(pad)));
+
+    // Then a stream that stops half way through a message
+    writer.writeHeader(test_xml);
+    frame.length = 1000;
+    BOOST_REQUIRE_EQUAL(write(fds[1], &frame, sizeof(frame)), static_cast<ssize_t>(sizeof(frame)));
+    BOOST_REQUIRE_EQUAL(write(fds[1], pad, sizeof(pad)), static_cast<ssize_t>(sizeof(pad)));
+    ::close(fds[1]);
+
+    StreamReader reader(fds[0]);
+    Acquisition in;
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+    std::string xml;
+    BOOST_CHECK_THROW(reader.readHeader(xml), std::runtime_error);
+    reader.readAcquisition(in);
+    check_acquisition(in, 1, 32, 2, 0);
+
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+    BOOST_CHECK_THROW(reader.readAcquisition(in), std::runtime_error);
+    check_acquisition(in, 1, 32, 2, 0);
+
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_HEADER);
+    reader.readHeader(xml);
+    BOOST_CHECK_EQUAL(xml, test_xml);
+    BOOST_REQUIRE_EQUAL(reader.nextMessage(), STREAM_ACQUISITION);
+    BOOST_CHECK_THROW(reader.readAcquisition(in), std::runtime_error);
+    ::close(fds[0]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
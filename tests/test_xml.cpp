@@ -0,0 +1,484 @@
+#include "ismrmrd/xml.h"
+#include "ismrmrd/version.h"
+#include "xml_fields.h"
+#include "pugixml.hpp"
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace ISMRMRD;
+
+BOOST_AUTO_TEST_SUITE(XmlTest)
+
+static const char* test_header =
+    "<?xml version=\"1.0\"?>\n"
+    "<ismrmrdHeader xmlns=\"http://www.ismrm.org/ISMRMRD\">\n"
+    "  <version>3</version>\n"
+    "  <acquisitionSystemInformation>\n"
+    "    <systemFieldStrength_T>2.89362</systemFieldStrength_T>\n"
+    "    <relativeReceiverNoiseBandwidth>0.793</relativeReceiverNoiseBandwidth>\n"
+    "    <receiverChannels>32</receiverChannels>\n"
+    "  </acquisitionSystemInformation>\n"
+    "  <experimentalConditions>\n"
+    "    <H1resonanceFrequency_Hz>123251815</H1resonanceFrequency_Hz>\n"
+    "  </experimentalConditions>\n"
+    "  <encoding>\n"
+    "    <encodedSpace>\n"
+    "      <matrixSize><x>256</x><y>140</y><z>80</z></matrixSize>\n"
+    "      <fieldOfView_mm><x>600</x><y>328.153125</y><z>160</z></fieldOfView_mm>\n"
+    "    </encodedSpace>\n"
+    "    <reconSpace>\n"
+    "      <matrixSize><x>128</x><y>116</y><z>64</z></matrixSize>\n"
+    "      <fieldOfView_mm><x>300</x><y>271.875</y><z>128</z></fieldOfView_mm>\n"
+    "    </reconSpace>\n"
+    "    <encodingLimits>\n"
+    "      <kspace_encoding_step_1><minimum>0</minimum><maximum>83</maximum><center>28</center></kspace_encoding_step_1>\n"
+    "    </encodingLimits>\n"
+    "    <trajectory>cartesian</trajectory>\n"
+    "  </encoding>\n"
+    "  <sequenceParameters>\n"
+    "    <TR>4.6</TR>\n"
+    "    <TR>1e-3</TR>\n"
+    "    <TE>-2.5E+1</TE>\n"
+    "  </sequenceParameters>\n"
+    "  <userParameters>\n"
+    "    <userParameterLong><name>a</name><value> -42</value></userParameterLong>\n"
+    "    <userParameterDouble><name>b</name><value>0.1</value></userParameterDouble>\n"
+    "    <userParameterString><name>c</name><value>text &amp; more</value></userParameterString>\n"
+    "    <userParameterLong><name>d</name><value>9000000000</value></userParameterLong>\n"
+    "    <userParameterDouble><name>e</name><value>123456789012345678901234.5</value></userParameterDouble>\n"
+    "  </userParameters>\n"
+    "</ismrmrdHeader>\n";
+
+// Every field of the header, with the encoding children out of schema order
+static const char* full_header =
+    "<ismrmrdHeader>\n"
+    "  <version>3</version>\n"
+    "  <subjectInformation><patientName>A &amp; B</patientName><patientWeight_kg>70.5</patientWeight_kg>"
+    "<patientID>x</patientID><patientBirthdate>2000-01-01</patientBirthdate><patientGender>O</patientGender></subjectInformation>\n"
+    "  <studyInformation><studyDate>2020-01-01</studyDate><studyTime>10:00:00</studyTime><studyID>s</studyID>"
+    "<accessionNumber>42</accessionNumber><referringPhysicianName>r</referringPhysicianName>"
+    "<studyDescription>d</studyDescription><studyInstanceUID>u</studyInstanceUID></studyInformation>\n"
+    "  <measurementInformation><measurementID>m</measurementID><seriesDate>2020-01-01</seriesDate>"
+    "<seriesTime>11:00:00</seriesTime><patientPosition>HFS</patientPosition><initialSeriesNumber>3</initialSeriesNumber>"
+    "<protocolName>p</protocolName><seriesDescription>sd</seriesDescription>"
+    "<measurementDependency><dependencyType>Noise</dependencyType><measurementID>n1</measurementID></measurementDependency>"
+    "<measurementDependency><dependencyType>Ref</dependencyType><measurementID>n2</measurementID></measurementDependency>"
+    "<seriesInstanceUIDRoot>root</seriesInstanceUIDRoot><frameOfReferenceUID>for</frameOfReferenceUID>"
+    "<referencedImageSequence><referencedSOPInstanceUID>a1</referencedSOPInstanceUID>"
+    "<referencedSOPInstanceUID>a2</referencedSOPInstanceUID></referencedImageSequence></measurementInformation>\n"
+    "  <acquisitionSystemInformation><systemVendor>v</systemVendor><systemModel>m</systemModel>"
+    "<systemFieldStrength_T>3</systemFieldStrength_T><relativeReceiverNoiseBandwidth>0.79</relativeReceiverNoiseBandwidth>"
+    "<receiverChannels>2</receiverChannels><coilLabel><coilNumber>1</coilNumber><coilName>c1</coilName></coilLabel>"
+    "<coilLabel><coilNumber>2</coilNumber><coilName>c2</coilName></coilLabel>"
+    "<institutionName>i</institutionName><stationName>st</stationName></acquisitionSystemInformation>\n"
+    "  <experimentalConditions><H1resonanceFrequency_Hz>123</H1resonanceFrequency_Hz></experimentalConditions>\n"
+    "  <encoding>\n"
+    "    <trajectory>spiral</trajectory>\n"
+    "    <echoTrainLength>4</echoTrainLength>\n"
+    "    <reconSpace><fieldOfView_mm><z>3</z><y>2</y><x>1</x></fieldOfView_mm><matrixSize><x>1</x><y>2</y><z>3</z></matrixSize></reconSpace>\n"
+    "    <encodedSpace><matrixSize><x>4</x><y>5</y><z>6</z></matrixSize><fieldOfView_mm><x>1.5</x><y>2</y><z>3</z></fieldOfView_mm></encodedSpace>\n"
+    "    <encodingLimits><segment><minimum>1</minimum><maximum>2</maximum><center>1</center></segment>"
+    "<kspace_encoding_step_0><minimum>0</minimum><maximum>5</maximum><center>2</center></kspace_encoding_step_0></encodingLimits>\n"
+    "    <parallelImaging><accelerationFactor><kspace_encoding_step_1>2</kspace_encoding_step_1>"
+    "<kspace_encoding_step_2>1</kspace_encoding_step_2></accelerationFactor><calibrationMode>embedded</calibrationMode>"
+    "<interleavingDimension>phase</interleavingDimension></parallelImaging>\n"
+    "    <trajectoryDescription><identifier>id</identifier><userParameterLong><name>l</name><value>1</value></userParameterLong>"
+    "<userParameterDouble><name>d</name><value>2.5</value></userParameterDouble><comment>c</comment></trajectoryDescription>\n"
+    "  </encoding>\n"
+    "  <sequenceParameters><TR>1</TR><TE>2</TE><TE>3</TE><TI>4</TI><flipAngle_deg>5</flipAngle_deg>"
+    "<sequence_type>TrueFISP</sequence_type><echo_spacing>6</echo_spacing></sequenceParameters>\n"
+    "  <userParameters><userParameterBase64><name>b</name><value>AAAA</value></userParameterBase64></userParameters>\n"
+    "</ismrmrdHeader>\n";
+
+BOOST_AUTO_TEST_CASE(test_deserialize_values)
+{
+    IsmrmrdHeader h;
+    deserialize(test_header, h);
+
+    BOOST_CHECK_EQUAL(*h.version, ISMRMRD_XMLHDR_VERSION);
+    BOOST_CHECK_EQUAL(h.experimentalConditions.H1resonanceFrequency_Hz, 123251815);
+    BOOST_CHECK_EQUAL(*h.acquisitionSystemInformation->systemFieldStrength_T, 2.89362f);
+    BOOST_CHECK_EQUAL(*h.acquisitionSystemInformation->receiverChannels, 32);
+    BOOST_CHECK_EQUAL(h.encoding[0].encodedSpace.fieldOfView_mm.y, 328.153125f);
+    BOOST_CHECK_EQUAL(h.encoding[0].encodingLimits.kspace_encoding_step_1->maximum, 83);
+    BOOST_CHECK_EQUAL(h.sequenceParameters->TR->at(1), 1e-3f);
+    BOOST_CHECK_EQUAL(h.sequenceParameters->TE->at(0), -25.0f);
+
+    const UserParameters& p = *h.userParameters;
+    BOOST_REQUIRE_EQUAL(p.userParameterLong.size(), 2u);
+    BOOST_CHECK_EQUAL(p.userParameterLong[0].name, "a");
+    BOOST_CHECK_EQUAL(p.userParameterLong[0].value, -42);
+    BOOST_CHECK_EQUAL(p.userParameterLong[1].name, "d");
+    if (sizeof(long) >= 8) {
+        BOOST_CHECK_EQUAL(p.userParameterLong[1].value, 9000000000L);
+    }
+    BOOST_REQUIRE_EQUAL(p.userParameterDouble.size(), 2u);
+    BOOST_CHECK_EQUAL(p.userParameterDouble[0].value, 0.1);
+    BOOST_CHECK_EQUAL(p.userParameterDouble[1].value, 123456789012345678901234.5);
+    BOOST_REQUIRE_EQUAL(p.userParameterString.size(), 1u);
+    BOOST_CHECK_EQUAL(p.userParameterString[0].value, "text & more");
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_length)
+{
+    // The buffer is not null terminated and is followed by unrelated bytes
+    size_t len = strlen(test_header);
+    std::vector<char> buffer(test_header, test_header + len);
+    buffer.insert(buffer.end(), 16, 'x');
+
+    IsmrmrdHeader h1, h2;
+    deserialize(test_header, h1);
+    deserialize(&buffer[0], len, h2);
+
+    std::stringstream s1, s2;
+    serialize(h1, s1);
+    serialize(h2, s2);
+    BOOST_CHECK_EQUAL(s1.str(), s2.str());
+
+    // Truncated documents are rejected
+    IsmrmrdHeader h3;
+    BOOST_CHECK_THROW(deserialize(&buffer[0], len / 2, h3), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_serialize_round_trip)
+{
+    IsmrmrdHeader h;
+    deserialize(test_header, h);
+
+    // Values that fixed point formatting used to lose
+    h.encoding[0].encodedSpace.fieldOfView_mm.x = 1.25e-7f;
+    h.encoding[0].encodedSpace.fieldOfView_mm.z = 3.0e38f;
+    h.userParameters().userParameterDouble[0].value = 1.0 / 3.0;
+    h.userParameters().userParameterString[0].value = "<a href=\"x\">&amp;</a>";
+    h.subjectInformation = SubjectInformation();
+
+    std::string xml;
+    serialize(h, xml);
+    BOOST_CHECK(xml.find("<subjectInformation />") != std::string::npos);
+    BOOST_CHECK(xml.find("&lt;a href=\"x\"&gt;&amp;amp;&lt;/a&gt;") != std::string::npos);
+
+    IsmrmrdHeader h2;
+    deserialize(xml.c_str(), h2);
+    BOOST_CHECK_EQUAL(h2.encoding[0].encodedSpace.fieldOfView_mm.x, 1.25e-7f);
+    BOOST_CHECK_EQUAL(h2.encoding[0].encodedSpace.fieldOfView_mm.y, 328.153125f);
+    BOOST_CHECK_EQUAL(h2.encoding[0].encodedSpace.fieldOfView_mm.z, 3.0e38f);
+    BOOST_CHECK_EQUAL(h2.userParameters->userParameterDouble[0].value, 1.0 / 3.0);
+    BOOST_CHECK_EQUAL(h2.userParameters->userParameterString[0].value, "<a href=\"x\">&amp;</a>");
+    BOOST_CHECK_EQUAL(h2.userParameters->userParameterLong[0].value, -42);
+
+    // The stream and string overloads agree and the output is stable
+    std::stringstream s;
+    serialize(h2, s);
+    BOOST_CHECK_EQUAL(s.str(), xml);
+}
+
+BOOST_AUTO_TEST_CASE(test_binary_round_trip)
+{
+    IsmrmrdHeader h;
+    deserialize(test_header, h);
+    h.userParameters().userParameterLong[0].value = -9000;
+    h.encoding.push_back(h.encoding[0]);
+    h.encoding[1].trajectory = "radial";
+    h.encoding[1].encodingLimits.slice = Limit(0, 7, 4);
+
+    std::string bin;
+    serialize_binary(h, bin);
+    BOOST_CHECK(is_binary_header(bin.data(), bin.size()));
+    BOOST_CHECK(!is_binary_header(test_header, strlen(test_header)));
+
+    IsmrmrdHeader h2;
+    deserialize_binary(bin.data(), bin.size(), h2);
+    BOOST_CHECK(!h2.subjectInformation);
+    BOOST_CHECK(!h2.encoding[0].encodingLimits.slice);
+    BOOST_CHECK_EQUAL(h2.encoding[1].encodingLimits.slice->maximum, 7);
+
+    std::string xml1, xml2;
+    serialize(h, xml1);
+    serialize(h2, xml2);
+    BOOST_CHECK_EQUAL(xml1, xml2);
+
+    // Truncated or foreign data is rejected and leaves the target alone
+    for (size_t len = 0; len < bin.size(); len++) {
+        IsmrmrdHeader h3;
+        BOOST_CHECK_THROW(deserialize_binary(bin.data(), len, h3), std::runtime_error);
+        BOOST_CHECK(h3.encoding.empty());
+    }
+    IsmrmrdHeader h4;
+    BOOST_CHECK_THROW(deserialize_binary(test_header, strlen(test_header), h4), std::runtime_error);
+
+    // Data for another header version or other field tables is rejected:
+    // format version at 4, header version at 6, table signature at 8 to 11
+    for (size_t at = 4; at < 12; at++) {
+        std::string other(bin);
+        other[at] ^= 0x10;
+        IsmrmrdHeader h5;
+        BOOST_CHECK_THROW(deserialize_binary(other.data(), other.size(), h5), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_sections)
+{
+    IsmrmrdHeader h;
+    deserialize(test_header, strlen(test_header), h, HEADER_ENCODING);
+    BOOST_CHECK_EQUAL(*h.version, ISMRMRD_XMLHDR_VERSION);
+    BOOST_REQUIRE_EQUAL(h.encoding.size(), 1u);
+    BOOST_CHECK_EQUAL(h.encoding[0].reconSpace.matrixSize.y, 116);
+    BOOST_CHECK(!h.acquisitionSystemInformation);
+    BOOST_CHECK(!h.sequenceParameters);
+    BOOST_CHECK(!h.userParameters);
+
+    // Missing required sections only matter when they are selected
+    const char* partial = "<ismrmrdHeader><userParameters /></ismrmrdHeader>";
+    IsmrmrdHeader h2;
+    deserialize(partial, strlen(partial), h2, HEADER_USER_PARAMETERS);
+    BOOST_CHECK(h2.userParameters);
+    IsmrmrdHeader h3;
+    BOOST_CHECK_THROW(deserialize(partial, strlen(partial), h3, HEADER_ENCODING), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_header)
+{
+    LazyHeader lazy(test_header, strlen(test_header));
+    BOOST_CHECK_EQUAL(lazy.header().encoding[0].trajectory, "cartesian");
+    BOOST_CHECK_EQUAL(*lazy.header().acquisitionSystemInformation->receiverChannels, 32);
+    BOOST_CHECK(!lazy.header().userParameters);
+
+    std::vector<UserParameterView> views;
+    lazy.userParameterViews(views);
+    BOOST_REQUIRE_EQUAL(views.size(), 5u);
+    BOOST_CHECK_EQUAL(std::string(views[2].type), "String");
+    BOOST_CHECK_EQUAL(std::string(views[2].name), "c");
+    BOOST_CHECK_EQUAL(std::string(views[2].value), "text & more");
+    BOOST_CHECK_EQUAL(std::string(lazy.findUserParameter("b")), "0.1");
+    BOOST_CHECK(lazy.findUserParameter("missing") == NULL);
+
+    const Optional<UserParameters>& p = lazy.userParameters();
+    BOOST_REQUIRE(p);
+    BOOST_CHECK_EQUAL(p->userParameterLong.size(), 2u);
+    BOOST_CHECK_EQUAL(p->userParameterDouble[0].value, 0.1);
+    BOOST_CHECK(lazy.header().userParameters);
+
+    // Same result as decoding everything at once
+    IsmrmrdHeader h;
+    deserialize(test_header, h);
+    std::string xml1, xml2;
+    serialize(h, xml1);
+    serialize(lazy.header(), xml2);
+    BOOST_CHECK_EQUAL(xml1, xml2);
+
+    BOOST_CHECK_THROW(LazyHeader(test_header, 10), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_all_fields_round_trip)
+{
+    IsmrmrdHeader h;
+    deserialize(full_header, h);
+
+    BOOST_CHECK_EQUAL(*h.subjectInformation->patientName, "A & B");
+    BOOST_CHECK_EQUAL(*h.studyInformation->accessionNumber, 42);
+    const MeasurementInformation& m = *h.measurementInformation;
+    BOOST_CHECK_EQUAL(m.patientPosition, "HFS");
+    BOOST_REQUIRE_EQUAL(m.measurementDependency.size(), 2u);
+    BOOST_CHECK_EQUAL(m.measurementDependency[1].measurementID, "n2");
+    BOOST_REQUIRE_EQUAL(m.referencedImageSequence.size(), 2u);
+    BOOST_CHECK_EQUAL(m.referencedImageSequence[1].referencedSOPInstanceUID, "a2");
+    BOOST_REQUIRE_EQUAL(h.acquisitionSystemInformation->coilLabel.size(), 2u);
+    BOOST_CHECK_EQUAL(h.acquisitionSystemInformation->coilLabel[1].coilName, "c2");
+
+    // Elements out of schema order are still found
+    const Encoding& e = h.encoding[0];
+    BOOST_CHECK_EQUAL(e.trajectory, "spiral");
+    BOOST_CHECK_EQUAL(*e.echoTrainLength, 4);
+    BOOST_CHECK_EQUAL(e.encodedSpace.matrixSize.z, 6);
+    BOOST_CHECK_EQUAL(e.reconSpace.fieldOfView_mm.x, 1.0f);
+    BOOST_CHECK_EQUAL(e.reconSpace.fieldOfView_mm.z, 3.0f);
+    BOOST_CHECK_EQUAL(e.encodingLimits.kspace_encoding_step_0->maximum, 5);
+    BOOST_CHECK(!e.encodingLimits.kspace_encoding_step_1);
+    BOOST_CHECK_EQUAL(e.parallelImaging->accelerationFactor.kspace_encoding_step_1, 2);
+    BOOST_CHECK_EQUAL(e.trajectoryDescription->userParameterDouble[0].value, 2.5);
+    BOOST_CHECK_EQUAL(*e.trajectoryDescription->comment, "c");
+    BOOST_CHECK_EQUAL(h.sequenceParameters->TE->size(), 2u);
+    BOOST_CHECK(!h.userParameters->userParameterBase64.empty());
+
+    // XML and binary agree on every field
+    std::string xml, xml2, xml3, bin;
+    serialize(h, xml);
+    IsmrmrdHeader h2;
+    deserialize(xml.c_str(), h2);
+    serialize(h2, xml2);
+    BOOST_CHECK_EQUAL(xml, xml2);
+
+    serialize_binary(h, bin);
+    IsmrmrdHeader h3;
+    deserialize_binary(bin.data(), bin.size(), h3);
+    serialize(h3, xml3);
+    BOOST_CHECK_EQUAL(xml, xml3);
+
+    // Required elements are enforced by the table
+    const char* missing = "<ismrmrdHeader><experimentalConditions /><encoding><encodedSpace /></encoding></ismrmrdHeader>";
+    IsmrmrdHeader h4;
+    BOOST_CHECK_THROW(deserialize(missing, h4), std::runtime_error);
+}
+
+// Walks a field table alongside the schema type it mirrors
+class SchemaChecker
+{
+public:
+    SchemaChecker(pugi::xml_node schema, pugi::xml_node type, bool repeated = false)
+        : schema_(schema)
+        , type_(type.attribute("name").value())
+        , repeated_(repeated)
+        , next_(0)
+    {
+        pugi::xml_node group = type.first_child();
+        for (pugi::xml_node e = group.child("xs:element"); e; e = e.next_sibling("xs:element")) {
+            elements_.push_back(e);
+        }
+    }
+
+    void finish()
+    {
+        for (size_t i = next_; i < elements_.size(); i++) {
+            BOOST_ERROR(type_ + "/" + elements_[i].attribute("name").value() + " is missing from the field table");
+        }
+    }
+
+    void begin() { }
+    void end() { }
+
+    template <class T> void operator()(const char* name, T& v)
+    {
+        pugi::xml_node e = repeated_ ? expect(name, "0", "unbounded") : expect(name, "1", "1");
+        check_type(e, v);
+    }
+
+    template <class T> void operator()(const char* name, Optional<T>&)
+    {
+        T v;
+        check_type(expect(name, "0", "1"), v);
+    }
+
+    template <class T> void operator()(const char* name, std::vector<T>&)
+    {
+        T v;
+        check_type(expect(name, NULL, "unbounded"), v);
+    }
+
+    template <class T> void operator()(const char* name, Optional<std::vector<T> >&)
+    {
+        T v;
+        check_type(expect(name, "0", "unbounded"), v);
+    }
+
+    template <class T> void section(unsigned int, const char* name, T& v)
+    {
+        (*this)(name, v);
+    }
+
+    template <class T> void wrapped(const char* outer, const char* inner, std::vector<T>&)
+    {
+        pugi::xml_node e = expect(outer, "0", "1");
+        if (e) {
+            SchemaChecker c(schema_, complex_type(e), true);
+            T v;
+            fields(c, v);
+            c.finish();
+            BOOST_CHECK_EQUAL(c.elements_.size(), 1u);
+            BOOST_CHECK_EQUAL(c.elements_[0].attribute("name").value(), std::string(inner));
+        }
+    }
+
+private:
+    static std::string occurs(pugi::xml_node e, const char* attribute)
+    {
+        pugi::xml_attribute a = e.attribute(attribute);
+        return a ? a.value() : "1";
+    }
+
+    pugi::xml_node expect(const char* name, const char* min, const char* max)
+    {
+        std::string where = type_ + "/" + name;
+        if (next_ == elements_.size()) {
+            BOOST_ERROR(where + " is not in the schema");
+            return pugi::xml_node();
+        }
+        pugi::xml_node e = elements_[next_++];
+        BOOST_CHECK_EQUAL(type_ + "/" + e.attribute("name").value(), where);
+        if (min) {
+            BOOST_CHECK_EQUAL(where + " minOccurs " + occurs(e, "minOccurs"), where + " minOccurs " + min);
+        }
+        BOOST_CHECK_EQUAL(where + " maxOccurs " + occurs(e, "maxOccurs"), where + " maxOccurs " + max);
+        return e;
+    }
+
+    pugi::xml_node complex_type(pugi::xml_node e)
+    {
+        return schema_.find_child_by_attribute("xs:complexType", "name", e.attribute("type").value());
+    }
+
+    void check_builtin(pugi::xml_node e, const char* type)
+    {
+        if (e) {
+            BOOST_CHECK_EQUAL(type_ + "/" + e.attribute("name").value() + " " + e.attribute("type").value(),
+                              type_ + "/" + e.attribute("name").value() + " " + type);
+        }
+    }
+
+    void check_type(pugi::xml_node e, unsigned short&) { check_builtin(e, "xs:unsignedShort"); }
+    void check_type(pugi::xml_node e, long&) { check_builtin(e, "xs:long"); }
+    void check_type(pugi::xml_node e, float&) { check_builtin(e, "xs:float"); }
+    void check_type(pugi::xml_node e, double&) { check_builtin(e, "xs:double"); }
+
+    void check_type(pugi::xml_node e, std::string&)
+    {
+        if (!e) {
+            return;
+        }
+        // Strings, dates and times, or a restriction of xs:string inline or by name
+        std::string type = e.attribute("type").value();
+        pugi::xml_node simple = type.empty() ? e.child("xs:simpleType") :
+            schema_.find_child_by_attribute("xs:simpleType", "name", type.c_str());
+        if (simple) {
+            type = simple.child("xs:restriction").attribute("base").value();
+        }
+        BOOST_CHECK_MESSAGE(type == "xs:string" || type == "xs:date" || type == "xs:time" || type == "xs:base64Binary",
+                            type_ + "/" + e.attribute("name").value() + " is not a string in the schema");
+    }
+
+    template <class T> void check_type(pugi::xml_node e, T& v)
+    {
+        if (!e) {
+            return;
+        }
+        pugi::xml_node t = complex_type(e);
+        BOOST_REQUIRE_MESSAGE(t, type_ + "/" + e.attribute("name").value() + " is not a complex type in the schema");
+        SchemaChecker c(schema_, t);
+        fields(c, v);
+        c.finish();
+    }
+
+    pugi::xml_node schema_;
+    std::string type_;
+    bool repeated_;
+    std::vector<pugi::xml_node> elements_;
+    size_t next_;
+};
+
+BOOST_AUTO_TEST_CASE(test_field_tables_match_schema)
+{
+    pugi::xml_document doc;
+    BOOST_REQUIRE(doc.load_file(ISMRMRD_SCHEMA_DIR "/ismrmrd.xsd"));
+    pugi::xml_node schema = doc.child("xs:schema");
+    pugi::xml_node root = schema.find_child_by_attribute("xs:element", "name", "ismrmrdHeader");
+    BOOST_REQUIRE(root);
+
+    SchemaChecker c(schema, schema.find_child_by_attribute("xs:complexType", "name", root.attribute("type").value()));
+    IsmrmrdHeader h;
+    fields(c, h);
+    c.finish();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,4 +1,3 @@
-
 /*
  * generate_cartesian_shepp_logan.cpp
  *
@@ -20,23 +19,106 @@
 using namespace ISMRMRD;
 namespace po = boost::program_options;
 
+// Oversampling of the k-space grid that non-Cartesian samples are interpolated from
+static const unsigned int GRID_OVERSAMPLING = 2;
+
+/**
+ * Coil k-space of one plane (a slice, or a partition of the z-transformed volume).
+ *
+ * The plane image is multiplied by the coil sensitivities, centered in a
+ * [nx, ny] grid and Fourier transformed. Only one plane is held at a time, so
+ * the size of the generated dataset is not limited by memory.
+ */
+static void plane_kspace(const complex_float_t* plane, NDArray<complex_float_t>& csm,
+                         unsigned int matrix_size, size_t nx, size_t ny,
+                         NDArray<complex_float_t>& out)
+{
+    size_t ncoils = csm.getDims()[2];
+    std::vector<size_t> dims;
+    dims.push_back(nx);
+    dims.push_back(ny);
+    dims.push_back(ncoils);
+    out.resize(dims);
+    memset(out.getDataPtr(), 0, out.getDataSize());
+
+    size_t xoff = (nx-matrix_size)/2;
+    size_t yoff = (ny-matrix_size)/2;
+    int rows = static_cast<int>(matrix_size*ncoils);
+#pragma omp parallel for
+    for (int r = 0; r < rows; r++) {
+        size_t y = r % matrix_size;
+        size_t c = r / matrix_size;
+        for (size_t x = 0; x < matrix_size; x++) {
+            out(x+xoff, y+yoff, c) = plane[y*matrix_size+x] * csm(x,y,c);
+        }
+    }
+
+    fft2c(out);
+}
+
+// Keys cubic convolution kernel (a = -0.5)
+static inline float cubic_weight(float t)
+{
+    t = std::abs(t);
+    if (t < 1.0f) {
+        return (1.5f*t - 2.5f)*t*t + 1.0f;
+    }
+    if (t < 2.0f) {
+        return ((-0.5f*t + 2.5f)*t - 4.0f)*t + 2.0f;
+    }
+    return 0.0f;
+}
+
+/**
+ * Sample the gridded k-space at normalized coordinates (kx, ky) in [-0.5, 0.5]
+ * with cubic interpolation. Points outside the grid are taken as zero.
+ */
+static complex_float_t interpolate(NDArray<complex_float_t>& grid, size_t c, float kx, float ky)
+{
+    int n = static_cast<int>(grid.getDims()[0]);
+    float gx = kx*n + n/2;
+    float gy = ky*n + n/2;
+    int x0 = static_cast<int>(std::floor(gx));
+    int y0 = static_cast<int>(std::floor(gy));
+
+    float wx[4], wy[4];
+    for (int k = 0; k < 4; k++) {
+        wx[k] = cubic_weight(gx - (x0-1+k));
+        wy[k] = cubic_weight(gy - (y0-1+k));
+    }
+
+    complex_float_t v(0.0f, 0.0f);
+    for (int j = 0; j < 4; j++) {
+        int y = y0-1+j;
+        if (y < 0 || y >= n) {
+            continue;
+        }
+        for (int i = 0; i < 4; i++) {
+            int x = x0-1+i;
+            if (x < 0 || x >= n) {
+                continue;
+            }
+            v += grid(x,y,c)*(wx[i]*wy[j]);
+        }
+    }
+    return v;
+}
+
 // MAIN APPLICATION
 int main(int argc, char** argv)
 {
-	/** TODO
-	 *
-	 *  Noise samples
-	 *  Acceleration
-	 *  k-space coordinates
-	 *
-	 */
-
 	unsigned int matrix_size; //Matrix size
 	unsigned int ncoils;      //Number of coils
 	unsigned int ros;           //Readout ovesampling
 	unsigned int repetitions;
 	unsigned int acc_factor;
+	unsigned int slices;
+	unsigned int partitions;
+	unsigned int projections;
+	unsigned int interleaves;
 	float noise_level;
+	unsigned long noise_seed;
+	std::string trajectory;
 	std::string outfile;
 	std::string dataset;
 	bool store_coordinates = false;
@@ -50,7 +132,13 @@ int main(int argc, char** argv)
 	    ("oversampling,O", po::value<unsigned int>(&ros)->default_value(2), "Readout oversampling")
 	    ("repetitions,r", po::value<unsigned int>(&repetitions)->default_value(1), "Repetitions")
 	    ("acceleration,a", po::value<unsigned int>(&acc_factor)->default_value(1), "Acceleration factor")
+	    ("slices,s", po::value<unsigned int>(&slices)->default_value(1), "Number of slices (multi-slice 2D)")
+	    ("partitions,z", po::value<unsigned int>(&partitions)->default_value(1), "Number of partitions (3D encoding)")
+	    ("trajectory,t", po::value<std::string>(&trajectory)->default_value("cartesian"), "Trajectory (cartesian, radial or spiral)")
+	    ("projections,p", po::value<unsigned int>(&projections)->default_value(0), "Radial projections (default matrix*pi/2)")
+	    ("interleaves,i", po::value<unsigned int>(&interleaves)->default_value(16), "Spiral interleaves")
 	    ("noise-level,n", po::value<float>(&noise_level)->default_value(0.05f,"0.05"), "Noise Level")
+	    ("noise-seed", po::value<unsigned long>(&noise_seed)->default_value(0), "Noise Seed")
 	    ("output,o", po::value<std::string>(&outfile)->default_value("testdata.h5"), "Output File Name")
 	    ("dataset,d", po::value<std::string>(&dataset)->default_value("dataset"), "Output Dataset Name")
 	    ("noise-calibration,C", po::value<bool>(&noise_calibration)->zero_tokens(), "Add noise calibration")
@@ -66,35 +154,72 @@ int main(int argc, char** argv)
 	    return 1;
 	}
 
-	std::cout << "Generating Cartesian Shepp Logan Phantom!!!" << std::endl;
-	std::cout << "Acceleration: " << acc_factor << std::endl;
+        bool cartesian = (trajectory == "cartesian");
+        bool radial = (trajectory == "radial");
+        bool spiral = (trajectory == "spiral");
+        if (!cartesian && !radial && !spiral) {
+            std::cout << "Unknown trajectory: " << trajectory << std::endl;
+            return -1;
+        }
+        if (slices < 1 || partitions < 1 || acc_factor < 1) {
+            std::cout << "Slices, partitions and acceleration must be at least 1" << std::endl;
+            return -1;
+        }
+        if (slices > 1 && partitions > 1) {
+            std::cout << "Multi-slice and 3D encoding cannot be combined" << std::endl;
+            return -1;
+        }
 
-	boost::shared_ptr<NDArray<complex_float_t> > phantom = shepp_logan_phantom(matrix_size);
-	boost::shared_ptr<NDArray<complex_float_t> > coils = generate_birdcage_sensititivies(matrix_size, ncoils, 1.5);
+	std::cout << "Generating " << trajectory << " Shepp Logan Phantom!!!" << std::endl;
+	std::cout << "Acceleration: " << acc_factor << std::endl;
 
-	std::vector<size_t> dims;
-	dims.push_back(matrix_size*ros); //oversampling in the readout direction
-	dims.push_back(matrix_size);
-	dims.push_back(ncoils);
+        size_t readout = matrix_size*ros;
+        unsigned int planes = (partitions > 1) ? partitions : slices;
 
-	NDArray<complex_float_t> coil_images(dims);
-	memset(coil_images.getDataPtr(), 0, coil_images.getDataSize());
+        //Number of shots (phase encoding lines, projections or interleaves) per plane
+        //and samples per shot
+        unsigned int shots = matrix_size;
+        size_t samples = readout;
+        float spiral_turns = 0;
+        if (radial) {
+            shots = projections ? projections : static_cast<unsigned int>(matrix_size*3.14159265359/2 + 0.5);
+        } else if (spiral) {
+            //Archimedean spiral, each interleave covers matrix/(2*interleaves) turns
+            shots = interleaves;
+            spiral_turns = 1.0f*matrix_size/(2*interleaves);
+            samples = static_cast<size_t>(std::ceil(0.5*3.14159265359*spiral_turns*readout));
+        }
+        if (samples > 65535) {
+            std::cout << "Too many samples per readout: " << samples << std::endl;
+            return -1;
+        }
+        if (acc_factor > shots) {
+            std::cout << "Acceleration " << acc_factor << " exceeds the number of phase encodes, projections or interleaves: " << shots << std::endl;
+            return -1;
+        }
 
-	for (unsigned int c = 0; c < ncoils; c++) {
-            for (unsigned int y = 0; y < matrix_size; y++) {
-                for (unsigned int x = 0; x < matrix_size; x++) {
-                    uint16_t xout = x + (matrix_size*ros-matrix_size)/2;
-                    coil_images(xout,y,c) = (*phantom)(x,y) * (*coils)(x,y,c);
-                }
-            }
-	}
+        //Phantom volume, one plane per slice/partition
+	boost::shared_ptr<NDArray<complex_float_t> > phantom =
+            (planes > 1) ? shepp_logan_phantom(matrix_size, planes) : shepp_logan_phantom(matrix_size);
+	boost::shared_ptr<NDArray<complex_float_t> > coils = generate_birdcage_sensititivies(matrix_size, ncoils, 1.5);
 
         //Let's append the data to the file
         //Create if needed
 	Dataset d(outfile.c_str(),dataset.c_str(), true);
+
+        //Write out some arrays for convenience
+        d.appendNDArray("phantom", *phantom);
+        d.appendNDArray("csm", *coils);
+
+        //With 3D encoding, transform along z once. The coil sensitivities do not depend
+        //on z, so each partition of the coil k-space is the 2D transform of one plane.
+        if (partitions > 1) {
+            fft1c(*phantom, 2, true);
+        }
+
+        set_noise_seed(noise_seed);
+
 	Acquisition acq;
-        size_t readout = matrix_size*ros;
-        
 	if (noise_calibration)
         {
             acq.resize(readout, ncoils);
@@ -104,53 +229,120 @@ int main(int argc, char** argv)
             acq.sample_time_us() = 5.0;
             d.appendAcquisition(acq);
 	}
-        
-        if (store_coordinates) {
-            acq.resize(readout, ncoils, 2);
-        }
-        else {
-            acq.resize(readout, ncoils);
+
+        uint16_t traj_dims = 0;
+        if (store_coordinates || !cartesian) {
+            traj_dims = (partitions > 1) ? 3 : 2;
         }
+        acq.resize(samples, ncoils, traj_dims);
         memset((void*)acq.getDataPtr(), 0, acq.getDataSize());
-        
+
         acq.available_channels() = ncoils;
-	acq.center_sample() = (readout>>1);
+	acq.center_sample() = spiral ? 0 : (readout>>1);
 
+        //Non-Cartesian samples are interpolated from an oversampled grid, scale them
+        //to match the amplitude of the Cartesian k-space
+        float grid_scale = GRID_OVERSAMPLING/std::sqrt(1.0f*ros);
+        size_t grid_size = GRID_OVERSAMPLING*matrix_size;
 
+        //Each repetition, r*acc_factor + a, is a complete volume, plane after
+        //plane. The coil k-space of a plane is computed again for every
+        //repetition of a multi-plane volume rather than kept for all planes.
+        NDArray<complex_float_t> cm;
+        unsigned int cm_plane = planes;
         for (unsigned int r = 0; r < repetitions; r++) {
             for (unsigned int a = 0; a < acc_factor; a++) {
-                NDArray<complex_float_t> cm = coil_images;
-                fft2c(cm);
-
-                add_noise(cm,noise_level);
-                for (size_t i = a; i < matrix_size; i+=acc_factor) {
-                    acq.clearAllFlags();
-                    
-                    //Set some flags
-                    if (i == a) {
-                        acq.setFlag(ISMRMRD_ACQ_FIRST_IN_SLICE);
-                    }
-                    if (i >= (matrix_size-acc_factor)) {
-                        acq.setFlag(ISMRMRD_ACQ_LAST_IN_SLICE);
-                    }
-                    acq.idx().kspace_encode_step_1 = i;
-                    acq.idx().repetition = r*acc_factor + a;
-                    acq.sample_time_us() = 5.0;
-                    for (size_t c = 0; c < ncoils; c++) {
-                        for (size_t s = 0; s < readout; s++) {
-                            acq.data(s,c) = cm(s,i,c);
+                for (unsigned int p = 0; p < planes; p++) {
+                    if (p != cm_plane) {
+                        const complex_float_t* plane = phantom->getDataPtr() + static_cast<size_t>(p)*matrix_size*matrix_size;
+                        if (cartesian) {
+                            plane_kspace(plane, *coils, matrix_size, readout, matrix_size, cm);
+                        } else {
+                            plane_kspace(plane, *coils, matrix_size, grid_size, grid_size, cm);
                         }
+                        cm_plane = p;
                     }
-                    
-                    if (store_coordinates) {
-                        float ky = (1.0*i-(matrix_size>>1))/(1.0*matrix_size);
-                        for (size_t x = 0; x < readout; x++) {
-                            float kx = (1.0*x-(readout>>1))/(1.0*readout);
-                            acq.traj(0,x) = kx;
-                            acq.traj(1,x) = ky;
+
+                    float kz = (1.0*p-(partitions>>1))/(1.0*partitions);
+
+                    for (size_t i = a; i < shots; i+=acc_factor) {
+                        acq.clearAllFlags();
+
+                        //Set some flags
+                        if (i == a) {
+                            if (partitions > 1) {
+                                acq.setFlag(ISMRMRD_ACQ_FIRST_IN_ENCODE_STEP2);
+                            }
+                            if (partitions == 1 || p == 0) {
+                                acq.setFlag(ISMRMRD_ACQ_FIRST_IN_SLICE);
+                            }
+                        }
+                        if (i + acc_factor >= shots) {
+                            if (partitions > 1) {
+                                acq.setFlag(ISMRMRD_ACQ_LAST_IN_ENCODE_STEP2);
+                            }
+                            if (partitions == 1 || p == partitions-1) {
+                                acq.setFlag(ISMRMRD_ACQ_LAST_IN_SLICE);
+                            }
                         }
+                        acq.idx().kspace_encode_step_1 = i;
+                        acq.idx().kspace_encode_step_2 = (partitions > 1) ? p : 0;
+                        acq.idx().slice = (partitions > 1) ? 0 : p;
+                        acq.idx().repetition = r*acc_factor + a;
+                        acq.sample_time_us() = 5.0;
+                        if (slices > 1) {
+                            acq.position()[2] = (1.0f*p - 0.5f*(slices-1))*6.0f;
+                        }
+
+                        if (cartesian) {
+                            for (size_t c = 0; c < ncoils; c++) {
+                                for (size_t s = 0; s < readout; s++) {
+                                    acq.data(s,c) = cm(s,i,c);
+                                }
+                            }
+
+                            if (store_coordinates) {
+                                float ky = (1.0*i-(matrix_size>>1))/(1.0*matrix_size);
+                                for (size_t x = 0; x < readout; x++) {
+                                    float kx = (1.0*x-(readout>>1))/(1.0*readout);
+                                    acq.traj(0,x) = kx;
+                                    acq.traj(1,x) = ky;
+                                }
+                            }
+                        } else {
+                            for (size_t s = 0; s < samples; s++) {
+                                float kx, ky;
+                                if (radial) {
+                                    float angle = 3.14159265359f*i/shots;
+                                    float k = (1.0f*s-(readout>>1))/(1.0f*readout);
+                                    kx = k*std::cos(angle);
+                                    ky = k*std::sin(angle);
+                                } else {
+                                    float t = 1.0f*s/samples;
+                                    float angle = 2*3.14159265359f*(spiral_turns*t + 1.0f*i/shots);
+                                    kx = 0.5f*t*std::cos(angle);
+                                    ky = 0.5f*t*std::sin(angle);
+                                }
+                                acq.traj(0,s) = kx;
+                                acq.traj(1,s) = ky;
+                            }
+#pragma omp parallel for
+                            for (int c = 0; c < static_cast<int>(ncoils); c++) {
+                                for (size_t s = 0; s < samples; s++) {
+                                    acq.data(s,c) = interpolate(cm, c, acq.traj(0,s), acq.traj(1,s))*grid_scale;
+                                }
+                            }
+                        }
+
+                        if (traj_dims == 3) {
+                            for (size_t s = 0; s < samples; s++) {
+                                acq.traj(2,s) = kz;
+                            }
+                        }
+
+                        add_noise(acq,noise_level);
+                        d.appendAcquisition(acq);
                     }
-                    d.appendAcquisition(acq);
                 }
             }
 	}
@@ -158,7 +350,7 @@ int main(int argc, char** argv)
 	//Let's create a header, we will use the C++ classes in ismrmrd/xml.h
 	IsmrmrdHeader h;
         h.version = ISMRMRD_XMLHDR_VERSION;
-	h.experimentalConditions.H1resonanceFrequency_Hz = 63500000; //~1.5T        
+	h.experimentalConditions.H1resonanceFrequency_Hz = 63500000; //~1.5T
 
 	AcquisitionSystemInformation sys;
 	sys.institutionName = "ISMRM Synthetic Imaging Lab";
@@ -167,22 +359,26 @@ int main(int argc, char** argv)
 
 	//Create an encoding section
         Encoding e;
-        e.encodedSpace.matrixSize.x = readout;
+        e.encodedSpace.matrixSize.x = spiral ? matrix_size : readout;
         e.encodedSpace.matrixSize.y = matrix_size;
-        e.encodedSpace.matrixSize.z = 1;
-        e.encodedSpace.fieldOfView_mm.x = 600;
+        e.encodedSpace.matrixSize.z = partitions;
+        e.encodedSpace.fieldOfView_mm.x = spiral ? 300 : 300*ros;
         e.encodedSpace.fieldOfView_mm.y = 300;
-        e.encodedSpace.fieldOfView_mm.z = 6;
-        e.reconSpace.matrixSize.x = readout/2;
+        e.encodedSpace.fieldOfView_mm.z = (partitions > 1) ? 300.0f*partitions/matrix_size : 6;
+        e.reconSpace.matrixSize.x = matrix_size;
         e.reconSpace.matrixSize.y = matrix_size;
-        e.reconSpace.matrixSize.z = 1;
+        e.reconSpace.matrixSize.z = partitions;
         e.reconSpace.fieldOfView_mm.x = 300;
         e.reconSpace.fieldOfView_mm.y = 300;
-        e.reconSpace.fieldOfView_mm.z = 6;
-        e.trajectory = "cartesian";
-        e.encodingLimits.kspace_encoding_step_1 = Limit(0, matrix_size-1,(matrix_size>>1));
+        e.reconSpace.fieldOfView_mm.z = e.encodedSpace.fieldOfView_mm.z;
+        e.trajectory = trajectory;
+        e.encodingLimits.kspace_encoding_step_1 = Limit(0, shots-1, cartesian ? (matrix_size>>1) : 0);
+        if (partitions > 1) {
+            e.encodingLimits.kspace_encoding_step_2 = Limit(0, partitions-1, (partitions>>1));
+        }
+        e.encodingLimits.slice = Limit(0, slices-1, 0);
         e.encodingLimits.repetition = Limit(0, repetitions*acc_factor - 1,0);
-        
+
 	//e.g. parallel imaging
 	if (acc_factor > 1) {
             ParallelImaging parallel;
@@ -202,14 +398,30 @@ int main(int argc, char** argv)
         ISMRMRD::serialize( h, str);
         std::string xml_header = str.str();
         //std::cout << xml_header << std::endl;
-        
+
 	//Write the header to the data file.
 	d.writeHeader(xml_header);
 
-        //Write out some arrays for convenience
-        d.appendNDArray("phantom", *phantom);
-        d.appendNDArray("csm", *coils);
-        d.appendNDArray("coil_images", coil_images);
-        
+        //The coil images are only kept for a single 2D Cartesian plane, in
+        //the other modes they would be as large as the k-space
+        if (cartesian && planes == 1) {
+            NDArray<complex_float_t> coil_images;
+            std::vector<size_t> dims;
+            dims.push_back(readout);
+            dims.push_back(matrix_size);
+            dims.push_back(ncoils);
+            coil_images.resize(dims);
+            memset(coil_images.getDataPtr(), 0, coil_images.getDataSize());
+            for (unsigned int c = 0; c < ncoils; c++) {
+                for (unsigned int y = 0; y < matrix_size; y++) {
+                    for (unsigned int x = 0; x < matrix_size; x++) {
+                        uint16_t xout = x + (readout-matrix_size)/2;
+                        coil_images(xout,y,c) = (*phantom)(x,y) * (*coils)(x,y,c);
+                    }
+                }
+            }
+            d.appendNDArray("coil_images", coil_images);
+        }
+
 	return 0;
 }
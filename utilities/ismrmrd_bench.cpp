@@ -0,0 +1,2000 @@
+/*
+ * ismrmrd_bench.cpp
+ *
+ * Micro-benchmarks for the ISMRMRD library: dataset I/O, streaming over local
+ * sockets and shared memory, XML header and meta (de)serialization, acquisition
+ * and coil compression, noise prewhitening and the copy/consistency and
+ * orientation functions of the C API.
+ *
+ * Every case is run repeatedly until it has taken at least --min-time seconds,
+ * the results are reported as operations and megabytes per second in CSV or JSON,
+ * with the compression ratio for the compression cases.
+ */
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#include <thread>
+#define ISMRMRD_BENCH_THREADS
+#endif
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/coils.h"
+#include "ismrmrd/compression.h"
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/xml.h"
+#include "ismrmrd/meta.h"
+
+#if defined(ISMRMRD_BENCH_THREADS) && !defined(WIN32)
+#include "ismrmrd/ring.h"
+#include "ismrmrd/stream.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define ISMRMRD_BENCH_STREAM
+#endif
+
+#ifndef ISMRMRD_SCHEMA_DIR
+#define ISMRMRD_SCHEMA_DIR "."
+#endif
+
+using namespace ISMRMRD;
+
+namespace {
+
+double now_seconds()
+{
+#ifdef WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)f.QuadPart;
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+#endif
+}
+
+struct Options
+{
+    Options()
+        : format("csv")
+        , min_time(0.5)
+        , dir(".")
+        , xml_file(ISMRMRD_SCHEMA_DIR "/ismrmrd_example_extended.xml")
+    { }
+
+    std::string format;
+    std::string output;
+    std::string filter;
+    double min_time;
+    std::string dir;
+    std::string xml_file;
+    std::string acquisitions_file;
+};
+
+struct Result
+{
+    std::string name;
+    size_t ops;
+    double bytes;
+    double seconds;
+    double ratio;
+};
+
+/**
+ * A benchmark case. run(n) performs n operations, each moving bytes() bytes.
+ * Anything that should not be timed goes in setup() and teardown().
+ */
+class Case
+{
+public:
+    Case(const std::string& name) : name_(name) { }
+    virtual ~Case() { }
+
+    const std::string& name() const { return name_; }
+    virtual double bytes() const { return 0; }
+    // Compression ratio, 0 where it does not apply
+    virtual double ratio() const { return 0; }
+    virtual void setup() { }
+    virtual void run(size_t n) = 0;
+    virtual void teardown() { }
+
+protected:
+    std::string name_;
+};
+
+std::string file_name(const Options& opt)
+{
+    return opt.dir + "/ismrmrd_bench.h5";
+}
+
+std::string read_file(const std::string& fname)
+{
+    std::ifstream f(fname.c_str(), std::ios::binary);
+    if (!f) {
+        throw std::runtime_error("Unable to open " + fname);
+    }
+    std::stringstream s;
+    s << f.rdbuf();
+    return s.str();
+}
+
+void fill(complex_float_t* data, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        data[i] = complex_float_t(static_cast<float>(i % 1031), -static_cast<float>(i % 17));
+    }
+}
+
+/* ---- Dataset cases ---- */
+
+class DatasetCase : public Case
+{
+public:
+    DatasetCase(const std::string& name, const Options& opt) : Case(name), opt_(opt), d_(NULL) { }
+    ~DatasetCase() { delete d_; }
+
+    void setup()
+    {
+        std::remove(file_name(opt_).c_str());
+        d_ = new Dataset(file_name(opt_).c_str(), "dataset", true);
+    }
+
+    void teardown()
+    {
+        delete d_;
+        d_ = NULL;
+        std::remove(file_name(opt_).c_str());
+    }
+
+protected:
+    const Options& opt_;
+    Dataset* d_;
+};
+
+class AcquisitionAppend : public DatasetCase
+{
+public:
+    AcquisitionAppend(const Options& opt, uint16_t samples, uint16_t channels)
+        : DatasetCase(label("acquisition_append", samples, channels), opt)
+        , acq_(samples, channels)
+    {
+        fill(acq_.getDataPtr(), (size_t)samples*channels);
+    }
+
+    static std::string label(const char* base, uint16_t samples, uint16_t channels)
+    {
+        std::stringstream s;
+        s << base << "/" << samples << "x" << channels;
+        return s.str();
+    }
+
+    double bytes() const { return sizeof(AcquisitionHeader) + acq_.getDataSize(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            d_->appendAcquisition(acq_);
+        }
+    }
+
+protected:
+    Acquisition acq_;
+};
+
+class AcquisitionRead : public AcquisitionAppend
+{
+public:
+    AcquisitionRead(const Options& opt, uint16_t samples, uint16_t channels)
+        : AcquisitionAppend(opt, samples, channels)
+    {
+        name_ = label("acquisition_read", samples, channels);
+    }
+
+    void setup()
+    {
+        AcquisitionAppend::setup();
+        AcquisitionAppend::run(COUNT);
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            d_->readAcquisition(i % COUNT, out_);
+        }
+    }
+
+private:
+    static const size_t COUNT = 64;
+    Acquisition out_;
+};
+
+/**
+ * Appends and reads acquisitions batch at a time with appendAcquisitions and
+ * readAcquisitions. An operation is still one acquisition.
+ */
+class AcquisitionAppendBatch : public DatasetCase
+{
+public:
+    AcquisitionAppendBatch(const Options& opt, uint16_t samples, uint16_t channels, size_t batch)
+        : DatasetCase(label("acquisition_append_batch", samples, channels, batch), opt)
+        , acqs_(batch, Acquisition(samples, channels))
+    {
+        for (size_t i = 0; i < batch; i++) {
+            fill(acqs_[i].getDataPtr(), (size_t)samples*channels);
+        }
+    }
+
+    static std::string label(const char* base, uint16_t samples, uint16_t channels, size_t batch)
+    {
+        std::stringstream s;
+        s << AcquisitionAppend::label(base, samples, channels) << "/" << batch;
+        return s.str();
+    }
+
+    double bytes() const { return sizeof(AcquisitionHeader) + acqs_[0].getDataSize(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i += acqs_.size()) {
+            d_->appendAcquisitions(&acqs_[0], std::min(acqs_.size(), n - i));
+        }
+    }
+
+protected:
+    std::vector<Acquisition> acqs_;
+};
+
+class AcquisitionReadBatch : public AcquisitionAppendBatch
+{
+public:
+    AcquisitionReadBatch(const Options& opt, uint16_t samples, uint16_t channels, size_t batch)
+        : AcquisitionAppendBatch(opt, samples, channels, batch)
+        , out_(batch)
+    {
+        name_ = label("acquisition_read_batch", samples, channels, batch);
+    }
+
+    void setup()
+    {
+        AcquisitionAppendBatch::setup();
+        AcquisitionAppendBatch::run(COUNT);
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i += out_.size()) {
+            size_t count = std::min(out_.size(), n - i);
+            d_->readAcquisitions((i % COUNT) / out_.size() * out_.size(), count, &out_[0]);
+        }
+    }
+
+private:
+    static const size_t COUNT = 1024;
+    std::vector<Acquisition> out_;
+};
+
+#ifdef ISMRMRD_BENCH_THREADS
+/**
+ * Reads from several datasets on several threads, each thread with its own
+ * Dataset. An operation is one acquisition read, so against the single thread
+ * case this shows how far the reads of a process scale.
+ */
+class AcquisitionReadThreads : public Case
+{
+public:
+    AcquisitionReadThreads(const Options& opt, size_t datasets, size_t threads)
+        : Case(label(datasets, threads)), opt_(opt), datasets_(datasets), threads_(threads), acq_(256, 8)
+    {
+        fill(acq_.getDataPtr(), acq_.getNumberOfDataElements());
+    }
+
+    static std::string label(size_t datasets, size_t threads)
+    {
+        std::stringstream s;
+        s << "acquisition_read_threads/" << datasets << "x" << threads;
+        return s.str();
+    }
+
+    std::string file(size_t i) const
+    {
+        std::stringstream s;
+        s << opt_.dir << "/ismrmrd_bench_" << i << ".h5";
+        return s.str();
+    }
+
+    double bytes() const { return sizeof(AcquisitionHeader) + acq_.getDataSize(); }
+
+    void setup()
+    {
+        for (size_t i = 0; i < datasets_; i++) {
+            std::remove(file(i).c_str());
+            Dataset d(file(i).c_str(), "dataset", true);
+            for (size_t j = 0; j < COUNT; j++) {
+                d.appendAcquisition(acq_);
+            }
+        }
+    }
+
+    void run(size_t n)
+    {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < threads_; t++) {
+            size_t count = n / threads_ + (t < n % threads_ ? 1 : 0);
+            threads.push_back(std::thread(read, file(t % datasets_), count));
+        }
+        for (size_t t = 0; t < threads_; t++) {
+            threads[t].join();
+        }
+    }
+
+    void teardown()
+    {
+        for (size_t i = 0; i < datasets_; i++) {
+            std::remove(file(i).c_str());
+        }
+    }
+
+private:
+    static void read(const std::string& fname, size_t count)
+    {
+        Dataset d(fname.c_str(), "dataset", false);
+        Acquisition acq;
+        for (size_t i = 0; i < count; i++) {
+            d.readAcquisition(i % COUNT, acq);
+        }
+    }
+
+    static const size_t COUNT = 64;
+    const Options& opt_;
+    size_t datasets_;
+    size_t threads_;
+    Acquisition acq_;
+};
+#endif
+
+#ifdef ISMRMRD_BENCH_STREAM
+/* ---- Stream cases ---- */
+
+/// Connects fds to each other through a Unix socket pair or TCP on 127.0.0.1
+void connect_pair(const std::string& transport, int fds[2])
+{
+    if (transport == "unix") {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("socketpair failed");
+        }
+        return;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (sockaddr*)&addr, &len) != 0) {
+        throw std::runtime_error("Unable to listen on 127.0.0.1");
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[0] < 0 || connect(fds[0], (sockaddr*)&addr, sizeof(addr)) != 0) {
+        throw std::runtime_error("Unable to connect to 127.0.0.1");
+    }
+    fds[1] = accept(listener, NULL, NULL);
+    close(listener);
+    if (fds[1] < 0) {
+        throw std::runtime_error("Unable to accept on 127.0.0.1");
+    }
+    int one = 1;
+    setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+void close_pair(int fds[2])
+{
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+/**
+ * Sends acquisitions from a writer thread to a StreamReader over a loopback
+ * connection, a Unix socket pair or TCP on 127.0.0.1. An operation is one
+ * readout received, so ops/s are readouts per second; the writer hands
+ * batch acquisitions at a time to writeAcquisitions.
+ */
+class StreamAcquisitions : public Case
+{
+public:
+    StreamAcquisitions(const std::string& transport, uint16_t samples, uint16_t channels, size_t batch)
+        : Case(label(transport, samples, channels, batch))
+        , transport_(transport)
+        , acqs_(batch, Acquisition(samples, channels))
+    {
+        for (size_t i = 0; i < batch; i++) {
+            fill(acqs_[i].getDataPtr(), acqs_[i].getNumberOfDataElements());
+        }
+        fds_[0] = fds_[1] = -1;
+    }
+
+    static std::string label(const std::string& transport, uint16_t samples, uint16_t channels, size_t batch)
+    {
+        std::stringstream s;
+        s << "stream_acquisitions/" << transport << "/" << samples << "x" << channels;
+        if (batch > 1) {
+            s << "/batch" << batch;
+        }
+        return s.str();
+    }
+
+    double bytes() const { return sizeof(StreamFrame) + sizeof(AcquisitionHeader) + acqs_[0].getDataSize(); }
+
+    void setup()
+    {
+        connect_pair(transport_, fds_);
+    }
+
+    void run(size_t n)
+    {
+        std::thread writer(write, fds_[0], &acqs_, n);
+        try {
+            StreamReader reader(fds_[1]);
+            Acquisition acq;
+            for (size_t i = 0; i < n; i++) {
+                if (reader.nextMessage() != STREAM_ACQUISITION) {
+                    throw std::runtime_error("Unexpected stream message");
+                }
+                reader.readAcquisition(acq);
+            }
+        } catch (...) {
+            // Unblocks the writer so it can be joined
+            shutdown(fds_[1], SHUT_RDWR);
+            writer.join();
+            throw;
+        }
+        writer.join();
+    }
+
+    void teardown()
+    {
+        close_pair(fds_);
+    }
+
+private:
+    static void write(int fd, const std::vector<Acquisition>* acqs, size_t n)
+    {
+        // A failed write shows up as a short stream on the reading side
+        try {
+            StreamWriter writer(fd);
+            for (size_t sent = 0; sent < n; sent += acqs->size()) {
+                writer.writeAcquisitions(&(*acqs)[0], std::min(acqs->size(), n - sent));
+            }
+        } catch (std::exception&) {
+        }
+    }
+
+    std::string transport_;
+    std::vector<Acquisition> acqs_;
+    int fds_[2];
+};
+
+// Rings of the cases below, large enough for the biggest readouts
+const size_t RING_CAPACITY = 8 << 20;
+
+std::string ring_name(const char* what)
+{
+    std::stringstream s;
+    s << "/ismrmrd_bench_" << what << "_" << getpid();
+    return s.str();
+}
+
+/**
+ * Sends acquisitions through a SharedRing from a producer thread, an
+ * operation is one readout received. The copying variant goes through
+ * writeAcquisition and readAcquisition like StreamAcquisitions; in place,
+ * the producer builds each readout in ring memory and the consumer sums its
+ * samples where they lie.
+ */
+class RingAcquisitions : public Case
+{
+public:
+    RingAcquisitions(uint16_t samples, uint16_t channels, bool in_place)
+        : Case(label(samples, channels, in_place))
+        , in_place_(in_place)
+        , acq_(samples, channels)
+        , consumer_(NULL)
+        , producer_(NULL)
+        , sum_(0)
+    {
+        fill(acq_.getDataPtr(), acq_.getNumberOfDataElements());
+    }
+
+    static std::string label(uint16_t samples, uint16_t channels, bool in_place)
+    {
+        std::stringstream s;
+        s << "ring_acquisitions/" << samples << "x" << channels;
+        if (in_place) {
+            s << "/inplace";
+        }
+        return s.str();
+    }
+
+    double bytes() const { return sizeof(StreamFrame) + sizeof(AcquisitionHeader) + acq_.getDataSize(); }
+
+    void setup()
+    {
+        std::string name = ring_name("acquisitions");
+        consumer_ = new SharedRing(name, true, RING_CAPACITY);
+        producer_ = new SharedRing(name, false);
+    }
+
+    void run(size_t n)
+    {
+        std::thread producer(produce, producer_, &acq_, in_place_, n);
+        Acquisition acq;
+        for (size_t i = 0; i < n; i++) {
+            if (consumer_->nextMessage() != STREAM_ACQUISITION) {
+                throw std::runtime_error("Unexpected ring message");
+            }
+            if (in_place_) {
+                AcquisitionView view = consumer_->acquisition();
+                const complex_float_t* data = view.getDataPtr();
+                size_t elements = view.getNumberOfDataElements();
+                float sum = 0;
+                for (size_t j = 0; j < elements; j++) {
+                    sum += data[j].real();
+                }
+                sum_ += sum;
+            } else {
+                consumer_->readAcquisition(acq);
+            }
+        }
+        consumer_->release();
+        producer.join();
+    }
+
+    void teardown()
+    {
+        delete producer_;
+        delete consumer_;
+        producer_ = consumer_ = NULL;
+    }
+
+private:
+    static void produce(SharedRing* ring, const Acquisition* acq, bool in_place, size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (in_place) {
+                AcquisitionView view = ring->beginAcquisition(acq->getHead().number_of_samples, acq->getHead().active_channels);
+                view.head().scan_counter = static_cast<uint32_t>(i);
+                memcpy(view.getDataPtr(), acq->getDataPtr(), acq->getDataSize());
+                ring->commit();
+            } else {
+                ring->writeAcquisition(*acq);
+            }
+        }
+    }
+
+    bool in_place_;
+    Acquisition acq_;
+    SharedRing* consumer_;
+    SharedRing* producer_;
+    float sum_;
+};
+
+/**
+ * Round trips of one acquisition to an echo thread and back, over a socket
+ * pair or a pair of SharedRings. ops/s are round trips per second, so the
+ * round trip latency is the inverse.
+ */
+class AcquisitionPingPong : public Case
+{
+public:
+    AcquisitionPingPong(const std::string& transport, uint16_t samples, uint16_t channels)
+        : Case(label(transport, samples, channels))
+        , transport_(transport)
+        , acq_(samples, channels)
+    {
+        fill(acq_.getDataPtr(), acq_.getNumberOfDataElements());
+        fds_[0] = fds_[1] = -1;
+        for (int i = 0; i < 4; i++) {
+            rings_[i] = NULL;
+        }
+    }
+
+    static std::string label(const std::string& transport, uint16_t samples, uint16_t channels)
+    {
+        std::stringstream s;
+        if (transport == "ring") {
+            s << "ring_pingpong/";
+        } else {
+            s << "stream_pingpong/" << transport << "/";
+        }
+        s << samples << "x" << channels;
+        return s.str();
+    }
+
+    double bytes() const { return 2.0 * (sizeof(StreamFrame) + sizeof(AcquisitionHeader) + acq_.getDataSize()); }
+
+    void setup()
+    {
+        if (transport_ != "ring") {
+            connect_pair(transport_, fds_);
+            return;
+        }
+        // 0 and 1 send and receive on this side, 2 and 3 are their ends in the echo thread
+        std::string there = ring_name("ping"), back = ring_name("pong");
+        rings_[0] = new SharedRing(there, true, RING_CAPACITY);
+        rings_[1] = new SharedRing(back, true, RING_CAPACITY);
+        rings_[2] = new SharedRing(there, false);
+        rings_[3] = new SharedRing(back, false);
+    }
+
+    void run(size_t n)
+    {
+        if (transport_ == "ring") {
+            std::thread echo(echo_ring, rings_[2], rings_[3], n);
+            for (size_t i = 0; i < n; i++) {
+                rings_[0]->writeAcquisition(acq_);
+                if (rings_[1]->nextMessage() != STREAM_ACQUISITION) {
+                    throw std::runtime_error("Unexpected ring message");
+                }
+                rings_[1]->readAcquisition(acq_);
+            }
+            rings_[1]->release();
+            echo.join();
+            return;
+        }
+
+        std::thread echo(echo_stream, fds_[1], n);
+        try {
+            StreamWriter writer(fds_[0]);
+            StreamReader reader(fds_[0]);
+            for (size_t i = 0; i < n; i++) {
+                writer.writeAcquisition(acq_);
+                if (reader.nextMessage() != STREAM_ACQUISITION) {
+                    throw std::runtime_error("Unexpected stream message");
+                }
+                reader.readAcquisition(acq_);
+            }
+        } catch (...) {
+            shutdown(fds_[0], SHUT_RDWR);
+            echo.join();
+            throw;
+        }
+        echo.join();
+    }
+
+    void teardown()
+    {
+        close_pair(fds_);
+        for (int i = 3; i >= 0; i--) {
+            delete rings_[i];
+            rings_[i] = NULL;
+        }
+    }
+
+private:
+    static void echo_ring(SharedRing* in, SharedRing* out, size_t n)
+    {
+        Acquisition acq;
+        for (size_t i = 0; i < n; i++) {
+            in->nextMessage();
+            in->readAcquisition(acq);
+            out->writeAcquisition(acq);
+        }
+        in->release();
+    }
+
+    static void echo_stream(int fd, size_t n)
+    {
+        try {
+            StreamReader reader(fd);
+            StreamWriter writer(fd);
+            Acquisition acq;
+            for (size_t i = 0; i < n; i++) {
+                if (reader.nextMessage() != STREAM_ACQUISITION) {
+                    break;
+                }
+                reader.readAcquisition(acq);
+                writer.writeAcquisition(acq);
+            }
+        } catch (std::exception&) {
+        }
+    }
+
+    std::string transport_;
+    Acquisition acq_;
+    int fds_[2];
+    SharedRing* rings_[4];
+};
+#endif
+
+template <typename T> class ImageAppend : public DatasetCase
+{
+public:
+    ImageAppend(const Options& opt, const char* base, uint16_t nx, uint16_t ny, uint16_t channels)
+        : DatasetCase(label(base, nx, ny, channels), opt)
+        , img_(nx, ny, 1, channels)
+    {
+        memset((void*)img_.getDataPtr(), 1, img_.getDataSize());
+        img_.setAttributeString("<ismrmrdMeta><meta><name>bench</name><value>1</value></meta></ismrmrdMeta>");
+    }
+
+    static std::string label(const char* base, uint16_t nx, uint16_t ny, uint16_t channels)
+    {
+        std::stringstream s;
+        s << base << "/" << nx << "x" << ny << "x" << channels;
+        return s.str();
+    }
+
+    double bytes() const { return sizeof(ImageHeader) + img_.getDataSize(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            d_->appendImage("image", img_);
+        }
+    }
+
+protected:
+    Image<T> img_;
+};
+
+template <typename T> class ImageRead : public ImageAppend<T>
+{
+public:
+    ImageRead(const Options& opt, const char* base, uint16_t nx, uint16_t ny, uint16_t channels)
+        : ImageAppend<T>(opt, base, nx, ny, channels) { }
+
+    void setup()
+    {
+        ImageAppend<T>::setup();
+        ImageAppend<T>::run(COUNT);
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            this->d_->readImage("image", i % COUNT, out_);
+        }
+    }
+
+private:
+    static const size_t COUNT = 16;
+    Image<T> out_;
+};
+
+class NDArrayAppend : public DatasetCase
+{
+public:
+    NDArrayAppend(const Options& opt, const std::vector<size_t>& dims, const char* base = "ndarray_append")
+        : DatasetCase(label(base, dims), opt)
+        , arr_(dims)
+    {
+        fill(arr_.getDataPtr(), arr_.getNumberOfElements());
+    }
+
+    static std::string label(const char* base, const std::vector<size_t>& dims)
+    {
+        std::stringstream s;
+        s << base << "/";
+        for (size_t i = 0; i < dims.size(); i++) {
+            s << (i ? "x" : "") << dims[i];
+        }
+        return s.str();
+    }
+
+    double bytes() const { return arr_.getDataSize(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            d_->appendNDArray("array", arr_);
+        }
+    }
+
+protected:
+    NDArray<complex_float_t> arr_;
+};
+
+class NDArrayRead : public NDArrayAppend
+{
+public:
+    NDArrayRead(const Options& opt, const std::vector<size_t>& dims)
+        : NDArrayAppend(opt, dims, "ndarray_read") { }
+
+    void setup()
+    {
+        NDArrayAppend::setup();
+        NDArrayAppend::run(COUNT);
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            d_->readNDArray("array", i % COUNT, out_);
+        }
+    }
+
+private:
+    static const size_t COUNT = 8;
+    NDArray<complex_float_t> out_;
+};
+
+/* Reading the header of a dataset: decoded from the XML or the binary copy,
+   or shared through the header cache */
+class HeaderRead : public DatasetCase
+{
+public:
+    HeaderRead(const Options& opt, const char* mode)
+        : DatasetCase(std::string("header_read/") + mode, opt)
+        , mode_(mode)
+    { }
+
+    void setup()
+    {
+        DatasetCase::setup();
+        xml_ = read_file(opt_.xml_file);
+        IsmrmrdHeader h;
+        deserialize(xml_.c_str(), h);
+        d_->writeHeader(h, mode_ != "xml");
+    }
+
+    double bytes() const { return xml_.size(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+#ifdef ISMRMRD_HEADER_CACHE
+            if (mode_ == "cached") {
+                d_->readParsedHeader();
+                continue;
+            }
+#endif
+            IsmrmrdHeader h;
+            d_->readHeader(h);
+        }
+    }
+
+private:
+    std::string mode_;
+    std::string xml_;
+};
+
+/* ---- XML header cases ---- */
+
+class XmlDeserialize : public Case
+{
+public:
+    XmlDeserialize(const Options& opt) : Case("xml_deserialize"), opt_(opt) { }
+
+    void setup() { xml_ = read_file(opt_.xml_file); }
+    double bytes() const { return xml_.size(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            IsmrmrdHeader h;
+            deserialize(xml_.c_str(), h);
+        }
+    }
+
+protected:
+    const Options& opt_;
+    std::string xml_;
+};
+
+class XmlSerialize : public XmlDeserialize
+{
+public:
+    XmlSerialize(const Options& opt) : XmlDeserialize(opt) { name_ = "xml_serialize"; }
+
+    void setup()
+    {
+        XmlDeserialize::setup();
+        deserialize(xml_.c_str(), h_);
+        std::stringstream s;
+        serialize(h_, s);
+        size_ = s.str().size();
+    }
+
+    double bytes() const { return size_; }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            std::stringstream s;
+            serialize(h_, s);
+        }
+    }
+
+protected:
+    IsmrmrdHeader h_;
+    size_t size_;
+};
+
+/* Serializing into a reused string, without a stream */
+class XmlSerializeString : public XmlSerialize
+{
+public:
+    XmlSerializeString(const Options& opt) : XmlSerialize(opt) { name_ = "xml_serialize_string"; }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            serialize(h_, s_);
+        }
+    }
+
+private:
+    std::string s_;
+};
+
+/* Serializing into a reused string and reading it back */
+class XmlRoundTrip : public XmlSerialize
+{
+public:
+    XmlRoundTrip(const Options& opt) : XmlSerialize(opt) { name_ = "xml_round_trip"; }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            serialize(h_, s_);
+            IsmrmrdHeader h;
+            deserialize(s_.data(), s_.size(), h);
+        }
+    }
+
+private:
+    std::string s_;
+};
+
+/* Header with its user parameters scaled up to a given count */
+class XmlDeserializeLarge : public XmlDeserialize
+{
+public:
+    XmlDeserializeLarge(const Options& opt, size_t parameters)
+        : XmlDeserialize(opt)
+        , parameters_(parameters)
+    {
+        std::stringstream name;
+        name << "xml_deserialize_large/" << parameters;
+        name_ = name.str();
+    }
+
+    void setup()
+    {
+        XmlDeserialize::setup();
+        IsmrmrdHeader h;
+        deserialize(xml_.c_str(), h);
+        if (!h.userParameters) {
+            h.userParameters = UserParameters();
+        }
+        UserParameters& p = h.userParameters.get();
+        size_t count = p.userParameterLong.size() + p.userParameterDouble.size() +
+            p.userParameterString.size() + p.userParameterBase64.size();
+        for (size_t i = count; i < parameters_; i++) {
+            std::stringstream name;
+            name << "bench_parameter_" << i;
+            switch (i % 3) {
+            case 0: {
+                UserParameterLong v;
+                v.name = name.str();
+                v.value = (long)(i * 7919);
+                p.userParameterLong.push_back(v);
+                break;
+            }
+            case 1: {
+                UserParameterDouble v;
+                v.name = name.str();
+                v.value = i * 0.3183098861837907;
+                p.userParameterDouble.push_back(v);
+                break;
+            }
+            default: {
+                UserParameterString v;
+                v.name = name.str();
+                v.value = "ISMRMRD benchmark value";
+                p.userParameterString.push_back(v);
+                break;
+            }
+            }
+        }
+        std::stringstream s;
+        serialize(h, s);
+        xml_ = s.str();
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            IsmrmrdHeader h;
+            deserialize(xml_.data(), xml_.size(), h);
+        }
+    }
+
+private:
+    size_t parameters_;
+};
+
+/* Decoding only the encoding section, with and without the document kept for later */
+class XmlDeserializeEncoding : public XmlDeserializeLarge
+{
+public:
+    XmlDeserializeEncoding(const Options& opt, size_t parameters, bool lazy)
+        : XmlDeserializeLarge(opt, parameters)
+        , lazy_(lazy)
+    {
+        std::stringstream name;
+        name << (lazy ? "xml_lazy_header/" : "xml_deserialize_encoding/") << parameters;
+        name_ = name.str();
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (lazy_) {
+                LazyHeader h(xml_.data(), xml_.size());
+            } else {
+                IsmrmrdHeader h;
+                deserialize(xml_.data(), xml_.size(), h, HEADER_ENCODING);
+            }
+        }
+    }
+
+private:
+    bool lazy_;
+};
+
+/* Decoding the binary form of the same header */
+class XmlBinaryDeserialize : public XmlDeserializeLarge
+{
+public:
+    XmlBinaryDeserialize(const Options& opt, size_t parameters)
+        : XmlDeserializeLarge(opt, parameters)
+    {
+        std::stringstream name;
+        name << "xml_binary_deserialize/" << parameters;
+        name_ = name.str();
+    }
+
+    void setup()
+    {
+        XmlDeserializeLarge::setup();
+        IsmrmrdHeader h;
+        deserialize(xml_.data(), xml_.size(), h);
+        serialize_binary(h, bin_);
+    }
+
+    double bytes() const { return bin_.size(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            IsmrmrdHeader h;
+            deserialize_binary(bin_.data(), bin_.size(), h);
+        }
+    }
+
+private:
+    std::string bin_;
+};
+
+/* ---- Meta attribute cases ---- */
+
+void make_meta(MetaContainer& meta)
+{
+    for (int i = 0; i < 32; i++) {
+        std::stringstream name;
+        name << "parameter_" << i;
+        switch (i % 3) {
+        case 0:
+            meta.set(name.str().c_str(), (long)(i * 1000));
+            break;
+        case 1:
+            meta.set(name.str().c_str(), i * 0.125);
+            meta.append(name.str().c_str(), i * 0.25);
+            break;
+        default:
+            meta.set(name.str().c_str(), "ISMRMRD benchmark value");
+            break;
+        }
+    }
+}
+
+// Attributes as Gadgetron attaches them to every reconstructed image
+void make_gadgetron_meta(MetaContainer& meta, long image)
+{
+    meta.set("GADGETRON_DataRole", "Image");
+    meta.set("GADGETRON_ImageNumber", image);
+    meta.set("GADGETRON_ImageIndex", image);
+    meta.set("GADGETRON_ImageSeries", 1L);
+    meta.set("GADGETRON_ImageComment", "GT");
+    meta.append("GADGETRON_ImageComment", "SNR");
+    meta.set("GADGETRON_SeriesDescription", "GT");
+    meta.append("GADGETRON_SeriesDescription", "SNR");
+    meta.append("GADGETRON_SeriesDescription", "MAG");
+    meta.set("GADGETRON_ImageProcessingHistory", "GT");
+    meta.append("GADGETRON_ImageProcessingHistory", "FFT");
+    meta.append("GADGETRON_ImageProcessingHistory", "COMBINE");
+    meta.set("GADGETRON_WindowCenter", 1432.57);
+    meta.set("GADGETRON_WindowWidth", 2865.14);
+    meta.set("GADGETRON_ColorMap", "GadgetronPerfusion.pal");
+    meta.set("GADGETRON_ImageScaleRatio", 8.0);
+    meta.set("GADGETRON_SequenceDescription", "_GT_SNR_MAG");
+    meta.set("GADGETRON_USE_DEDICATED_DICOM_SERIES_NUMBER", 0L);
+    meta.set("GADGETRON_IMAGE_SCALE_OFFSET", 0.0);
+    meta.set("GADGETRON_IsRoot", 0L);
+    meta.set("GADGETRON_Phase", image % 30);
+    meta.set("GADGETRON_Slice", image / 30);
+    meta.set("GADGETRON_AcquisitionTime", 47531.2 + image);
+    meta.set("GADGETRON_TriggerTime", 33.25 * (image % 30));
+    const char* dirs[] = { "GADGETRON_read_dir", "GADGETRON_phase_dir", "GADGETRON_slice_dir", "GADGETRON_position" };
+    for (int i = 0; i < 4; i++) {
+        meta.set(dirs[i], 0.707107 * (i + 1));
+        meta.append(dirs[i], -0.0297516);
+        meta.append(dirs[i], 0.706439);
+    }
+}
+
+// Thousands of parameters, as in the attributes of a diffusion or cine series
+void make_large_meta(MetaContainer& meta)
+{
+    for (int i = 0; i < 4096; i++) {
+        std::stringstream name;
+        name << "entry_" << i;
+        switch (i % 4) {
+        case 0:
+            meta.set(name.str().c_str(), (long)i);
+            break;
+        case 1:
+            meta.set(name.str().c_str(), 0.001 * i);
+            break;
+        case 2:
+            meta.set(name.str().c_str(), "b1000");
+            break;
+        default:
+            meta.set(name.str().c_str(), (long)(i * 37));
+            meta.append(name.str().c_str(), -0.5 * i);
+            meta.append(name.str().c_str(), "MAG");
+            break;
+        }
+    }
+}
+
+class MetaSerialize : public Case
+{
+public:
+    MetaSerialize(const char* set = "generic", const char* format = "xml")
+        : Case(label("meta_serialize", set, format))
+        , binary_(strcmp(format, "binary") == 0)
+    {
+        if (strcmp(set, "gadgetron") == 0) {
+            make_gadgetron_meta(meta_, 1200);
+        } else if (strcmp(set, "large") == 0) {
+            make_large_meta(meta_);
+        } else {
+            make_meta(meta_);
+        }
+    }
+
+    // The generic XML cases keep their original names
+    static std::string label(const char* base, const char* set, const char* format)
+    {
+        if (strcmp(set, "generic") == 0 && strcmp(format, "xml") == 0) {
+            return base;
+        }
+        return std::string(base) + "/" + set + "/" + format;
+    }
+
+    void setup()
+    {
+        serialized_ = serialize_once();
+    }
+
+    double bytes() const { return serialized_.size(); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            serialize_once();
+        }
+    }
+
+protected:
+    std::string serialize_once()
+    {
+        if (binary_) {
+            std::string s;
+            serialize_binary(meta_, s);
+            return s;
+        }
+        std::stringstream s;
+        serialize(meta_, s);
+        return s.str();
+    }
+
+    bool binary_;
+    MetaContainer meta_;
+    std::string serialized_;
+};
+
+class MetaDeserialize : public MetaSerialize
+{
+public:
+    MetaDeserialize(const char* set = "generic", const char* format = "xml")
+        : MetaSerialize(set, format)
+    {
+        name_ = label("meta_deserialize", set, format);
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            MetaContainer m;
+            deserialize(serialized_.c_str(), m);
+        }
+    }
+};
+
+// Builds and reads back the attributes of one image per operation, the way
+// an image pipeline touches the same few dozen parameters over and over
+class MetaAccess : public Case
+{
+public:
+    MetaAccess() : Case("meta_access/gadgetron") { }
+
+    void setup()
+    {
+        MetaContainer meta;
+        make_gadgetron_meta(meta, 0);
+        std::string bin;
+        serialize_binary(meta, bin);
+        size_ = bin.size();
+    }
+
+    double bytes() const { return size_; }
+
+    void run(size_t n)
+    {
+        static const char* longs[] = { "GADGETRON_ImageNumber", "GADGETRON_ImageIndex", "GADGETRON_ImageSeries",
+                                       "GADGETRON_IsRoot", "GADGETRON_Phase", "GADGETRON_Slice" };
+        static const char* doubles[] = { "GADGETRON_WindowCenter", "GADGETRON_WindowWidth", "GADGETRON_TriggerTime",
+                                         "GADGETRON_read_dir", "GADGETRON_phase_dir", "GADGETRON_slice_dir" };
+        static const char* strings[] = { "GADGETRON_DataRole", "GADGETRON_ImageComment",
+                                         "GADGETRON_SeriesDescription", "GADGETRON_ImageProcessingHistory" };
+        long sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            MetaContainer meta;
+            make_gadgetron_meta(meta, static_cast<long>(i));
+            for (size_t j = 0; j < sizeof(longs) / sizeof(longs[0]); j++) {
+                sum += meta.as_long(longs[j]);
+            }
+            for (size_t j = 0; j < sizeof(doubles) / sizeof(doubles[0]); j++) {
+                for (size_t k = 0; k < meta.length(doubles[j]); k++) {
+                    sum += static_cast<long>(meta.as_double(doubles[j], k));
+                }
+            }
+            for (size_t j = 0; j < sizeof(strings) / sizeof(strings[0]); j++) {
+                sum += meta.as_str(strings[j], meta.length(strings[j]) - 1)[0];
+            }
+        }
+        sink_ = sum;
+    }
+
+private:
+    size_t size_;
+    volatile long sink_;
+};
+
+/* ---- Copy and consistency cases ---- */
+
+class AcquisitionCopy : public Case
+{
+public:
+    AcquisitionCopy(uint16_t samples, uint16_t channels)
+        : Case(AcquisitionAppend::label("acquisition_copy", samples, channels))
+    {
+        ismrmrd_init_acquisition(&src_);
+        ismrmrd_init_acquisition(&dst_);
+        src_.head.number_of_samples = samples;
+        src_.head.active_channels = channels;
+        ismrmrd_make_consistent_acquisition(&src_);
+        fill(src_.data, (size_t)samples*channels);
+    }
+
+    ~AcquisitionCopy()
+    {
+        ismrmrd_cleanup_acquisition(&src_);
+        ismrmrd_cleanup_acquisition(&dst_);
+    }
+
+    double bytes() const { return sizeof(AcquisitionHeader) + ismrmrd_size_of_acquisition_data(&src_); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            ismrmrd_copy_acquisition(&dst_, &src_);
+        }
+    }
+
+protected:
+    ISMRMRD_Acquisition src_;
+    ISMRMRD_Acquisition dst_;
+};
+
+class AcquisitionMakeConsistent : public AcquisitionCopy
+{
+public:
+    AcquisitionMakeConsistent(uint16_t samples, uint16_t channels)
+        : AcquisitionCopy(samples, channels)
+    {
+        name_ = AcquisitionAppend::label("acquisition_make_consistent", samples, channels);
+    }
+
+    double bytes() const { return 0; }
+
+    void run(size_t n)
+    {
+        // Alternate between two sizes so every call has to reallocate
+        uint16_t samples = src_.head.number_of_samples;
+        for (size_t i = 0; i < n; i++) {
+            src_.head.number_of_samples = (i & 1) ? samples : samples/2;
+            ismrmrd_make_consistent_acquisition(&src_);
+        }
+        src_.head.number_of_samples = samples;
+        ismrmrd_make_consistent_acquisition(&src_);
+    }
+};
+
+class ImageCopy : public Case
+{
+public:
+    ImageCopy(uint16_t nx, uint16_t ny, uint16_t channels)
+        : Case(ImageAppend<float>::label("image_copy", nx, ny, channels))
+    {
+        ismrmrd_init_image(&src_);
+        ismrmrd_init_image(&dst_);
+        src_.head.data_type = ISMRMRD_CXFLOAT;
+        src_.head.matrix_size[0] = nx;
+        src_.head.matrix_size[1] = ny;
+        src_.head.matrix_size[2] = 1;
+        src_.head.channels = channels;
+        ismrmrd_make_consistent_image(&src_);
+        memset(src_.data, 1, ismrmrd_size_of_image_data(&src_));
+    }
+
+    ~ImageCopy()
+    {
+        ismrmrd_cleanup_image(&src_);
+        ismrmrd_cleanup_image(&dst_);
+    }
+
+    double bytes() const { return sizeof(ImageHeader) + ismrmrd_size_of_image_data(&src_); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            ismrmrd_copy_image(&dst_, &src_);
+        }
+    }
+
+private:
+    ISMRMRD_Image src_;
+    ISMRMRD_Image dst_;
+};
+
+class NDArrayCopy : public Case
+{
+public:
+    NDArrayCopy(const std::vector<size_t>& dims)
+        : Case(NDArrayAppend::label("ndarray_copy", dims))
+    {
+        ismrmrd_init_ndarray(&src_);
+        ismrmrd_init_ndarray(&dst_);
+        src_.data_type = ISMRMRD_CXFLOAT;
+        src_.ndim = dims.size();
+        for (size_t i = 0; i < dims.size(); i++) {
+            src_.dims[i] = dims[i];
+        }
+        ismrmrd_make_consistent_ndarray(&src_);
+        memset(src_.data, 1, ismrmrd_size_of_ndarray_data(&src_));
+    }
+
+    ~NDArrayCopy()
+    {
+        ismrmrd_cleanup_ndarray(&src_);
+        ismrmrd_cleanup_ndarray(&dst_);
+    }
+
+    double bytes() const { return ismrmrd_size_of_ndarray_data(&src_); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            ismrmrd_copy_ndarray(&dst_, &src_);
+        }
+    }
+
+private:
+    ISMRMRD_NDArray src_;
+    ISMRMRD_NDArray dst_;
+};
+
+/* ---- Orientation cases ---- */
+
+// Quaternions and signs of the orientations of a set of acquisition headers,
+// one call per header or one batch call per operation
+class AcquisitionOrientations : public Case
+{
+public:
+    AcquisitionOrientations(size_t count, bool batch)
+        : Case(std::string("acquisition_orientations/") + (batch ? "batch" : "scalar"))
+        , batch_(batch)
+        , head_(count)
+        , quat_(4 * count)
+        , sign_(count)
+    {
+        srand(3);
+        for (size_t i = 0; i < count; i++) {
+            ismrmrd_init_acquisition_header(&head_[i]);
+            float q[4];
+            float norm = 0;
+            for (int k = 0; k < 4; k++) {
+                q[k] = rand() / (float)RAND_MAX - 0.5f;
+                norm += q[k] * q[k];
+            }
+            for (int k = 0; k < 4; k++) {
+                q[k] /= sqrtf(norm);
+            }
+            ismrmrd_quaternion_to_directions(q, head_[i].read_dir, head_[i].phase_dir, head_[i].slice_dir);
+        }
+    }
+
+    double bytes() const { return head_.size() * sizeof(AcquisitionHeader); }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (batch_) {
+                ismrmrd_acquisition_orientations(&head_[0], head_.size(), &quat_[0], &sign_[0], NULL);
+                continue;
+            }
+            for (size_t j = 0; j < head_.size(); j++) {
+                ISMRMRD_AcquisitionHeader& h = head_[j];
+                ismrmrd_directions_to_quaternion(h.read_dir, h.phase_dir, h.slice_dir, &quat_[4 * j]);
+                sign_[j] = ismrmrd_sign_of_directions(h.read_dir, h.phase_dir, h.slice_dir);
+            }
+        }
+    }
+
+private:
+    bool batch_;
+    std::vector<ISMRMRD_AcquisitionHeader> head_;
+    std::vector<float> quat_;
+    std::vector<int> sign_;
+};
+
+/* ---- Compression cases ---- */
+
+// Compresses, or decompresses, a set of acquisitions per operation: the
+// phantom, k-space of a Gaussian blob over unit noise, or those of the
+// --acquisitions dataset. threads is passed on, 0 for one per CPU.
+class AcquisitionCompress : public Case
+{
+public:
+    AcquisitionCompress(const Options& opt, const std::string& source, uint16_t mode, bool decompress,
+                        uint16_t threads)
+        : Case(std::string(decompress ? "decompress/" : "compress/")
+               + (mode == ISMRMRD_COMPRESSION_LOSSLESS ? "lossless/" : "near_lossless/") + source
+               + (threads == 1 ? "" : "/threads"))
+        , opt_(opt)
+        , source_(source)
+        , decompress_(decompress)
+        , data_bytes_(0)
+        , compressed_bytes_(0)
+    {
+        ismrmrd_init_compression_parameters(&params_);
+        params_.mode = mode;
+        params_.threads = threads;
+    }
+
+    double bytes() const { return data_bytes_; }
+    double ratio() const { return compressed_bytes_ > 0 ? data_bytes_ / compressed_bytes_ : 0; }
+
+    void setup()
+    {
+        if (source_ == "file") {
+            Dataset d(opt_.acquisitions_file.c_str(), "dataset", false);
+            acqs_.resize(d.getNumberOfAcquisitions());
+            if (!acqs_.empty()) {
+                d.readAcquisitions(0, acqs_.size(), &acqs_[0]);
+            }
+        } else {
+            make_phantom(64, 256, 8);
+        }
+        if (acqs_.empty()) {
+            throw std::runtime_error("No acquisitions to compress");
+        }
+
+        blocks_.resize(acqs_.size());
+        out_.resize(acqs_.size());
+        in_.resize(acqs_.size());
+        sizes_.resize(acqs_.size());
+        capacity_.resize(acqs_.size());
+        for (size_t i = 0; i < acqs_.size(); i++) {
+            capacity_[i] = ismrmrd_size_of_compressed_data_bound(c_acq(i));
+            blocks_[i].resize(capacity_[i]);
+            out_[i] = &blocks_[i][0];
+            in_[i] = &blocks_[i][0];
+            data_bytes_ += acqs_[i].getDataSize();
+        }
+        compress();
+        for (size_t i = 0; i < acqs_.size(); i++) {
+            compressed_bytes_ += sizes_[i];
+        }
+        copies_ = acqs_;
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (!decompress_) {
+                compress();
+            } else if (ismrmrd_decompress_acquisitions(&in_[0], &sizes_[0], static_cast<uint32_t>(acqs_.size()),
+                                                       reinterpret_cast<ISMRMRD_Acquisition*>(&copies_[0]),
+                                                       params_.threads) != ISMRMRD_NOERROR) {
+                throw std::runtime_error(build_exception_string());
+            }
+        }
+    }
+
+    void teardown()
+    {
+        acqs_.clear();
+        copies_.clear();
+        blocks_.clear();
+    }
+
+private:
+    ISMRMRD_Acquisition* c_acq(size_t i) { return reinterpret_cast<ISMRMRD_Acquisition*>(&acqs_[i]); }
+
+    void compress()
+    {
+        sizes_ = capacity_;
+        if (ismrmrd_compress_acquisitions(c_acq(0), static_cast<uint32_t>(acqs_.size()), &params_, &out_[0],
+                                          &sizes_[0]) != ISMRMRD_NOERROR) {
+            throw std::runtime_error(build_exception_string());
+        }
+    }
+
+    void make_phantom(uint16_t lines, uint16_t samples, uint16_t channels)
+    {
+        srand(5);
+        acqs_.resize(lines);
+        for (uint16_t k = 0; k < lines; k++) {
+            Acquisition& acq = acqs_[k];
+            acq.resize(samples, channels);
+            acq.idx().kspace_encode_step_1 = k;
+            float ky = (k - lines / 2) / 6.0f;
+            for (uint16_t c = 0; c < channels; c++) {
+                complex_float_t sensitivity = std::polar(1.0f + c / 4.0f, 0.7f * c);
+                for (uint16_t s = 0; s < samples; s++) {
+                    float kx = (s - samples / 2) / 12.0f;
+                    // Box-Muller, unit noise in each part
+                    float u1 = (rand() + 1.0f) / (RAND_MAX + 2.0f), u2 = rand() / (RAND_MAX + 1.0f);
+                    float r = sqrtf(-2 * logf(u1));
+                    complex_float_t noise(r * cosf(6.2831853f * u2), r * sinf(6.2831853f * u2));
+                    acq.data(s, c) = 2000.0f * expf(-(kx * kx + ky * ky) / 2) * sensitivity + noise;
+                }
+            }
+        }
+    }
+
+    const Options& opt_;
+    std::string source_;
+    bool decompress_;
+    CompressionParameters params_;
+    std::vector<Acquisition> acqs_;
+    std::vector<Acquisition> copies_;
+    std::vector<std::vector<char> > blocks_;
+    std::vector<void*> out_;
+    std::vector<const void*> in_;
+    std::vector<size_t> sizes_;
+    std::vector<size_t> capacity_;
+    double data_bytes_;
+    double compressed_bytes_;
+};
+
+/* ---- Coil compression and noise prewhitening cases ---- */
+
+// Compresses a batch of acquisitions from channels to virtual channels per
+// operation, or calibrates: the covariance of 24 calibration readouts and
+// the matrix. The compression copies the batch back in first, which is small
+// next to the product.
+class CoilCompress : public Case
+{
+public:
+    CoilCompress(uint16_t samples, uint16_t channels, uint16_t virtual_channels, size_t batch, bool calibrate)
+        : Case(label(calibrate ? "coil_calibrate" : "coil_compress", samples, channels, virtual_channels, batch))
+        , virtual_channels_(virtual_channels)
+        , calibrate_(calibrate)
+        , input_(calibrate ? 24 : batch, Acquisition(samples, channels))
+    {
+        for (size_t i = 0; i < input_.size(); i++) {
+            fill(input_[i].getDataPtr(), input_[i].getNumberOfDataElements());
+            // Different for every channel, so the covariance is not degenerate
+            for (uint16_t c = 0; c < channels; c++) {
+                input_[i].data(c % samples, c) += complex_float_t(static_cast<float>(i + c), 1.0f);
+            }
+            input_[i].setFlag(ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION);
+        }
+    }
+
+    static std::string label(const char* base, uint16_t samples, uint16_t channels, uint16_t virtual_channels,
+                             size_t batch)
+    {
+        std::stringstream s;
+        s << base << "/" << samples << "x" << channels << "/" << virtual_channels;
+        if (batch > 1) {
+            s << "/batch" << batch;
+        }
+        return s.str();
+    }
+
+    double bytes() const { return input_.size() * input_[0].getDataSize(); }
+
+    void setup()
+    {
+        for (size_t i = 0; i < input_.size(); i++) {
+            cc_.addCalibration(input_[i]);
+        }
+        cc_.computeMatrix(virtual_channels_);
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (calibrate_) {
+                cc_.reset();
+                for (size_t j = 0; j < input_.size(); j++) {
+                    cc_.addCalibration(input_[j]);
+                }
+                cc_.computeMatrix(virtual_channels_);
+            } else {
+                output_ = input_;
+                cc_.compress(output_);
+            }
+        }
+    }
+
+private:
+    uint16_t virtual_channels_;
+    bool calibrate_;
+    std::vector<Acquisition> input_;
+    std::vector<Acquisition> output_;
+    CoilCompressor cc_;
+};
+
+// Whitens a batch of acquisitions per operation, or accumulates the noise
+// covariance of a batch of noise readouts and computes the whitening matrix.
+// The whitening copies the batch back in first.
+class NoisePrewhiten : public Case
+{
+public:
+    NoisePrewhiten(uint16_t samples, uint16_t channels, size_t batch, bool covariance)
+        : Case(AcquisitionAppendBatch::label(covariance ? "noise_covariance" : "noise_whiten", samples, channels,
+                                             batch))
+        , covariance_(covariance)
+        , input_(batch, Acquisition(samples, channels))
+    {
+        // Uniform noise, mixed a little between neighbouring channels
+        srand(5);
+        for (size_t i = 0; i < input_.size(); i++) {
+            complex_float_t* data = input_[i].getDataPtr();
+            for (size_t k = 0; k < input_[i].getNumberOfDataElements(); k++) {
+                data[k] = complex_float_t(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f);
+                if (k >= samples) {
+                    data[k] += 0.3f * data[k - samples];
+                }
+            }
+            input_[i].setFlag(ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+        }
+    }
+
+    double bytes() const { return input_.size() * input_[0].getDataSize(); }
+
+    void setup()
+    {
+        for (size_t i = 0; i < input_.size(); i++) {
+            pw_.addNoise(input_[i]);
+        }
+        pw_.computeWhitening();
+    }
+
+    void run(size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (covariance_) {
+                pw_.reset();
+                for (size_t j = 0; j < input_.size(); j++) {
+                    pw_.addNoise(input_[j]);
+                }
+                pw_.computeWhitening();
+            } else {
+                output_ = input_;
+                pw_.whiten(output_);
+            }
+        }
+    }
+
+private:
+    bool covariance_;
+    std::vector<Acquisition> input_;
+    std::vector<Acquisition> output_;
+    NoisePrewhitener pw_;
+};
+
+/* ---- Runner ---- */
+
+Result measure(Case& c, const Options& opt)
+{
+    c.setup();
+
+    // Grow the batch until it takes at least min_time
+    size_t n = 1;
+    double t = 0;
+    for (;;) {
+        double t0 = now_seconds();
+        c.run(n);
+        t = now_seconds() - t0;
+        if (t >= opt.min_time || n >= (size_t(1) << 30)) {
+            break;
+        }
+        double scale = (t > 0) ? 1.5 * opt.min_time / t : 100.0;
+        if (scale < 2.0) scale = 2.0;
+        if (scale > 100.0) scale = 100.0;
+        n = static_cast<size_t>(n * scale);
+    }
+
+    c.teardown();
+
+    Result r;
+    r.name = c.name();
+    r.ops = n;
+    r.bytes = c.bytes() * n;
+    r.seconds = t;
+    r.ratio = c.ratio();
+    return r;
+}
+
+void write_results(const std::vector<Result>& results, const Options& opt, std::ostream& o)
+{
+    if (opt.format == "json") {
+        o << "[" << std::endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            o << "  {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+              << ", \"bytes\": " << r.bytes << ", \"seconds\": " << r.seconds
+              << ", \"ops_per_sec\": " << r.ops / r.seconds
+              << ", \"mb_per_sec\": " << r.bytes / r.seconds / 1e6;
+            if (r.ratio > 0) {
+                o << ", \"ratio\": " << r.ratio;
+            }
+            o << "}"
+              << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        o << "]" << std::endl;
+    } else {
+        o << "name,ops,bytes,seconds,ops_per_sec,mb_per_sec,ratio" << std::endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            o << r.name << "," << r.ops << "," << r.bytes << "," << r.seconds << ","
+              << r.ops / r.seconds << "," << r.bytes / r.seconds / 1e6 << ",";
+            if (r.ratio > 0) {
+                o << r.ratio;
+            }
+            o << std::endl;
+        }
+    }
+}
+
+void print_usage(const char* application)
+{
+    std::cout << "Usage: " << application << " [options]" << std::endl;
+    std::cout << "  --format csv|json   Output format (default csv)" << std::endl;
+    std::cout << "  --output FILE       Write results to FILE instead of stdout" << std::endl;
+    std::cout << "  --filter STRING     Only run cases whose name contains STRING" << std::endl;
+    std::cout << "  --min-time SECONDS  Minimum time per case (default 0.5)" << std::endl;
+    std::cout << "  --dir DIRECTORY     Directory for temporary files (default .)" << std::endl;
+    std::cout << "  --xml FILE          XML header used by the xml cases" << std::endl;
+    std::cout << "  --acquisitions FILE Dataset whose acquisitions the compression cases also run on" << std::endl;
+    std::cout << "  --list              List the cases and exit" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    bool list = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        bool has_value = (i + 1 < argc);
+        if (arg == "--format" && has_value) {
+            opt.format = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            opt.output = argv[++i];
+        } else if (arg == "--filter" && has_value) {
+            opt.filter = argv[++i];
+        } else if (arg == "--min-time" && has_value) {
+            opt.min_time = atof(argv[++i]);
+        } else if (arg == "--dir" && has_value) {
+            opt.dir = argv[++i];
+        } else if (arg == "--xml" && has_value) {
+            opt.xml_file = argv[++i];
+        } else if (arg == "--acquisitions" && has_value) {
+            opt.acquisitions_file = argv[++i];
+        } else if (arg == "--list") {
+            list = true;
+        } else {
+            print_usage(argv[0]);
+            return (arg == "--help" || arg == "-h") ? 0 : -1;
+        }
+    }
+
+    if (opt.format != "csv" && opt.format != "json") {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    std::vector<Case*> cases;
+
+    const uint16_t acq_sizes[][2] = { {128, 4}, {256, 8}, {512, 16}, {1024, 32} };
+    for (size_t i = 0; i < sizeof(acq_sizes)/sizeof(acq_sizes[0]); i++) {
+        cases.push_back(new AcquisitionAppend(opt, acq_sizes[i][0], acq_sizes[i][1]));
+        cases.push_back(new AcquisitionRead(opt, acq_sizes[i][0], acq_sizes[i][1]));
+    }
+    cases.push_back(new AcquisitionAppendBatch(opt, 256, 8, 64));
+    cases.push_back(new AcquisitionReadBatch(opt, 256, 8, 64));
+
+#ifdef ISMRMRD_BENCH_THREADS
+    cases.push_back(new AcquisitionReadThreads(opt, 1, 1));
+    cases.push_back(new AcquisitionReadThreads(opt, 4, 4));
+    cases.push_back(new AcquisitionReadThreads(opt, 4, 16));
+#endif
+
+#ifdef ISMRMRD_BENCH_STREAM
+    const char* transports[] = { "unix", "tcp" };
+    for (size_t i = 0; i < 2; i++) {
+        cases.push_back(new StreamAcquisitions(transports[i], 128, 4, 1));
+        cases.push_back(new StreamAcquisitions(transports[i], 256, 8, 1));
+        cases.push_back(new StreamAcquisitions(transports[i], 256, 8, 64));
+        cases.push_back(new StreamAcquisitions(transports[i], 1024, 32, 1));
+        cases.push_back(new AcquisitionPingPong(transports[i], 256, 8));
+    }
+    cases.push_back(new RingAcquisitions(128, 4, false));
+    cases.push_back(new RingAcquisitions(256, 8, false));
+    cases.push_back(new RingAcquisitions(256, 8, true));
+    cases.push_back(new RingAcquisitions(1024, 32, false));
+    cases.push_back(new RingAcquisitions(1024, 32, true));
+    cases.push_back(new AcquisitionPingPong("ring", 256, 8));
+#endif
+
+    cases.push_back(new ImageAppend<float>(opt, "image_float_append", 256, 256, 1));
+    cases.push_back(new ImageRead<float>(opt, "image_float_read", 256, 256, 1));
+    cases.push_back(new ImageAppend<complex_float_t>(opt, "image_cxfloat_append", 256, 256, 8));
+    cases.push_back(new ImageRead<complex_float_t>(opt, "image_cxfloat_read", 256, 256, 8));
+
+    std::vector<size_t> dims;
+    dims.push_back(256);
+    dims.push_back(256);
+    dims.push_back(8);
+    cases.push_back(new NDArrayAppend(opt, dims));
+    cases.push_back(new NDArrayRead(opt, dims));
+
+    cases.push_back(new HeaderRead(opt, "xml"));
+    cases.push_back(new HeaderRead(opt, "binary"));
+#ifdef ISMRMRD_HEADER_CACHE
+    cases.push_back(new HeaderRead(opt, "cached"));
+#endif
+
+    cases.push_back(new XmlDeserialize(opt));
+    cases.push_back(new XmlSerialize(opt));
+    cases.push_back(new XmlSerializeString(opt));
+    cases.push_back(new XmlRoundTrip(opt));
+    cases.push_back(new XmlDeserializeLarge(opt, 10000));
+    cases.push_back(new XmlDeserializeEncoding(opt, 10000, false));
+    cases.push_back(new XmlDeserializeEncoding(opt, 10000, true));
+    cases.push_back(new XmlBinaryDeserialize(opt, 0));
+    cases.push_back(new XmlBinaryDeserialize(opt, 10000));
+    cases.push_back(new MetaSerialize());
+    cases.push_back(new MetaDeserialize());
+    cases.push_back(new MetaSerialize("generic", "binary"));
+    cases.push_back(new MetaDeserialize("generic", "binary"));
+    cases.push_back(new MetaSerialize("gadgetron", "xml"));
+    cases.push_back(new MetaDeserialize("gadgetron", "xml"));
+    cases.push_back(new MetaSerialize("gadgetron", "binary"));
+    cases.push_back(new MetaDeserialize("gadgetron", "binary"));
+    cases.push_back(new MetaDeserialize("large", "xml"));
+    cases.push_back(new MetaDeserialize("large", "binary"));
+    cases.push_back(new MetaAccess());
+
+    cases.push_back(new AcquisitionCopy(1024, 32));
+    cases.push_back(new AcquisitionMakeConsistent(1024, 32));
+    cases.push_back(new ImageCopy(256, 256, 8));
+    cases.push_back(new NDArrayCopy(dims));
+
+    cases.push_back(new AcquisitionOrientations(4096, false));
+    cases.push_back(new AcquisitionOrientations(4096, true));
+
+    const uint16_t modes[] = { ISMRMRD_COMPRESSION_LOSSLESS, ISMRMRD_COMPRESSION_NEAR_LOSSLESS };
+    for (size_t i = 0; i < 2; i++) {
+        cases.push_back(new AcquisitionCompress(opt, "phantom", modes[i], false, 1));
+        cases.push_back(new AcquisitionCompress(opt, "phantom", modes[i], true, 1));
+        cases.push_back(new AcquisitionCompress(opt, "phantom", modes[i], false, 0));
+        if (!opt.acquisitions_file.empty()) {
+            cases.push_back(new AcquisitionCompress(opt, "file", modes[i], false, 1));
+            cases.push_back(new AcquisitionCompress(opt, "file", modes[i], true, 1));
+        }
+    }
+
+    cases.push_back(new CoilCompress(256, 32, 8, 64, false));
+    cases.push_back(new CoilCompress(256, 128, 16, 16, false));
+    cases.push_back(new CoilCompress(256, 32, 8, 1, true));
+    cases.push_back(new CoilCompress(256, 128, 16, 1, true));
+    cases.push_back(new NoisePrewhiten(256, 32, 64, false));
+    cases.push_back(new NoisePrewhiten(256, 128, 16, false));
+    cases.push_back(new NoisePrewhiten(256, 32, 64, true));
+    cases.push_back(new NoisePrewhiten(256, 128, 16, true));
+
+    std::vector<Result> results;
+    int status = 0;
+    for (size_t i = 0; i < cases.size(); i++) {
+        if (list) {
+            std::cout << cases[i]->name() << std::endl;
+        } else if (cases[i]->name().find(opt.filter) != std::string::npos) {
+            try {
+                results.push_back(measure(*cases[i], opt));
+            } catch (std::exception& e) {
+                std::cerr << cases[i]->name() << ": " << e.what() << std::endl;
+                status = -1;
+            }
+        }
+        delete cases[i];
+    }
+
+    if (!list) {
+        if (opt.output.empty()) {
+            write_results(results, opt, std::cout);
+        } else {
+            std::ofstream o(opt.output.c_str());
+            write_results(results, opt, o);
+        }
+    }
+
+    return status;
+}
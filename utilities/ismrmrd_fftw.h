@@ -7,6 +7,15 @@
 
 #include "fftw3.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
 namespace ISMRMRD {
 
 template<typename TI, typename TO> void circshift(TO *out, const TI *in, int xdim, int ydim, int xshift, int yshift)
@@ -76,4 +85,200 @@ int ifft2c(NDArray<complex_float_t> &a) {
     return fft2c(a,false);
 }
 
+/**
+ * Centered FFT along a single dimension of the array, e.g. the partition
+ * direction of a 3D volume.
+ */
+int fft1c(NDArray<complex_float_t> &a, size_t dim, bool forward)
+{
+    if (dim >= a.getNDim()) {
+        std::cout << "fft1c Error: dimension out of range" << std::endl;
+        return -1;
+    }
+
+    size_t n = a.getDims()[dim];
+    size_t inner = 1;
+    for (size_t d = 0; d < dim; d++) {
+        inner *= a.getDims()[d];
+    }
+    size_t outer = a.getNumberOfElements()/(inner*n);
+
+    fftwf_complex* tmp = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex)*n);
+    if (!tmp) {
+        std::cout << "Error allocating temporary storage for FFTW" << std::endl;
+        return -1;
+    }
+    fftwf_plan p = fftwf_plan_dft_1d(n, tmp, tmp, forward ? FFTW_FORWARD : FFTW_BACKWARD, FFTW_ESTIMATE);
+
+    std::complex<float>* t = reinterpret_cast<std::complex<float>*>(tmp);
+    float scale = 1.0f/std::sqrt(1.0f*n);
+    for (size_t o = 0; o < outer; o++) {
+        for (size_t i = 0; i < inner; i++) {
+            complex_float_t* col = a.getDataPtr() + o*n*inner + i;
+            for (size_t k = 0; k < n; k++) {
+                t[(k + n/2) % n] = col[k*inner];
+            }
+            fftwf_execute(p);
+            for (size_t k = 0; k < n; k++) {
+                col[((k + n/2) % n)*inner] = t[k]*scale;
+            }
+        }
+    }
+
+    fftwf_destroy_plan(p);
+    fftwf_free(tmp);
+    return 0;
+}
+
+/**
+ * Removes readout oversampling from acquisitions in place: a transform of
+ * the readouts of all channels to image space, a crop to the center of the
+ * field of view and a transform back, so only the reconstructed field of
+ * view is buffered. number_of_samples, center_sample, discard_pre/post and
+ * sample_time_us follow the shorter readout.
+ *
+ * The channels are transformed in one batched plan each way; the plans are
+ * made once per readout length and channel count and kept. The transforms
+ * are unitary, so the noise level of the samples is kept. Readouts have to
+ * be sampled evenly along a line, as Cartesian readouts are; a stored
+ * trajectory is resampled with the data, linearly along the readout.
+ */
+class OversamplingRemover {
+public:
+    /// Readouts of encoded_samples samples are reduced to recon_samples
+    OversamplingRemover(uint16_t encoded_samples, uint16_t recon_samples)
+        : encoded_(encoded_samples), recon_(recon_samples)
+    {
+        if (encoded_samples == 0 || recon_samples == 0 || recon_samples > encoded_samples) {
+            throw std::runtime_error("Oversampling removal needs 0 < recon samples <= encoded samples");
+        }
+    }
+
+    ~OversamplingRemover()
+    {
+        for (PlanMap::iterator it = plans_.begin(); it != plans_.end(); ++it) {
+            fftwf_destroy_plan(it->second.forward);
+            fftwf_destroy_plan(it->second.backward);
+            fftwf_free(it->second.in);
+            fftwf_free(it->second.out);
+        }
+    }
+
+    /// The number of samples a readout of samples samples is reduced to
+    uint16_t outputSamples(uint16_t samples) const
+    {
+        return static_cast<uint16_t>((static_cast<uint32_t>(samples) * recon_ + encoded_ / 2) / encoded_);
+    }
+
+    void remove(Acquisition &acq)
+    {
+        uint16_t n = acq.number_of_samples(), m = outputSamples(n), channels = acq.active_channels();
+        if (m == n || channels == 0) {
+            return;
+        }
+        Plans &plan = plans(n, m, channels);
+
+        // The center moves with the readout; where it does not land on a
+        // sample a phase ramp keeps the image in place
+        double c = acq.center_sample(), c_out = std::floor(c * m / n + 0.5);
+        const double pi = 3.14159265358979323846;
+        double ramp = -2 * pi * (c / n - c_out / m);
+        float scale = 1.0f / std::sqrt(static_cast<float>(n) * m);
+
+        memcpy(plan.in, acq.getDataPtr(), sizeof(fftwf_complex) * n * channels);
+        fftwf_execute(plan.forward);
+        const complex_float_t *in = reinterpret_cast<const complex_float_t *>(plan.in);
+        complex_float_t *out = reinterpret_cast<complex_float_t *>(plan.out);
+        // Image space is not shifted: pixels 0 to (m + 1) / 2 - 1 are at and
+        // right of the center, the rest wrap around from the left
+        uint16_t positive = (m + 1) / 2;
+        for (uint16_t ch = 0; ch < channels; ch++) {
+            const complex_float_t *x = in + static_cast<size_t>(ch) * n;
+            complex_float_t *y = out + static_cast<size_t>(ch) * m;
+            for (uint16_t i = 0; i < positive; i++) {
+                y[i] = scale * x[i];
+            }
+            for (uint16_t i = positive; i < m; i++) {
+                y[i] = scale * x[n - m + i];
+            }
+        }
+        if (ramp != 0) {
+            for (uint16_t i = 0; i < m; i++) {
+                int f = i < positive ? i : static_cast<int>(i) - m;
+                complex_float_t phase(static_cast<float>(std::cos(ramp * f)), static_cast<float>(std::sin(ramp * f)));
+                for (uint16_t ch = 0; ch < channels; ch++) {
+                    out[static_cast<size_t>(ch) * m + i] *= phase;
+                }
+            }
+        }
+        fftwf_execute(plan.backward);
+
+        uint16_t dims = acq.trajectory_dimensions();
+        std::vector<float> traj(acq.getTrajPtr(), acq.getTrajPtr() + static_cast<size_t>(dims) * n);
+        acq.resize(m, channels, dims);
+        memcpy(reinterpret_cast<float *>(acq.getDataPtr()), plan.out, sizeof(fftwf_complex) * m * channels);
+        // Sample j lies where sample c + (j - c_out) n / m of the readout did
+        for (uint16_t j = 0; j < m && dims > 0; j++) {
+            double t = c + (j - c_out) * n / m;
+            int i0 = std::min(std::max(static_cast<int>(std::floor(t)), 0), n - 2);
+            float f = static_cast<float>(t - i0);
+            const float *a = &traj[static_cast<size_t>(i0) * dims];
+            for (uint16_t d = 0; d < dims; d++) {
+                acq.traj(d, j) = a[d] + f * (a[dims + d] - a[d]);
+            }
+        }
+        acq.center_sample() = static_cast<uint16_t>(c_out);
+        acq.discard_pre() = static_cast<uint16_t>((static_cast<uint32_t>(acq.discard_pre()) * m + n - 1) / n);
+        acq.discard_post() = static_cast<uint16_t>((static_cast<uint32_t>(acq.discard_post()) * m + n - 1) / n);
+        acq.sample_time_us() *= static_cast<float>(n) / m;
+    }
+
+    void remove(std::vector<Acquisition> &acqs)
+    {
+        for (size_t i = 0; i < acqs.size(); i++) {
+            remove(acqs[i]);
+        }
+    }
+
+private:
+    // Image space is the backward transform of a readout, as in the 2D
+    // reconstruction, so the crop keeps the same pixels
+    struct Plans {
+        fftwf_complex *in;
+        fftwf_complex *out;
+        fftwf_plan forward;
+        fftwf_plan backward;
+    };
+    typedef std::map<std::pair<uint16_t, uint16_t>, Plans> PlanMap;
+
+    Plans &plans(uint16_t n, uint16_t m, uint16_t channels)
+    {
+        std::pair<uint16_t, uint16_t> key(n, channels);
+        PlanMap::iterator it = plans_.find(key);
+        if (it != plans_.end()) {
+            return it->second;
+        }
+        Plans p;
+        p.in = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * channels);
+        p.out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * m * channels);
+        if (!p.in || !p.out) {
+            fftwf_free(p.in);
+            fftwf_free(p.out);
+            throw std::runtime_error("Error allocating temporary storage for FFTW");
+        }
+        int ni = n, mi = m;
+        p.forward = fftwf_plan_many_dft(1, &ni, channels, p.in, NULL, 1, n, p.in, NULL, 1, n, FFTW_BACKWARD, FFTW_ESTIMATE);
+        p.backward = fftwf_plan_many_dft(1, &mi, channels, p.out, NULL, 1, m, p.out, NULL, 1, m, FFTW_FORWARD, FFTW_ESTIMATE);
+        return plans_.insert(std::make_pair(key, p)).first->second;
+    }
+
+    // Not copyable, the plans are owned
+    OversamplingRemover(const OversamplingRemover &);
+    OversamplingRemover &operator=(const OversamplingRemover &);
+
+    uint16_t encoded_;
+    uint16_t recon_;
+    PlanMap plans_;
+};
+
 };
@@ -0,0 +1,203 @@
+/*
+ * ismrmrd_hdf5_to_stream.cpp
+ *
+ * Replays the header and acquisitions of an ISMRMRD dataset as a stream, see
+ * ismrmrd/stream.h, either as fast as possible or in real time, paced by the
+ * acquisition time stamps. A reader thread loads batches of acquisitions from
+ * the file while the main thread sends the previous ones.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/stream.h"
+#include "ismrmrd_stream_utils.h"
+
+using namespace ISMRMRD;
+
+namespace {
+
+struct Options
+{
+    Options() : group("dataset"), batch(64), depth(4), repeat(1), realtime(false), tick_us(2500.0) { }
+
+    std::string file;
+    std::string output;
+    std::string group;
+    size_t batch;
+    size_t depth;
+    size_t repeat;
+    bool realtime;
+    double tick_us;
+};
+
+void print_usage(const char* application)
+{
+    std::cerr << "Usage: " << application << " [options] FILE OUTPUT" << std::endl;
+    std::cerr << "  OUTPUT is - for stdout, tcp:HOST:PORT, unix:PATH or a file name" << std::endl;
+    std::cerr << "  --group NAME      Dataset group in the file (default dataset)" << std::endl;
+    std::cerr << "  --batch N         Acquisitions per HDF5 read and stream write (default 64)" << std::endl;
+    std::cerr << "  --repeat N        Send the acquisitions N times (default 1)" << std::endl;
+    std::cerr << "  --realtime        Pace the acquisitions by acquisition_time_stamp" << std::endl;
+    std::cerr << "  --tick-us N       Microseconds per time stamp tick (default 2500)" << std::endl;
+}
+
+void read_acquisitions(Dataset* d, AcquisitionPipe* pipe, const Options* opt, std::string* error)
+{
+    try {
+        uint32_t total = d->getNumberOfAcquisitions();
+        for (size_t r = 0; r < opt->repeat; r++) {
+            for (uint32_t index = 0; index < total; ) {
+                AcquisitionPipe::Batch* b = pipe->fill();
+                if (b == NULL) {
+                    return;
+                }
+                b->count = std::min<size_t>(opt->batch, total - index);
+                d->readAcquisitions(index, b->count, &b->acqs[0]);
+                index += b->count;
+                pipe->push(b);
+            }
+        }
+        pipe->finish();
+    } catch (std::exception& e) {
+        *error = e.what();
+        pipe->cancel();
+    }
+}
+
+/**
+ * Keeps the acquisitions on the schedule of their time stamps. Stamps are
+ * compared as differences, so they may wrap around; a stamp that goes back,
+ * e.g. at the start of a repetition, is sent right away.
+ */
+class Pacer
+{
+public:
+    Pacer(double tick_us) : tick_(tick_us), started_(false), last_(0) { }
+
+    /// When acquisition acq is due
+    std::chrono::steady_clock::time_point due(Acquisition& acq)
+    {
+        uint32_t stamp = acq.acquisition_time_stamp();
+        if (!started_) {
+            started_ = true;
+            due_ = std::chrono::steady_clock::now();
+        } else {
+            int32_t ticks = static_cast<int32_t>(stamp - last_);
+            if (ticks > 0) {
+                due_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double, std::micro>(ticks * tick_));
+            }
+        }
+        last_ = stamp;
+        return due_;
+    }
+
+private:
+    double tick_;
+    bool started_;
+    uint32_t last_;
+    std::chrono::steady_clock::time_point due_;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        bool has_value = (i + 1 < argc);
+        if (arg == "--group" && has_value) {
+            opt.group = argv[++i];
+        } else if (arg == "--batch" && has_value) {
+            opt.batch = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--repeat" && has_value) {
+            opt.repeat = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--realtime") {
+            opt.realtime = true;
+        } else if (arg == "--tick-us" && has_value) {
+            opt.tick_us = atof(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-') {
+            print_usage(argv[0]);
+            return (arg == "--help") ? 0 : -1;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != 2) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    opt.file = args[0];
+    opt.output = args[1];
+
+    try {
+        Dataset d(opt.file.c_str(), opt.group.c_str(), false);
+        std::string xml;
+        d.readHeader(xml);
+
+        int fd = open_stream_output(opt.output);
+        StreamWriter writer(fd);
+        writer.writeHeader(xml);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        AcquisitionPipe pipe(opt.depth, opt.batch);
+        std::string error;
+        std::thread reader(read_acquisitions, &d, &pipe, &opt, &error);
+
+        size_t sent = 0;
+        Pacer pacer(opt.tick_us);
+        try {
+            AcquisitionPipe::Batch* b;
+            while ((b = pipe.pop()) != NULL) {
+                if (!opt.realtime) {
+                    writer.writeAcquisitions(&b->acqs[0], b->count);
+                } else {
+                    // Acquisitions that are already due go out together
+                    size_t first = 0;
+                    for (size_t i = 0; i < b->count; i++) {
+                        std::chrono::steady_clock::time_point due = pacer.due(b->acqs[i]);
+                        if (due > std::chrono::steady_clock::now()) {
+                            writer.writeAcquisitions(&b->acqs[first], i - first);
+                            first = i;
+                            std::this_thread::sleep_until(due);
+                        }
+                    }
+                    writer.writeAcquisitions(&b->acqs[first], b->count - first);
+                }
+                sent += b->count;
+                pipe.recycle(b);
+            }
+        } catch (...) {
+            pipe.cancel();
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+        writer.close();
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Sent " << sent << " acquisitions, " << writer.bytesWritten() / 1e6 << " MB in "
+                  << seconds << " s: " << sent / seconds << " acquisitions/s, "
+                  << writer.bytesWritten() / seconds / 1e6 << " MB/s" << std::endl;
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -6,26 +6,118 @@
  */
 
 #include "ismrmrd_phantom.h"
-#include <boost/random.hpp>
-#include <boost/random/normal_distribution.hpp>
+#include <algorithm>
 #include <cstring>
+#include <cmath>
 
 namespace ISMRMRD {
 
 
+namespace {
+
+// Narrow the pixel span [x0,x1] estimated from an analytic extent to exactly the
+// pixels accepted by the inside test (the estimate can be off by one at the edges).
+template <typename Inside>
+bool clip_span(double c_min, double c_max, int matrix_size, const Inside& inside, int& x0, int& x1)
+{
+    double h = matrix_size>>1;
+    double lo = std::ceil(c_min*h + h);
+    double hi = std::floor(c_max*h + h);
+    x0 = lo < 0 ? 0 : (lo > matrix_size-1 ? matrix_size-1 : static_cast<int>(lo));
+    x1 = hi < 0 ? 0 : (hi > matrix_size-1 ? matrix_size-1 : static_cast<int>(hi));
+    while (x0 > 0 && inside(x0-1)) x0--;
+    while (x0 <= x1 && !inside(x0)) x0++;
+    while (x1 < matrix_size-1 && inside(x1+1)) x1++;
+    while (x1 >= x0 && !inside(x1)) x1--;
+    return x0 <= x1;
+}
+
+struct InsideEllipse
+{
+    InsideEllipse(const PhantomEllipse& e, unsigned int matrix_size, float y_co)
+        : e_(e), h_(matrix_size>>1), y_co_(y_co) { }
+    bool operator()(int x) const { return e_.isInside((1.0*x-h_)/h_, y_co_); }
+    const PhantomEllipse& e_;
+    unsigned int h_;
+    float y_co_;
+};
+
+struct InsideEllipsoid
+{
+    InsideEllipsoid(const PhantomEllipsoid& e, unsigned int matrix_size, float y_co, float z_co)
+        : e_(e), h_(matrix_size>>1), y_co_(y_co), z_co_(z_co) { }
+    bool operator()(int x) const { return e_.isInside((1.0*x-h_)/h_, y_co_, z_co_); }
+    const PhantomEllipsoid& e_;
+    unsigned int h_;
+    float y_co_;
+    float z_co_;
+};
+
+}
+
 boost::shared_ptr<NDArray<complex_float_t> > phantom(std::vector<PhantomEllipse>& ellipses, unsigned int matrix_size)
 {
     std::vector<size_t> dims(2,matrix_size);
     boost::shared_ptr<NDArray<complex_float_t> > out(new NDArray<complex_float_t>(dims));
     memset(out->getDataPtr(), 0, out->getDataSize());
-    for (std::vector<PhantomEllipse>::iterator it = ellipses.begin(); it != ellipses.end(); it++) {
-        for (unsigned int y = 0; y < matrix_size; y++) {
-            float y_co = (1.0*y-(matrix_size>>1))/(matrix_size>>1);
-            for (unsigned int x = 0; x < matrix_size; x++) {
-                float x_co = (1.0*x-(matrix_size>>1))/(matrix_size>>1);
-                if (it->isInside(x_co,y_co)) {
-                    (*out)(x,y) += std::complex<float>(it->getAmplitude(),0.0);
-                }
+
+    complex_float_t* data = out->getDataPtr();
+    int rows = static_cast<int>(matrix_size);
+
+    // Rows are independent; within a row the ellipses are accumulated in table
+    // order so the result does not depend on the number of threads.
+#pragma omp parallel for schedule(dynamic, 4)
+    for (int y = 0; y < rows; y++) {
+        float y_co = (1.0*y-(matrix_size>>1))/(matrix_size>>1);
+        complex_float_t* row = data + static_cast<size_t>(y)*matrix_size;
+        for (size_t e = 0; e < ellipses.size(); e++) {
+            double c_min, c_max;
+            int x0, x1;
+            if (!ellipses[e].getExtent(y_co, c_min, c_max)) {
+                continue;
+            }
+            if (!clip_span(c_min, c_max, rows, InsideEllipse(ellipses[e], matrix_size, y_co), x0, x1)) {
+                continue;
+            }
+            float A = ellipses[e].getAmplitude();
+            for (int x = x0; x <= x1; x++) {
+                row[x] += std::complex<float>(A,0.0);
+            }
+        }
+    }
+    return out;
+}
+
+boost::shared_ptr<NDArray<complex_float_t> > phantom(std::vector<PhantomEllipsoid>& ellipsoids, unsigned int matrix_size, unsigned int slices)
+{
+    std::vector<size_t> dims(2,matrix_size);
+    dims.push_back(slices);
+    boost::shared_ptr<NDArray<complex_float_t> > out(new NDArray<complex_float_t>(dims));
+    memset(out->getDataPtr(), 0, out->getDataSize());
+
+    complex_float_t* data = out->getDataPtr();
+    int rows = static_cast<int>(matrix_size*slices);
+
+#pragma omp parallel for schedule(dynamic, 4)
+    for (int r = 0; r < rows; r++) {
+        unsigned int y = r % matrix_size;
+        unsigned int z = r / matrix_size;
+        float y_co = (1.0*y-(matrix_size>>1))/(matrix_size>>1);
+        float z_co = slices > 1 ? (1.0*z-(slices>>1))/(slices>>1) : 0.0f;
+        complex_float_t* row = data + static_cast<size_t>(r)*matrix_size;
+        for (size_t e = 0; e < ellipsoids.size(); e++) {
+            double c_min, c_max;
+            int x0, x1;
+            if (!ellipsoids[e].getExtent(y_co, z_co, c_min, c_max)) {
+                continue;
+            }
+            if (!clip_span(c_min, c_max, static_cast<int>(matrix_size),
+                           InsideEllipsoid(ellipsoids[e], matrix_size, y_co, z_co), x0, x1)) {
+                continue;
+            }
+            float A = ellipsoids[e].getAmplitude();
+            for (int x = x0; x <= x1; x++) {
+                row[x] += std::complex<float>(A,0.0);
             }
         }
     }
@@ -39,6 +131,12 @@ boost::shared_ptr<NDArray<complex_float_t> > shepp_logan_phantom(unsigned int ma
     return phantom(*e, matrix_size);
 }
 
+boost::shared_ptr<NDArray<complex_float_t> > shepp_logan_phantom(unsigned int matrix_size, unsigned int slices)
+{
+    boost::shared_ptr< std::vector<PhantomEllipsoid> > e = modified_shepp_logan_ellipsoids();
+    return phantom(*e, matrix_size, slices);
+}
+
 
 boost::shared_ptr< std::vector<PhantomEllipse> > shepp_logan_ellipses()
 {
@@ -73,6 +171,23 @@ boost::shared_ptr< std::vector<PhantomEllipse> > modified_shepp_logan_ellipses()
     return out;
 }
 
+boost::shared_ptr< std::vector<PhantomEllipsoid> > modified_shepp_logan_ellipsoids()
+{
+    // 3D extension of the modified Shepp-Logan phantom (Kak & Slaney)
+    boost::shared_ptr< std::vector<PhantomEllipsoid> > out(new std::vector<PhantomEllipsoid>);
+    out->push_back(PhantomEllipsoid(  1,   .6900, .920, .810,    0,      0,     0,     0,  0,  0));
+    out->push_back(PhantomEllipsoid(-.8,   .6624, .874, .780,    0,  -.0184,    0,     0,  0,  0));
+    out->push_back(PhantomEllipsoid(-.2,   .1100, .310, .220,  .22,      0,     0,   -18,  0, 10));
+    out->push_back(PhantomEllipsoid(-.2,   .1600, .410, .280, -.22,      0,     0,    18,  0, 10));
+    out->push_back(PhantomEllipsoid( .1,   .2100, .250, .410,    0,    .35,  -.15,     0,  0,  0));
+    out->push_back(PhantomEllipsoid( .1,   .0460, .046, .050,    0,     .1,   .25,     0,  0,  0));
+    out->push_back(PhantomEllipsoid( .1,   .0460, .046, .050,    0,    -.1,   .25,     0,  0,  0));
+    out->push_back(PhantomEllipsoid( .1,   .0460, .023, .050, -.08,  -.605,     0,     0,  0,  0));
+    out->push_back(PhantomEllipsoid( .1,   .0230, .023, .020,    0,  -.606,     0,     0,  0,  0));
+    out->push_back(PhantomEllipsoid( .1,   .0230, .046, .020,  .06,  -.605,     0,     0,  0,  0));
+    return out;
+}
+
 boost::shared_ptr<NDArray<complex_float_t> > generate_birdcage_sensititivies(unsigned int matrix_size, unsigned int ncoils, float relative_radius)
 {
     //This function is heavily inspired by the mri_birdcage.m Matlab script in Jeff Fessler's IRT packake
@@ -83,18 +198,23 @@ boost::shared_ptr<NDArray<complex_float_t> > generate_birdcage_sensititivies(uns
     boost::shared_ptr<NDArray<complex_float_t> > out(new NDArray<complex_float_t>(dims));
     memset(out->getDataPtr(), 0, out->getDataSize());
 
-    for (unsigned int c = 0; c < ncoils; c++) {
+    complex_float_t* data = out->getDataPtr();
+    int rows = static_cast<int>(matrix_size*ncoils);
+
+#pragma omp parallel for
+    for (int r = 0; r < rows; r++) {
+        unsigned int y = r % matrix_size;
+        unsigned int c = r / matrix_size;
         float coilx = relative_radius*std::cos(c*(2*3.14159265359/ncoils));
         float coily = relative_radius*std::sin(c*(2*3.14159265359/ncoils));
         float coil_phase = -c*(2*3.14159265359/ncoils);
-        for (unsigned int y = 0; y < matrix_size; y++) {
-            float y_co = (1.0*y-(matrix_size>>1))/(matrix_size>>1)-coily;
-            for (unsigned int x = 0; x < matrix_size; x++) {
-                float x_co = (1.0*x-(matrix_size>>1))/(matrix_size>>1)-coilx;
-                float rr = std::sqrt(x_co*x_co+y_co*y_co);
-                float phi = atan2(x_co, -y_co) + coil_phase;
-                (*out)(x,y,c) = std::polar(1 / rr, phi);
-            }
+        float y_co = (1.0*y-(matrix_size>>1))/(matrix_size>>1)-coily;
+        complex_float_t* row = data + static_cast<size_t>(r)*matrix_size;
+        for (unsigned int x = 0; x < matrix_size; x++) {
+            float x_co = (1.0*x-(matrix_size>>1))/(matrix_size>>1)-coilx;
+            float rr = std::sqrt(x_co*x_co+y_co*y_co);
+            float phi = atan2(x_co, -y_co) + coil_phase;
+            row[x] = std::polar(1 / rr, phi);
         }
     }
 
@@ -102,21 +222,120 @@ boost::shared_ptr<NDArray<complex_float_t> > generate_birdcage_sensititivies(uns
 }
 
 
-boost::mt19937& get_noise_seed()
+namespace {
+
+uint64_t noise_seed = 0;
+
+// Philox4x32-10 counter based generator (Salmon et al., SC'11). Every block of
+// four 32-bit outputs is a pure function of (key, counter), so noise can be
+// generated in any order and on any number of threads with identical results.
+inline uint32_t mulhilo32(uint32_t a, uint32_t b, uint32_t& hi)
+{
+    uint64_t p = static_cast<uint64_t>(a)*b;
+    hi = static_cast<uint32_t>(p >> 32);
+    return static_cast<uint32_t>(p);
+}
+
+inline void philox4x32_10(const uint32_t key[2], const uint32_t ctr[4], uint32_t out[4])
+{
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < 10; r++) {
+        uint32_t hi0, hi1;
+        uint32_t lo0 = mulhilo32(0xD2511F53, c0, hi0);
+        uint32_t lo1 = mulhilo32(0xCD9E8D57, c2, hi1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// Stream domains, so arrays, acquisitions and noise scans never share a stream.
+// The domain is the top byte of the upper block counter word, the key is the
+// seed alone, so no other seed or domain reaches the same counters.
+enum {
+    NOISE_DOMAIN_NDARRAY = 1,
+    NOISE_DOMAIN_ACQUISITION = 2,
+    NOISE_DOMAIN_NOISE_SCAN = 3
+};
+
+/**
+ * Add complex Gaussian noise with standard deviation sd (per real and imaginary part)
+ * to n samples. Sample j is drawn from counter block first_block + j/2 of the stream
+ * (stream[0], stream[1]) in domain; each block yields two complex samples via Box-Muller.
+ * Block counters are below 2^56, the byte above them holds the domain.
+ *
+ * The counters are generated into small arrays first and the transform is applied
+ * as straight-line loops over them, which the compiler can vectorize.
+ */
+void add_normal(const uint32_t key[2], uint32_t domain, uint64_t first_block, uint32_t stream0, uint32_t stream1,
+                float sd, complex_float_t* out, size_t n)
+{
+    const size_t BATCH = 32; // blocks per batch
+    const float two_pi = 6.2831853071795865f;
+    float u[4*BATCH];
+    float z[4*BATCH];
+
+    size_t nblocks = (n+1)/2;
+    for (size_t b0 = 0; b0 < nblocks; b0 += BATCH) {
+        size_t nb = std::min(BATCH, nblocks-b0);
+        for (size_t b = 0; b < nb; b++) {
+            uint64_t block = first_block + b0 + b;
+            uint32_t ctr[4] = {static_cast<uint32_t>(block), static_cast<uint32_t>(block >> 32) | (domain << 24),
+                               stream0, stream1};
+            uint32_t bits[4];
+            philox4x32_10(key, ctr, bits);
+            // 24 bit uniforms in (0,1), never 0 so the logarithm is finite
+            for (int k = 0; k < 4; k++) {
+                u[4*b+k] = ((bits[k] >> 8) + 0.5f)*(1.0f/16777216.0f);
+            }
+        }
+        for (size_t i = 0; i < 2*nb; i++) {
+            float r = sd*std::sqrt(-2.0f*std::log(u[2*i]));
+            float t = two_pi*u[2*i+1];
+            z[2*i] = r*std::cos(t);
+            z[2*i+1] = r*std::sin(t);
+        }
+        size_t first = 2*b0;
+        size_t count = std::min(2*nb, n-first);
+        for (size_t i = 0; i < count; i++) {
+            out[first+i] += complex_float_t(z[2*i], z[2*i+1]);
+        }
+    }
+}
+
+void make_key(uint32_t key[2])
+{
+    key[0] = static_cast<uint32_t>(noise_seed);
+    key[1] = static_cast<uint32_t>(noise_seed >> 32);
+}
+
+}
+
+void set_noise_seed(uint64_t seed)
 {
-    static boost::mt19937 rng;
-    return rng;
+    noise_seed = seed;
 }
 
-int add_noise(NDArray<complex_float_t> & a, float sd)
+int add_noise(NDArray<complex_float_t> & a, float sd, uint64_t stream)
 {
+    const size_t CHUNK = 4096; // complex samples per parallel work item, must be even
+    uint32_t key[2];
+    make_key(key);
 
-    boost::normal_distribution<float> nd(0.0, sd);
-    boost::variate_generator<boost::mt19937&,
-                             boost::normal_distribution<float> > var_nor(get_noise_seed(), nd);
+    complex_float_t* data = a.getDataPtr();
+    size_t n = a.getNumberOfElements();
+    long chunks = static_cast<long>((n+CHUNK-1)/CHUNK);
 
-    for (size_t i = 0; i < a.getNumberOfElements(); i++) {
-        a.getDataPtr()[i] += std::complex<float>(var_nor(),var_nor());
+#pragma omp parallel for
+    for (long c = 0; c < chunks; c++) {
+        size_t first = static_cast<size_t>(c)*CHUNK;
+        add_normal(key, NOISE_DOMAIN_NDARRAY, first/2, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32),
+                   sd, data+first, std::min(CHUNK, n-first));
     }
 
     return 0;
@@ -124,15 +343,25 @@ int add_noise(NDArray<complex_float_t> & a, float sd)
 
 int add_noise(Acquisition& a, float sd)
 {
+    // The stream is identified by where the readout sits in the encoding, so the
+    // noise of a line does not depend on which other lines were generated or in
+    // which order.
+    uint32_t key[2];
+    make_key(key);
+    uint32_t domain = a.isFlagSet(ISMRMRD_ACQ_IS_NOISE_MEASUREMENT) ? NOISE_DOMAIN_NOISE_SCAN : NOISE_DOMAIN_ACQUISITION;
 
-    boost::normal_distribution<float> nd(0.0, sd);
-    boost::variate_generator<boost::mt19937&,
-                             boost::normal_distribution<float> > var_nor(get_noise_seed(), nd);
+    const EncodingCounters& idx = a.idx();
+    uint32_t line = idx.kspace_encode_step_1 | (static_cast<uint32_t>(idx.kspace_encode_step_2) << 16);
+    uint32_t rep = idx.repetition | (static_cast<uint32_t>(idx.slice) << 16);
 
-    for (uint16_t c=0; c<a.active_channels(); c++) {
-        for (uint16_t s=0; s<a.number_of_samples(); s++) {
-            a.data(s,c) += std::complex<float>(var_nor(), var_nor());
-        }
+    int channels = a.active_channels();
+    size_t samples = a.number_of_samples();
+    complex_float_t* data = a.getDataPtr();
+
+#pragma omp parallel for if (channels*samples > 8192)
+    for (int c = 0; c < channels; c++) {
+        // channel goes in the upper half of the block counter
+        add_normal(key, domain, static_cast<uint64_t>(c) << 32, line, rep, sd, data + c*samples, samples);
     }
 
     return 0;
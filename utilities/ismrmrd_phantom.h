@@ -8,6 +8,7 @@
 #include <boost/shared_ptr.hpp>
 #include <vector>
 #include <complex>
+#include <cmath>
 #include "ismrmrd/ismrmrd.h"
 
 #ifndef ISMRMRD_PHANTOM_H_
@@ -15,6 +16,14 @@
 
 namespace ISMRMRD {
 
+	/**
+	 * Ellipse with amplitude A, semi-axes a and b, centre (x0,y0) and rotation phi (degrees).
+	 *
+	 * The rotation and axis lengths are folded into the symmetric quadratic form
+	 * q00*dx^2 + 2*q01*dx*dy + q11*dy^2 <= 1 once at construction, so the inside
+	 * test is a handful of multiply-adds and a row of the image can be rasterized
+	 * by solving for its x-extent instead of testing every pixel.
+	 */
 	class PhantomEllipse
 	{
 	public:
@@ -26,22 +35,43 @@ namespace ISMRMRD {
 			, y0_(y0)
 			, phi_(phi)
 		{
+			double p = phi_*3.14159265359/180; // rotation angle in radians
+			double cosp = std::cos(p);
+			double sinp = std::sin(p);
+			double ia = 1.0/(a_*a_);
+			double ib = 1.0/(b_*b_);
+			q00_ = cosp*cosp*ia + sinp*sinp*ib;
+			q01_ = cosp*sinp*(ia - ib);
+			q11_ = sinp*sinp*ia + cosp*cosp*ib;
+		}
 
+		bool isInside(float x, float y) const
+		{
+			double dx = x-x0_;
+			double dy = y-y0_;
+			return (q00_*dx*dx + 2*q01_*dx*dy + q11_*dy*dy <= 1);
 		}
 
-		bool isInside(float x, float y)
+		/**
+		 * Range [x_min, x_max] of coordinates inside the ellipse on the line y.
+		 * Returns false if the line does not intersect the ellipse.
+		 */
+		bool getExtent(float y, double& x_min, double& x_max) const
 		{
-			float asq = a_*a_;                // a^2
-			float bsq = b_*b_;                // b^2
-			float phi = phi_*3.14159265359/180; // rotation angle in radians
-			float x0  = x-x0_; 					  // x offset
-			float y0 =  y-y0_;                     // y offset
-			float cosp = cos(phi);
-			float sinp = sin(phi);
-			return (((x0*cosp + y0*sinp)*(x0*cosp + y0*sinp))/asq + ((y0*cosp - x0*sinp)*(y0*cosp - x0*sinp))/bsq <= 1);
+			double dy = y-y0_;
+			double b = q01_*dy;
+			double c = q11_*dy*dy - 1;
+			double disc = b*b - q00_*c;
+			if (disc < 0) {
+				return false;
+			}
+			double r = std::sqrt(disc);
+			x_min = x0_ + (-b - r)/q00_;
+			x_max = x0_ + (-b + r)/q00_;
+			return true;
 		}
 
-		float getAmplitude()
+		float getAmplitude() const
 		{
 			return A_;
 		}
@@ -55,14 +85,109 @@ namespace ISMRMRD {
 		float x0_;
 		float y0_;
 		float phi_;
+
+		double q00_;
+		double q01_;
+		double q11_;
+	};
+
+	/**
+	 * Ellipsoid with amplitude A, semi-axes a, b and c, centre (x0,y0,z0) and
+	 * Euler angles phi, theta and psi (degrees, same convention as the ellipse).
+	 */
+	class PhantomEllipsoid
+	{
+	public:
+		PhantomEllipsoid(float A, float a, float b, float c, float x0, float y0, float z0,
+				 float phi, float theta = 0, float psi = 0)
+			: A_(A)
+			, x0_(x0)
+			, y0_(y0)
+			, z0_(z0)
+		{
+			double deg = 3.14159265359/180;
+			double cphi = std::cos(phi*deg), sphi = std::sin(phi*deg);
+			double ctheta = std::cos(theta*deg), stheta = std::sin(theta*deg);
+			double cpsi = std::cos(psi*deg), spsi = std::sin(psi*deg);
+
+			// Rotation from phantom coordinates into the ellipsoid frame
+			double R[3][3] = {
+				{ cpsi*cphi - ctheta*sphi*spsi,  cpsi*sphi + ctheta*cphi*spsi, spsi*stheta},
+				{-spsi*cphi - ctheta*sphi*cpsi, -spsi*sphi + ctheta*cphi*cpsi, cpsi*stheta},
+				{ stheta*sphi,                  -stheta*cphi,                  ctheta}
+			};
+			double inv[3] = {1.0/(a*a), 1.0/(b*b), 1.0/(c*c)};
+
+			// Q = R^T diag(inv) R
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) {
+					q_[i][j] = 0;
+					for (int k = 0; k < 3; k++) {
+						q_[i][j] += R[k][i]*inv[k]*R[k][j];
+					}
+				}
+			}
+		}
+
+		bool isInside(float x, float y, float z) const
+		{
+			double dx = x-x0_;
+			double dy = y-y0_;
+			double dz = z-z0_;
+			return (q_[0][0]*dx*dx + q_[1][1]*dy*dy + q_[2][2]*dz*dz +
+				2*(q_[0][1]*dx*dy + q_[0][2]*dx*dz + q_[1][2]*dy*dz) <= 1);
+		}
+
+		/**
+		 * Range [x_min, x_max] of coordinates inside the ellipsoid on the line (y,z).
+		 * Returns false if the line does not intersect the ellipsoid.
+		 */
+		bool getExtent(float y, float z, double& x_min, double& x_max) const
+		{
+			double dy = y-y0_;
+			double dz = z-z0_;
+			double b = q_[0][1]*dy + q_[0][2]*dz;
+			double c = q_[1][1]*dy*dy + q_[2][2]*dz*dz + 2*q_[1][2]*dy*dz - 1;
+			double disc = b*b - q_[0][0]*c;
+			if (disc < 0) {
+				return false;
+			}
+			double r = std::sqrt(disc);
+			x_min = x0_ + (-b - r)/q_[0][0];
+			x_max = x0_ + (-b + r)/q_[0][0];
+			return true;
+		}
+
+		float getAmplitude() const
+		{
+			return A_;
+		}
+
+	protected:
+		float A_;
+		float x0_;
+		float y0_;
+		float z0_;
+		double q_[3][3];
 	};
 
 	boost::shared_ptr< std::vector<PhantomEllipse> > shepp_logan_ellipses();
         boost::shared_ptr< std::vector<PhantomEllipse> > modified_shepp_logan_ellipses();
+        boost::shared_ptr< std::vector<PhantomEllipsoid> > modified_shepp_logan_ellipsoids();
         boost::shared_ptr<NDArray<complex_float_t> > phantom(std::vector<PhantomEllipse>& coefficients, unsigned int matrix_size);
+        boost::shared_ptr<NDArray<complex_float_t> > phantom(std::vector<PhantomEllipsoid>& coefficients, unsigned int matrix_size, unsigned int slices);
         boost::shared_ptr<NDArray<complex_float_t> > shepp_logan_phantom(unsigned int matrix_size);
+        boost::shared_ptr<NDArray<complex_float_t> > shepp_logan_phantom(unsigned int matrix_size, unsigned int slices);
         boost::shared_ptr<NDArray<complex_float_t> > generate_birdcage_sensititivies(unsigned int matrix_size, unsigned int ncoils, float relative_radius);
-	int add_noise(NDArray<complex_float_t> & a, float sd);
+
+	/**
+	 * Noise is drawn from a counter based generator (Philox4x32-10) keyed by the seed,
+	 * so it is reproducible bit for bit regardless of thread count or generation order.
+	 */
+	void set_noise_seed(uint64_t seed);
+	/// Sample i of the array gets the same noise for a given seed and stream
+	int add_noise(NDArray<complex_float_t> & a, float sd, uint64_t stream = 0);
+	/// Noise is determined by (repetition, slice, kspace_encode_step_1/2, channel) and the noise measurement flag
 	int add_noise(Acquisition & a, float sd);
 
 };
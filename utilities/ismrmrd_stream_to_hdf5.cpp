@@ -0,0 +1,158 @@
+/*
+ * ismrmrd_stream_to_hdf5.cpp
+ *
+ * Captures a stream, see ismrmrd/stream.h, into an ISMRMRD dataset. The main
+ * thread receives the messages into batches of acquisitions while a writer
+ * thread appends the previous batches to the file.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/stream.h"
+#include "ismrmrd_stream_utils.h"
+
+using namespace ISMRMRD;
+
+namespace {
+
+struct Options
+{
+    Options() : group("dataset"), batch(64), depth(4) { }
+
+    std::string input;
+    std::string file;
+    std::string group;
+    size_t batch;
+    size_t depth;
+};
+
+void print_usage(const char* application)
+{
+    std::cerr << "Usage: " << application << " [options] INPUT FILE" << std::endl;
+    std::cerr << "  INPUT is - for stdin, tcp:HOST:PORT or unix:PATH to listen on, or a file name" << std::endl;
+    std::cerr << "  --group NAME      Dataset group in the file (default dataset)" << std::endl;
+    std::cerr << "  --batch N         Acquisitions per HDF5 append (default 64)" << std::endl;
+}
+
+void append_acquisitions(Dataset* d, AcquisitionPipe* pipe, std::string* error)
+{
+    try {
+        AcquisitionPipe::Batch* b;
+        while ((b = pipe->pop()) != NULL) {
+            if (!b->header.empty()) {
+                d->writeHeader(b->header);
+            }
+            d->appendAcquisitions(&b->acqs[0], b->count);
+            pipe->recycle(b);
+        }
+    } catch (std::exception& e) {
+        *error = e.what();
+        pipe->cancel();
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        bool has_value = (i + 1 < argc);
+        if (arg == "--group" && has_value) {
+            opt.group = argv[++i];
+        } else if (arg == "--batch" && has_value) {
+            opt.batch = std::max(1, atoi(argv[++i]));
+        } else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-') {
+            print_usage(argv[0]);
+            return (arg == "--help") ? 0 : -1;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != 2) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    opt.input = args[0];
+    opt.file = args[1];
+
+    try {
+        Dataset d(opt.file.c_str(), opt.group.c_str(), true);
+        int fd = open_stream_input(opt.input);
+        StreamReader reader(fd);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        AcquisitionPipe pipe(opt.depth, opt.batch);
+        std::string error;
+        std::thread writer(append_acquisitions, &d, &pipe, &error);
+
+        size_t received = 0, skipped = 0;
+        try {
+            AcquisitionPipe::Batch* b = NULL;
+            uint16_t id;
+            while ((id = reader.nextMessage()) != STREAM_CLOSE) {
+                if (id != STREAM_HEADER && id != STREAM_ACQUISITION) {
+                    skipped++;
+                    continue;
+                }
+                if (b == NULL && (b = pipe.fill()) == NULL) {
+                    break;
+                }
+                if (id == STREAM_HEADER) {
+                    // The header goes ahead of the acquisitions of its batch
+                    if (b->count > 0) {
+                        pipe.push(b);
+                        if ((b = pipe.fill()) == NULL) {
+                            break;
+                        }
+                    }
+                    reader.readHeader(b->header);
+                    continue;
+                }
+                reader.readAcquisition(b->acqs[b->count++]);
+                received++;
+                if (b->count == b->acqs.size()) {
+                    pipe.push(b);
+                    b = NULL;
+                }
+            }
+            if (b != NULL) {
+                pipe.push(b);
+            }
+            pipe.finish();
+        } catch (...) {
+            pipe.cancel();
+            writer.join();
+            throw;
+        }
+        writer.join();
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Received " << received << " acquisitions, " << reader.bytesRead() / 1e6 << " MB in "
+                  << seconds << " s: " << received / seconds << " acquisitions/s, "
+                  << reader.bytesRead() / seconds / 1e6 << " MB/s" << std::endl;
+        if (skipped > 0) {
+            std::cerr << "Skipped " << skipped << " messages other than the header and acquisitions" << std::endl;
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * ismrmrd_stream_utils.h
+ *
+ * Helpers shared by ismrmrd_hdf5_to_stream and ismrmrd_stream_to_hdf5:
+ * opening the stream endpoint and handing batches of acquisitions between
+ * the HDF5 and the stream thread.
+ */
+
+#ifndef ISMRMRD_STREAM_UTILS_H
+#define ISMRMRD_STREAM_UTILS_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ismrmrd/ismrmrd.h"
+
+namespace ISMRMRD {
+
+/*
+ * A stream endpoint is one of
+ *
+ *   -                standard input or output
+ *   tcp:HOST:PORT    a TCP connection
+ *   unix:PATH        a Unix domain socket
+ *   anything else    a file
+ *
+ * The sending side connects to sockets, the receiving side listens on them
+ * and accepts a single connection.
+ */
+inline bool split_endpoint(const std::string& spec, const char* prefix, std::string& rest)
+{
+    size_t n = strlen(prefix);
+    if (spec.compare(0, n, prefix) != 0) {
+        return false;
+    }
+    rest = spec.substr(n);
+    return true;
+}
+
+inline int tcp_endpoint(const std::string& address, bool listening)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("Expected tcp:HOST:PORT, got tcp:" + address);
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo* found = NULL;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &found) != 0) {
+        throw std::runtime_error("Unable to resolve " + address);
+    }
+
+    int fd = -1;
+    for (addrinfo* a = found; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        bool ok;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 1) == 0;
+        } else {
+            ok = connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        throw std::runtime_error(std::string(listening ? "Unable to listen on " : "Unable to connect to ") + address);
+    }
+    return fd;
+}
+
+inline int unix_endpoint(const std::string& path, bool listening)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool ok;
+    if (listening) {
+        unlink(path.c_str());
+        ok = fd >= 0 && bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 1) == 0;
+    } else {
+        ok = fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    }
+    if (!ok) {
+        std::string error = strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error(std::string(listening ? "Unable to listen on " : "Unable to connect to ") + path + ": " + error);
+    }
+    return fd;
+}
+
+/// Opens the endpoint a stream is written to
+inline int open_stream_output(const std::string& spec)
+{
+    std::string rest;
+    if (spec == "-") {
+        return STDOUT_FILENO;
+    } else if (split_endpoint(spec, "tcp:", rest)) {
+        return tcp_endpoint(rest, false);
+    } else if (split_endpoint(spec, "unix:", rest)) {
+        return unix_endpoint(rest, false);
+    }
+    int fd = open(spec.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open " + spec + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+/// Opens the endpoint a stream is read from, waiting for the sender on sockets
+inline int open_stream_input(const std::string& spec)
+{
+    std::string rest;
+    int listener = -1;
+    if (spec == "-") {
+        return STDIN_FILENO;
+    } else if (split_endpoint(spec, "tcp:", rest)) {
+        listener = tcp_endpoint(rest, true);
+    } else if (split_endpoint(spec, "unix:", rest)) {
+        listener = unix_endpoint(rest, true);
+    } else {
+        int fd = open(spec.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open " + spec + ": " + strerror(errno));
+        }
+        return fd;
+    }
+    int fd = accept(listener, NULL, NULL);
+    close(listener);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to accept a connection on " + spec + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * Hands batches of acquisitions from a producer to a consumer thread.
+ *
+ * A fixed set of depth batches circulates between the two threads, so the
+ * acquisition buffers are reused from batch to batch and the producer runs at
+ * most depth batches ahead of the consumer. The producer takes an empty batch
+ * with fill(), sets count (and header, which keeps the XML header in order
+ * with the acquisitions) and hands it over with push(); the consumer takes it
+ * with pop() and gives it back with recycle(). finish() marks the end of the
+ * data, cancel() stops both sides after an error.
+ */
+class AcquisitionPipe
+{
+public:
+    struct Batch
+    {
+        std::string header;             ///< XML header to handle before the acquisitions, if not empty
+        std::vector<Acquisition> acqs;
+        size_t count;
+    };
+
+    AcquisitionPipe(size_t depth, size_t batch_size)
+        : batches_(depth), finished_(false), cancelled_(false)
+    {
+        for (size_t i = 0; i < depth; i++) {
+            batches_[i].acqs.resize(batch_size);
+            batches_[i].count = 0;
+            empty_.push_back(&batches_[i]);
+        }
+    }
+
+    /// An empty batch to fill, NULL once cancelled
+    Batch* fill()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return cancelled_ || !empty_.empty(); });
+        if (cancelled_) {
+            return NULL;
+        }
+        Batch* b = empty_.front();
+        empty_.pop_front();
+        b->header.clear();
+        b->count = 0;
+        return b;
+    }
+
+    void push(Batch* b)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        full_.push_back(b);
+        changed_.notify_all();
+    }
+
+    /// The next full batch, NULL after the last one or once cancelled
+    Batch* pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return cancelled_ || finished_ || !full_.empty(); });
+        if (cancelled_ || full_.empty()) {
+            return NULL;
+        }
+        Batch* b = full_.front();
+        full_.pop_front();
+        return b;
+    }
+
+    void recycle(Batch* b)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        empty_.push_back(b);
+        changed_.notify_all();
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_ = true;
+        changed_.notify_all();
+    }
+
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+        changed_.notify_all();
+    }
+
+private:
+    std::vector<Batch> batches_;
+    std::deque<Batch*> empty_;
+    std::deque<Batch*> full_;
+    bool finished_;
+    bool cancelled_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+};
+
+} // namespace ISMRMRD
+
+#endif // ISMRMRD_STREAM_UTILS_H
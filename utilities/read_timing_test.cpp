@@ -15,17 +15,9 @@ class Timer
 {
 public:
 
-  Timer() { Timer("Timer"); }
+  Timer() : name_("Timer") { start(); }
 
-  Timer(const char* name) : name_(name) {
-    pre();
-#ifdef WIN32
-    QueryPerformanceFrequency(&frequency_);
-    QueryPerformanceCounter(&start_);
-#else
-    gettimeofday(&start_, NULL);
-#endif
-  }
+  Timer(const char* name) : name_(name) { start(); }
 
   virtual ~Timer() {
     double time_in_us = 0.0;
@@ -45,6 +37,16 @@ public:
 
 protected:
 
+  void start() {
+    pre();
+#ifdef WIN32
+    QueryPerformanceFrequency(&frequency_);
+    QueryPerformanceCounter(&start_);
+#else
+    gettimeofday(&start_, NULL);
+#endif
+  }
+
 #ifdef WIN32
   LARGE_INTEGER frequency_;
   LARGE_INTEGER start_;
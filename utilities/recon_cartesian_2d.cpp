@@ -7,10 +7,11 @@
  */
 
 #include <iostream>
+#include <algorithm>
 #include "ismrmrd/ismrmrd.h"
 #include "ismrmrd/dataset.h"
 #include "ismrmrd/xml.h"
-#include "fftw3.h"
+#include "ismrmrd_fftw.h"
 
 //Helper function for the FFTW library
 void circshift(complex_float_t *out, const complex_float_t *in, int xdim, int ydim, int xshift, int yshift)
@@ -24,8 +25,6 @@ void circshift(complex_float_t *out, const complex_float_t *in, int xdim, int yd
     }
 }
 
-#define fftshift(out, in, x, y) circshift(out, in, x, y, (x/2), (y/2))
-
 void print_usage(const char* application)
 {
     std::cout << "Usage:" << std::endl;
@@ -75,7 +74,10 @@ int main(int argc, char** argv)
         return -1;
     }
     
-    uint16_t nX = e_space.matrixSize.x;
+    // Readout oversampling is removed as the data are read, so the buffer
+    // only holds the reconstructed field of view
+    uint16_t nX = r_space.matrixSize.x;
+    uint16_t xShift = e_space.matrixSize.x/2 - ((e_space.matrixSize.x - r_space.matrixSize.x)>>1);
     uint16_t nY = e_space.matrixSize.y;
     
     // The number of channels is optional, so read the first line
@@ -97,14 +99,22 @@ int main(int argc, char** argv)
     memset(buffer.getDataPtr(), 0, sizeof(complex_float_t)*nX*nY*nCoils);
     
     //Now loop through and copy data
+    ISMRMRD::OversamplingRemover oversampling(e_space.matrixSize.x, r_space.matrixSize.x);
     unsigned int number_of_acquisitions = d.getNumberOfAcquisitions();
     for (unsigned int i = 0; i < number_of_acquisitions; i++) {
         //Read one acquisition at a time
         d.readAcquisition(i, acq);
+        if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT)) {
+            continue;
+        }
+
+        //Remove the readout oversampling, if any
+        oversampling.remove(acq);
 
         //Copy data, we should probably be more careful here and do more tests....
+        uint16_t samples = std::min(acq.number_of_samples(), nX);
         for (uint16_t c=0; c<nCoils; c++) {
-            memcpy(&buffer(0,acq.idx().kspace_encode_step_1,c), &acq.data(0, c), sizeof(complex_float_t)*nX);
+            memcpy(&buffer(0,acq.idx().kspace_encode_step_1,c), &acq.data(0, c), sizeof(complex_float_t)*samples);
         }
     }
 
@@ -128,8 +138,8 @@ int main(int argc, char** argv)
         //Execute the FFT
         fftwf_execute(p);
         
-        //FFTSHIFT
-        fftshift( &buffer(0,0,c), reinterpret_cast<std::complex<float>*>(tmp), nX, nY);
+        //FFTSHIFT, centering the readout where the full encoded readout had it
+        circshift( &buffer(0,0,c), reinterpret_cast<std::complex<float>*>(tmp), nX, nY, xShift, (nY/2));
 
         //Clean up.
         fftwf_destroy_plan(p);
@@ -141,13 +151,11 @@ int main(int argc, char** argv)
     ISMRMRD::Image<float> img_out(r_space.matrixSize.x, r_space.matrixSize.y, 1, 1);
     memset(img_out.getDataPtr(), 0, sizeof(float_t)*r_space.matrixSize.x*r_space.matrixSize.y);
            
-    //f there is oversampling in the readout direction remove it
     //Take the sqrt of the sum of squares
-    uint16_t offset = ((e_space.matrixSize.x - r_space.matrixSize.x)>>1);
     for (uint16_t y = 0; y < r_space.matrixSize.y; y++) {
         for (uint16_t x = 0; x < r_space.matrixSize.x; x++) {
             for (uint16_t c=0; c<nCoils; c++) {
-                img_out(x,y) += (std::abs(buffer(x+offset, y, c)))*(std::abs(buffer(x+offset, y, c)));
+                img_out(x,y) += (std::abs(buffer(x, y, c)))*(std::abs(buffer(x, y, c)));
             }
             img_out(x,y) = std::sqrt(img_out(x,y));            
         }